@@ -0,0 +1,146 @@
+#include "batch.hpp"
+#include "index_log.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+#include "storage.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+// Splits a line on tabs, keeping empty fields
+static std::vector<std::string> split_fields(const std::string& line, char delimiter) {
+    std::vector<std::string> fields;
+    std::string field;
+    std::istringstream stream(line);
+    while (std::getline(stream, field, delimiter)) {
+        fields.push_back(field);
+    }
+    if (!line.empty() && line.back() == delimiter) {
+        fields.push_back("");
+    }
+    return fields;
+}
+
+std::vector<AnnotationRequest> read_annotation_manifest(const std::string& manifest_path) {
+    std::ifstream manifest(manifest_path);
+    if (!manifest.is_open()) {
+        throw std::runtime_error("Could not open manifest: " + manifest_path);
+    }
+    fs::path base_dir = fs::path(manifest_path).parent_path();
+
+    std::vector<AnnotationRequest> requests;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(manifest, line)) {
+        ++line_number;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#' || (requests.empty() && line.rfind("file\t", 0) == 0)) {
+            continue;
+        }
+        std::vector<std::string> fields = split_fields(line, '\t');
+        if (fields.size() < 3) {
+            throw std::runtime_error("Manifest line " + std::to_string(line_number) +
+                                     " needs at least file, operation and method columns.");
+        }
+
+        AnnotationRequest request;
+        fs::path file = fields[0];
+        request.filepath = (file.is_relative() ? base_dir / file : file).string();
+        request.operation_class = fields[1];
+        request.operation_method = fields[2];
+        if (fields.size() > 3 && !fields[3].empty() && fields[3] != "-") {
+            for (const auto& assump : split_fields(fields[3], ',')) {
+                if (!assump.empty()) {
+                    request.assumptions.push_back(assump);
+                }
+            }
+        }
+        if (fields.size() > 4 && !fields[4].empty()) {
+            request.parent_id = fields[4];
+        }
+        requests.push_back(request);
+    }
+    return requests;
+}
+
+std::vector<AnnotationResult> annotate_batch(
+    const std::vector<AnnotationRequest>& requests,
+    const Ontology& ontology,
+    ChecksumCache& checksum_cache,
+    const std::string& algorithm,
+    const fs::path& project_root,
+    unsigned int num_threads
+) {
+    std::vector<AnnotationResult> results(requests.size());
+    std::vector<TraceNode> nodes(requests.size());
+
+    // 1. Validate every row against the ontology
+    for (size_t i = 0; i < requests.size(); ++i) {
+        const AnnotationRequest& request = requests[i];
+        AnnotationResult& result = results[i];
+        result.filepath = request.filepath;
+
+        if (!ontology.validate_operation(request.operation_class)) {
+            result.error = "Invalid operation class '" + request.operation_class + "'";
+            continue;
+        }
+        for (const auto& assump : request.assumptions) {
+            if (!ontology.validate_assumption(assump)) {
+                result.error = "Invalid assumption '" + assump + "'";
+                break;
+            }
+        }
+    }
+
+    // 2. Hash the files and build their trace nodes concurrently
+    parallel_for(requests.size(), num_threads, [&](size_t i) {
+        const AnnotationRequest& request = requests[i];
+        AnnotationResult& result = results[i];
+        if (!result.error.empty()) {
+            return;
+        }
+        try {
+            result.checksum = checksum_cache.recorded_checksum(request.filepath, algorithm);
+        } catch (const std::exception& e) {
+            result.error = e.what();
+            return;
+        }
+
+        TraceNode node = create_trace_node(
+            request.parent_id,
+            "quantitative_matrix", // Placeholder, as in the single-file annotate command
+            request.operation_class,
+            request.operation_method,
+            request.assumptions
+        );
+        node.input.checksum = result.checksum;
+        node.input.shape = "unknown";
+        node.output.data_class = "quantitative_matrix";
+        node.output.checksum = result.checksum;
+
+        result.trace_id = node.trace_id;
+        nodes[i] = node;
+    });
+
+    // 3. Commit every node as one batch, then every index entry as another
+    //    (one store append and one log fsync, or two transactions)
+    std::vector<TraceNode> committed;
+    IndexEntries entries;
+    committed.reserve(requests.size());
+    entries.reserve(requests.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].trace_id.empty()) {
+            committed.push_back(std::move(nodes[i]));
+            entries.emplace_back(results[i].checksum, results[i].trace_id);
+        }
+    }
+    std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+    storage->write_nodes(committed);
+    Profiler::count("nodes_written", static_cast<int64_t>(committed.size()));
+    storage->append_index(entries);
+    return results;
+}
@@ -0,0 +1,73 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "tracer.hpp"
+#include "checksum_cache.hpp"
+
+/**
+ * @brief One row of an annotation manifest.
+ */
+struct AnnotationRequest {
+    std::string filepath;                   ///< The file to annotate.
+    std::string operation_class;            ///< The class of the operation performed.
+    std::string operation_method;           ///< The method of the operation performed.
+    std::vector<std::string> assumptions;   ///< Assumptions made during the operation.
+    std::string parent_id = "null";         ///< Trace ID of the parent node ("null" if root).
+};
+
+/**
+ * @brief The outcome of annotating one manifest row.
+ */
+struct AnnotationResult {
+    std::string filepath;   ///< The file that was annotated.
+    std::string trace_id;   ///< The new trace ID, empty if the row failed.
+    std::string checksum;   ///< The file's checksum, empty if it could not be hashed.
+    std::string error;      ///< Why the row failed, empty on success.
+};
+
+/**
+ * @brief Reads a tab-separated annotation manifest.
+ *
+ * Each line holds `file`, `operation`, `method`, and optionally
+ * `assumptions` (comma-separated, empty or "-" for none) and `parent`
+ * (a trace ID, empty or "null" for a root node). Blank lines, lines
+ * starting with '#' and a leading header line starting with "file" are
+ * skipped. Relative file paths are resolved against the manifest's directory.
+ *
+ * @param manifest_path The path of the manifest file.
+ * @return The manifest rows in file order.
+ * @throws std::runtime_error if the manifest cannot be read or a row has fewer than three columns.
+ */
+std::vector<AnnotationRequest> read_annotation_manifest(const std::string& manifest_path);
+
+/**
+ * @brief Annotates many files in one pass.
+ *
+ * Files are hashed concurrently through the checksum cache, every row is
+ * validated against the single loaded ontology, all trace nodes are written
+ * with one `write_trace_nodes` append and all index entries are committed
+ * with one `append_index` call. Rows that fail (unreadable file, invalid
+ * operation or assumption) are reported in their result and do not prevent
+ * the other rows from being committed.
+ *
+ * @param requests The rows to annotate.
+ * @param ontology The loaded ontology to validate against.
+ * @param checksum_cache The cache used to hash the files.
+ * @param algorithm The checksum algorithm (see `checksum_file`).
+ * @param project_root The root directory of the project.
+ * @param num_threads The number of worker threads (0 means one per hardware core).
+ * @return One result per request, in request order.
+ */
+std::vector<AnnotationResult> annotate_batch(
+    const std::vector<AnnotationRequest>& requests,
+    const Ontology& ontology,
+    ChecksumCache& checksum_cache,
+    const std::string& algorithm,
+    const std::filesystem::path& project_root,
+    unsigned int num_threads = 0
+);
+
+#endif // BATCH_HPP
@@ -0,0 +1,214 @@
+// Multi-process stress test of the trace index.
+//
+// Forks writer processes that save trace nodes into one project through
+// TraceNode::save, as concurrent '--annotate' jobs do, while a compactor
+// process folds the write-ahead log into the snapshot over and over and a
+// reader process checks that the index never shrinks. Once every process has
+// exited, each index entry written must be present and point at its node.
+// Exits non-zero on the first lost or wrong entry.
+#include "tracer.hpp"
+#include "lineage.hpp"
+#include "index_log.hpp"
+#include "nlohmann/json.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Set by SIGTERM in the compactor and reader processes
+static volatile sig_atomic_t g_stop = 0;
+
+struct StressOptions {
+    int writers = 8;         ///< Writer processes.
+    int threads = 2;         ///< Saving threads in each writer.
+    int saves = 500;         ///< Saves per thread.
+    fs::path work_dir;       ///< Parent of the scratch project.
+};
+
+static std::string checksum_for(int writer, int thread, int save, const char* side) {
+    return "stress-" + std::to_string(writer) + "-" + std::to_string(thread) + "-" + std::to_string(save) + "-" + side;
+}
+
+static std::string trace_id_for(int writer, int thread, int save) {
+    return "stress-node-" + std::to_string(writer) + "-" + std::to_string(thread) + "-" + std::to_string(save);
+}
+
+// Saves `options.saves` nodes on each of `options.threads` threads
+static int run_writer(const fs::path& root, const StressOptions& options, int writer) {
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t] {
+            try {
+                TraceNode node = create_trace_node("null", "quantitative_matrix", "normalization", "TPM", {});
+                for (int i = 0; i < options.saves; ++i) {
+                    node.trace_id = trace_id_for(writer, t, i);
+                    node.save(checksum_for(writer, t, i, "in"), checksum_for(writer, t, i, "out"), "quantitative_matrix", root);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "writer " << writer << ": " << e.what() << std::endl;
+                failed = true;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return failed ? 1 : 0;
+}
+
+// Compacts the index until it is told to stop
+static int run_compactor(const fs::path& root) {
+    size_t compactions = 0;
+    try {
+        while (!g_stop) {
+            compact_index(root);
+            ++compactions;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "compactor: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "compactions: " << compactions << std::endl;
+    return compactions > 0 ? 0 : 1;
+}
+
+// Refreshes an index view until told to stop; entries are only ever added,
+// so the view must never shrink
+static int run_reader(const fs::path& root) {
+    IndexView view(root);
+    size_t seen = 0;
+    try {
+        while (!g_stop) {
+            size_t size = view.refresh().size();
+            if (size < seen) {
+                std::cerr << "reader: index shrank from " << seen << " to " << size << " entries" << std::endl;
+                return 1;
+            }
+            seen = size;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "reader: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+template <typename Fn>
+static pid_t spawn(Fn fn) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork failed: " << std::strerror(errno) << std::endl;
+        std::exit(1);
+    }
+    if (pid == 0) {
+        std::cout.flush();
+        _exit(fn());
+    }
+    return pid;
+}
+
+static bool wait_ok(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Checks that every entry written is in the index and points at its node
+static size_t count_lost_entries(const fs::path& root, const StressOptions& options) {
+    nlohmann::json index_json = load_index(root);
+    size_t lost = 0;
+    for (int w = 0; w < options.writers; ++w) {
+        for (int t = 0; t < options.threads; ++t) {
+            for (int i = 0; i < options.saves; ++i) {
+                const std::string trace_id = trace_id_for(w, t, i);
+                for (const char* side : {"in", "out"}) {
+                    const std::string checksum = checksum_for(w, t, i, side);
+                    if (!index_json.contains(checksum) || index_json[checksum] != trace_id) {
+                        if (lost < 10) {
+                            std::cerr << "lost: " << checksum << " -> " << trace_id << std::endl;
+                        }
+                        ++lost;
+                    }
+                }
+            }
+        }
+    }
+    return lost;
+}
+
+static void print_usage() {
+    std::cerr << "Usage: traceseq_index_stress [--writers N] [--threads T] [--saves S] [--work-dir <dir>]\n";
+}
+
+int main(int argc, char** argv) {
+    StressOptions options;
+    for (int i = 1; i < argc; ++i) {
+        auto value = [&](const char* flag) -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << flag << std::endl;
+                print_usage();
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if (std::strcmp(argv[i], "--writers") == 0) {
+            options.writers = std::stoi(value("--writers"));
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            options.threads = std::stoi(value("--threads"));
+        } else if (std::strcmp(argv[i], "--saves") == 0) {
+            options.saves = std::stoi(value("--saves"));
+        } else if (std::strcmp(argv[i], "--work-dir") == 0) {
+            options.work_dir = value("--work-dir");
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (options.work_dir.empty()) {
+        options.work_dir = fs::temp_directory_path();
+    }
+    const fs::path root = options.work_dir / ("traceseq_index_stress-" + std::to_string(getpid()));
+    fs::create_directories(root / ".traceseq");
+
+    // Installed before forking so no child can miss the stop request
+    signal(SIGTERM, [](int) { g_stop = 1; });
+    pid_t compactor = spawn([&] { return run_compactor(root); });
+    pid_t reader = spawn([&] { return run_reader(root); });
+    std::vector<pid_t> writers;
+    for (int w = 0; w < options.writers; ++w) {
+        writers.push_back(spawn([&, w] { return run_writer(root, options, w); }));
+    }
+
+    bool ok = true;
+    for (pid_t pid : writers) {
+        ok = wait_ok(pid) && ok;
+    }
+    kill(compactor, SIGTERM);
+    kill(reader, SIGTERM);
+    ok = wait_ok(compactor) && ok;
+    ok = wait_ok(reader) && ok;
+
+    const size_t expected = 2 * static_cast<size_t>(options.writers) * options.threads * options.saves;
+    const size_t lost = count_lost_entries(root, options);
+    std::cout << options.writers << " writers x " << options.threads << " threads x " << options.saves
+              << " saves: " << expected - lost << " of " << expected << " index entries" << std::endl;
+    fs::remove_all(root);
+    return ok && lost == 0 ? 0 : 1;
+}
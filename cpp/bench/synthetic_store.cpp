@@ -0,0 +1,100 @@
+#include "synthetic_store.hpp"
+#include "tracer.hpp"
+#include "lineage.hpp"
+#include "nlohmann/json.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <random>
+
+namespace fs = std::filesystem;
+
+// Hex string of a given length drawn from the generator
+static std::string random_hex(std::mt19937_64& rng, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(length, '0');
+    for (auto& c : hex) {
+        c = digits[rng() & 0xf];
+    }
+    return hex;
+}
+
+SyntheticStore generate_synthetic_store(const fs::path& project_root, const SyntheticStoreOptions& options) {
+    fs::remove_all(project_root / ".traceseq");
+    fs::create_directories(project_root / ".traceseq");
+
+    std::mt19937_64 rng(options.seed);
+    const char* operations[] = {"normalization", "filtering", "alignment", "quantification"};
+    const char* assumptions[] = {"reference_version:hg38", "batch_correction:combat", "sequencing_depth:deep"};
+
+    SyntheticStore store;
+    std::vector<TraceNode> batch;
+    nlohmann::json index_json = nlohmann::json::object();
+    const size_t batch_size = 4096;
+
+    // Open child slots, breadth-first: each node with room below it adds
+    // `fanout` slots, and every new node takes the oldest slot as its parent
+    std::deque<std::pair<std::string, size_t>> slots;
+    while (store.trace_ids.size() < options.nodes) {
+        std::string parent = "null";
+        size_t depth = 1;
+        if (!slots.empty()) {
+            parent = slots.front().first;
+            depth = slots.front().second + 1;
+            slots.pop_front();
+        }
+
+        char id[48];
+        std::snprintf(id, sizeof(id), "syn-%08x-%010zu", options.seed, store.trace_ids.size());
+        TraceNode node;
+        node.trace_id = id;
+        node.parent = parent;
+        node.timestamp = "2024-01-01T00:00:00Z";
+        node.data_class = "quantitative_matrix";
+        node.operation.op_class = operations[rng() % 4];
+        node.operation.method = "method_" + std::to_string(rng() % 16);
+        node.assumptions.push_back(assumptions[rng() % 3]);
+        node.input.shape = "unknown";
+        node.input.checksum = store.checksums.empty() ? random_hex(rng, 64) : store.checksums.back();
+        node.output.data_class = "quantitative_matrix";
+        node.output.checksum = random_hex(rng, 64);
+
+        index_json[node.output.checksum] = node.trace_id;
+        store.trace_ids.push_back(node.trace_id);
+        store.checksums.push_back(node.output.checksum);
+        if (depth > store.max_depth) {
+            store.max_depth = depth;
+            store.deepest_trace_id = node.trace_id;
+        }
+
+        if (depth < options.depth) {
+            for (size_t child = 0; child < options.fanout; ++child) {
+                slots.emplace_back(node.trace_id, depth);
+            }
+        }
+
+        batch.push_back(std::move(node));
+        if (batch.size() == batch_size) {
+            write_trace_nodes(batch, project_root);
+            batch.clear();
+        }
+    }
+    write_trace_nodes(batch, project_root);
+    save_index(index_json, project_root);
+    return store;
+}
+
+void write_synthetic_file(const fs::path& path, uint64_t size, uint32_t seed) {
+    std::mt19937_64 rng(seed);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::vector<uint64_t> block(8192);
+    while (size > 0) {
+        for (auto& word : block) {
+            word = rng();
+        }
+        size_t length = static_cast<size_t>(std::min<uint64_t>(size, block.size() * sizeof(uint64_t)));
+        out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(length));
+        size -= length;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef SYNTHETIC_STORE_HPP
+#define SYNTHETIC_STORE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Shape of a generated trace store.
+ */
+struct SyntheticStoreOptions {
+    size_t nodes = 10000;   ///< Total number of trace nodes.
+    size_t depth = 10;      ///< Maximum lineage length (1 means only root nodes).
+    size_t fanout = 4;      ///< Children per node before a new subtree is started.
+    uint32_t seed = 1;      ///< Seed of the deterministic generator.
+};
+
+/**
+ * @brief What was generated, for picking benchmark inputs.
+ */
+struct SyntheticStore {
+    std::vector<std::string> trace_ids;   ///< Every trace ID, in creation order.
+    std::vector<std::string> checksums;   ///< The output checksum indexed for each node.
+    std::string deepest_trace_id;         ///< A node at the maximum depth.
+    size_t max_depth = 0;                 ///< Length of the longest lineage.
+};
+
+/**
+ * @brief Builds a deterministic synthetic '.traceseq' store.
+ *
+ * Nodes form a forest: each tree is filled breadth-first, every node getting
+ * up to `fanout` children, until `depth` levels exist; then a new root is
+ * started. Trace IDs, timestamps and checksums derive from the seed, so the
+ * same options always produce byte-identical stores. Nodes are written to
+ * the packed store and every node's output checksum is indexed.
+ *
+ * @param project_root The project directory to create the store in; any
+ *        existing '.traceseq' directory is replaced.
+ * @param options The shape of the store.
+ * @return The generated IDs and checksums.
+ */
+SyntheticStore generate_synthetic_store(const std::filesystem::path& project_root, const SyntheticStoreOptions& options);
+
+/**
+ * @brief Writes a file of pseudo-random bytes.
+ * @param path The file to create.
+ * @param size The file size in bytes.
+ * @param seed The generator seed.
+ */
+void write_synthetic_file(const std::filesystem::path& path, uint64_t size, uint32_t seed = 1);
+
+#endif // SYNTHETIC_STORE_HPP
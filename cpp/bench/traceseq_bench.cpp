@@ -0,0 +1,484 @@
+// Microbenchmarks for the traceseq core library.
+//
+// Every input is generated deterministically (fixed seeds, fixed trace IDs),
+// so two runs on the same machine measure the same work. Inputs live in a
+// scratch directory that is removed on exit; pass --work-dir to place it on
+// a particular filesystem. With --generate-store the binary only writes a
+// synthetic store and exits.
+#include <benchmark/benchmark.h>
+#include "synthetic_store.hpp"
+#include "tracer.hpp"
+#include "lineage.hpp"
+#include "hashing.hpp"
+#include "node_store.hpp"
+#include "node_yaml.hpp"
+#include "storage.hpp"
+#include "lineage_columns.hpp"
+#include "lineage_diff.hpp"
+#include "query_index.hpp"
+#include "nlohmann/json.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static fs::path g_work_dir;
+
+// Returns a directory below the scratch directory, created on first use
+static fs::path work_path(const std::string& name) {
+    fs::path path = g_work_dir / name;
+    fs::create_directories(path);
+    return path;
+}
+
+// Stores are expensive to build, so each shape is generated once per run
+static const SyntheticStore& prepared_store(const fs::path& root, const SyntheticStoreOptions& options) {
+    static std::mutex mutex;
+    static std::map<std::string, SyntheticStore> stores;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = stores.find(root.string());
+    if (it == stores.end()) {
+        it = stores.emplace(root.string(), generate_synthetic_store(root, options)).first;
+    }
+    return it->second;
+}
+
+// Backend arguments: 0 is the file layout, 1 the same store converted to SQLite
+static StorageBackend backend_arg(benchmark::State& state, int position) {
+    StorageBackend backend = state.range(position) ? StorageBackend::Sqlite : StorageBackend::Files;
+    state.SetLabel(backend == StorageBackend::Sqlite ? "sqlite" : "files");
+    return backend;
+}
+
+static const SyntheticStore& prepared_store(const std::string& name, const SyntheticStoreOptions& options,
+                                             StorageBackend backend, fs::path& root) {
+    root = work_path(backend == StorageBackend::Sqlite ? name + "-sqlite" : name);
+    const SyntheticStore& store = prepared_store(root, options);
+    convert_storage(root, backend);  // No-op once converted
+    return store;
+}
+
+static fs::path prepared_file(uint64_t size) {
+    fs::path path = work_path("files") / ("data-" + std::to_string(size) + ".bin");
+    if (!fs::exists(path) || fs::file_size(path) != size) {
+        write_synthetic_file(path, size);
+    }
+    return path;
+}
+
+// --- Hashing ---------------------------------------------------------------
+
+static void BM_Sha256File(benchmark::State& state) {
+    const uint64_t size = static_cast<uint64_t>(state.range(0));
+    const std::string path = prepared_file(size).string();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sha256_file(path));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_Sha256File)->Arg(4 << 10)->Arg(1 << 20)->Arg(64 << 20)->Unit(benchmark::kMicrosecond);
+
+static void BM_ChecksumFile(benchmark::State& state) {
+    const std::string algorithm = checksum_algorithms().at(static_cast<size_t>(state.range(0)));
+    const uint64_t size = 64 << 20;
+    const std::string path = prepared_file(size).string();
+    state.SetLabel(algorithm);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(checksum_file(path, algorithm));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_ChecksumFile)->DenseRange(0, 4)->Unit(benchmark::kMillisecond);
+
+// Re-hashing a file after an in-place edit, with the previous chunk list
+static void BM_ChunkFileRehash(benchmark::State& state) {
+    const uint64_t size = 64 << 20;
+    const std::string path = prepared_file(size).string();
+    const ChunkList previous = chunk_file(path);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chunk_file(path, &previous).checksum());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_ChunkFileRehash)->Unit(benchmark::kMillisecond);
+
+// --- Writing nodes ---------------------------------------------------------
+
+// Each run writes into a fresh project; the threaded variants model many
+// concurrent '--annotate' jobs sharing one store and index.
+static void BM_TraceNodeSave(benchmark::State& state) {
+    static fs::path root;
+    StorageBackend backend = backend_arg(state, 0);
+    if (state.thread_index() == 0) {
+        root = work_path("save-" + std::to_string(state.threads()));
+        fs::remove_all(root / ".traceseq");
+        fs::create_directories(root / ".traceseq");
+        convert_storage(root, backend);
+    }
+    TraceNode node = create_trace_node("null", "quantitative_matrix", "normalization", "TPM", {"reference_version:hg38"});
+    const std::string prefix = "save-" + std::to_string(state.thread_index()) + "-";
+    std::mt19937_64 rng(static_cast<uint64_t>(state.thread_index()) + 1);
+    size_t count = 0;
+    for (auto _ : state) {
+        node.trace_id = prefix + std::to_string(count++);
+        node.save(std::to_string(rng()), std::to_string(rng()), "quantitative_matrix", root);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_TraceNodeSave)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond)->UseRealTime()->Threads(1)->Threads(4)->Threads(16);
+
+// Saves into a store of a given size through one open storage, as the
+// daemon does; the time per save should not depend on the store size
+static void BM_TraceNodeSaveShared(benchmark::State& state) {
+    SyntheticStoreOptions options;
+    options.nodes = static_cast<size_t>(state.range(0));
+    fs::path root;
+    const SyntheticStore& store = prepared_store("save-store-" + std::to_string(options.nodes), options, backend_arg(state, 1), root);
+    std::unique_ptr<TraceStorage> storage = open_storage(root);
+    storage->index();  // Read once, as a session that has served a request would have
+    TraceNode node = create_trace_node("null", "quantitative_matrix", "normalization", "TPM", {"reference_version:hg38"});
+    std::mt19937_64 rng(options.nodes);
+    size_t count = 0;
+    for (auto _ : state) {
+        node.trace_id = "save-shared-" + std::to_string(count++);
+        node.parent = store.trace_ids[rng() % store.trace_ids.size()];
+        node.save(std::to_string(rng()), std::to_string(rng()), "quantitative_matrix", *storage);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_TraceNodeSaveShared)->ArgsProduct({{1000, 100000}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+// --- Index -----------------------------------------------------------------
+
+static nlohmann::json synthetic_index(size_t entries) {
+    std::mt19937_64 rng(entries);
+    nlohmann::json index_json = nlohmann::json::object();
+    char checksum[65];
+    for (size_t i = 0; i < entries; ++i) {
+        std::snprintf(checksum, sizeof(checksum), "%016llx%016llx%016llx%016llx",
+                      static_cast<unsigned long long>(rng()), static_cast<unsigned long long>(rng()),
+                      static_cast<unsigned long long>(rng()), static_cast<unsigned long long>(rng()));
+        index_json[checksum] = "syn-" + std::to_string(i);
+    }
+    return index_json;
+}
+
+static void BM_SaveIndex(benchmark::State& state) {
+    const size_t entries = static_cast<size_t>(state.range(0));
+    const fs::path root = work_path("index-save-" + std::to_string(entries));
+    fs::create_directories(root / ".traceseq");
+    const nlohmann::json index_json = synthetic_index(entries);
+    for (auto _ : state) {
+        save_index(index_json, root);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * entries));
+}
+BENCHMARK(BM_SaveIndex)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+static void BM_LoadIndex(benchmark::State& state) {
+    const size_t entries = static_cast<size_t>(state.range(0));
+    const fs::path root = work_path("index-load-" + std::to_string(entries));
+    fs::create_directories(root / ".traceseq");
+    save_index(synthetic_index(entries), root);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(load_index(root));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * entries));
+}
+BENCHMARK(BM_LoadIndex)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// --- Reading nodes ---------------------------------------------------------
+
+static void BM_LoadNode(benchmark::State& state) {
+    SyntheticStoreOptions options;
+    options.nodes = static_cast<size_t>(state.range(0));
+    const fs::path root = work_path("store-" + std::to_string(options.nodes));
+    const SyntheticStore& store = prepared_store(root, options);
+    std::mt19937 rng(7);
+    for (auto _ : state) {
+        const std::string& trace_id = store.trace_ids[rng() % store.trace_ids.size()];
+        benchmark::DoNotOptimize(load_node(trace_id, root));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_LoadNode)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+// The same lookups through one open storage, as the daemon and batch commands do
+static void BM_LoadNodeShared(benchmark::State& state) {
+    SyntheticStoreOptions options;
+    options.nodes = static_cast<size_t>(state.range(0));
+    fs::path root;
+    const SyntheticStore& store = prepared_store("store-" + std::to_string(options.nodes), options, backend_arg(state, 1), root);
+    std::unique_ptr<TraceStorage> storage = open_storage(root);
+    std::mt19937 rng(7);
+    for (auto _ : state) {
+        const std::string& trace_id = store.trace_ids[rng() % store.trace_ids.size()];
+        benchmark::DoNotOptimize(load_node(trace_id, root, *storage));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_LoadNodeShared)->Args({10000, 0})->Args({10000, 1})->Unit(benchmark::kMicrosecond);
+
+// Payload codecs, YAML (arg 1, the single-pass parser) against binary (arg 2)
+static TraceNode sample_node() {
+    TraceNode node = create_trace_node("syn-00000001-0000000041", "quantitative_matrix", "normalization", "TPM",
+                                       {"reference_version:hg38", "batch_correction:combat"});
+    node.operation.parameters["min_count"] = "10";
+    node.input.shape = "20000x48";
+    node.input.checksum = std::string(64, 'a');
+    node.output.data_class = "quantitative_matrix";
+    node.output.checksum = std::string(64, 'b');
+    return node;
+}
+
+static std::string encode_payload(NodeFormat format, const TraceNode& node) {
+    return format == NodeFormat::Yaml ? trace_node_to_yaml(node) : encode_node_binary(node);
+}
+
+static void BM_NodeEncode(benchmark::State& state) {
+    const NodeFormat format = static_cast<NodeFormat>(state.range(0));
+    const TraceNode node = sample_node();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(encode_payload(format, node));
+    }
+    state.counters["payload_bytes"] = static_cast<double>(encode_payload(format, node).size());
+}
+BENCHMARK(BM_NodeEncode)->Arg(static_cast<int>(NodeFormat::Yaml))->Arg(static_cast<int>(NodeFormat::Binary));
+
+static void BM_NodeDecode(benchmark::State& state) {
+    const NodeFormat format = static_cast<NodeFormat>(state.range(0));
+    const std::string payload = encode_payload(format, sample_node());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(decode_node_payload(format, payload));
+    }
+}
+BENCHMARK(BM_NodeDecode)->Arg(static_cast<int>(NodeFormat::Yaml))->Arg(static_cast<int>(NodeFormat::Binary));
+
+// The yaml-cpp document tree that the YAML decoder falls back to
+static void BM_NodeDecodeYamlCpp(benchmark::State& state) {
+    const std::string payload = trace_node_to_yaml(sample_node());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(yaml_to_tracenode(YAML::Load(payload)));
+    }
+}
+BENCHMARK(BM_NodeDecodeYamlCpp);
+
+// A per-file node read from disk, mapped and scanned (arg 0) or through yaml-cpp (arg 1)
+static void BM_LoadNodeYamlFile(benchmark::State& state) {
+    const fs::path path = work_path("node-yaml") / "node.yaml";
+    fs::create_directories(path.parent_path());
+    {
+        std::ofstream out(path);
+        out << trace_node_to_yaml(sample_node());
+    }
+    const bool yaml_cpp = state.range(0) != 0;
+    for (auto _ : state) {
+        if (yaml_cpp) {
+            benchmark::DoNotOptimize(yaml_to_tracenode(YAML::LoadFile(path.string())));
+        } else {
+            benchmark::DoNotOptimize(load_node_yaml_file(path));
+        }
+    }
+}
+BENCHMARK(BM_LoadNodeYamlFile)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// Lineages are single chains of the requested depth
+static const SyntheticStore& chain_store(size_t depth, fs::path& root) {
+    SyntheticStoreOptions options;
+    options.nodes = depth;
+    options.depth = depth;
+    options.fanout = 1;
+    root = work_path("chain-" + std::to_string(depth));
+    return prepared_store(root, options);
+}
+
+static void BM_ResolveLineage(benchmark::State& state) {
+    fs::path root;
+    const SyntheticStore& store = chain_store(static_cast<size_t>(state.range(0)), root);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(resolve_lineage(store.deepest_trace_id, root));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * store.max_depth));
+}
+BENCHMARK(BM_ResolveLineage)->Arg(10)->Arg(100)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+static void BM_ResolveLineageIds(benchmark::State& state) {
+    fs::path root;
+    const SyntheticStore& store = chain_store(static_cast<size_t>(state.range(0)), root);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(resolve_lineage_ids(store.deepest_trace_id, root));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * store.max_depth));
+}
+BENCHMARK(BM_ResolveLineageIds)->Arg(10)->Arg(100)->Arg(1000)->Arg(5000)->Unit(benchmark::kMicrosecond);
+
+// Everything below the first root of a bushy store, through a storage that
+// stays open as in the daemon
+static void BM_ResolveDescendantIds(benchmark::State& state) {
+    SyntheticStoreOptions options;
+    options.nodes = static_cast<size_t>(state.range(0));
+    fs::path root;
+    const SyntheticStore& store = prepared_store("store-" + std::to_string(options.nodes), options, backend_arg(state, 1), root);
+    std::unique_ptr<TraceStorage> storage = open_storage(root);
+    size_t found = 0;
+    for (auto _ : state) {
+        std::vector<DescendantId> ids = resolve_descendant_ids(store.trace_ids.front(), root, *storage);
+        found = ids.size();
+        benchmark::DoNotOptimize(ids);
+    }
+    state.counters["descendants"] = static_cast<double>(found);
+}
+BENCHMARK(BM_ResolveDescendantIds)->ArgsProduct({{10000, 100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+// A conjunction over an index that is already up to date, as repeated
+// queries in the daemon see it
+static void BM_Query(benchmark::State& state) {
+    SyntheticStoreOptions options;
+    options.nodes = static_cast<size_t>(state.range(0));
+    const fs::path root = work_path("store-" + std::to_string(options.nodes));
+    prepared_store(root, options);
+    NodeStore node_store(root);
+    QueryIndex index(root, node_store);
+    index.refresh();
+    size_t matches = 0;
+    for (auto _ : state) {
+        std::vector<std::string> ids = index.query("class=normalization AND (method=method_3 OR method=method_7) AND assumption=reference_version:hg38");
+        matches = ids.size();
+        benchmark::DoNotOptimize(ids);
+    }
+    state.counters["matches"] = static_cast<double>(matches);
+}
+BENCHMARK(BM_Query)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// Two unrelated chains with random steps, the worst case for the alignment
+static void BM_DiffLineage(benchmark::State& state) {
+    const size_t depth = static_cast<size_t>(state.range(0));
+    SyntheticStoreOptions options;
+    options.nodes = 2 * depth;
+    options.depth = depth;
+    options.fanout = 1;
+    const fs::path root = work_path("chains-" + std::to_string(depth));
+    const SyntheticStore& store = prepared_store(root, options);
+    FileStorage storage(root);
+    for (auto _ : state) {
+        LineageDiffer differ(root, storage);
+        benchmark::DoNotOptimize(differ.diff(store.deepest_trace_id, store.trace_ids.back()));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 2 * depth));
+}
+BENCHMARK(BM_DiffLineage)->Arg(100)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+// Every leaf of a bushy store at once, as an analytics query would ask
+static void BM_ResolveLineageColumns(benchmark::State& state) {
+    SyntheticStoreOptions options;
+    options.nodes = static_cast<size_t>(state.range(0));
+    const fs::path root = work_path("store-" + std::to_string(options.nodes));
+    const SyntheticStore& store = prepared_store(root, options);
+    const std::vector<std::string> leaves(store.trace_ids.end() - store.trace_ids.size() / 2, store.trace_ids.end());
+    FileStorage storage(root);
+    size_t rows = 0;
+    for (auto _ : state) {
+        LineageColumns columns = resolve_lineage_columns(leaves, root, storage);
+        rows = columns.rows();
+        benchmark::DoNotOptimize(columns);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * rows));
+}
+BENCHMARK(BM_ResolveLineageColumns)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// --- Ontology --------------------------------------------------------------
+
+static void BM_ValidateAssumption(benchmark::State& state) {
+    const fs::path core = fs::path(TRACESEQ_SOURCE_DIR) / "core";
+    Ontology ontology;
+    ontology.load((core / "operation_ontology.yaml").string(), (core / "assumption_ontology.yaml").string());
+    const std::vector<std::string> assumptions = {
+        "reference_version:hg38", "batch_correction:combat", "library_preparation:polyA_selected",
+        "reference_version:hg19", "unknown_class:value", "sequencing_depth"
+    };
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ontology.validate_assumption(assumptions[i++ % assumptions.size()]));
+    }
+}
+BENCHMARK(BM_ValidateAssumption);
+
+// --- Driver ----------------------------------------------------------------
+
+static void print_usage() {
+    std::cerr << "Usage: traceseq_bench [--work-dir <dir>] [benchmark options]\n"
+              << "       traceseq_bench --generate-store <project_dir> [--nodes N] [--depth D] [--fanout F] [--seed S]\n";
+}
+
+int main(int argc, char** argv) {
+    fs::path generate_root;
+    fs::path work_dir;
+    SyntheticStoreOptions options;
+
+    // Take our own flags out of argv; everything else goes to Google Benchmark
+    std::vector<char*> remaining = {argv[0]};
+    for (int i = 1; i < argc; ++i) {
+        auto value = [&](const char* flag) -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << flag << std::endl;
+                print_usage();
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if (std::strcmp(argv[i], "--generate-store") == 0) {
+            generate_root = value("--generate-store");
+        } else if (std::strcmp(argv[i], "--nodes") == 0) {
+            options.nodes = std::stoul(value("--nodes"));
+        } else if (std::strcmp(argv[i], "--depth") == 0) {
+            options.depth = std::stoul(value("--depth"));
+        } else if (std::strcmp(argv[i], "--fanout") == 0) {
+            options.fanout = std::stoul(value("--fanout"));
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            options.seed = static_cast<uint32_t>(std::stoul(value("--seed")));
+        } else if (std::strcmp(argv[i], "--work-dir") == 0) {
+            work_dir = value("--work-dir");
+        } else {
+            remaining.push_back(argv[i]);
+        }
+    }
+
+    if (!generate_root.empty()) {
+        try {
+            SyntheticStore store = generate_synthetic_store(generate_root, options);
+            std::cout << "Generated " << store.trace_ids.size() << " nodes in " << generate_root.string()
+                      << " (max depth " << store.max_depth << ", deepest " << store.deepest_trace_id << ")" << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (work_dir.empty()) {
+        work_dir = fs::temp_directory_path();
+    }
+    g_work_dir = work_dir / ("traceseq_bench-" + std::to_string(getpid()));
+    fs::create_directories(g_work_dir);
+
+    int remaining_argc = static_cast<int>(remaining.size());
+    benchmark::Initialize(&remaining_argc, remaining.data());
+    if (benchmark::ReportUnrecognizedArguments(remaining_argc, remaining.data())) {
+        print_usage();
+        fs::remove_all(g_work_dir);
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    fs::remove_all(g_work_dir);
+    return 0;
+}
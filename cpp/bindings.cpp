@@ -2,13 +2,49 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl/filesystem.h>
+#include <pybind11/numpy.h>
 #include "tracer.hpp"
 #include "lineage.hpp"
 #include "hashing.hpp"
+#include "checksum_cache.hpp"
+#include "index_log.hpp"
+#include "batch.hpp"
+#include "stream_annotate.hpp"
+#include "node_store.hpp"
+#include "storage.hpp"
+#include "profiler.hpp"
+#include "lineage_columns.hpp"
+#include "query_index.hpp"
 #include "pybind11_json.hpp"
 
 namespace py = pybind11;
 
+// Read-only numpy view of a column buffer; `owner` keeps the buffer alive
+template <typename T>
+static py::array column_view(const T* data, size_t size, py::handle owner) {
+    py::array view = py::array_t<T>({static_cast<py::ssize_t>(size)}, {static_cast<py::ssize_t>(sizeof(T))}, data, owner);
+    view.attr("flags").attr("writeable") = false;
+    return view;
+}
+
+// Capsule destructors of the Arrow PyCapsule interface: release the
+// structure unless a consumer already moved it, then free it
+static void release_schema_capsule(PyObject* capsule) {
+    auto* schema = static_cast<ArrowSchema*>(PyCapsule_GetPointer(capsule, "arrow_schema"));
+    if (schema->release) {
+        schema->release(schema);
+    }
+    delete schema;
+}
+
+static void release_array_capsule(PyObject* capsule) {
+    auto* array = static_cast<ArrowArray*>(PyCapsule_GetPointer(capsule, "arrow_array"));
+    if (array->release) {
+        array->release(array);
+    }
+    delete array;
+}
+
 PYBIND11_MODULE(traceseq_py, m) {
     m.doc() = "Python bindings for the traceseq library";
 
@@ -47,18 +83,155 @@ PYBIND11_MODULE(traceseq_py, m) {
         .def_readwrite("output", &TraceNode::output)
         .def_readwrite("environment", &TraceNode::environment)
         .def_readwrite("ontology_version", &TraceNode::ontology_version)
-        .def("save", &TraceNode::save);
+        .def("save", [](const TraceNode& node, const std::string& input_checksum, const std::string& output_checksum,
+                        const std::string& output_data_class, const fs::path& project_root) {
+            // Python threads may modify the node once the GIL is released, so save a copy
+            TraceNode copy = node;
+            py::gil_scoped_release release;
+            copy.save(input_checksum, output_checksum, output_data_class, project_root);
+        });
     
     py::class_<Ontology>(m, "Ontology")
         .def(py::init<>()) 
-        .def("load", &Ontology::load)
+        .def("load", &Ontology::load, py::call_guard<py::gil_scoped_release>())
+        .def("load_cached", &Ontology::load_cached, py::call_guard<py::gil_scoped_release>())
+        .def("load_project", &Ontology::load_project, py::call_guard<py::gil_scoped_release>())
         .def("validate_operation", &Ontology::validate_operation)
         .def("validate_assumption", &Ontology::validate_assumption);
 
+    py::class_<ChecksumCache>(m, "ChecksumCache")
+        .def(py::init<const std::filesystem::path&, bool>(), py::arg("project_root"), py::arg("enabled") = true)
+        .def("checksum", &ChecksumCache::checksum, py::call_guard<py::gil_scoped_release>())
+        .def("recorded_checksum", &ChecksumCache::recorded_checksum, py::call_guard<py::gil_scoped_release>())
+        .def("lookup", &ChecksumCache::lookup, py::call_guard<py::gil_scoped_release>())
+        .def("set_enabled", &ChecksumCache::set_enabled);
+
+    py::class_<AnnotationRequest>(m, "AnnotationRequest")
+        .def(py::init<>())
+        .def_readwrite("filepath", &AnnotationRequest::filepath)
+        .def_readwrite("operation_class", &AnnotationRequest::operation_class)
+        .def_readwrite("operation_method", &AnnotationRequest::operation_method)
+        .def_readwrite("assumptions", &AnnotationRequest::assumptions)
+        .def_readwrite("parent_id", &AnnotationRequest::parent_id);
+
+    py::class_<AnnotationResult>(m, "AnnotationResult")
+        .def(py::init<>())
+        .def_readwrite("filepath", &AnnotationResult::filepath)
+        .def_readwrite("trace_id", &AnnotationResult::trace_id)
+        .def_readwrite("checksum", &AnnotationResult::checksum)
+        .def_readwrite("error", &AnnotationResult::error);
+
+    py::class_<DigestSink>(m, "DigestSink")
+        .def(py::init<const std::string&>(), py::arg("algorithm") = kSha256Algorithm)
+        .def("update", [](DigestSink& sink, py::buffer data) {
+            py::buffer_info info = data.request();
+            py::gil_scoped_release release;
+            sink.update(static_cast<const char*>(info.ptr), static_cast<size_t>(info.size * info.itemsize));
+        })
+        .def("finish", &DigestSink::finish, py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("bytes", &DigestSink::bytes)
+        .def_property_readonly("algorithm", &DigestSink::algorithm);
+
+    py::class_<StreamAnnotator>(m, "StreamAnnotator")
+        .def(py::init<const AnnotationRequest&, const Ontology&, const std::string&, const std::filesystem::path&>(),
+             py::arg("request"), py::arg("ontology"), py::arg("algorithm"), py::arg("project_root"))
+        .def("set_input_checksum", &StreamAnnotator::set_input_checksum)
+        .def("write", [](StreamAnnotator& annotator, py::buffer data) {
+            py::buffer_info info = data.request();
+            py::gil_scoped_release release;
+            annotator.write(static_cast<const char*>(info.ptr), static_cast<size_t>(info.size * info.itemsize));
+        })
+        .def("close", &StreamAnnotator::close, py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("bytes", &StreamAnnotator::bytes);
+
+    py::class_<LineageColumns, std::shared_ptr<LineageColumns>>(m, "LineageColumns")
+        .def_property_readonly("num_rows", &LineageColumns::rows)
+        .def_property_readonly("column_names", [](const LineageColumns&) { return LineageColumns::column_names(); })
+        .def("__len__", &LineageColumns::rows)
+        .def("buffers", [](py::object self, const std::string& name) {
+            const auto& columns = self.cast<const LineageColumns&>();
+            if (const StringColumn* strings = columns.string_column(name)) {
+                return py::make_tuple(column_view(strings->offsets.data(), strings->offsets.size(), self),
+                                      column_view(reinterpret_cast<const uint8_t*>(strings->data.data()), strings->data.size(), self));
+            }
+            if (name == "lineage" || name == "depth") {
+                const std::vector<int32_t>& values = name == "lineage" ? columns.lineage : columns.depth;
+                return py::make_tuple(column_view(values.data(), values.size(), self));
+            }
+            throw py::key_error(name);
+        }, "Zero-copy numpy views of a column: (values,) for integers, (offsets, utf8 data) for strings")
+        .def("__arrow_c_array__", [](std::shared_ptr<LineageColumns> self, py::object) {
+            auto* schema = new ArrowSchema();
+            auto* array = new ArrowArray();
+            export_lineage_columns(self, schema, array);
+            py::capsule schema_capsule(schema, "arrow_schema", &release_schema_capsule);
+            py::capsule array_capsule(array, "arrow_array", &release_array_capsule);
+            return py::make_tuple(schema_capsule, array_capsule);
+        }, py::arg("requested_schema") = py::none(), "Export the table through the Arrow PyCapsule interface");
+
+    // Calls that read files or hash release the GIL, so Python threads run them in parallel
+    m.def("read_annotation_manifest", &read_annotation_manifest, "Read a TSV annotation manifest");
+    m.def("annotate_batch", &annotate_batch, "Annotate many files in one pass",
+          py::arg("requests"), py::arg("ontology"), py::arg("checksum_cache"), py::arg("algorithm"),
+          py::arg("project_root"), py::arg("num_threads") = 0, py::call_guard<py::gil_scoped_release>());
     m.def("create_trace_node", &create_trace_node, "Create a new trace node");
     m.def("validate_node", &validate_node, "Validate a trace node");
-    m.def("load_index", &load_index, "Load the trace index");
-    m.def("save_index", &save_index, "Save the trace index");
-    m.def("resolve_lineage", &resolve_lineage, "Resolve the full lineage for a given file");
-    m.def("sha256_file", &sha256_file, "Calculate the SHA256 checksum of a file");
+    m.def("load_index", &load_index, "Load the trace index", py::call_guard<py::gil_scoped_release>());
+    m.def("save_index", &save_index, "Save the trace index", py::call_guard<py::gil_scoped_release>());
+    m.def("append_index", [](const IndexEntries& entries, const fs::path& project_root) {
+        open_storage(project_root)->append_index(entries);
+    }, "Append checksum to trace ID entries to the index", py::call_guard<py::gil_scoped_release>());
+    m.def("compact_index", &compact_index, "Fold the index log into the index snapshot", py::call_guard<py::gil_scoped_release>());
+    m.def("load_node", py::overload_cast<const std::string&, const fs::path&>(&load_node), "Load a single trace node", py::call_guard<py::gil_scoped_release>());
+    m.def("trace_node_to_yaml", &trace_node_to_yaml, "Serialize a trace node to YAML");
+    m.def("migrate_node_files", &migrate_node_files, "Move per-file YAML nodes into the packed store", py::call_guard<py::gil_scoped_release>());
+    m.def("export_nodes_yaml", &export_nodes_yaml, "Export every stored trace node as YAML files", py::call_guard<py::gil_scoped_release>());
+    m.def("storage_backend", [](const fs::path& project_root) {
+        return storage_backend(project_root) == StorageBackend::Sqlite ? "sqlite" : "files";
+    }, "Name the storage backend of a project (\"files\" or \"sqlite\")");
+    m.def("convert_storage", [](const fs::path& project_root, const std::string& backend) {
+        if (backend != "files" && backend != "sqlite") {
+            throw std::invalid_argument("Unknown storage backend: " + backend);
+        }
+        return convert_storage(project_root, backend == "sqlite" ? StorageBackend::Sqlite : StorageBackend::Files);
+    }, "Move the trace nodes and index to another storage backend (\"files\" or \"sqlite\")",
+          py::arg("project_root"), py::arg("backend"), py::call_guard<py::gil_scoped_release>());
+    m.def("resolve_lineage_ids", py::overload_cast<const std::string&, const fs::path&>(&resolve_lineage_ids), "Resolve the trace IDs of a lineage without loading the nodes", py::call_guard<py::gil_scoped_release>());
+    m.def("resolve_descendant_ids", [](const std::string& trace_id, const fs::path& project_root) {
+        std::vector<std::pair<std::string, size_t>> ids;
+        for (auto& descendant : resolve_descendant_ids(trace_id, project_root)) {
+            ids.emplace_back(std::move(descendant.trace_id), descendant.depth);
+        }
+        return ids;
+    }, "Resolve (trace ID, depth) of every node derived from a trace node, depth first", py::call_guard<py::gil_scoped_release>());
+    m.def("query_trace_ids", [](const std::string& expression, const fs::path& project_root, unsigned int num_threads) {
+        FileStorage storage(project_root);
+        if (storage_backend(project_root) != StorageBackend::Files) {
+            throw std::runtime_error("Queries need the file storage layout; this project uses SQLite");
+        }
+        QueryIndex index(project_root, storage.node_store());
+        return index.query(expression, num_threads);
+    }, "Find the trace IDs of nodes matching a query such as \"class=normalization AND since=2026-06\"",
+          py::arg("expression"), py::arg("project_root"), py::arg("num_threads") = 0, py::call_guard<py::gil_scoped_release>());
+    m.def("resolve_lineage", py::overload_cast<const std::string&, const fs::path&>(&resolve_lineage), "Resolve the full lineage for a given file", py::call_guard<py::gil_scoped_release>());
+    m.def("resolve_lineages", &resolve_lineages, "Resolve the lineages of many trace nodes on a native thread pool",
+          py::arg("trace_ids"), py::arg("project_root"), py::arg("num_threads") = 0, py::call_guard<py::gil_scoped_release>());
+    m.def("resolve_lineage_columns", [](const std::vector<std::string>& trace_ids, const fs::path& project_root) {
+        py::gil_scoped_release release;
+        std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+        return std::make_shared<LineageColumns>(resolve_lineage_columns(trace_ids, project_root, *storage));
+    }, "Resolve many lineages into one columnar table", py::arg("trace_ids"), py::arg("project_root"));
+    m.def("sha256_file", &sha256_file, "Calculate the SHA256 checksum of a file", py::call_guard<py::gil_scoped_release>());
+    m.def("sha256_tree_file", &sha256_tree_file, "Calculate the parallel SHA256 tree checksum of a file",
+          py::arg("path"), py::arg("num_threads") = 0, py::call_guard<py::gil_scoped_release>());
+    m.def("sha256_files", &sha256_files, "Calculate the SHA256 checksums of many files on a native thread pool",
+          py::arg("paths"), py::arg("num_threads") = 0, py::call_guard<py::gil_scoped_release>());
+    m.def("checksum_file", &checksum_file, "Calculate the checksum of a file with the named algorithm", py::call_guard<py::gil_scoped_release>());
+    m.def("checksum_algorithms", &checksum_algorithms, "List the supported checksum algorithms");
+    m.def("checksum_algorithm", &checksum_algorithm, "Return the algorithm that produced a stored checksum");
+    m.def("lookup_trace_id", &lookup_trace_id, "Find the trace ID recorded in the index for a file", py::call_guard<py::gil_scoped_release>());
+    m.def("profile_start", &Profiler::start, "Discard recorded profile events and start recording");
+    m.def("profile_stop", &Profiler::stop, "Stop recording profile events");
+    m.def("profile_chrome_trace", &Profiler::chrome_trace_json, "Return the recorded profile as Chrome trace JSON");
+    m.def("profile_write", &Profiler::write_chrome_trace, "Write the recorded profile as Chrome trace JSON");
 }
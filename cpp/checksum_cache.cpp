@@ -0,0 +1,475 @@
+#include "checksum_cache.hpp"
+#include "hashing.hpp"
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Files modified this recently may still be written within the same
+// timestamp tick, so their digests are not cached yet.
+static const int64_t kRacyWindowNs = 2000000000LL;
+
+// Pseudo-algorithm under which SHA256 midstates of large files are cached
+static const char kMidstateAlgorithm[] = "sha256-midstate";
+
+// Pseudo-algorithm naming the sha256-cdc checksum whose chunk list was last
+// stored for an inode
+static const char kChunkListAlgorithm[] = "sha256-cdc-chunks";
+
+// Chunk list file: magic, total size, chunk count, then per chunk its
+// length, XXH64 fingerprint and SHA256 digest (integers in host byte order)
+static const char kChunkListMagic[8] = {'T', 'S', 'Q', 'C', 'D', 'C', '1', '\n'};
+static const size_t kChunkRecordSize = 8 + 8 + 32;
+
+// Superseded lines tolerated before the cache file is rewritten.
+static const uint64_t kCompactionSlack = 4096;
+
+bool FileIdentity::operator==(const FileIdentity& other) const {
+    return device == other.device && inode == other.inode && size == other.size &&
+           mtime_ns == other.mtime_ns && ctime_ns == other.ctime_ns;
+}
+
+FileIdentity stat_file_identity(const std::string& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("Could not stat file: " + path);
+    }
+    FileIdentity identity;
+    identity.device = static_cast<uint64_t>(st.st_dev);
+    identity.inode = static_cast<uint64_t>(st.st_ino);
+    identity.size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    identity.mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+    identity.ctime_ns = static_cast<int64_t>(st.st_ctimespec.tv_sec) * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+    identity.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    identity.ctime_ns = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+    return identity;
+}
+
+ChecksumCache::ChecksumCache(const fs::path& project_root, bool enabled)
+    : cache_path_(project_root / ".traceseq" / "checksum_cache.tsv"),
+      chunks_dir_(project_root / ".traceseq" / "chunks"), enabled_(enabled) {
+    if (enabled_) {
+        refresh();
+    }
+}
+
+std::string ChecksumCache::key(uint64_t device, uint64_t inode, const std::string& algorithm) {
+    return std::to_string(device) + ":" + std::to_string(inode) + ":" + algorithm;
+}
+
+// Line format: device inode size mtime_ns ctime_ns algorithm checksum
+void ChecksumCache::parse_line(const std::string& line) {
+    std::istringstream fields(line);
+    Entry entry;
+    std::string algorithm;
+    if (!(fields >> entry.identity.device >> entry.identity.inode >> entry.identity.size >>
+          entry.identity.mtime_ns >> entry.identity.ctime_ns >> algorithm >> entry.checksum)) {
+        return; // Torn or foreign line; ignore it
+    }
+    entries_[key(entry.identity.device, entry.identity.inode, algorithm)] = entry;
+    ++line_count_;
+}
+
+// Applies lines appended since the last read, or reloads after a rewrite.
+// Called with mutex_ held (or from the constructor).
+void ChecksumCache::refresh() {
+    struct stat st;
+    if (::stat(cache_path_.c_str(), &st) != 0) {
+        return;
+    }
+    if (static_cast<uint64_t>(st.st_ino) != file_inode_ || static_cast<uint64_t>(st.st_size) < read_offset_) {
+        entries_.clear();
+        read_offset_ = 0;
+        line_count_ = 0;
+        file_inode_ = static_cast<uint64_t>(st.st_ino);
+    }
+    if (static_cast<uint64_t>(st.st_size) == read_offset_) {
+        return;
+    }
+
+    std::ifstream file(cache_path_, std::ios::binary);
+    if (!file.is_open()) {
+        return;
+    }
+    file.seekg(static_cast<std::streamoff>(read_offset_));
+    std::string line;
+    while (std::getline(file, line)) {
+        if (file.eof()) {
+            break; // Partial line still being written; re-read it next time
+        }
+        parse_line(line);
+        read_offset_ += line.size() + 1;
+    }
+
+    if (line_count_ > entries_.size() + kCompactionSlack) {
+        compact();
+    }
+}
+
+// Rewrites the cache with one line per live entry. Appends racing with the
+// rename may be lost, which only costs a re-hash later.
+void ChecksumCache::compact() {
+    fs::path tmp_path = cache_path_;
+    tmp_path += ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            return;
+        }
+        for (const auto& pair : entries_) {
+            const Entry& entry = pair.second;
+            std::string algorithm = pair.first.substr(pair.first.rfind(':') + 1);
+            out << entry.identity.device << '\t' << entry.identity.inode << '\t' << entry.identity.size << '\t'
+                << entry.identity.mtime_ns << '\t' << entry.identity.ctime_ns << '\t' << algorithm << '\t'
+                << entry.checksum << '\n';
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, cache_path_, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        return;
+    }
+    struct stat st;
+    if (::stat(cache_path_.c_str(), &st) == 0) {
+        file_inode_ = static_cast<uint64_t>(st.st_ino);
+        read_offset_ = static_cast<uint64_t>(st.st_size);
+        line_count_ = entries_.size();
+    }
+}
+
+std::string ChecksumCache::lookup(const std::string& path, const std::string& algorithm) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!enabled_ && pins_.empty()) {
+            return "";
+        }
+    }
+    FileIdentity identity = stat_file_identity(path);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pinned = pins_.find(key(identity.device, identity.inode, algorithm));
+    if (pinned != pins_.end() && pinned->second.identity == identity) {
+        return pinned->second.checksum;
+    }
+    if (!enabled_) {
+        return "";
+    }
+    refresh();
+    auto it = entries_.find(key(identity.device, identity.inode, algorithm));
+    if (it == entries_.end() || it->second.identity != identity) {
+        return "";
+    }
+    return it->second.checksum;
+}
+
+void ChecksumCache::store(const FileIdentity& identity, const std::string& algorithm, const std::string& checksum) {
+    if (!enabled_) {
+        return;
+    }
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    if (now_ns - identity.mtime_ns < kRacyWindowNs || now_ns - identity.ctime_ns < kRacyWindowNs) {
+        return;
+    }
+    append_entry(identity, algorithm, checksum);
+}
+
+void ChecksumCache::pin(const PinnedChecksum& pinned) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pins_[key(pinned.identity.device, pinned.identity.inode, pinned.algorithm)] = Entry{pinned.identity, pinned.checksum};
+}
+
+void ChecksumCache::clear_pins() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pins_.clear();
+}
+
+void ChecksumCache::append_entry(const FileIdentity& identity, const std::string& algorithm, const std::string& checksum) {
+    std::ostringstream line;
+    line << identity.device << '\t' << identity.inode << '\t' << identity.size << '\t' << identity.mtime_ns << '\t'
+         << identity.ctime_ns << '\t' << algorithm << '\t' << checksum << '\n';
+    std::string record = line.str();
+
+    std::error_code ec;
+    fs::create_directories(cache_path_.parent_path(), ec);
+    // A single O_APPEND write keeps concurrent writers' lines intact
+    int fd = ::open(cache_path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t written = ::write(fd, record.data(), record.size());
+    ::close(fd);
+    if (written != static_cast<ssize_t>(record.size())) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[key(identity.device, identity.inode, algorithm)] = Entry{identity, checksum};
+}
+
+// Midstate format: <length>:<H0..H7 as eight 8-digit hex words>:<prefix digest>,
+// where H0..H7 are the FIPS 180-4 chaining values after <length> bytes and
+// the prefix digest is the sha256-tree checksum of those bytes
+static std::string encode_midstate(const Sha256Midstate& midstate) {
+    std::ostringstream out;
+    out << midstate.length << ':' << std::hex << std::setfill('0');
+    for (uint32_t word : midstate.state) {
+        out << std::setw(8) << word;
+    }
+    out << ':' << midstate.prefix_digest;
+    return out.str();
+}
+
+static bool decode_midstate(const std::string& encoded, Sha256Midstate& midstate) {
+    size_t first = encoded.find(':');
+    size_t second = encoded.find(':', first == std::string::npos ? first : first + 1);
+    if (first == std::string::npos || second == std::string::npos || second - first - 1 != 64) {
+        return false;
+    }
+    try {
+        midstate.length = std::stoull(encoded.substr(0, first));
+        for (int i = 0; i < 8; ++i) {
+            midstate.state[i] = static_cast<uint32_t>(std::stoul(encoded.substr(first + 1 + 8 * i, 8), nullptr, 16));
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    midstate.prefix_digest = encoded.substr(second + 1);
+    return true;
+}
+
+// Hashes a large file with SHA256, resuming from the midstate recorded for
+// its inode only when the file may have purely grown since: the recorded
+// size is strictly smaller and neither timestamp went backwards. Any other
+// identity change hashes from the start. Even then the midstate is only used
+// once `sha256_file_resume` has found the whole prefix unchanged, so it is
+// recorded even inside the racy window.
+std::string ChecksumCache::resumable_sha256(const std::string& path, const FileIdentity& before) {
+    Sha256Midstate resume;
+    bool have_resume = false;
+    bool recorded_current = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key(before.device, before.inode, kMidstateAlgorithm));
+        if (it != entries_.end()) {
+            recorded_current = it->second.identity == before;
+            const FileIdentity& recorded = it->second.identity;
+            have_resume = recorded.size < before.size && recorded.mtime_ns <= before.mtime_ns &&
+                          recorded.ctime_ns <= before.ctime_ns && decode_midstate(it->second.checksum, resume);
+        }
+    }
+
+    Sha256Midstate midstate;
+    std::string digest = sha256_file_resume(path, have_resume ? &resume : nullptr, midstate);
+    if (midstate.length > 0 && !recorded_current && stat_file_identity(path) == before) {
+        append_entry(before, kMidstateAlgorithm, encode_midstate(midstate));
+    }
+    return digest;
+}
+
+static std::string chunk_list_name(const std::string& checksum) {
+    if (checksum_algorithm(checksum) != kSha256CdcAlgorithm) {
+        return "";
+    }
+    return checksum.substr(kSha256CdcAlgorithm.size() + 1) + ".cdc";
+}
+
+void ChecksumCache::store_chunks(const std::string& checksum, const ChunkList& list) const {
+    fs::path path = chunks_dir_ / chunk_list_name(checksum);
+    std::error_code ec;
+    if (fs::exists(path, ec)) {
+        return; // Named after its content, so it cannot be stale
+    }
+    fs::create_directories(chunks_dir_, ec);
+    std::string data(kChunkListMagic, sizeof(kChunkListMagic));
+    uint64_t header[2] = {list.size, static_cast<uint64_t>(list.chunks.size())};
+    data.append(reinterpret_cast<const char*>(header), sizeof(header));
+    for (const FileChunk& chunk : list.chunks) {
+        data.append(reinterpret_cast<const char*>(&chunk.length), sizeof(chunk.length));
+        data.append(reinterpret_cast<const char*>(&chunk.fingerprint), sizeof(chunk.fingerprint));
+        data.append(reinterpret_cast<const char*>(chunk.digest), sizeof(chunk.digest));
+    }
+    fs::path tmp_path = path;
+    tmp_path += ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open() || !out.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+    }
+}
+
+bool ChecksumCache::stored_chunks(const std::string& checksum, ChunkList& list) const {
+    std::string name = chunk_list_name(checksum);
+    if (name.empty()) {
+        return false;
+    }
+    std::ifstream in(chunks_dir_ / name, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t header[2];
+    if (data.size() < sizeof(kChunkListMagic) + sizeof(header) ||
+        data.compare(0, sizeof(kChunkListMagic), kChunkListMagic, sizeof(kChunkListMagic)) != 0) {
+        return false;
+    }
+    std::memcpy(header, data.data() + sizeof(kChunkListMagic), sizeof(header));
+    const size_t offset = sizeof(kChunkListMagic) + sizeof(header);
+    if (header[1] > (data.size() - offset) / kChunkRecordSize || data.size() != offset + header[1] * kChunkRecordSize) {
+        return false;
+    }
+    ChunkList loaded;
+    loaded.size = header[0];
+    loaded.chunks.resize(static_cast<size_t>(header[1]));
+    const char* record = data.data() + offset;
+    for (FileChunk& chunk : loaded.chunks) {
+        std::memcpy(&chunk.length, record, 8);
+        std::memcpy(&chunk.fingerprint, record + 8, 8);
+        std::memcpy(chunk.digest, record + 16, sizeof(chunk.digest));
+        record += kChunkRecordSize;
+    }
+    // Rejects torn or foreign files
+    if (loaded.checksum() != checksum) {
+        return false;
+    }
+    list = std::move(loaded);
+    return true;
+}
+
+std::vector<std::string> ChecksumCache::stored_chunk_checksums() const {
+    std::vector<std::string> checksums;
+    std::error_code ec;
+    for (fs::directory_iterator it(chunks_dir_, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() == ".cdc") {
+            checksums.push_back(kSha256CdcAlgorithm + ":" + it->path().stem().string());
+        }
+    }
+    return checksums;
+}
+
+size_t ChecksumCache::sweep_chunks(const std::unordered_set<std::string>& keep, int64_t grace_seconds, bool dry_run) {
+    std::unordered_set<std::string> current;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refresh();
+        const std::string suffix = std::string(":") + kChunkListAlgorithm;
+        for (const auto& pair : entries_) {
+            if (pair.first.size() > suffix.size() &&
+                pair.first.compare(pair.first.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                current.insert(pair.second.checksum);
+            }
+        }
+    }
+    const auto cutoff = fs::file_time_type::clock::now() - std::chrono::seconds(grace_seconds);
+    size_t removed = 0;
+    for (const auto& checksum : stored_chunk_checksums()) {
+        if (keep.count(checksum) || current.count(checksum)) {
+            continue;
+        }
+        fs::path path = chunks_dir_ / chunk_list_name(checksum);
+        std::error_code ec;
+        fs::file_time_type written = fs::last_write_time(path, ec);
+        if (ec || written >= cutoff) {
+            continue;
+        }
+        if (dry_run || fs::remove(path, ec)) {
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+// Chunks a file, reusing the chunk digests of the version last hashed under
+// its inode. Kept lists are stored, and like the midstate, the pointer to
+// them is recorded even inside the racy window: chunks are only reused after
+// their fingerprints match.
+std::string ChecksumCache::chunked_sha256(const std::string& path, const FileIdentity& before, ChunkList* list, bool keep) {
+    std::string previous_checksum;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key(before.device, before.inode, kChunkListAlgorithm));
+        if (it != entries_.end()) {
+            previous_checksum = it->second.checksum;
+        }
+    }
+    ChunkList previous;
+    bool have_previous = !previous_checksum.empty() && stored_chunks(previous_checksum, previous);
+
+    ChunkList chunks = chunk_file(path, have_previous ? &previous : nullptr);
+    std::string digest = chunks.checksum();
+    if (keep) {
+        store_chunks(digest, chunks);
+        if (digest != previous_checksum) {
+            append_entry(before, kChunkListAlgorithm, digest);
+        }
+    }
+    if (list) {
+        *list = std::move(chunks);
+    }
+    return digest;
+}
+
+ChunkList ChecksumCache::chunks(const std::string& path) {
+    if (!enabled_) {
+        return chunk_file(path);
+    }
+    ChunkList list;
+    std::string cached = lookup(path, kSha256CdcAlgorithm);
+    if (!cached.empty() && stored_chunks(cached, list)) {
+        return list;
+    }
+    FileIdentity before = stat_file_identity(path);
+    std::string digest = chunked_sha256(path, before, &list, false);
+    if (stat_file_identity(path) == before) {
+        store(before, kSha256CdcAlgorithm, digest);
+    }
+    return list;
+}
+
+std::string ChecksumCache::checksum(const std::string& path, const std::string& algorithm) {
+    return compute_checksum(path, algorithm, false);
+}
+
+std::string ChecksumCache::recorded_checksum(const std::string& path, const std::string& algorithm) {
+    return compute_checksum(path, algorithm, true);
+}
+
+std::string ChecksumCache::compute_checksum(const std::string& path, const std::string& algorithm, bool keep_chunks) {
+    std::string cached = lookup(path, algorithm);
+    // A cached sha256-cdc checksum may have been computed without its list
+    std::error_code ec;
+    if (!cached.empty() && (!keep_chunks || algorithm != kSha256CdcAlgorithm ||
+                            fs::exists(chunks_dir_ / chunk_list_name(cached), ec))) {
+        return cached;
+    }
+    FileIdentity before = stat_file_identity(path);
+    std::string digest;
+    if (enabled_ && algorithm == kSha256Algorithm && before.size >= kResumableHashMinBytes) {
+        digest = resumable_sha256(path, before);
+    } else if (enabled_ && algorithm == kSha256CdcAlgorithm) {
+        digest = chunked_sha256(path, before, nullptr, keep_chunks);
+    } else {
+        digest = checksum_file(path, algorithm);
+    }
+    if (enabled_ && stat_file_identity(path) == before) {
+        store(before, algorithm, digest);
+    }
+    return digest;
+}
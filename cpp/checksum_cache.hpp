@@ -0,0 +1,205 @@
+#ifndef CHECKSUM_CACHE_HPP
+#define CHECKSUM_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "hashing.hpp"
+
+/**
+ * @brief The stat-level identity of a file used to decide whether a cached
+ *        checksum is still valid.
+ */
+struct FileIdentity {
+    uint64_t device = 0;    ///< Device the file lives on.
+    uint64_t inode = 0;     ///< Inode number on that device.
+    uint64_t size = 0;      ///< File size in bytes.
+    int64_t mtime_ns = 0;   ///< Last modification time in nanoseconds since the epoch.
+    int64_t ctime_ns = 0;   ///< Last status change time in nanoseconds since the epoch.
+
+    bool operator==(const FileIdentity& other) const;
+    bool operator!=(const FileIdentity& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief Reads the identity of a file with a single `stat` call.
+ * @param path The file to stat.
+ * @return The file's identity.
+ * @throws std::runtime_error if the file cannot be stat'ed.
+ */
+FileIdentity stat_file_identity(const std::string& path);
+
+/**
+ * @brief A checksum computed by another process, for a file identity.
+ */
+struct PinnedChecksum {
+    FileIdentity identity;  ///< The identity of the file when it was hashed.
+    std::string algorithm;  ///< The checksum algorithm.
+    std::string checksum;   ///< The checksum string.
+};
+
+/**
+ * @brief Persistent cache of file checksums keyed by file identity.
+ *
+ * Entries live in the append-only '.traceseq/checksum_cache.tsv' file, one
+ * line per (device, inode, algorithm) with the size, mtime and ctime that
+ * were observed when the digest was computed. A lookup costs one `stat`: if
+ * any identity field differs the entry is ignored and the file is re-hashed.
+ *
+ * Digests are only recorded when the file did not change while it was being
+ * hashed and its mtime is old enough that a later write could not share the
+ * same timestamp on filesystems with coarse time resolution.
+ *
+ * Large files (see `kResumableHashMinBytes`) additionally keep their SHA256
+ * midstate, so when an append-only file grew only the new tail goes through
+ * the sequential SHA256 pass; the old prefix is re-read and checked with a
+ * parallel tree digest, so an in-place edit is never missed.
+ *
+ * Files whose `sha256-cdc` checksum is recorded (see `recorded_checksum`)
+ * keep their chunk list in '.traceseq/chunks/<hex>.cdc', named after the file
+ * checksum. When such a file is edited in place, the list recorded for its
+ * inode is passed to `chunk_file`, so only the chunks that changed are hashed
+ * with SHA256. Lists nothing refers to any more are removed by
+ * `sweep_chunks`.
+ *
+ * All methods are thread-safe; files are hashed outside the internal lock.
+ */
+class ChecksumCache {
+public:
+    /**
+     * @brief Opens the checksum cache of a project.
+     * @param project_root The root directory of the project.
+     * @param enabled Whether to read and write the cache (see `set_enabled`).
+     */
+    explicit ChecksumCache(const std::filesystem::path& project_root, bool enabled = true);
+
+    /**
+     * @brief Returns the checksum of a file, hashing it only on a cache miss.
+     * @param path The file to checksum.
+     * @param algorithm The checksum algorithm (see `checksum_file`).
+     * @return The checksum string as stored in trace nodes and the index.
+     * @throws std::runtime_error if the file cannot be stat'ed or hashed.
+     */
+    std::string checksum(const std::string& path, const std::string& algorithm);
+
+    /**
+     * @brief Returns the checksum of a file that is about to be recorded in the index.
+     *
+     * Like `checksum`, except that a `sha256-cdc` file also keeps its chunk
+     * list, for `--overlap` and for re-hashing the file's next version.
+     *
+     * @param path The file to checksum.
+     * @param algorithm The checksum algorithm (see `checksum_file`).
+     * @return The checksum string.
+     * @throws std::runtime_error if the file cannot be stat'ed or hashed.
+     */
+    std::string recorded_checksum(const std::string& path, const std::string& algorithm);
+
+    /**
+     * @brief Returns the pinned or cached checksum of a file without hashing it.
+     * @param path The file to look up.
+     * @param algorithm The checksum algorithm.
+     * @return The cached checksum, or an empty string on a miss.
+     */
+    std::string lookup(const std::string& path, const std::string& algorithm);
+
+    /**
+     * @brief Records a checksum computed elsewhere for a file identity.
+     * @param identity The identity of the file when it was hashed.
+     * @param algorithm The checksum algorithm.
+     * @param checksum The checksum string.
+     */
+    void store(const FileIdentity& identity, const std::string& algorithm, const std::string& checksum);
+
+    /**
+     * @brief Makes lookups return a checksum computed elsewhere while the file keeps its identity.
+     *
+     * Unlike `store`, pins live only in memory until `clear_pins`, are kept
+     * inside the racy window and apply even to a disabled cache. `traceseq`
+     * pins the checksums it computed before handing a command to `traceseqd`.
+     *
+     * @param pinned The checksum and the identity of the file it was computed for.
+     */
+    void pin(const PinnedChecksum& pinned);
+
+    /// Forgets every checksum given to `pin`.
+    void clear_pins();
+
+    /**
+     * @brief Returns the content-defined chunks of a file.
+     *
+     * The stored chunk list is returned while the file is unchanged;
+     * otherwise the file is chunked (reusing the digests of its previous
+     * version) exactly as `checksum(path, kSha256CdcAlgorithm)` would. A
+     * list computed here is not stored.
+     *
+     * @param path The file to chunk.
+     * @return The chunks of the file.
+     * @throws std::runtime_error if the file cannot be stat'ed or read.
+     */
+    ChunkList chunks(const std::string& path);
+
+    /**
+     * @brief Reads the chunk list stored for a `sha256-cdc` checksum.
+     * @param checksum The file checksum, e.g. "sha256-cdc:<hex>".
+     * @param list Filled with the chunks on success.
+     * @return Whether an intact list was stored for the checksum.
+     */
+    bool stored_chunks(const std::string& checksum, ChunkList& list) const;
+
+    /**
+     * @brief Lists the `sha256-cdc` checksums whose chunk lists are stored.
+     * @return The checksums, in no particular order.
+     */
+    std::vector<std::string> stored_chunk_checksums() const;
+
+    /**
+     * @brief Removes stored chunk lists that nothing refers to any more.
+     *
+     * A list is kept if its checksum is in `keep` (e.g. the index keys), if
+     * it is the latest list recorded for a cached file, whose next version
+     * would reuse it, or if it was written within the last `grace_seconds`
+     * and its index entry may not have been written yet.
+     *
+     * @param keep Checksums whose lists must stay.
+     * @param grace_seconds Lists younger than this are kept.
+     * @param dry_run Only count the lists that would be removed.
+     * @return The number of lists removed (or that would be).
+     */
+    size_t sweep_chunks(const std::unordered_set<std::string>& keep, int64_t grace_seconds, bool dry_run);
+
+    /// Disables reading and writing the cache; `checksum` always re-hashes.
+    void set_enabled(bool enabled) { enabled_ = enabled; }
+
+private:
+    struct Entry {
+        FileIdentity identity;
+        std::string checksum;
+    };
+
+    void refresh();
+    void compact();
+    void append_entry(const FileIdentity& identity, const std::string& algorithm, const std::string& checksum);
+    std::string resumable_sha256(const std::string& path, const FileIdentity& before);
+    std::string compute_checksum(const std::string& path, const std::string& algorithm, bool keep_chunks);
+    std::string chunked_sha256(const std::string& path, const FileIdentity& before, ChunkList* list, bool keep);
+    void store_chunks(const std::string& checksum, const ChunkList& list) const;
+    void parse_line(const std::string& line);
+    static std::string key(uint64_t device, uint64_t inode, const std::string& algorithm);
+
+    std::mutex mutex_;
+    std::filesystem::path cache_path_;
+    std::filesystem::path chunks_dir_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::unordered_map<std::string, Entry> pins_;   ///< Checksums given to `pin`.
+    uint64_t read_offset_ = 0;   ///< Bytes of the cache file already applied.
+    uint64_t file_inode_ = 0;    ///< Inode of the cache file, to notice compaction by others.
+    uint64_t line_count_ = 0;    ///< Lines read, including superseded ones.
+    bool enabled_ = true;
+};
+
+#endif // CHECKSUM_CACHE_HPP
@@ -0,0 +1,1236 @@
+#include "commands.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <iomanip>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+#include <filesystem>
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#include <limits.h>
+#elif defined(__linux__)
+#include <unistd.h> // For readlink
+#include <limits.h> // For PATH_MAX
+#endif
+#include <unistd.h>
+#include "cxxopts.hpp"
+#include "hashing.hpp"
+#include "checksum_cache.hpp"
+#include "batch.hpp"
+#include "stream_annotate.hpp"
+#include "validation.hpp"
+#include "node_store.hpp"
+#include "storage.hpp"
+#include "profiler.hpp"
+#include "tracer.hpp"
+#include "lineage.hpp"
+#include "lineage_diff.hpp"
+#include "store_gc.hpp"
+#include "query_index.hpp"
+#include "parallel.hpp"
+#include "nlohmann/json.hpp" // For the index and resolve_lineage
+
+namespace fs = std::filesystem;
+
+fs::path get_project_root_path(const char* argv0) {
+    fs::path executable_path;
+    // Get the path to the executable
+#if defined(__APPLE__)
+    char path[PATH_MAX];
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) == 0) {
+        executable_path = fs::path(path);
+    } else {
+        executable_path = fs::current_path() / argv0;
+    }
+#elif defined(__linux__)
+    char path[PATH_MAX];
+    ssize_t count = readlink("/proc/self/exe", path, PATH_MAX);
+    if (count != -1) {
+        executable_path = fs::path(std::string(path, count));
+    } else {
+        executable_path = fs::current_path() / argv0;
+    }
+#else
+    // Generic fallback for other OSes
+    executable_path = fs::current_path() / argv0;
+#endif
+
+    fs::path current_dir = fs::canonical(executable_path).parent_path();
+    while (!current_dir.empty() && current_dir != current_dir.parent_path()) {
+        if (fs::exists(current_dir / "cpp" / "CMakeLists.txt")) {
+            return current_dir;
+        }
+        current_dir = current_dir.parent_path();
+    }
+    
+    // Fallback if root is not found
+    return fs::current_path();
+}
+
+
+/**
+ * @brief Returns the project's checksum cache, honouring --no-checksum-cache.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ * @return The checksum cache to hash files through.
+ */
+static ChecksumCache& checksum_cache_for(const cxxopts::ParseResult& result, ProjectSession& session) {
+    return session.checksum_cache(!result.count("no-checksum-cache"));
+}
+
+// Forward declarations
+/**
+ * @brief Annotates a file with a new trace node.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void annotate(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Annotates data streamed on standard input, hashing it as it arrives.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void annotate_stream(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Annotates every file listed in a manifest in one pass.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void annotate_batch_command(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Runs the node store maintenance commands (migrate, export, convert, gc, index-add).
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void store_command(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Explains the provenance of a file.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void explain(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Lists every trace node derived from a file or trace ID.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void descendants(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Lists the trace nodes matching a query on their fields.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void query(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Diffs the provenance of two files, or of a reference file against several.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void diff(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Reports how much of a file's content occurs in another file or in traced files.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void overlap(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Validates the provenance of a file.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void validate(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Validates the provenance of a directory tree or a list of files.
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void validate_many(const cxxopts::ParseResult& result, ProjectSession& session);
+
+/**
+ * @brief Runs the command selected by the parsed arguments.
+ * @param result The parsed command-line arguments.
+ * @param options The option definitions, for printing usage.
+ * @param session The project session.
+ * @return The process exit status.
+ */
+static int dispatch_command(const cxxopts::ParseResult& result, const cxxopts::Options& options, ProjectSession& session);
+
+/**
+ * @brief Defines the command-line options of every command.
+ * @return The option definitions.
+ */
+static cxxopts::Options command_options() {
+    cxxopts::Options options("trace-seq", "Minimal Semantic Provenance Tracking");
+
+    options.add_options()
+        ("a,annotate", "Annotate a file with a new trace", cxxopts::value<std::string>())
+        ("annotate-batch", "Annotate every file listed in a TSV manifest", cxxopts::value<std::string>())
+        ("e,explain", "Explain the provenance of a file", cxxopts::value<std::string>())
+        ("descendants", "List every trace node derived from a file or trace ID", cxxopts::value<std::string>())
+        ("query", "List trace nodes matching a query, e.g. \"class=normalization AND since=2026-06\"", cxxopts::value<std::string>())
+        ("d,diff", "Diff two files, or a reference file against several others", cxxopts::value<std::vector<std::string>>())
+        ("diff-list", "With --diff <reference>, diff against every file listed in a file, one path per line", cxxopts::value<std::string>())
+        ("overlap", "Report how much of a file's content occurs in a second file, or in previously traced files", cxxopts::value<std::vector<std::string>>())
+        ("v,validate", "Validate the provenance of a file, or of every file in a directory", cxxopts::value<std::string>())
+        ("validate-list", "Validate the provenance of every file listed in a file, one path per line", cxxopts::value<std::string>())
+        ("operation", "Operation class (e.g., normalization, filtering)", cxxopts::value<std::string>())
+        ("method", "Operation method (e.g., TPM, DESeq2, GATK_HaplotypeCaller)", cxxopts::value<std::string>())
+        ("assumption", "Assumption", cxxopts::value<std::vector<std::string>>())
+        ("parent", "Parent trace ID", cxxopts::value<std::string>())
+        ("output", "With --annotate -, write the streamed data to this file", cxxopts::value<std::string>())
+        ("input", "With --annotate -, the input file the stream was derived from", cxxopts::value<std::string>())
+        ("hash", "Checksum algorithm (sha256, sha256-tree, sha256-cdc, blake2b, xxh64)", cxxopts::value<std::string>()->default_value("sha256"))
+        ("no-checksum-cache", "Always re-hash files instead of using the checksum cache")
+        ("threads", "Worker threads for batch commands (0 = one per core)", cxxopts::value<unsigned int>()->default_value("0"))
+        ("migrate-store", "Move per-file YAML nodes into the packed segment store")
+        ("export-node", "Print a stored trace node as YAML", cxxopts::value<std::string>())
+        ("export-yaml", "Export every stored trace node as YAML files into a directory", cxxopts::value<std::string>())
+        ("convert-store", "Move the trace nodes and index to another storage backend (files, sqlite)", cxxopts::value<std::string>())
+        ("index-add", "Record index entries <checksum>=<trace_id> for nodes written by another tool", cxxopts::value<std::vector<std::string>>())
+        ("gc", "Remove trace nodes unreachable from the index and compact the node store by lineage")
+        ("gc-files", "With --gc, keep only the lineages of files found below this directory", cxxopts::value<std::string>())
+        ("gc-grace", "With --gc, keep unreachable nodes created within this many seconds", cxxopts::value<int64_t>()->default_value("3600"))
+        ("gc-dry-run", "With --gc, only report what would be removed and rewritten")
+        ("profile", "Write timed spans and counters of this command as Chrome trace JSON to a file", cxxopts::value<std::string>())
+        ("h,help", "Print usage");
+    return options;
+}
+
+/**
+ * @brief Parses a command line.
+ * @param options The option definitions.
+ * @param args The command-line arguments, including the program name.
+ * @return The parsed arguments.
+ * @throws std::exception if the command line is invalid.
+ */
+static cxxopts::ParseResult parse_command(cxxopts::Options& options, const std::vector<std::string>& args) {
+    std::vector<char*> argv_storage;
+    for (const auto& arg : args) {
+        argv_storage.push_back(const_cast<char*>(arg.c_str()));
+    }
+    return options.parse(static_cast<int>(argv_storage.size()), argv_storage.data());
+}
+
+int run_command(const std::vector<std::string>& args, ProjectSession& session) {
+    cxxopts::Options options = command_options();
+    cxxopts::ParseResult result;
+    try {
+        result = parse_command(options, args);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (result.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+    if (!result.count("profile")) {
+        return dispatch_command(result, options, session);
+    }
+    // Spans recorded while the command runs end up in the trace, including
+    // those of worker threads
+    std::string profile_path = result["profile"].as<std::string>();
+    Profiler::start();
+    int status = dispatch_command(result, options, session);
+    Profiler::stop();
+    try {
+        Profiler::write_chrome_trace(profile_path);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return status;
+}
+
+// Mirrors dispatch_command: the files the selected command hashes one by
+// one, or false for commands that read standard input or hash in bulk
+static bool files_hashed_by(const cxxopts::ParseResult& result, std::vector<std::string>& files, bool& recorded) {
+    recorded = false;
+    if (result.count("help")) {
+        return true;
+    }
+    if (result.count("migrate-store") || result.count("export-node") || result.count("export-yaml") || result.count("convert-store") || result.count("gc") || result.count("index-add")) {
+        return !result.count("gc-files");
+    }
+    if (result.count("annotate-batch")) {
+        return false;
+    }
+    if (result.count("annotate")) {
+        std::string filepath = result["annotate"].as<std::string>();
+        if (filepath == "-") {
+            return false;
+        }
+        if (result.count("operation") && result.count("method")) {
+            files.push_back(filepath);
+            recorded = true;
+        }
+    } else if (result.count("explain")) {
+        files.push_back(result["explain"].as<std::string>());
+    } else if (result.count("descendants")) {
+        std::string target = result["descendants"].as<std::string>();
+        if (fs::is_regular_file(target)) {
+            files.push_back(target);
+        }
+    } else if (result.count("query")) {
+        return true;
+    } else if (result.count("diff")) {
+        if (result.count("diff-list")) {
+            return false;
+        }
+        files = result["diff"].as<std::vector<std::string>>();
+    } else if (result.count("overlap")) {
+        return false;
+    } else if (result.count("validate-list") || (result.count("validate") && fs::is_directory(result["validate"].as<std::string>()))) {
+        return false;
+    } else if (result.count("validate")) {
+        files.push_back(result["validate"].as<std::string>());
+    }
+    return true;
+}
+
+bool prepare_daemon_request(const std::vector<std::string>& args, ProjectSession& session, std::vector<PinnedChecksum>& checksums) {
+    cxxopts::Options options = command_options();
+    cxxopts::ParseResult result;
+    std::vector<std::string> files;
+    bool recorded = false;
+    try {
+        result = parse_command(options, args);
+        if (!files_hashed_by(result, files, recorded)) {
+            return false;
+        }
+    } catch (const std::exception&) {
+        return false; // Reported when the command line is parsed in-process
+    }
+    ChecksumCache& checksum_cache = checksum_cache_for(result, session);
+    const std::string algorithm = result["hash"].as<std::string>();
+    for (const auto& file : files) {
+        try {
+            FileIdentity before = stat_file_identity(file);
+            std::string checksum = recorded ? checksum_cache.recorded_checksum(file, algorithm)
+                                            : checksum_cache.checksum(file, algorithm);
+            if (stat_file_identity(file) == before) {
+                checksums.push_back(PinnedChecksum{before, algorithm, checksum});
+            }
+        } catch (const std::exception&) {
+            continue; // The command reports the unreadable file itself
+        }
+    }
+    // Also serves the command in-process if no daemon answers
+    session.pin_checksums(checksums);
+    return true;
+}
+
+static int dispatch_command(const cxxopts::ParseResult& result, const cxxopts::Options& options, ProjectSession& session) {
+    ProfileSpan span("command");
+    if (result.count("migrate-store") || result.count("export-node") || result.count("export-yaml") || result.count("convert-store") || result.count("gc") || result.count("index-add")) {
+        store_command(result, session);
+    } else if (result.count("annotate") || result.count("annotate-batch") || result.count("explain") || result.count("descendants") || result.count("query") || result.count("diff") || result.count("overlap") || result.count("validate") || result.count("validate-list")) {
+        if (result.count("annotate-batch")) {
+            annotate_batch_command(result, session);
+        } else if (result.count("annotate")) {
+            // Ensure required options for annotate are present
+            if (!result.count("operation") || !result.count("method")) {
+                std::cerr << "Error: --operation and --method are required for annotate command." << std::endl;
+                std::cout << options.help() << std::endl;
+                return 1;
+            }
+            annotate(result, session);
+        } else if (result.count("explain")) {
+            explain(result, session);
+        } else if (result.count("descendants")) {
+            descendants(result, session);
+        } else if (result.count("query")) {
+            query(result, session);
+        } else if (result.count("diff")) {
+            diff(result, session);
+        } else if (result.count("overlap")) {
+            overlap(result, session);
+        } else if (result.count("validate-list") || (result.count("validate") && fs::is_directory(result["validate"].as<std::string>()))) {
+            validate_many(result, session);
+        } else if (result.count("validate")) {
+            validate(result, session);
+        }
+    } else {
+        std::cout << options.help() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Implements the annotate command.
+ *
+ * Annotates a specified file with a new trace node, capturing details
+ * about the operation, method, assumptions, and parent lineage.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void annotate(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::string filepath = result["annotate"].as<std::string>();
+    if (filepath == "-") {
+        annotate_stream(result, session);
+        return;
+    }
+    std::string operation_class = result["operation"].as<std::string>();
+    std::string operation_method = result["method"].as<std::string>();
+    std::vector<std::string> assumptions;
+    if (result.count("assumption")) {
+        assumptions = result["assumption"].as<std::vector<std::string>>();
+    }
+
+    std::string parent_id = "null";
+    if (result.count("parent")) {
+        parent_id = result["parent"].as<std::string>();
+    }
+
+    // 1. Calculate checksum for input file
+    std::string input_checksum;
+    try {
+        input_checksum = checksum_cache_for(result, session).recorded_checksum(filepath, result["hash"].as<std::string>());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    // 3. Load ontology
+    const Ontology* ontology = nullptr;
+    try {
+        // Kept in memory by a long-lived session until the YAML ontologies change
+        ontology = &session.ontology();
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error loading ontology: " << e.what() << std::endl;
+        return;
+    }
+
+    // 4. Validate operation and assumptions
+    if (!ontology->validate_operation(operation_class)) {
+        std::cerr << "Error: Invalid operation class '" << operation_class << "'" << std::endl;
+        return;
+    }
+    for (const auto& assump : assumptions) {
+        if (!ontology->validate_assumption(assump)) { // Use full assumption string for validation
+            std::cerr << "Error: Invalid assumption '" << assump << "'" << std::endl;
+            return;
+        }
+    }
+
+    // 5. Create TraceNode
+    TraceNode node = create_trace_node(
+        parent_id,
+        "quantitative_matrix", // Placeholder: input data_class needs to be dynamic
+        operation_class,
+        operation_method,
+        assumptions
+    );
+    // Set input details
+    node.input.checksum = input_checksum;
+    node.input.shape = "unknown"; // Placeholder: input shape needs to be dynamic
+    node.output.data_class = "quantitative_matrix"; // Placeholder: output data_class needs to be dynamic
+
+    // 6. Save TraceNode
+    // Assuming output file is the same as input file for simplicity in annotation
+    // In a real pipeline, a new file would be created, and its checksum passed.
+    std::string output_checksum = input_checksum; // Placeholder
+    std::string output_data_class = "quantitative_matrix"; // Placeholder
+    node.save(input_checksum, output_checksum, output_data_class, session.storage());
+
+    std::cout << "Successfully annotated " << filepath << " with trace ID: " << node.trace_id << std::endl;
+}
+
+/**
+ * @brief Implements `--annotate -`.
+ *
+ * Reads the output of a tool from standard input, hashing it on the fly and
+ * writing it through to --output when given, then records the trace node
+ * once the stream ends. The data is never read a second time.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void annotate_stream(const cxxopts::ParseResult& result, ProjectSession& session) {
+    AnnotationRequest request;
+    request.filepath = result.count("output") ? result["output"].as<std::string>() : "-";
+    request.operation_class = result["operation"].as<std::string>();
+    request.operation_method = result["method"].as<std::string>();
+    if (result.count("assumption")) {
+        request.assumptions = result["assumption"].as<std::vector<std::string>>();
+    }
+    if (result.count("parent")) {
+        request.parent_id = result["parent"].as<std::string>();
+    }
+
+    try {
+        std::string algorithm = result["hash"].as<std::string>();
+        StreamAnnotator annotator(request, session.ontology(), algorithm, session.storage());
+        if (result.count("input")) {
+            annotator.set_input_checksum(checksum_cache_for(result, session).recorded_checksum(result["input"].as<std::string>(), algorithm));
+        }
+
+        std::vector<char> buffer(1 << 20);
+        while (true) {
+            ssize_t n = ::read(STDIN_FILENO, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw std::runtime_error("Could not read standard input");
+            }
+            if (n == 0) {
+                break;
+            }
+            annotator.write(buffer.data(), static_cast<size_t>(n));
+        }
+
+        AnnotationResult annotated = annotator.close();
+        std::cout << "Successfully annotated " << (annotated.filepath == "-" ? "standard input" : annotated.filepath)
+                  << " (" << annotated.checksum << ") with trace ID: " << annotated.trace_id << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+/**
+ * @brief Implements the annotate-batch command.
+ *
+ * Reads a TSV manifest of (file, operation, method, assumptions, parent)
+ * rows, loads the ontology once, hashes the files in parallel and commits
+ * every trace node and index entry in a single pass.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void annotate_batch_command(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::string manifest_path = result["annotate-batch"].as<std::string>();
+
+    // 1. Read the manifest
+    std::vector<AnnotationRequest> requests;
+    try {
+        requests = read_annotation_manifest(manifest_path);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    // 2. Load ontology once for every row
+    const Ontology* ontology = nullptr;
+    try {
+        // Kept in memory by a long-lived session until the YAML ontologies change
+        ontology = &session.ontology();
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error loading ontology: " << e.what() << std::endl;
+        return;
+    }
+
+    // 3. Hash, validate and commit all rows
+    ChecksumCache& checksum_cache = checksum_cache_for(result, session);
+    std::vector<AnnotationResult> results;
+    try {
+        results = annotate_batch(requests, *ontology, checksum_cache, result["hash"].as<std::string>(),
+                                 session.root(), result["threads"].as<unsigned int>());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    size_t annotated = 0;
+    for (const auto& row : results) {
+        if (row.error.empty()) {
+            ++annotated;
+            std::cout << "Successfully annotated " << row.filepath << " with trace ID: " << row.trace_id << std::endl;
+        } else {
+            std::cerr << "Error: " << row.filepath << ": " << row.error << std::endl;
+        }
+    }
+    std::cout << "Annotated " << annotated << " of " << results.size() << " files from " << manifest_path << std::endl;
+}
+
+/**
+ * @brief Implements the gc command.
+ *
+ * Without --gc-files every index entry keeps its lineage alive. With
+ * --gc-files only the lineages of the files below that directory are kept;
+ * the files are hashed on --threads workers, and a file that cannot be read
+ * is reported and keeps nothing alive.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ * @throws std::runtime_error if the index or store cannot be read or written.
+ */
+static void gc_command(const cxxopts::ParseResult& result, ProjectSession& session) {
+    GcOptions options;
+    options.grace_seconds = result["gc-grace"].as<int64_t>();
+    options.num_threads = result["threads"].as<unsigned int>();
+    options.dry_run = result.count("gc-dry-run") > 0;
+    if (result.count("gc-files")) {
+        std::vector<std::string> files = collect_validation_files(result["gc-files"].as<std::string>());
+        const nlohmann::json& index_json = session.index();
+        ChecksumCache& checksum_cache = checksum_cache_for(result, session);
+        const std::string algorithm = result["hash"].as<std::string>();
+        std::vector<std::string> trace_ids(files.size());
+        std::vector<std::string> errors(files.size());
+        parallel_for(files.size(), options.num_threads, [&](size_t i) {
+            try {
+                trace_ids[i] = lookup_trace_id(index_json, files[i], algorithm, checksum_cache);
+            } catch (const std::exception& e) {
+                errors[i] = e.what();
+            }
+        });
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (!errors[i].empty()) {
+                std::cerr << "Error: " << files[i] << ": " << errors[i] << std::endl;
+            }
+        }
+        options.restrict_roots = true;
+        options.live_trace_ids = std::move(trace_ids);
+    }
+
+    GcReport report = collect_garbage(session.root(), session.node_store(), options);
+    std::cout << (options.dry_run ? "Would keep " : "Kept ") << report.reachable << " trace nodes reachable from "
+              << report.roots << (options.restrict_roots ? " live files" : " index entries");
+    if (report.in_grace > 0) {
+        std::cout << " and " << report.in_grace << " created within the last " << options.grace_seconds << " seconds";
+    }
+    std::cout << "." << std::endl;
+    if (options.dry_run) {
+        std::cout << "Would remove " << report.removed << " trace nodes, pack " << report.files_packed
+                  << " per-file nodes, rewrite " << report.segments_rewritten << " segments ("
+                  << report.segments_kept << " compacted segments unchanged) and remove "
+                  << report.chunk_lists_removed << " chunk lists." << std::endl;
+        return;
+    }
+    std::cout << "Removed " << report.removed << " trace nodes, " << report.index_entries_removed
+              << " index entries and " << report.chunk_lists_removed << " chunk lists; packed " << report.files_packed << " per-file nodes." << std::endl;
+    std::cout << "Rewrote " << report.segments_rewritten << " segments (" << report.nodes_copied << " nodes copied, "
+              << report.segments_kept << " compacted segments unchanged); store size "
+              << report.bytes_before << " -> " << report.bytes_after << " bytes." << std::endl;
+}
+
+/**
+ * @brief Implements the node store maintenance commands.
+ *
+ * --migrate-store moves per-file nodes into the packed segment store,
+ * --export-node prints one node as YAML and --export-yaml writes every
+ * node as a YAML file for human inspection or the R tooling. --convert-store
+ * moves the project to another storage backend. --gc removes unreachable
+ * nodes and lays out the rest by lineage.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void store_command(const cxxopts::ParseResult& result, ProjectSession& session) {
+    try {
+        if (result.count("gc")) {
+            gc_command(result, session);
+        } else if (result.count("migrate-store")) {
+            session.node_store(); // The packed store only exists in the file layout
+            size_t migrated = migrate_node_files(session.root());
+            std::cout << "Migrated " << migrated << " trace nodes into the packed store." << std::endl;
+        } else if (result.count("export-node")) {
+            TraceNode node = load_node(result["export-node"].as<std::string>(), session.root(), session.storage());
+            std::cout << trace_node_to_yaml(node) << std::endl;
+        } else if (result.count("export-yaml")) {
+            fs::path output_dir = result["export-yaml"].as<std::string>();
+            size_t exported = export_nodes_yaml(session.root(), output_dir);
+            std::cout << "Exported " << exported << " trace nodes to " << output_dir.string() << std::endl;
+        } else if (result.count("convert-store")) {
+            std::string backend = result["convert-store"].as<std::string>();
+            if (backend != "files" && backend != "sqlite") {
+                throw std::runtime_error("Unknown storage backend: " + backend + " (expected files or sqlite)");
+            }
+            StorageBackend target = backend == "sqlite" ? StorageBackend::Sqlite : StorageBackend::Files;
+            if (storage_backend(session.root()) == target) {
+                std::cout << "The project already uses " << backend << " storage." << std::endl;
+                return;
+            }
+            size_t converted = convert_storage(session.root(), target);
+            std::cout << "Converted " << converted << " trace nodes to " << backend << " storage." << std::endl;
+        } else if (result.count("index-add")) {
+            // Appended under the index lock like the CLI's own annotations,
+            // so a concurrent compaction cannot drop them
+            IndexEntries entries;
+            for (const auto& entry : result["index-add"].as<std::vector<std::string>>()) {
+                size_t separator = entry.rfind('=');
+                if (separator == std::string::npos || separator == 0 || separator + 1 == entry.size()) {
+                    throw std::runtime_error("Expected <checksum>=<trace_id>: " + entry);
+                }
+                entries.emplace_back(entry.substr(0, separator), entry.substr(separator + 1));
+            }
+            session.storage().append_index(entries);
+            std::cout << "Recorded " << entries.size() << " index entries." << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+/**
+ * @brief Implements the explain command.
+ *
+ * Explains the full provenance lineage of a specified file by
+ * traversing its trace nodes.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void explain(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::string filepath = result["explain"].as<std::string>();
+
+    // 1. Load index.json and look up the trace_id by the file's checksum
+    const nlohmann::json& index_json = session.index();
+
+    std::string latest_trace_id;
+    try {
+        ChecksumCache& checksum_cache = checksum_cache_for(result, session);
+        latest_trace_id = lookup_trace_id(index_json, filepath, result["hash"].as<std::string>(), checksum_cache);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    if (latest_trace_id.empty()) {
+        std::cout << "No provenance found for file: " << filepath << std::endl;
+        return;
+    }
+
+    // 3. Resolve lineage
+    std::vector<TraceNode> lineage = resolve_lineage(latest_trace_id, session.root(), session.storage());
+
+    // 4. Print lineage details
+    std::cout << "Provenance for " << filepath << ":" << std::endl;
+    for (size_t i = 0; i < lineage.size(); ++i) {
+        const auto& node = lineage[i];
+        std::cout << "----------------------------------------" << std::endl;
+        std::cout << "Step " << i + 1 << ":" << std::endl;
+        std::cout << "  Trace ID: " << node.trace_id << std::endl;
+        std::cout << "  Parent ID: " << node.parent << std::endl;
+        std::cout << "  Timestamp: " << node.timestamp << std::endl;
+        std::cout << "  Input Data Class: " << node.data_class << std::endl;
+        std::cout << "  Operation Class: " << node.operation.op_class << std::endl;
+        std::cout << "  Operation Method: " << node.operation.method << std::endl;
+        std::cout << "  Assumptions:" << std::endl;
+        for (const auto& assump : node.assumptions) {
+            std::cout << "    - " << assump << std::endl;
+        }
+        std::cout << "  Input Checksum: " << node.input.checksum << std::endl;
+        std::cout << "  Output Checksum: " << node.output.checksum << std::endl;
+        std::cout << "  Output Data Class: " << node.output.data_class << std::endl;
+        std::cout << "  Environment: " << node.environment.language << "/" << node.environment.tool << " v" << node.environment.version << std::endl;
+        std::cout << "  Ontology Version: " << node.ontology_version << std::endl;
+    }
+    std::cout << "----------------------------------------" << std::endl;
+}
+
+/**
+ * @brief Implements the descendants command.
+ *
+ * Accepts a file (looked up in the index) or a trace ID, and streams every
+ * node derived from it, indented by depth, with its operation and output
+ * checksum: the blast radius of a faulty reference or input.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void descendants(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::string target = result["descendants"].as<std::string>();
+    TraceStorage& storage = session.storage();
+
+    std::string trace_id = target;
+    if (fs::is_regular_file(target)) {
+        try {
+            trace_id = lookup_trace_id(session.index(), target, result["hash"].as<std::string>(), checksum_cache_for(result, session));
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return;
+        }
+        if (trace_id.empty()) {
+            std::cout << "No provenance found for file: " << target << std::endl;
+            return;
+        }
+    } else {
+        std::string parent;
+        if (!storage.find_parent(trace_id, parent)) {
+            std::cerr << "Error: " << target << " is neither a file nor a known trace ID." << std::endl;
+            return;
+        }
+    }
+
+    std::vector<DescendantId> ids = resolve_descendant_ids(trace_id, session.root(), storage);
+    std::cout << "Descendants of " << target;
+    if (trace_id != target) {
+        std::cout << " (Trace ID: " << trace_id << ")";
+    }
+    std::cout << ":" << std::endl;
+    std::unordered_set<std::string> outputs;
+    for (const auto& id : ids) {
+        std::cout << std::string(2 * id.depth, ' ') << id.trace_id;
+        try {
+            TraceNode node = load_node(id.trace_id, session.root(), storage);
+            std::cout << "  " << node.operation.op_class << " / " << node.operation.method
+                      << "  output " << node.output.checksum << '\n';
+            outputs.insert(node.output.checksum);
+        } catch (const std::runtime_error& e) {
+            std::cout << "  [ERROR] " << e.what() << '\n';
+        }
+    }
+    std::cout << "----------------------------------------" << std::endl;
+    std::cout << ids.size() << " downstream trace nodes, " << outputs.size() << " distinct output checksums." << std::endl;
+}
+
+/**
+ * @brief Implements the query command.
+ *
+ * Brings the query index up to date with the node store and prints every
+ * matching node with its timestamp, operation and output checksum.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void query(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::string expression = result["query"].as<std::string>();
+    std::vector<std::string> trace_ids;
+    try {
+        trace_ids = session.query_index().query(expression, result["threads"].as<unsigned int>());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+    TraceStorage& storage = session.storage();
+    for (const auto& trace_id : trace_ids) {
+        std::cout << trace_id;
+        try {
+            TraceNode node = load_node(trace_id, session.root(), storage);
+            std::cout << "  " << node.timestamp << "  " << node.operation.op_class << " / " << node.operation.method
+                      << "  output " << node.output.checksum << '\n';
+        } catch (const std::runtime_error& e) {
+            std::cout << "  [ERROR] " << e.what() << '\n';
+        }
+    }
+    std::cout << "----------------------------------------" << std::endl;
+    std::cout << trace_ids.size() << " matching trace nodes." << std::endl;
+}
+
+/**
+ * @brief Prints one step of an aligned diff.
+ * @param marker '~' changed, '-' only in A, '+' only in B.
+ * @param label The step number, e.g. "3 (A)".
+ * @param node The step.
+ */
+static void print_diff_step(char marker, const std::string& label, const TraceNode& node) {
+    std::cout << marker << " Step " << label << ": " << node.operation.op_class << " / " << node.operation.method
+              << " (Trace ID: " << node.trace_id << ")" << std::endl;
+}
+
+/**
+ * @brief Prints a run of steps present in both lineages.
+ * @param first The first step of the run in lineage A, counted from 1.
+ * @param count The length of the run.
+ * @param what How the steps relate, e.g. "unchanged".
+ */
+static void print_diff_run(long first, size_t count, const char* what) {
+    if (count == 1) {
+        std::cout << "  Step " << first << ": " << what << std::endl;
+    } else {
+        std::cout << "  Steps " << first << "-" << first + static_cast<long>(count) - 1 << ": " << what << std::endl;
+    }
+}
+
+/**
+ * @brief Implements the diff command.
+ *
+ * With two files, aligns their provenance lineages on step signatures and
+ * prints the inserted, removed and changed steps. With a reference and more
+ * files (or `--diff-list`), diffs the reference against each of them and
+ * prints one summary line per file.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void diff(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::vector<std::string> files = result["diff"].as<std::vector<std::string>>();
+    if (result.count("diff-list")) {
+        try {
+            std::vector<std::string> listed = read_validation_list(result["diff-list"].as<std::string>());
+            files.insert(files.end(), listed.begin(), listed.end());
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return;
+        }
+    }
+    if (files.size() < 2) {
+        std::cerr << "Error: diff command requires at least two filepaths." << std::endl;
+        return;
+    }
+
+    // 1. Look up every file by checksum
+    const nlohmann::json& index_json = session.index();
+    std::vector<std::string> trace_ids(files.size());
+    std::vector<std::string> errors(files.size());
+    try {
+        std::string algorithm = result["hash"].as<std::string>();
+        ChecksumCache& checksum_cache = checksum_cache_for(result, session);
+        parallel_for(files.size(), result["threads"].as<unsigned int>(), [&](size_t i) {
+            try {
+                trace_ids[i] = lookup_trace_id(index_json, files[i], algorithm, checksum_cache);
+            } catch (const std::exception& e) {
+                errors[i] = e.what();
+            }
+        });
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+    if (!errors[0].empty() || (files.size() == 2 && !errors[1].empty())) {
+        std::cerr << "Error: " << (errors[0].empty() ? errors[1] : errors[0]) << std::endl;
+        return;
+    }
+    if (trace_ids[0].empty()) {
+        std::cout << "No provenance found for file A: " << files[0] << std::endl;
+        return;
+    }
+
+    LineageDiffer differ(session.root(), session.storage());
+
+    if (files.size() > 2) {
+        // 2. Batch: the reference lineage is loaded once for all files
+        std::vector<std::string> others;
+        for (size_t i = 1; i < files.size(); ++i) {
+            if (!trace_ids[i].empty()) {
+                others.push_back(trace_ids[i]);
+            }
+        }
+        std::vector<LineageDiff> diffs = differ.diff_many(trace_ids[0], others, result["threads"].as<unsigned int>());
+
+        std::cout << "--- Diffing Provenance against " << files[0] << " ---" << std::endl;
+        size_t next = 0;
+        size_t identical = 0, different = 0, untracked = 0;
+        for (size_t i = 1; i < files.size(); ++i) {
+            if (!errors[i].empty()) {
+                std::cout << "[ERROR] " << files[i] << ": " << errors[i] << std::endl;
+                ++different;
+                continue;
+            }
+            if (trace_ids[i].empty()) {
+                std::cout << "[UNTRACKED] " << files[i] << std::endl;
+                ++untracked;
+                continue;
+            }
+            const LineageDiff& d = diffs[next++];
+            if (!d.error.empty()) {
+                std::cout << "[ERROR] " << files[i] << ": " << d.error << std::endl;
+                ++different;
+            } else if (d.identical()) {
+                std::cout << "[SAME] " << files[i] << " (" << d.unchanged << " steps)" << std::endl;
+                ++identical;
+            } else {
+                std::cout << "[DIFF] " << files[i] << ": " << d.changed << " changed, " << d.removed
+                          << " removed, " << d.inserted << " inserted, " << d.unchanged << " unchanged" << std::endl;
+                ++different;
+            }
+        }
+        std::cout << "----------------------------------------" << std::endl;
+        std::cout << "Diffed " << files.size() - 1 << " files: " << identical << " with the same steps, "
+                  << different << " different or unreadable, " << untracked << " without provenance." << std::endl;
+        return;
+    }
+
+    if (trace_ids[1].empty()) {
+        std::cout << "No provenance found for file B: " << files[1] << std::endl;
+        return;
+    }
+
+    // 2. Align the two lineages
+    LineageDiff d;
+    try {
+        d = differ.diff(trace_ids[0], trace_ids[1]);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error resolving lineage: " << e.what() << std::endl;
+        return;
+    }
+
+    std::cout << "--- Diffing Provenance ---" << std::endl;
+    std::cout << "File A: " << files[0] << " (" << d.lineage_a.size() << " steps)" << std::endl;
+    std::cout << "File B: " << files[1] << " (" << d.lineage_b.size() << " steps)" << std::endl;
+    std::cout << std::endl;
+    if (d.shared_ancestors > 0) {
+        print_diff_run(1, d.shared_ancestors, "shared ancestry");
+    }
+
+    // Runs of unchanged steps are collapsed to one line, numbered as in A
+    size_t run = 0;
+    auto flush_run = [&](long next_a) {
+        if (run > 0) {
+            print_diff_run(next_a - static_cast<long>(run) + 1, run, "unchanged");
+            run = 0;
+        }
+    };
+    long position_a = static_cast<long>(d.shared_ancestors);
+    for (const auto& step : d.steps) {
+        if (step.change == StepChange::Unchanged) {
+            ++run;
+            ++position_a;
+            continue;
+        }
+        flush_run(position_a);
+        switch (step.change) {
+            case StepChange::Changed: {
+                const TraceNode& node_a = differ.node(d.lineage_a[step.index_a]);
+                const TraceNode& node_b = differ.node(d.lineage_b[step.index_b]);
+                print_diff_step('~', std::to_string(step.index_a + 1) + " (A) / " + std::to_string(step.index_b + 1) + " (B)", node_a);
+                for (const auto& field : step.fields) {
+                    if (field == "operation.method") {
+                        std::cout << "      Operation Method: A='" << node_a.operation.method << "', B='" << node_b.operation.method << "'" << std::endl;
+                    } else {
+                        std::cout << "      " << field << " differs" << std::endl;
+                    }
+                }
+                ++position_a;
+                break;
+            }
+            case StepChange::Removed:
+                print_diff_step('-', std::to_string(step.index_a + 1) + " (A)", differ.node(d.lineage_a[step.index_a]));
+                ++position_a;
+                break;
+            case StepChange::Inserted:
+                print_diff_step('+', std::to_string(step.index_b + 1) + " (B)", differ.node(d.lineage_b[step.index_b]));
+                break;
+            case StepChange::Unchanged:
+                break;
+        }
+    }
+    flush_run(position_a);
+
+    std::cout << "\n" << d.changed << " changed, " << d.removed << " only in A, " << d.inserted
+              << " only in B, " << d.unchanged << " unchanged." << std::endl;
+    std::cout << "----------------------------------------" << std::endl;
+}
+
+/**
+ * @brief Implements the overlap command.
+ *
+ * Splits the file into content-defined chunks (see `chunk_file`) and
+ * measures how many of its bytes lie in chunks that also occur in the second
+ * file, or, with a single file, in each traced file whose chunk list was
+ * stored by `--hash sha256-cdc`.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void overlap(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::vector<std::string> files = result["overlap"].as<std::vector<std::string>>();
+    if (files.empty() || files.size() > 2) {
+        std::cerr << "Error: overlap command requires one or two filepaths." << std::endl;
+        return;
+    }
+    ChecksumCache& checksum_cache = checksum_cache_for(result, session);
+
+    ChunkList chunks;
+    ChunkList other;
+    try {
+        chunks = checksum_cache.chunks(files[0]);
+        if (files.size() == 2) {
+            other = checksum_cache.chunks(files[1]);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    auto print_overlap = [](const ChunkOverlap& o) {
+        std::cout << o.shared_bytes << " of " << o.total_bytes << " bytes (" << std::fixed << std::setprecision(1)
+                  << 100.0 * o.fraction() << "%), " << o.shared_chunks << " of " << o.total_chunks << " chunks";
+    };
+
+    if (files.size() == 2) {
+        std::cout << files[0] << ": ";
+        print_overlap(chunk_overlap(chunks, other));
+        std::cout << " also occur in " << files[1] << std::endl;
+        return;
+    }
+
+    // Compare against every traced file version whose chunks are stored
+    const nlohmann::json& index_json = session.index();
+    const std::string own_checksum = chunks.checksum();
+    std::vector<std::pair<std::string, ChunkOverlap>> matches;
+    for (const auto& checksum : checksum_cache.stored_chunk_checksums()) {
+        ChunkList traced;
+        if (checksum == own_checksum || !index_json.contains(checksum) || !checksum_cache.stored_chunks(checksum, traced)) {
+            continue;
+        }
+        ChunkOverlap o = chunk_overlap(chunks, traced);
+        if (o.shared_chunks > 0) {
+            matches.emplace_back(index_json[checksum].get<std::string>(), o);
+        }
+    }
+    std::sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) {
+        return a.second.shared_bytes > b.second.shared_bytes;
+    });
+
+    std::cout << "--- Content Overlap: " << files[0] << " (" << chunks.size << " bytes, " << chunks.chunks.size()
+              << " chunks) ---" << std::endl;
+    if (index_json.contains(own_checksum)) {
+        std::cout << "Identical to traced content (Trace ID: " << index_json[own_checksum].get<std::string>() << ")" << std::endl;
+    }
+    for (const auto& match : matches) {
+        std::cout << "Trace ID: " << match.first << ": ";
+        print_overlap(match.second);
+        std::cout << " shared" << std::endl;
+    }
+    if (matches.empty()) {
+        std::cout << "No overlap with other traced files hashed with --hash " << kSha256CdcAlgorithm << "." << std::endl;
+    }
+    std::cout << "----------------------------------------" << std::endl;
+}
+
+/**
+ * @brief Implements the validate command.
+ *
+ * Validates the provenance chain of a specified file against the defined
+ * ontologies and checks for lineage integrity.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void validate(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::string filepath = result["validate"].as<std::string>();
+
+    // 1. Load index.json and look up the trace_id by the file's checksum
+    const nlohmann::json& index_json = session.index();
+
+    std::string latest_trace_id;
+    try {
+        ChecksumCache& checksum_cache = checksum_cache_for(result, session);
+        latest_trace_id = lookup_trace_id(index_json, filepath, result["hash"].as<std::string>(), checksum_cache);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    if (latest_trace_id.empty()) {
+        std::cout << "No provenance found for file: " << filepath << std::endl;
+        return;
+    }
+
+    // 3. Load ontology
+    const Ontology* ontology = nullptr;
+    try {
+        // Kept in memory by a long-lived session until the YAML ontologies change
+        ontology = &session.ontology();
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error loading ontology: " << e.what() << std::endl;
+        return;
+    }
+
+    // 4. Resolve lineage
+    std::vector<TraceNode> lineage = resolve_lineage(latest_trace_id, session.root(), session.storage());
+
+    if (lineage.empty()) {
+        std::cout << "No lineage found for file: " << filepath << std::endl;
+        return;
+    }
+
+    bool all_valid = true;
+    std::string prev_trace_id = ""; // To check parent-child link
+
+    for (size_t i = 0; i < lineage.size(); ++i) {
+        const auto& node = lineage[i];
+        std::cout << "Validating Step " << i + 1 << " (Trace ID: " << node.trace_id << "): ";
+
+        // 5. Validate node against ontology and schema
+        if (!validate_node(node, *ontology)) {
+            all_valid = false;
+            std::cout << "[FAILED]" << std::endl;
+            // Error messages are printed by validate_node
+        } else {
+            std::cout << "[PASSED]" << std::endl;
+        }
+
+        // 6. Check lineage integrity
+        if (i > 0) {
+            if (node.parent != prev_trace_id) {
+                all_valid = false;
+                std::cout << "  [FAILED] Lineage integrity check: Parent ID mismatch. Expected '"
+                          << prev_trace_id << "', got '" << node.parent << "'" << std::endl;
+            }
+        }
+        prev_trace_id = node.trace_id;
+    }
+
+    if (all_valid) {
+        std::cout << "\nValidation successful for " << filepath << ": All trace nodes and lineage are valid." << std::endl;
+    } else {
+        std::cout << "\nValidation failed for " << filepath << ": Issues found in trace nodes or lineage." << std::endl;
+    }
+}
+
+/**
+ * @brief Implements --validate <directory> and --validate-list <file>.
+ *
+ * Hashes and validates all files on a thread pool, checking every shared
+ * ancestor node once, and prints the failures followed by a summary.
+ *
+ * @param result The parsed command-line arguments.
+ * @param session The project session.
+ */
+static void validate_many(const cxxopts::ParseResult& result, ProjectSession& session) {
+    std::vector<std::string> files;
+    try {
+        if (result.count("validate-list")) {
+            files = read_validation_list(result["validate-list"].as<std::string>());
+        } else {
+            files = collect_validation_files(result["validate"].as<std::string>());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    const Ontology* ontology = nullptr;
+    try {
+        // Kept in memory by a long-lived session until the YAML ontologies change
+        ontology = &session.ontology();
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error loading ontology: " << e.what() << std::endl;
+        return;
+    }
+
+    ValidationReport report;
+    try {
+        report = validate_files(files, session.index(), *ontology, checksum_cache_for(result, session),
+                                result["hash"].as<std::string>(), session.storage(), session.root(),
+                                result["threads"].as<unsigned int>());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return;
+    }
+
+    for (const auto& file : report.files) {
+        if (file.trace_id.empty() && file.error.empty()) {
+            std::cout << "[UNTRACKED] " << file.filepath << std::endl;
+        } else if (!file.valid) {
+            std::cout << "[FAILED] " << file.filepath;
+            if (!file.failed_trace_id.empty()) {
+                std::cout << " (Trace ID: " << file.failed_trace_id << ")";
+            }
+            std::cout << ": " << file.error << std::endl;
+        }
+    }
+    std::cout << "----------------------------------------" << std::endl;
+    std::cout << "Validated " << report.files.size() << " files: " << report.passed << " passed, "
+              << report.failed << " failed, " << report.untracked << " without provenance ("
+              << report.nodes_checked << " distinct trace nodes checked)." << std::endl;
+}
@@ -0,0 +1,56 @@
+#ifndef COMMANDS_HPP
+#define COMMANDS_HPP
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "session.hpp"
+
+/**
+ * @brief Retrieves the root path of the project.
+ *
+ * This function attempts to determine the project's root directory by
+ * locating a "cpp/CMakeLists.txt" file, traversing up from the executable's
+ * location. It handles platform-specific methods for obtaining the
+ * executable's path.
+ *
+ * @param argv0 The first command-line argument (path to the executable).
+ * @return A `std::filesystem::path` object representing the project root.
+ */
+std::filesystem::path get_project_root_path(const char* argv0);
+
+/**
+ * @brief Parses a traceseq command line and runs the selected command.
+ *
+ * This is the whole command-line interface minus process setup, shared by
+ * the `traceseq` executable and the `traceseqd` daemon. Output is written to
+ * `std::cout` and errors to `std::cerr`; relative paths are resolved against
+ * the current working directory.
+ *
+ * @param args The command-line arguments, including the program name.
+ * @param session The project session to run the command against.
+ * @return The process exit status.
+ */
+int run_command(const std::vector<std::string>& args, ProjectSession& session);
+
+/**
+ * @brief Hashes the files a command line names before it is handed to `traceseqd`.
+ *
+ * The daemon serves one request at a time, so it must not spend that time
+ * reading files. Commands that hash many files or bytes (`--annotate-batch`,
+ * `--validate-list`, `--validate` of a directory, `--diff-list`,
+ * `--overlap`, `--gc-files`) or read standard input are left to run
+ * in-process on the caller's cores. For any other command the files it
+ * hashes (given to `--annotate`, `--explain`, `--validate`, `--diff` or
+ * `--descendants`) are hashed here, through the session's checksum cache,
+ * and the checksums are pinned in the session as well, so the command does
+ * not hash them again if no daemon answers.
+ *
+ * @param args The command-line arguments, including the program name.
+ * @param session The caller's project session.
+ * @param checksums Filled with the checksums to send with the request.
+ * @return false if the command must run in-process.
+ */
+bool prepare_daemon_request(const std::vector<std::string>& args, ProjectSession& session, std::vector<PinnedChecksum>& checksums);
+
+#endif // COMMANDS_HPP
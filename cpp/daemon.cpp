@@ -0,0 +1,182 @@
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "commands.hpp"
+#include "daemon_protocol.hpp"
+#include "session.hpp"
+#include "nlohmann/json.hpp"
+
+namespace fs = std::filesystem;
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+// How long a client may take to send its request or read the reply before
+// the daemon drops it and moves on to the next one
+static const int kClientTimeoutSeconds = 5;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+/**
+ * @brief Runs one request against the warm session.
+ *
+ * Requests are served one at a time, so the process-wide working directory
+ * and standard streams can be pointed at the request for its duration.
+ *
+ * @param request The decoded request (`cwd`, `args` and `checksums`).
+ * @param session The project session kept alive by the daemon.
+ * @return The reply to send back.
+ */
+static nlohmann::json serve_request(const nlohmann::json& request, ProjectSession& session) {
+    nlohmann::json reply;
+    std::ostringstream out;
+    std::ostringstream err;
+    int status = 1;
+
+    if (!request.is_object() || !request.contains("args") || !request["args"].is_array()) {
+        err << "Error: malformed traceseqd request" << std::endl;
+    } else if (::chdir(request.value("cwd", "/").c_str()) != 0) {
+        err << "Error: cannot enter working directory " << request.value("cwd", "") << std::endl;
+    } else {
+        std::streambuf* cout_buf = std::cout.rdbuf(out.rdbuf());
+        std::streambuf* cerr_buf = std::cerr.rdbuf(err.rdbuf());
+        // The client hashed the files the command names, so the daemon only looks them up
+        session.pin_checksums(decode_checksums(request.value("checksums", nlohmann::json::array())));
+        try {
+            status = run_command(request["args"].get<std::vector<std::string>>(), session);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        session.clear_pinned_checksums();
+        std::cout.rdbuf(cout_buf);
+        std::cerr.rdbuf(cerr_buf);
+    }
+
+    reply["status"] = status;
+    reply["stdout"] = out.str();
+    reply["stderr"] = err.str();
+    return reply;
+}
+
+/**
+ * @brief Binds the project's daemon socket.
+ * @param socket_path The socket path from `daemon_socket_path`.
+ * @return The listening socket, or -1 if another daemon is running or binding failed.
+ */
+static int listen_on(const fs::path& socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (fs::exists(socket_path)) {
+        int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        bool running = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe >= 0) {
+            ::close(probe);
+        }
+        if (running) {
+            std::cerr << "Error: traceseqd is already running on " << socket_path.string() << std::endl;
+            return -1;
+        }
+        fs::remove(socket_path); // Left behind by a daemon that did not exit cleanly
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "Error: cannot create socket: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    // Only the owner may run commands through the daemon
+    mode_t old_mask = ::umask(0077);
+    int rc = ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    ::umask(old_mask);
+    if (rc != 0 || ::listen(fd, 64) != 0) {
+        std::cerr << "Error: cannot listen on " << socket_path.string() << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int, char** argv) {
+    fs::path project_root = get_project_root_path(argv[0]);
+    fs::create_directories(project_root / ".traceseq");
+    fs::path socket_path = daemon_socket_path(project_root);
+    if (socket_path.parent_path() != project_root / ".traceseq") {
+        try {
+            ensure_private_directory(socket_path.parent_path());
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    int listen_fd = listen_on(socket_path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    // No SA_RESTART, so a signal interrupts accept() and ends the loop
+    struct sigaction action{};
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    ProjectSession session(project_root);
+    std::cerr << "traceseqd serving " << project_root.string() << " on " << socket_path.string() << std::endl;
+
+    int exit_status = 0;
+    bool starved = false;
+    while (!stop_requested) {
+        int client_fd = ::accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+                continue; // Interrupted by a signal, or the client gave up
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // Out of descriptors or memory: the pending connection stays
+                // queued, so wait for resources instead of spinning on it
+                if (!starved) {
+                    std::cerr << "traceseqd: accept: " << std::strerror(errno) << ", retrying" << std::endl;
+                    starved = true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            std::cerr << "Error: traceseqd cannot accept connections: " << std::strerror(errno) << std::endl;
+            exit_status = 1;
+            break;
+        }
+        starved = false;
+        timeval timeout{};
+        timeout.tv_sec = kClientTimeoutSeconds;
+        ::setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        std::string message;
+        if (peer_is_current_user(client_fd) && read_frame(client_fd, message)) {
+            nlohmann::json request = nlohmann::json::parse(message, nullptr, false);
+            write_frame(client_fd, serve_request(request, session).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+        }
+        ::close(client_fd);
+    }
+
+    ::close(listen_fd);
+    fs::remove(socket_path);
+    return exit_status;
+}
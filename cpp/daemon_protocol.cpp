@@ -0,0 +1,189 @@
+#include "daemon_protocol.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Requests and replies are small; anything larger is a corrupt stream
+static const uint32_t kMaxFrameBytes = 64u * 1024 * 1024;
+
+fs::path daemon_socket_path(const fs::path& project_root) {
+    fs::path socket_path = project_root / ".traceseq" / "traceseqd.sock";
+    if (socket_path.string().size() < sizeof(sockaddr_un::sun_path)) {
+        return socket_path;
+    }
+    // FNV-1a of the project root gives a stable, short per-project name
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : project_root.string()) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char name[48];
+    std::snprintf(name, sizeof(name), "traceseqd-%016llx.sock", static_cast<unsigned long long>(hash));
+    // A shared directory would let another user bind the name first
+    const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && fs::path(runtime_dir).is_absolute()) {
+        return fs::path(runtime_dir) / "traceseq" / name;
+    }
+    return fs::temp_directory_path() / ("traceseq-" + std::to_string(::geteuid())) / name;
+}
+
+void ensure_private_directory(const fs::path& directory) {
+    if (::mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Could not create directory: " + directory.string() + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (::lstat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        throw std::runtime_error("Not a directory: " + directory.string());
+    }
+    if (st.st_uid != ::geteuid() || (st.st_mode & 077) != 0) {
+        throw std::runtime_error("Directory is not private to the current user: " + directory.string());
+    }
+}
+
+bool peer_is_current_user(int fd) {
+    ucred credentials{};
+    socklen_t length = sizeof(credentials);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0 || length != sizeof(credentials)) {
+        return false;
+    }
+    return credentials.uid == ::geteuid();
+}
+
+static bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool read_all(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::recv(fd, data, length, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_frame(int fd, const std::string& message) {
+    if (message.size() > kMaxFrameBytes) {
+        return false;
+    }
+    char header[4];
+    uint32_t length = static_cast<uint32_t>(message.size());
+    for (int i = 0; i < 4; ++i) {
+        header[i] = static_cast<char>(length >> (8 * i));
+    }
+    return write_all(fd, header, sizeof(header)) && write_all(fd, message.data(), message.size());
+}
+
+bool read_frame(int fd, std::string& message) {
+    unsigned char header[4];
+    if (!read_all(fd, reinterpret_cast<char*>(header), sizeof(header))) {
+        return false;
+    }
+    uint32_t length = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<uint32_t>(header[3]) << 24);
+    if (length > kMaxFrameBytes) {
+        return false;
+    }
+    message.assign(length, '\0');
+    return read_all(fd, &message[0], length);
+}
+
+nlohmann::json encode_checksums(const std::vector<PinnedChecksum>& checksums) {
+    nlohmann::json encoded = nlohmann::json::array();
+    for (const auto& pinned : checksums) {
+        const FileIdentity& identity = pinned.identity;
+        encoded.push_back({{"device", identity.device}, {"inode", identity.inode}, {"size", identity.size},
+                           {"mtime_ns", identity.mtime_ns}, {"ctime_ns", identity.ctime_ns},
+                           {"algorithm", pinned.algorithm}, {"checksum", pinned.checksum}});
+    }
+    return encoded;
+}
+
+std::vector<PinnedChecksum> decode_checksums(const nlohmann::json& encoded) {
+    std::vector<PinnedChecksum> checksums;
+    if (!encoded.is_array()) {
+        return checksums;
+    }
+    for (const auto& entry : encoded) {
+        try {
+            PinnedChecksum pinned;
+            pinned.identity.device = entry.at("device").get<uint64_t>();
+            pinned.identity.inode = entry.at("inode").get<uint64_t>();
+            pinned.identity.size = entry.at("size").get<uint64_t>();
+            pinned.identity.mtime_ns = entry.at("mtime_ns").get<int64_t>();
+            pinned.identity.ctime_ns = entry.at("ctime_ns").get<int64_t>();
+            pinned.algorithm = entry.at("algorithm").get<std::string>();
+            pinned.checksum = entry.at("checksum").get<std::string>();
+            checksums.push_back(std::move(pinned));
+        } catch (const nlohmann::json::exception&) {
+            continue; // Malformed entry; the daemon hashes that file itself
+        }
+    }
+    return checksums;
+}
+
+bool forward_to_daemon(const fs::path& project_root, const std::vector<std::string>& args,
+                       const std::vector<PinnedChecksum>& checksums, DaemonReply& reply) {
+    fs::path socket_path = daemon_socket_path(project_root);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd); // No daemon (or a stale socket); run in-process
+        return false;
+    }
+    if (!peer_is_current_user(fd)) {
+        ::close(fd); // Not our daemon; never hand it the request
+        return false;
+    }
+
+    nlohmann::json request;
+    request["cwd"] = fs::current_path().string();
+    request["args"] = args;
+    request["checksums"] = encode_checksums(checksums);
+    if (!write_frame(fd, request.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace))) {
+        ::close(fd);
+        return false; // The daemon went away before reading the request
+    }
+
+    std::string message;
+    bool answered = read_frame(fd, message);
+    ::close(fd);
+    nlohmann::json response = answered ? nlohmann::json::parse(message, nullptr, false) : nlohmann::json();
+    if (!response.is_object()) {
+        throw std::runtime_error("traceseqd did not answer the request: " + socket_path.string());
+    }
+    reply.status = response.value("status", 1);
+    reply.out = response.value("stdout", "");
+    reply.err = response.value("stderr", "");
+    return true;
+}
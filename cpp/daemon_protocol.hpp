@@ -0,0 +1,102 @@
+#ifndef DAEMON_PROTOCOL_HPP
+#define DAEMON_PROTOCOL_HPP
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "checksum_cache.hpp"
+#include "nlohmann/json.hpp"
+
+/**
+ * @brief The outcome of a command run by the daemon.
+ */
+struct DaemonReply {
+    int status = 0;         ///< The command's exit status.
+    std::string out;        ///< Everything the command wrote to standard output.
+    std::string err;        ///< Everything the command wrote to standard error.
+};
+
+/**
+ * @brief Returns the Unix domain socket the project's daemon listens on.
+ *
+ * This is '.traceseq/traceseqd.sock' unless that path is too long for a
+ * socket address, in which case a per-project name is used in a directory
+ * private to the user: '$XDG_RUNTIME_DIR/traceseq' if that variable is set,
+ * otherwise 'traceseq-<uid>' in the temporary directory.
+ *
+ * @param project_root The root directory of the project.
+ * @return The socket path.
+ */
+std::filesystem::path daemon_socket_path(const std::filesystem::path& project_root);
+
+/**
+ * @brief Creates a directory only the current user can enter, or checks an existing one.
+ *
+ * The daemon calls this for the directory of a socket outside the project,
+ * so another user cannot create the socket first or replace it.
+ *
+ * @param directory The directory; its parent must exist.
+ * @throws std::runtime_error if the directory cannot be created, is not a
+ *         directory (a symlink is refused), belongs to another user or is
+ *         accessible to the group or others.
+ */
+void ensure_private_directory(const std::filesystem::path& directory);
+
+/**
+ * @brief Checks that the process at the other end of a Unix socket runs as the current user.
+ * @param fd The connected socket.
+ * @return false if the peer's user differs or cannot be determined.
+ */
+bool peer_is_current_user(int fd);
+
+/**
+ * @brief Writes one length-prefixed message (u32 LE length, then the bytes).
+ * @param fd The connected socket.
+ * @param message The message bytes.
+ * @return false if the peer went away.
+ */
+bool write_frame(int fd, const std::string& message);
+
+/**
+ * @brief Reads one length-prefixed message.
+ * @param fd The connected socket.
+ * @param message Filled with the message bytes.
+ * @return false on end of stream, a read error or an oversized frame.
+ */
+bool read_frame(int fd, std::string& message);
+
+/**
+ * @brief Encodes checksums computed by the client for a request's `checksums` field.
+ * @param checksums The checksums.
+ * @return A JSON array with one object per checksum.
+ */
+nlohmann::json encode_checksums(const std::vector<PinnedChecksum>& checksums);
+
+/**
+ * @brief Decodes a request's `checksums` field.
+ * @param encoded The field, as written by `encode_checksums`.
+ * @return The checksums; malformed entries are skipped.
+ */
+std::vector<PinnedChecksum> decode_checksums(const nlohmann::json& encoded);
+
+/**
+ * @brief Runs a command line in the project's daemon, if one is running.
+ *
+ * The request carries the arguments and the caller's working directory so
+ * relative paths resolve as they would in-process, and the checksums the
+ * caller already computed for the files the command hashes. Nothing is sent to a
+ * socket whose owner is not the current user (see `peer_is_current_user`).
+ *
+ * @param project_root The root directory of the project.
+ * @param args The command-line arguments, including the program name.
+ * @param checksums Checksums for the daemon to pin while it runs the command (see `ChecksumCache::pin`).
+ * @param reply Filled with the command's exit status and output.
+ * @return false if no daemon of the current user accepted the connection;
+ *         the caller should then run the command itself.
+ * @throws std::runtime_error if the daemon accepted the request but did not
+ *         answer it. The command may have run, so it must not be retried.
+ */
+bool forward_to_daemon(const std::filesystem::path& project_root, const std::vector<std::string>& args,
+                       const std::vector<PinnedChecksum>& checksums, DaemonReply& reply);
+
+#endif // DAEMON_PROTOCOL_HPP
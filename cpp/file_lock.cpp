@@ -0,0 +1,46 @@
+#include "file_lock.hpp"
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+FileLock::FileLock(const fs::path& lock_path, Mode mode) {
+    fs::create_directories(lock_path.parent_path());
+    fd_ = ::open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Could not open lock file: " + lock_path.string());
+    }
+    int operation = mode == Mode::Exclusive ? LOCK_EX : LOCK_SH;
+    while (::flock(fd_, operation) != 0) {
+        if (errno != EINTR) {
+            ::close(fd_);
+            throw std::runtime_error("Could not lock: " + lock_path.string());
+        }
+    }
+}
+
+FileLock::~FileLock() {
+    if (fd_ >= 0) {
+        ::flock(fd_, LOCK_UN);
+        ::close(fd_);
+    }
+}
+
+fs::path index_lock_path(const fs::path& project_root) {
+    return project_root / ".traceseq" / "index.lock";
+}
+
+void sync_directory(const fs::path& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open directory: " + directory.string());
+    }
+    int rc = ::fsync(fd);
+    ::close(fd);
+    if (rc != 0) {
+        throw std::runtime_error("Could not sync directory: " + directory.string());
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef FILE_LOCK_HPP
+#define FILE_LOCK_HPP
+
+#include <filesystem>
+
+/**
+ * @brief RAII advisory lock on a lock file shared by cooperating processes.
+ *
+ * Uses `flock`, which locks the open file description: two locks taken in
+ * the same process through different `FileLock` objects conflict exactly
+ * like locks held by different processes. Callers must therefore not nest
+ * locks on the same file.
+ */
+class FileLock {
+public:
+    /// Lock modes; many shared holders or one exclusive holder.
+    enum class Mode { Shared, Exclusive };
+
+    /**
+     * @brief Opens (creating if needed) the lock file and blocks until the lock is granted.
+     * @param lock_path The lock file to use.
+     * @param mode Whether to take a shared or an exclusive lock.
+     * @throws std::runtime_error if the lock file cannot be opened or locked.
+     */
+    FileLock(const std::filesystem::path& lock_path, Mode mode);
+
+    /// Releases the lock.
+    ~FileLock();
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+    int fd_ = -1;
+};
+
+/**
+ * @brief Returns the lock file guarding the index snapshot and its log.
+ * @param project_root The root directory of the project.
+ * @return The path of '.traceseq/index.lock'.
+ */
+std::filesystem::path index_lock_path(const std::filesystem::path& project_root);
+
+/**
+ * @brief Flushes a directory's entries to disk.
+ *
+ * A file created in or renamed into a directory is only durable once the
+ * directory itself has been synced.
+ *
+ * @param directory The directory to sync.
+ * @throws std::runtime_error if the directory cannot be opened or synced.
+ */
+void sync_directory(const std::filesystem::path& directory);
+
+#endif // FILE_LOCK_HPP
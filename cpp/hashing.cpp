@@ -1,34 +1,1059 @@
+#include "hashing.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <future>
 #include <iomanip>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Helper to render a digest as lowercase hex
+static std::string to_hex(const unsigned char* digest, size_t length) {
+    std::stringstream ss;
+    for (size_t i = 0; i < length; i++) {
+        ss << std::hex << std::setw(2) << std::setfill('0') << (int)digest[i];
+    }
+    return ss.str();
+}
+
+namespace {
+
+// Incremental digest behind every streaming checksum algorithm
+class StreamHasher {
+public:
+    virtual ~StreamHasher() = default;
+    virtual void update(const char* data, size_t length) = 0;
+    virtual std::string final_hex() = 0;
+};
+
+// An EVP digest context. Every digest in this file goes through EVP; the
+// SHA256_* functions are deprecated since OpenSSL 3.0.
+class EvpDigest {
+public:
+    EvpDigest(const EVP_MD* md, const char* unavailable) : ctx_(EVP_MD_CTX_new()), md_(md) {
+        if (!ctx_ || !md_ || EVP_DigestInit_ex(ctx_, md_, nullptr) != 1) {
+            EVP_MD_CTX_free(ctx_);
+            throw std::runtime_error(unavailable);
+        }
+    }
+    ~EvpDigest() { EVP_MD_CTX_free(ctx_); }
+    EvpDigest(const EvpDigest&) = delete;
+    EvpDigest& operator=(const EvpDigest&) = delete;
+
+    void update(const void* data, size_t length) { EVP_DigestUpdate(ctx_, data, length); }
+
+    // Writes the digest and starts a new one; returns its length
+    unsigned int final(unsigned char* digest) {
+        unsigned int length = 0;
+        EVP_DigestFinal_ex(ctx_, digest, &length);
+        EVP_DigestInit_ex(ctx_, md_, nullptr);
+        return length;
+    }
+
+private:
+    EVP_MD_CTX* ctx_;
+    const EVP_MD* md_;
+};
+
+// A SHA256 context
+class Sha256Digest : public EvpDigest {
+public:
+    Sha256Digest() : EvpDigest(EVP_sha256(), "SHA256 is not available in this OpenSSL build.") {}
+};
+
+// SHA256 of one buffer
+void sha256_digest(const void* data, size_t length, unsigned char* digest) {
+    if (EVP_Digest(data, length, digest, nullptr, EVP_sha256(), nullptr) != 1) {
+        throw std::runtime_error("SHA256 is not available in this OpenSSL build.");
+    }
+}
+
+// Any EVP digest as a streaming checksum
+class EvpHasher : public StreamHasher {
+public:
+    EvpHasher(const EVP_MD* md, const char* unavailable) : digest_(md, unavailable) {}
+    void update(const char* data, size_t length) override { digest_.update(data, length); }
+    std::string final_hex() override {
+        unsigned char hash[EVP_MAX_MD_SIZE];
+        unsigned int length = digest_.final(hash);
+        return to_hex(hash, length);
+    }
+
+private:
+    EvpDigest digest_;
+};
+
+// XXH64 with seed 0, rendered big-endian like the reference xxhsum tool.
+// Non-cryptographic: it detects accidental changes, not deliberate ones.
+class Xxh64Hasher : public StreamHasher {
+public:
+    Xxh64Hasher() {
+        acc_[0] = kPrime1 + kPrime2;
+        acc_[1] = kPrime2;
+        acc_[2] = 0;
+        acc_[3] = 0 - kPrime1;
+    }
+
+    void update(const char* data, size_t length) override {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        total_ += length;
+        if (buffered_ + length < 32) {
+            std::memcpy(buffer_ + buffered_, p, length);
+            buffered_ += length;
+            return;
+        }
+        if (buffered_ > 0) {
+            size_t fill = 32 - buffered_;
+            std::memcpy(buffer_ + buffered_, p, fill);
+            consume_stripe(buffer_);
+            p += fill;
+            length -= fill;
+            buffered_ = 0;
+        }
+        // Accumulators in locals: the input pointer may alias the members
+        uint64_t v1 = acc_[0], v2 = acc_[1], v3 = acc_[2], v4 = acc_[3];
+        while (length >= 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+            length -= 32;
+        }
+        acc_[0] = v1;
+        acc_[1] = v2;
+        acc_[2] = v3;
+        acc_[3] = v4;
+        std::memcpy(buffer_, p, length);
+        buffered_ = length;
+    }
+
+    std::string final_hex() override {
+        uint64_t h = value();
+        unsigned char digest[8];
+        for (int b = 0; b < 8; ++b) {
+            digest[b] = static_cast<unsigned char>(h >> (56 - 8 * b));
+        }
+        return to_hex(digest, sizeof(digest));
+    }
+
+    uint64_t value() const {
+        uint64_t h;
+        if (total_ >= 32) {
+            h = rotl(acc_[0], 1) + rotl(acc_[1], 7) + rotl(acc_[2], 12) + rotl(acc_[3], 18);
+            for (uint64_t acc : acc_) {
+                h = (h ^ round(0, acc)) * kPrime1 + kPrime4;
+            }
+        } else {
+            h = kPrime5;
+        }
+        h += total_;
+
+        const unsigned char* p = buffer_;
+        size_t length = buffered_;
+        while (length >= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * kPrime1 + kPrime4;
+            p += 8;
+            length -= 8;
+        }
+        if (length >= 4) {
+            h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+            h = rotl(h, 23) * kPrime2 + kPrime3;
+            p += 4;
+            length -= 4;
+        }
+        while (length > 0) {
+            h ^= (*p) * kPrime5;
+            h = rotl(h, 11) * kPrime1;
+            ++p;
+            --length;
+        }
+        h ^= h >> 33;
+        h *= kPrime2;
+        h ^= h >> 29;
+        h *= kPrime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * kPrime2, 31) * kPrime1; }
+    static uint64_t read64(const unsigned char* p) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        return v;
+    }
+    static uint32_t read32(const unsigned char* p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+               (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+    void consume_stripe(const unsigned char* p) {
+        for (int lane = 0; lane < 4; ++lane) {
+            acc_[lane] = round(acc_[lane], read64(p + 8 * lane));
+        }
+    }
+
+    uint64_t acc_[4];
+    unsigned char buffer_[32];
+    size_t buffered_ = 0;
+    uint64_t total_ = 0;
+};
+
+// Returns the streaming hasher of an algorithm, or nullptr for the chunked
+// algorithms (sha256-tree, sha256-cdc)
+std::unique_ptr<StreamHasher> make_stream_hasher(const std::string& algorithm) {
+    if (algorithm == kSha256Algorithm) {
+        return std::make_unique<EvpHasher>(EVP_sha256(), "SHA256 is not available in this OpenSSL build.");
+    }
+    if (algorithm == kBlake2bAlgorithm) {
+        return std::make_unique<EvpHasher>(EVP_blake2b512(), "BLAKE2b is not available in this OpenSSL build.");
+    }
+    if (algorithm == kXxh64Algorithm) {
+        return std::make_unique<Xxh64Hasher>();
+    }
+    if (algorithm == kSha256TreeAlgorithm || algorithm == kSha256CdcAlgorithm) {
+        return nullptr;
+    }
+    throw std::invalid_argument("Unknown checksum algorithm: " + algorithm);
+}
+
+// Untagged for sha256, "<algorithm>:<hex>" for everything else
+std::string tag_checksum(const std::string& algorithm, const std::string& hex) {
+    return algorithm == kSha256Algorithm ? hex : algorithm + ":" + hex;
+}
+
+} // namespace
 
 std::string sha256_file(const std::string& path) {
+    ProfileSpan span("sha256_file");
+    span.set_detail(path);
     std::ifstream file(path, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file for hashing.");
     }
 
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-
+    Sha256Digest sha256;
     const int bufSize = 32768;
-    char* buffer = new char[bufSize];
+    std::vector<char> buffer(bufSize);
 
+    int64_t total = 0;
     while (file.good()) {
-        file.read(buffer, bufSize);
-        SHA256_Update(&sha256, buffer, file.gcount());
+        file.read(buffer.data(), bufSize);
+        sha256.update(buffer.data(), static_cast<size_t>(file.gcount()));
+        total += file.gcount();
     }
 
-    SHA256_Final(hash, &sha256);
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    sha256.final(hash);
+    span.set_value("bytes", total);
+    Profiler::count("bytes_hashed", total);
+    return to_hex(hash, SHA256_DIGEST_LENGTH);
+}
 
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+std::vector<std::string> sha256_files(const std::vector<std::string>& paths, unsigned int num_threads) {
+    std::vector<std::string> checksums(paths.size());
+    parallel_for(paths.size(), num_threads, [&](size_t i) {
+        try {
+            checksums[i] = sha256_file(paths[i]);
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(paths[i] + ": " + e.what());
+        }
+    });
+    return checksums;
+}
+
+// Reads exactly `length` bytes at `offset`, retrying short reads
+static void pread_fully(int fd, char* buffer, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, length - done, offset + static_cast<off_t>(done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Could not read file for hashing.");
+        }
+        if (n == 0) {
+            throw std::runtime_error("File changed size while hashing.");
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+// Root binds the leaves to the chunk size and total length so that
+// differently chunked or truncated inputs can never share a digest.
+static std::string tree_root_checksum(const std::vector<unsigned char>& leaves, uint64_t file_size) {
+    Sha256Digest root;
+    const char domain[] = "traceseq-tree-v1";
+    root.update(domain, sizeof(domain) - 1);
+    unsigned char header[16];
+    uint64_t fields[2] = {static_cast<uint64_t>(kTreeHashChunkSize), file_size};
+    for (int f = 0; f < 2; ++f) {
+        for (int b = 0; b < 8; ++b) {
+            header[f * 8 + b] = static_cast<unsigned char>(fields[f] >> (56 - 8 * b));
+        }
     }
+    root.update(header, sizeof(header));
+    root.update(leaves.data(), leaves.size());
 
-    delete[] buffer;
-    return ss.str();
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    root.final(hash);
+    return kSha256TreeAlgorithm + ":" + to_hex(hash, SHA256_DIGEST_LENGTH);
+}
+
+// Hashes the leaves of the first `length` bytes of `fd` concurrently; leaf i
+// is SHA256 of bytes [i * chunk, min((i + 1) * chunk, length))
+static std::vector<unsigned char> tree_leaves(int fd, uint64_t length, unsigned int num_threads) {
+    const size_t chunk_count = static_cast<size_t>((length + kTreeHashChunkSize - 1) / kTreeHashChunkSize);
+    std::vector<unsigned char> leaves(chunk_count * SHA256_DIGEST_LENGTH);
+    unsigned int threads = resolve_thread_count(num_threads, chunk_count);
+    std::atomic<size_t> next_chunk{0};
+
+    // One task per worker so each thread reuses a single chunk buffer
+    parallel_for(threads, threads, [&](size_t) {
+        std::vector<char> buffer(static_cast<size_t>(std::min<uint64_t>(kTreeHashChunkSize, length)));
+        for (size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++) {
+            uint64_t offset = static_cast<uint64_t>(chunk) * kTreeHashChunkSize;
+            size_t size = static_cast<size_t>(std::min<uint64_t>(kTreeHashChunkSize, length - offset));
+            pread_fully(fd, buffer.data(), size, static_cast<off_t>(offset));
+            sha256_digest(buffer.data(), size, &leaves[chunk * SHA256_DIGEST_LENGTH]);
+        }
+    });
+    return leaves;
+}
+
+std::string sha256_tree_file(const std::string& path, unsigned int num_threads) {
+    ProfileSpan span("sha256_tree_file");
+    span.set_detail(path);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file for hashing.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat file for hashing.");
+    }
+    const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    std::vector<unsigned char> leaves;
+    try {
+        leaves = tree_leaves(fd, file_size, num_threads);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    span.set_value("bytes", static_cast<int64_t>(file_size));
+    Profiler::count("bytes_hashed", static_cast<int64_t>(file_size));
+
+    return tree_root_checksum(leaves, file_size);
+}
+
+// SHA256 block size; midstates are only taken at block boundaries
+static const uint64_t kSha256BlockBytes = 64;
+
+namespace {
+
+// SHA256 round constants (FIPS 180-4, section 4.2.2)
+const uint32_t kSha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// SHA256 initial chaining values (FIPS 180-4, section 5.3.3)
+const uint32_t kSha256InitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline uint32_t rotr32(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// Compresses whole 64-byte blocks into the chaining values `h`
+void sha256_blocks_portable(uint32_t h[8], const unsigned char* data, size_t blocks) {
+    uint32_t w[64];
+    for (; blocks > 0; --blocks, data += kSha256BlockBytes) {
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (static_cast<uint32_t>(data[4 * i]) << 24) | (static_cast<uint32_t>(data[4 * i + 1]) << 16) |
+                   (static_cast<uint32_t>(data[4 * i + 2]) << 8) | static_cast<uint32_t>(data[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = k + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) +
+                          kSha256RoundConstants[i] + w[i];
+            uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += k;
+    }
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TRACESEQ_SHA256_X86 1
+
+// The same compression with the x86 SHA extensions: four rounds per pair
+// of sha256rnds2, with the message schedule computed three groups ahead
+__attribute__((target("sha,sse4.1"))) void sha256_blocks_x86(uint32_t h[8], const unsigned char* data, size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h)), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h + 4)), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);       // CDGH
+    for (; blocks > 0; --blocks, data += kSha256BlockBytes) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+        __m128i schedule[4];
+#pragma GCC unroll 16
+        for (int j = 0; j < 16; ++j) {
+            if (j < 4) {
+                schedule[j] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * j)), byte_swap);
+            }
+            __m128i words = _mm_add_epi32(
+                schedule[j & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(kSha256RoundConstants + 4 * j)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+            if (j >= 3 && j <= 14) {
+                __m128i next = _mm_add_epi32(schedule[(j + 1) & 3], _mm_alignr_epi8(schedule[j & 3], schedule[(j - 1) & 3], 4));
+                schedule[(j + 1) & 3] = _mm_sha256msg2_epu32(next, schedule[j & 3]);
+            }
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(words, 0x0E));
+            if (j >= 1 && j <= 12) {
+                schedule[(j - 1) & 3] = _mm_sha256msg1_epu32(schedule[(j - 1) & 3], schedule[j & 3]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(h), _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(h + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+bool cpu_has_sha_extensions() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA);
+}
+#endif
+
+// SHA256 on chaining values this file owns. OpenSSL keeps the state of an
+// EVP digest private, so the resumable hash of a growing file, whose
+// midstate is saved in the checksum cache and restored later, runs here.
+class Sha256State {
+public:
+    explicit Sha256State(Sha256Blocks blocks = Sha256Blocks::Auto) : blocks_(blocks) {
+        std::memcpy(h_, kSha256InitialState, sizeof(h_));
+    }
+
+    // Continues after `midstate.length` bytes, a multiple of the block size
+    explicit Sha256State(const Sha256Midstate& midstate) : length_(midstate.length) {
+        std::memcpy(h_, midstate.state, sizeof(h_));
+    }
+
+    void update(const char* data, size_t length) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        length_ += length;
+        if (buffered_ > 0) {
+            size_t take = std::min<size_t>(length, kSha256BlockBytes - buffered_);
+            std::memcpy(buffer_ + buffered_, p, take);
+            buffered_ += take;
+            p += take;
+            length -= take;
+            if (buffered_ < kSha256BlockBytes) {
+                return;
+            }
+            compress(buffer_, 1);
+            buffered_ = 0;
+        }
+        compress(p, length / kSha256BlockBytes);
+        p += length - length % kSha256BlockBytes;
+        buffered_ = length % kSha256BlockBytes;
+        std::memcpy(buffer_, p, buffered_);
+    }
+
+    // Records the state; only meaningful on a block boundary
+    void capture(Sha256Midstate& midstate) const {
+        midstate.length = length_;
+        std::memcpy(midstate.state, h_, sizeof(h_));
+    }
+
+    void final(unsigned char* digest) {
+        const uint64_t bits = length_ * 8;
+        unsigned char padding[2 * kSha256BlockBytes] = {0x80};
+        size_t pad = (buffered_ < 56 ? 56 : 120) - buffered_;
+        for (int b = 0; b < 8; ++b) {
+            padding[pad + b] = static_cast<unsigned char>(bits >> (56 - 8 * b));
+        }
+        update(reinterpret_cast<const char*>(padding), pad + 8);
+        for (int i = 0; i < 8; ++i) {
+            for (int b = 0; b < 4; ++b) {
+                digest[4 * i + b] = static_cast<unsigned char>(h_[i] >> (24 - 8 * b));
+            }
+        }
+    }
+
+private:
+    void compress(const unsigned char* data, size_t blocks) {
+        if (blocks == 0) {
+            return;
+        }
+#ifdef TRACESEQ_SHA256_X86
+        static const bool use_x86 = cpu_has_sha_extensions();
+        if (blocks_ == Sha256Blocks::X86 || (blocks_ == Sha256Blocks::Auto && use_x86)) {
+            sha256_blocks_x86(h_, data, blocks);
+            return;
+        }
+#endif
+        sha256_blocks_portable(h_, data, blocks);
+    }
+
+    Sha256Blocks blocks_ = Sha256Blocks::Auto;
+    uint32_t h_[8];
+    uint64_t length_ = 0;
+    unsigned char buffer_[kSha256BlockBytes];
+    size_t buffered_ = 0;
+};
+
+} // namespace
+
+bool sha256_blocks_available(Sha256Blocks blocks) {
+    if (blocks != Sha256Blocks::X86) {
+        return true;
+    }
+#ifdef TRACESEQ_SHA256_X86
+    return cpu_has_sha_extensions();
+#else
+    return false;
+#endif
+}
+
+std::string sha256_resumable_hex(const std::vector<std::string>& parts, Sha256Blocks blocks) {
+    if (!sha256_blocks_available(blocks)) {
+        throw std::invalid_argument("This SHA256 implementation is not available on this CPU.");
+    }
+    Sha256State sha256(blocks);
+    for (const auto& part : parts) {
+        sha256.update(part.data(), part.size());
+    }
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    sha256.final(hash);
+    return to_hex(hash, SHA256_DIGEST_LENGTH);
+}
+
+std::string sha256_prefix_digest(const std::string& path, uint64_t length, unsigned int num_threads) {
+    ProfileSpan span("sha256_prefix_digest");
+    span.set_detail(path);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file for hashing.");
+    }
+    std::vector<unsigned char> leaves;
+    try {
+        leaves = tree_leaves(fd, length, num_threads);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    span.set_value("bytes", static_cast<int64_t>(length));
+    Profiler::count("bytes_hashed", static_cast<int64_t>(length));
+    return tree_root_checksum(leaves, length);
+}
+
+std::string sha256_file_resume(const std::string& path, const Sha256Midstate* resume, Sha256Midstate& midstate) {
+    ProfileSpan span("sha256_file_resume");
+    span.set_detail(path);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file for hashing.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat file for hashing.");
+    }
+
+    // The leaves of the whole chunks hashed so far, which make up the
+    // prefix digest of the next midstate
+    Sha256State sha256;
+    std::vector<unsigned char> leaves;
+    std::vector<char> buffer(kTreeHashChunkSize);
+    try {
+        // Every byte of the prefix is checked, just in parallel: the midstate
+        // is only used if the prefix still has the tree digest it had
+        if (resume && resume->length > 0 && resume->length % kTreeHashChunkSize == 0 &&
+            resume->length <= static_cast<uint64_t>(st.st_size)) {
+            std::vector<unsigned char> prefix_leaves = tree_leaves(fd, resume->length, 0);
+            if (tree_root_checksum(prefix_leaves, resume->length) == resume->prefix_digest) {
+                sha256 = Sha256State(*resume);
+                leaves = std::move(prefix_leaves);
+            }
+        }
+        sha256.capture(midstate);
+        uint64_t offset = midstate.length;
+        const uint64_t resumed_at = offset;
+
+        // Read a chunk at a time; the leaf of a whole chunk is hashed on a
+        // second thread while the SHA256 stream continues on this one
+        while (true) {
+            size_t filled = 0;
+            while (filled < buffer.size()) {
+                ssize_t n = pread(fd, buffer.data() + filled, buffer.size() - filled, static_cast<off_t>(offset + filled));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0) {
+                    throw std::runtime_error("Could not read file for hashing.");
+                }
+                if (n == 0) {
+                    break;
+                }
+                filled += static_cast<size_t>(n);
+            }
+            if (filled < buffer.size()) {
+                sha256.update(buffer.data(), filled);
+                offset += filled;
+                break;
+            }
+            unsigned char leaf[SHA256_DIGEST_LENGTH];
+            std::future<void> leaf_done = std::async(std::launch::async, [&] {
+                sha256_digest(buffer.data(), buffer.size(), leaf);
+            });
+            sha256.update(buffer.data(), buffer.size());
+            leaf_done.get();
+            leaves.insert(leaves.end(), leaf, leaf + SHA256_DIGEST_LENGTH);
+            sha256.capture(midstate);
+            offset += filled;
+        }
+        span.set_value("bytes", static_cast<int64_t>(offset - resumed_at));
+        Profiler::count("bytes_hashed", static_cast<int64_t>(offset - resumed_at));
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    if (midstate.length > 0) {
+        midstate.prefix_digest = tree_root_checksum(leaves, midstate.length);
+    }
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    sha256.final(hash);
+    return to_hex(hash, SHA256_DIGEST_LENGTH);
+}
+
+namespace {
+
+// 256 pseudo-random words (splitmix64) for the gear rolling hash. They are
+// part of the sha256-cdc definition: changing them moves every boundary.
+struct GearTable {
+    uint64_t words[256];
+    uint64_t shifted[256]; ///< words[b] << 1, to advance the hash by two bytes at once.
+    GearTable() {
+        uint64_t state = 0x7472616365736571ULL;
+        for (int b = 0; b < 256; ++b) {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            words[b] = z ^ (z >> 31);
+            shifted[b] = words[b] << 1;
+        }
+    }
+};
+
+// A chunk may end after every second byte past the minimum, where the top
+// 14 bits of the gear hash are zero: about 32 KiB past the minimum on average
+constexpr uint64_t kCdcBoundaryMask = 0xFFFC000000000000ULL;
+
+// Bytes buffered before boundaries are searched and chunks hashed in parallel
+constexpr size_t kCdcBatchSize = 8 * 1024 * 1024;
+
+// Length of the chunk at the start of `data`. Callers pass at least
+// kCdcMaxChunkSize bytes unless they reached the end of the stream, so the
+// result depends only on the content.
+size_t cdc_cut_point(const unsigned char* data, size_t length) {
+    if (length <= kCdcMinChunkSize) {
+        return length;
+    }
+    static const GearTable gear;
+    const size_t limit = std::min(length, kCdcMaxChunkSize);
+    uint64_t hash = 0;
+    // hash = ((hash << 1) + gear[a] << 1) + gear[b], with a shorter dependency chain
+    for (size_t i = kCdcMinChunkSize; i + 1 < limit; i += 2) {
+        hash = (hash << 2) + (gear.shifted[data[i]] + gear.words[data[i + 1]]);
+        if ((hash & kCdcBoundaryMask) == 0) {
+            return i + 2;
+        }
+    }
+    return limit;
+}
+
+// Cuts a byte stream into content-defined chunks and hashes them, taking
+// the SHA256 of chunks that a previous version had at the same offset
+class ContentChunker {
+public:
+    ContentChunker(const ChunkList* previous, unsigned int num_threads) : num_threads_(num_threads) {
+        if (previous) {
+            uint64_t offset = 0;
+            for (const FileChunk& chunk : previous->chunks) {
+                previous_.emplace(offset, &chunk);
+                offset += chunk.length;
+            }
+        }
+    }
+
+    void update(const char* data, size_t length) {
+        reserve(length);
+        std::memcpy(buffer_.data() + used_, data, length);
+        used_ += length;
+        if (used_ >= kCdcBatchSize) {
+            cut(false);
+        }
+    }
+
+    // Reads the next bytes of a file straight into the buffer; returns
+    // false at the end of the file
+    bool read_from(int fd) {
+        const size_t block = 1 << 20;
+        reserve(block);
+        ssize_t n;
+        do {
+            n = read(fd, buffer_.data() + used_, block);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            throw std::runtime_error("Could not read file for hashing.");
+        }
+        used_ += static_cast<size_t>(n);
+        if (used_ >= kCdcBatchSize) {
+            cut(false);
+        }
+        return n > 0;
+    }
+
+    ChunkList finish() {
+        cut(true);
+        return std::move(list_);
+    }
+
+    uint64_t reused_bytes() const { return reused_bytes_; }
+
+private:
+    void reserve(size_t length) {
+        if (buffer_.size() < used_ + length) {
+            buffer_.resize(std::max(used_ + length, kCdcBatchSize + kCdcMaxChunkSize));
+        }
+    }
+
+    void cut(bool final) {
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer_.data());
+        std::vector<std::pair<size_t, size_t>> spans;
+        size_t pos = 0;
+        while (pos < used_) {
+            size_t remaining = used_ - pos;
+            if (!final && remaining < kCdcMaxChunkSize) {
+                break; // The next boundary may lie in data not read yet
+            }
+            size_t length = cdc_cut_point(data + pos, remaining);
+            spans.emplace_back(pos, length);
+            pos += length;
+        }
+
+        const size_t first = list_.chunks.size();
+        list_.chunks.resize(first + spans.size());
+        std::atomic<uint64_t> reused{0};
+        parallel_for(spans.size(), num_threads_, [&](size_t i) {
+            FileChunk& chunk = list_.chunks[first + i];
+            const char* bytes = buffer_.data() + spans[i].first;
+            chunk.length = spans[i].second;
+            Xxh64Hasher fingerprint;
+            fingerprint.update(bytes, spans[i].second);
+            chunk.fingerprint = fingerprint.value();
+            // Reuse only a chunk covering the same byte range with the same fingerprint
+            auto it = previous_.find(list_.size + spans[i].first);
+            if (it != previous_.end() && it->second->length == chunk.length &&
+                it->second->fingerprint == chunk.fingerprint) {
+                std::memcpy(chunk.digest, it->second->digest, sizeof(chunk.digest));
+                reused += chunk.length;
+            } else {
+                sha256_digest(bytes, spans[i].second, chunk.digest);
+            }
+        });
+        reused_bytes_ += reused;
+        list_.size += pos;
+        if (used_ > pos) {
+            std::memmove(buffer_.data(), buffer_.data() + pos, used_ - pos);
+        }
+        used_ -= pos;
+    }
+
+    unsigned int num_threads_;
+    std::unordered_map<uint64_t, const FileChunk*> previous_; ///< Chunks of the previous version by offset.
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+    ChunkList list_;
+    uint64_t reused_bytes_ = 0;
+};
+
+} // namespace
+
+std::string ChunkList::checksum() const {
+    Sha256Digest root;
+    const char domain[] = "traceseq-cdc-v1";
+    root.update(domain, sizeof(domain) - 1);
+    // Bind the chunking parameters and total length, then every chunk's
+    // length and digest
+    auto update_u64 = [&root](uint64_t value) {
+        unsigned char bytes[8];
+        for (int b = 0; b < 8; ++b) {
+            bytes[b] = static_cast<unsigned char>(value >> (56 - 8 * b));
+        }
+        root.update(bytes, sizeof(bytes));
+    };
+    update_u64(kCdcMinChunkSize);
+    update_u64(kCdcMaxChunkSize);
+    update_u64(size);
+    for (const FileChunk& chunk : chunks) {
+        update_u64(chunk.length);
+        root.update(chunk.digest, sizeof(chunk.digest));
+    }
+
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    root.final(hash);
+    return kSha256CdcAlgorithm + ":" + to_hex(hash, SHA256_DIGEST_LENGTH);
+}
+
+ChunkList chunk_file(const std::string& path, const ChunkList* previous, unsigned int num_threads) {
+    ProfileSpan span("chunk_file");
+    span.set_detail(path);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file for hashing.");
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    ContentChunker chunker(previous, num_threads);
+    try {
+        while (chunker.read_from(fd)) {
+        }
+    } catch (const std::runtime_error&) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    ChunkList list = chunker.finish();
+    span.set_value("bytes", static_cast<int64_t>(list.size));
+    span.set_value("bytes_reused", static_cast<int64_t>(chunker.reused_bytes()));
+    Profiler::count("bytes_hashed", static_cast<int64_t>(list.size - chunker.reused_bytes()));
+    return list;
+}
+
+ChunkOverlap chunk_overlap(const ChunkList& file, const ChunkList& other) {
+    std::unordered_set<std::string> digests;
+    for (const FileChunk& chunk : other.chunks) {
+        digests.emplace(reinterpret_cast<const char*>(chunk.digest), sizeof(chunk.digest));
+    }
+    ChunkOverlap overlap;
+    overlap.total_bytes = file.size;
+    overlap.total_chunks = file.chunks.size();
+    for (const FileChunk& chunk : file.chunks) {
+        if (digests.count(std::string(reinterpret_cast<const char*>(chunk.digest), sizeof(chunk.digest)))) {
+            overlap.shared_bytes += chunk.length;
+            ++overlap.shared_chunks;
+        }
+    }
+    return overlap;
+}
+
+std::string checksum_file(const std::string& path, const std::string& algorithm) {
+    if (algorithm == kSha256Algorithm) {
+        return sha256_file(path);
+    }
+    if (algorithm == kSha256TreeAlgorithm) {
+        return sha256_tree_file(path);
+    }
+    if (algorithm == kSha256CdcAlgorithm) {
+        return chunk_file(path).checksum();
+    }
+    std::unique_ptr<StreamHasher> hasher = make_stream_hasher(algorithm);
+    ProfileSpan span("checksum_file");
+    if (span.active()) {
+        span.set_detail(algorithm + " " + path);
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file for hashing.");
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    std::vector<char> buffer(1 << 20);
+    int64_t total = 0;
+    while (true) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            close(fd);
+            throw std::runtime_error("Could not read file for hashing.");
+        }
+        if (n == 0) {
+            break;
+        }
+        hasher->update(buffer.data(), static_cast<size_t>(n));
+        total += n;
+    }
+    close(fd);
+    span.set_value("bytes", total);
+    Profiler::count("bytes_hashed", total);
+    return tag_checksum(algorithm, hasher->final_hex());
+}
+
+const std::vector<std::string>& checksum_algorithms() {
+    static const std::vector<std::string> algorithms = {
+        kSha256Algorithm, kSha256TreeAlgorithm, kSha256CdcAlgorithm, kBlake2bAlgorithm, kXxh64Algorithm};
+    return algorithms;
+}
+
+std::string checksum_algorithm(const std::string& checksum) {
+    size_t colon_pos = checksum.find(':');
+    if (colon_pos == std::string::npos) {
+        return kSha256Algorithm;
+    }
+    return checksum.substr(0, colon_pos);
+}
+
+struct DigestSink::State {
+    std::unique_ptr<StreamHasher> stream; ///< Whole-stream digest; null for sha256-tree and sha256-cdc.
+    std::unique_ptr<ContentChunker> chunker; ///< Content-defined chunks (sha256-cdc).
+    Sha256Digest leaf;                  ///< Current tree leaf (sha256-tree).
+    uint64_t chunk_bytes = 0;           ///< Bytes of the current tree leaf.
+    std::vector<unsigned char> leaves;  ///< Completed tree leaf digests.
+};
+
+DigestSink::DigestSink(const std::string& algorithm) : algorithm_(algorithm), state_(new State) {
+    state_->stream = make_stream_hasher(algorithm);
+    if (algorithm == kSha256CdcAlgorithm) {
+        state_->chunker = std::make_unique<ContentChunker>(nullptr, 1);
+    }
+}
+
+DigestSink::~DigestSink() = default;
+
+void DigestSink::update(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) {
+        throw std::logic_error("DigestSink::update called after finish");
+    }
+    bytes_ += length;
+    if (state_->stream) {
+        state_->stream->update(data, length);
+        return;
+    }
+    if (state_->chunker) {
+        state_->chunker->update(data, length);
+        return;
+    }
+    // Split the stream into the same leaves sha256_tree_file hashes
+    while (length > 0) {
+        size_t take = static_cast<size_t>(std::min<uint64_t>(length, kTreeHashChunkSize - state_->chunk_bytes));
+        state_->leaf.update(data, take);
+        state_->chunk_bytes += take;
+        data += take;
+        length -= take;
+        if (state_->chunk_bytes == kTreeHashChunkSize) {
+            finish_leaf();
+        }
+    }
+}
+
+void DigestSink::finish_leaf() {
+    unsigned char leaf[SHA256_DIGEST_LENGTH];
+    state_->leaf.final(leaf);
+    state_->leaves.insert(state_->leaves.end(), leaf, leaf + SHA256_DIGEST_LENGTH);
+    state_->chunk_bytes = 0;
+}
+
+std::string DigestSink::finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_) {
+        return checksum_;
+    }
+    finished_ = true;
+    if (state_->stream) {
+        checksum_ = tag_checksum(algorithm_, state_->stream->final_hex());
+    } else if (state_->chunker) {
+        checksum_ = state_->chunker->finish().checksum();
+    } else {
+        if (state_->chunk_bytes > 0) {
+            finish_leaf();
+        }
+        checksum_ = tree_root_checksum(state_->leaves, bytes_);
+    }
+    return checksum_;
+}
+
+uint64_t DigestSink::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
 }
@@ -1,7 +1,36 @@
 #ifndef HASHING_HPP
 #define HASHING_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+/// Algorithm name of the plain, single-stream SHA256 digest.
+inline const std::string kSha256Algorithm = "sha256";
+
+/// Algorithm name of the chunked SHA256 tree digest computed by `sha256_tree_file`.
+inline const std::string kSha256TreeAlgorithm = "sha256-tree";
+
+/// Algorithm name of BLAKE2b-512, a fast cryptographic digest.
+inline const std::string kBlake2bAlgorithm = "blake2b";
+
+/// Algorithm name of XXH64, a non-cryptographic digest for scratch data.
+inline const std::string kXxh64Algorithm = "xxh64";
+
+/// Algorithm name of the content-defined chunk digest computed by `chunk_file`.
+inline const std::string kSha256CdcAlgorithm = "sha256-cdc";
+
+/// Size of the leaf chunks hashed by `sha256_tree_file`. Part of the digest definition.
+constexpr std::size_t kTreeHashChunkSize = 8 * 1024 * 1024;
+
+/// Smallest content-defined chunk, except at the end of a file. Part of the digest definition.
+constexpr std::size_t kCdcMinChunkSize = 32 * 1024;
+
+/// Largest content-defined chunk. Part of the digest definition.
+constexpr std::size_t kCdcMaxChunkSize = 256 * 1024;
 
 /**
  * @brief Calculates the SHA256 checksum of a given file.
@@ -15,4 +44,272 @@
  */
 std::string sha256_file(const std::string& path);
 
+/**
+ * @brief Calculates the SHA256 checksums of many files concurrently.
+ *
+ * Files are hashed with `sha256_file` on a pool of worker threads, so a
+ * batch of many small or medium outputs scales with the number of cores.
+ *
+ * @param paths The files to hash.
+ * @param num_threads The number of worker threads (0 means one per hardware core).
+ * @return The checksums, in the order of `paths`.
+ * @throws std::runtime_error naming the first file that could not be hashed.
+ */
+std::vector<std::string> sha256_files(const std::vector<std::string>& paths, unsigned int num_threads = 0);
+
+/**
+ * @brief Calculates a parallel SHA256 tree digest of a given file.
+ *
+ * The file is split into fixed `kTreeHashChunkSize` chunks which are read
+ * with `pread` and hashed concurrently. The leaf digests are then combined,
+ * together with the chunk size and file length, into a single root SHA256.
+ * The result differs from `sha256_file` and is therefore returned with the
+ * `sha256-tree:` algorithm tag.
+ *
+ * @param path The path to the file for which to calculate the checksum.
+ * @param num_threads The number of hashing threads (0 means one per hardware core).
+ * @return The tagged tree checksum, e.g. "sha256-tree:<hex>".
+ * @throws std::runtime_error if the file cannot be opened or read.
+ */
+std::string sha256_tree_file(const std::string& path, unsigned int num_threads = 0);
+
+/**
+ * @brief Calculates the checksum of a file with the named algorithm.
+ *
+ * Plain SHA256 checksums are returned untagged, as they always have been,
+ * so existing index entries keep resolving. Every other algorithm returns
+ * an "<algorithm>:<hex>" string.
+ *
+ * @param path The path to the file for which to calculate the checksum.
+ * @param algorithm One of `checksum_algorithms()`.
+ * @return The checksum string as stored in trace nodes and the index.
+ * @throws std::invalid_argument if the algorithm is unknown.
+ * @throws std::runtime_error if the file cannot be opened or read.
+ */
+std::string checksum_file(const std::string& path, const std::string& algorithm);
+
+/**
+ * @brief Lists the supported checksum algorithms.
+ *
+ * `sha256` is the default; `sha256-tree` hashes large files on all cores;
+ * `sha256-cdc` hashes content-defined chunks so that edited files can be
+ * re-hashed incrementally; `blake2b` is a cryptographic alternative; `xxh64`
+ * is several times faster but only detects accidental changes, so it suits
+ * scratch data.
+ *
+ * @return The algorithm names accepted by `checksum_file`.
+ */
+const std::vector<std::string>& checksum_algorithms();
+
+/**
+ * @brief Returns the algorithm that produced a stored checksum.
+ *
+ * @param checksum A checksum string as stored in a trace node or the index.
+ * @return The algorithm tag, or `kSha256Algorithm` for untagged checksums.
+ */
+std::string checksum_algorithm(const std::string& checksum);
+
+/// Files at least this large keep a resumable SHA256 midstate in the checksum cache.
+constexpr uint64_t kResumableHashMinBytes = 8 * 1024 * 1024;
+
+/**
+ * @brief The SHA256 state after hashing a chunk-aligned prefix of a file.
+ *
+ * Hashing can resume from a midstate once the file has grown, so the
+ * sequential SHA256 pass only covers the appended bytes. The state is the
+ * standard one of FIPS 180-4, independent of any library: the eight
+ * chaining values H0..H7 after the last complete block. Together with the
+ * length it fully determines how hashing continues.
+ */
+struct Sha256Midstate {
+    uint64_t length = 0;        ///< Bytes covered; a multiple of `kTreeHashChunkSize`.
+    uint32_t state[8] = {};     ///< The chaining values H0..H7 after `length` bytes.
+    std::string prefix_digest;  ///< `sha256_prefix_digest` of the covered prefix.
+};
+
+/// The SHA256 compression functions `sha256_file_resume` can run.
+enum class Sha256Blocks {
+    Auto,       ///< The x86 SHA extensions where the CPU has them, the portable code otherwise.
+    Portable,   ///< Plain C++.
+    X86,        ///< The x86 SHA extensions.
+};
+
+/**
+ * @brief Whether this build and CPU can run a SHA256 compression function.
+ * @param blocks The compression function.
+ * @return true if `sha256_resumable_hex` accepts it.
+ */
+bool sha256_blocks_available(Sha256Blocks blocks);
+
+/**
+ * @brief Calculates SHA256 with the in-tree implementation behind `sha256_file_resume`.
+ *
+ * The parts are hashed one after another, so callers can place block
+ * boundaries wherever they like. This is how each compression function is
+ * checked against known answers and against OpenSSL.
+ *
+ * @param parts The data, in order.
+ * @param blocks The compression function to use.
+ * @return The SHA256 checksum in hexadecimal format.
+ * @throws std::invalid_argument if `blocks` is not available (see `sha256_blocks_available`).
+ */
+std::string sha256_resumable_hex(const std::vector<std::string>& parts, Sha256Blocks blocks);
+
+/**
+ * @brief Calculates the `sha256-tree` digest of a file prefix.
+ *
+ * This is the check that the prefix covered by a midstate was not
+ * rewritten. Every byte of the prefix is read and hashed, but as
+ * independent leaves on all cores rather than as one sequential stream.
+ *
+ * @param path The file.
+ * @param length The length of the prefix.
+ * @param num_threads The number of hashing threads (0 means one per hardware core).
+ * @return The tagged tree checksum of the first `length` bytes, as `sha256_tree_file` would give for them.
+ * @throws std::runtime_error if the file is shorter than `length` or cannot be read.
+ */
+std::string sha256_prefix_digest(const std::string& path, uint64_t length, unsigned int num_threads = 0);
+
+/**
+ * @brief Calculates the SHA256 checksum of a file, resuming from a midstate.
+ *
+ * If `resume` is given and the file's prefix of `resume->length` bytes
+ * still has the recorded `sha256_prefix_digest`, hashing continues from its
+ * state and the sequential SHA256 pass only covers the bytes after it. The
+ * prefix check still reads the whole prefix, so the I/O is that of hashing
+ * the whole file; what is saved is the sequential SHA256 computation over
+ * the prefix, which the check replaces with tree leaves hashed on all cores.
+ * A file edited anywhere before the end of the midstate is hashed again from
+ * the start. Either way the result equals `sha256_file`.
+ *
+ * @param path The path to the file for which to calculate the checksum.
+ * @param resume A midstate recorded earlier for this file, or nullptr.
+ * @param midstate Filled with the midstate at the last chunk boundary of the file.
+ * @return A string representing the SHA256 checksum in hexadecimal format.
+ * @throws std::runtime_error if the file cannot be opened or read.
+ */
+std::string sha256_file_resume(const std::string& path, const Sha256Midstate* resume, Sha256Midstate& midstate);
+
+/**
+ * @brief One content-defined chunk of a file.
+ */
+struct FileChunk {
+    uint64_t length = 0;          ///< Bytes in the chunk.
+    uint64_t fingerprint = 0;     ///< XXH64 of the chunk, to recognize it cheaply.
+    unsigned char digest[32] = {}; ///< SHA256 of the chunk.
+};
+
+/**
+ * @brief A file split into content-defined chunks.
+ *
+ * Chunk boundaries are placed where a rolling (gear) hash of the preceding
+ * bytes matches a fixed bit pattern, between `kCdcMinChunkSize` and
+ * `kCdcMaxChunkSize` bytes apart (about 64 KiB on average). Because a
+ * boundary depends only on nearby content, an edit changes the chunks it
+ * touches and leaves the others, even when it shifts the rest of the file.
+ */
+struct ChunkList {
+    uint64_t size = 0;              ///< Total bytes.
+    std::vector<FileChunk> chunks;  ///< The chunks in file order.
+
+    /**
+     * @brief The file checksum: SHA256 over the chunk lengths and digests.
+     * @return The tagged checksum, e.g. "sha256-cdc:<hex>".
+     */
+    std::string checksum() const;
+};
+
+/**
+ * @brief Splits a file into content-defined chunks and hashes each one.
+ *
+ * If `previous` lists the chunks of an earlier version of the file, a chunk
+ * that covers the same byte range as one of them and has the same XXH64
+ * fingerprint takes its SHA256 without hashing it again, so re-hashing a
+ * file edited in place costs one pass of the much cheaper rolling and XXH64
+ * hashes over the unchanged regions. Chunks that moved, for example after
+ * an insertion, are hashed again. Pass nullptr to hash every chunk.
+ *
+ * @param path The file.
+ * @param previous The chunks of an earlier version of the file, or nullptr.
+ * @param num_threads The number of hashing threads (0 means one per hardware core).
+ * @return The chunks of the file.
+ * @throws std::runtime_error if the file cannot be opened or read.
+ */
+ChunkList chunk_file(const std::string& path, const ChunkList* previous = nullptr, unsigned int num_threads = 0);
+
+/**
+ * @brief How much of one file's content also occurs in another.
+ */
+struct ChunkOverlap {
+    uint64_t shared_bytes = 0;   ///< Bytes of the file in chunks that also occur in the other.
+    uint64_t total_bytes = 0;    ///< Bytes of the file.
+    size_t shared_chunks = 0;    ///< Chunks of the file that also occur in the other.
+    size_t total_chunks = 0;     ///< Chunks of the file.
+
+    /// `shared_bytes` as a fraction of `total_bytes`; 1 for two empty files.
+    double fraction() const { return total_bytes == 0 ? 1.0 : static_cast<double>(shared_bytes) / total_bytes; }
+};
+
+/**
+ * @brief Measures how much of a file is made of chunks of another file.
+ * @param file The chunks of the file to measure.
+ * @param other The chunks of the file to compare against.
+ * @return The overlap, relative to `file`.
+ */
+ChunkOverlap chunk_overlap(const ChunkList& file, const ChunkList& other);
+
+/**
+ * @brief Computes a file checksum from data as it is written.
+ *
+ * Feeding a file's bytes through `update` in order and calling `finish`
+ * yields exactly what `checksum_file` returns for the same content and
+ * algorithm, so a producer can hash its output while writing it instead of
+ * reading the finished file again. All methods are thread-safe.
+ */
+class DigestSink {
+public:
+    /**
+     * @brief Starts a digest.
+     * @param algorithm One of `checksum_algorithms()`.
+     * @throws std::invalid_argument if the algorithm is unknown.
+     */
+    explicit DigestSink(const std::string& algorithm = kSha256Algorithm);
+    ~DigestSink();
+
+    DigestSink(const DigestSink&) = delete;
+    DigestSink& operator=(const DigestSink&) = delete;
+
+    /**
+     * @brief Hashes the next bytes of the stream.
+     * @param data The bytes.
+     * @param length The number of bytes.
+     * @throws std::logic_error if the digest was already finished.
+     */
+    void update(const char* data, size_t length);
+
+    /**
+     * @brief Completes the digest; later calls return the same checksum.
+     * @return The checksum string, tagged as described for `checksum_file`.
+     */
+    std::string finish();
+
+    /// The number of bytes hashed so far.
+    uint64_t bytes() const;
+
+    /// The checksum algorithm.
+    const std::string& algorithm() const { return algorithm_; }
+
+private:
+    struct State;
+
+    void finish_leaf();
+
+    std::string algorithm_;
+    mutable std::mutex mutex_;   ///< Guards the state below.
+    std::unique_ptr<State> state_;
+    uint64_t bytes_ = 0;
+    bool finished_ = false;
+    std::string checksum_;
+};
+
 #endif // HASHING_HPP
@@ -0,0 +1,274 @@
+#include "index_log.hpp"
+#include "file_lock.hpp"
+#include "profiler.hpp"
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// The log is compacted once it is larger than the snapshot and this floor.
+static const uint64_t kMinCompactionBytes = 1 << 20;
+
+namespace {
+
+// Per-log state shared by all threads appending to it in this process
+struct LogWriter {
+    std::mutex mutex;
+    std::condition_variable synced;
+    int fd = -1;
+    uint64_t written_seq = 0;   ///< Records handed to write().
+    uint64_t synced_seq = 0;    ///< Records known to be on stable storage.
+    bool syncing = false;       ///< A leader is currently inside fsync().
+};
+
+LogWriter& writer_for(const fs::path& log_path) {
+    static std::mutex registry_mutex;
+    static std::map<std::string, std::unique_ptr<LogWriter>> registry;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto& writer = registry[log_path.string()];
+    if (!writer) {
+        writer = std::make_unique<LogWriter>();
+    }
+    return *writer;
+}
+
+fs::path log_path_for(const fs::path& project_root) {
+    return project_root / ".traceseq" / "index.log";
+}
+
+uint64_t file_size_or_zero(const fs::path& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+// The log is folded into the snapshot once it outgrows it
+bool needs_compaction(const fs::path& project_root) {
+    uint64_t log_size = file_size_or_zero(log_path_for(project_root));
+    return log_size > kMinCompactionBytes &&
+           log_size > file_size_or_zero(project_root / ".traceseq" / "index.json");
+}
+
+// Applies every complete log record in a stream to the index
+void apply_log_records(std::istream& log_file, nlohmann::json& index_json) {
+    std::string line;
+    while (std::getline(log_file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        nlohmann::json record = nlohmann::json::parse(line, nullptr, false);
+        if (record.is_discarded() || !record.is_object()) {
+            continue; // Torn record from an interrupted append
+        }
+        if (!index_json.is_object()) {
+            index_json = nlohmann::json::object();
+        }
+        for (auto it = record.begin(); it != record.end(); ++it) {
+            index_json[it.key()] = it.value();
+        }
+    }
+}
+
+// Appends one record while the index lock is held. A failed or short write
+// is cut back to the previous end of the log, and a record torn by a writer
+// that died mid-append is terminated first, so every record stays on a line
+// of its own.
+void append_record_locked(int fd, std::string line, const fs::path& log_path) {
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw std::runtime_error("Could not stat index log: " + log_path.string());
+    }
+    const off_t start = st.st_size;
+    char last = '\n';
+    if (start > 0 && ::pread(fd, &last, 1, start - 1) == 1 && last != '\n') {
+        line.insert(0, 1, '\n');
+    }
+    size_t done = 0;
+    while (done < line.size()) {
+        ssize_t n = ::write(fd, line.data() + done, line.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (::ftruncate(fd, start) != 0) {
+                throw std::runtime_error("Could not append to index log, and could not remove the partial record: " +
+                                         log_path.string());
+            }
+            throw std::runtime_error("Could not append to index log: " + log_path.string());
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+} // namespace
+
+void append_index(const IndexEntries& entries, const fs::path& project_root) {
+    if (entries.empty()) {
+        return;
+    }
+    ProfileSpan span("append_index");
+    span.set_value("entries", static_cast<int64_t>(entries.size()));
+    nlohmann::json record = nlohmann::json::object();
+    for (const auto& entry : entries) {
+        record[entry.first] = entry.second;
+    }
+    std::string line = record.dump() + "\n";
+
+    fs::path log_path = log_path_for(project_root);
+    fs::create_directories(log_path.parent_path());
+    LogWriter& writer = writer_for(log_path);
+
+    std::unique_lock<std::mutex> lock(writer.mutex);
+    if (writer.fd < 0) {
+        writer.fd = ::open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (writer.fd < 0) {
+            throw std::runtime_error("Could not open index log: " + log_path.string());
+        }
+    }
+    {
+        FileLock index_lock(index_lock_path(project_root), FileLock::Mode::Exclusive);
+        append_record_locked(writer.fd, line, log_path);
+    }
+    uint64_t my_seq = ++writer.written_seq;
+
+    // Group commit: the first waiter syncs everything written so far while
+    // later appenders queue behind it and are usually covered by its fsync.
+    while (writer.synced_seq < my_seq) {
+        if (writer.syncing) {
+            writer.synced.wait(lock);
+            continue;
+        }
+        writer.syncing = true;
+        uint64_t target = writer.written_seq;
+        int fd = writer.fd;
+        lock.unlock();
+        int rc = ::fsync(fd);
+        lock.lock();
+        writer.syncing = false;
+        if (rc == 0 && target > writer.synced_seq) {
+            writer.synced_seq = target;
+        }
+        writer.synced.notify_all();
+        if (rc != 0) {
+            throw std::runtime_error("Could not sync index log: " + log_path.string());
+        }
+    }
+    lock.unlock();
+
+    if (needs_compaction(project_root)) {
+        FileLock index_lock(index_lock_path(project_root), FileLock::Mode::Exclusive);
+        // Another writer may have compacted while we waited for the lock
+        if (needs_compaction(project_root)) {
+            write_index_unlocked(read_index_unlocked(project_root), project_root);
+        }
+    }
+}
+
+nlohmann::json read_index_unlocked(const fs::path& project_root) {
+    nlohmann::json index_json;
+    fs::path index_path = project_root / ".traceseq" / "index.json";
+    if (fs::exists(index_path)) {
+        std::ifstream index_file(index_path);
+        if (index_file.is_open()) {
+            index_file >> index_json;
+            index_file.close();
+        }
+    }
+
+    std::ifstream log_file(log_path_for(project_root));
+    if (log_file.is_open()) {
+        apply_log_records(log_file, index_json);
+    }
+    return index_json;
+}
+
+void write_index_unlocked(const nlohmann::json& index_json, const fs::path& project_root) {
+    fs::path trace_dir = project_root / ".traceseq";
+    fs::create_directories(trace_dir);
+    fs::path tmp_path = trace_dir / ("index.json.tmp" + std::to_string(::getpid()));
+    std::ofstream output_index_file(tmp_path);
+    output_index_file << std::setw(4) << index_json << std::endl;
+    output_index_file.close();
+    if (!output_index_file) {
+        fs::remove(tmp_path);
+        throw std::runtime_error("Could not write index snapshot: " + tmp_path.string());
+    }
+    int fd = ::open(tmp_path.c_str(), O_RDONLY);
+    if (fd < 0 || ::fsync(fd) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fs::remove(tmp_path);
+        throw std::runtime_error("Could not sync index snapshot: " + tmp_path.string());
+    }
+    ::close(fd);
+    fs::rename(tmp_path, trace_dir / "index.json");
+    // The log may only be emptied once the rename itself is durable
+    sync_directory(trace_dir);
+
+    // Truncate in place so descriptors held by appenders stay valid
+    fs::path log_path = log_path_for(project_root);
+    if (fs::exists(log_path) && ::truncate(log_path.c_str(), 0) != 0) {
+        throw std::runtime_error("Could not truncate index log: " + log_path.string());
+    }
+}
+
+void compact_index(const fs::path& project_root) {
+    ProfileSpan span("compact_index");
+    FileLock index_lock(index_lock_path(project_root), FileLock::Mode::Exclusive);
+    write_index_unlocked(read_index_unlocked(project_root), project_root);
+}
+
+IndexView::IndexView(const fs::path& project_root) : project_root_(project_root) {}
+
+const nlohmann::json& IndexView::refresh() {
+    ProfileSpan span("IndexView::refresh");
+    fs::path trace_dir = project_root_ / ".traceseq";
+    if (!fs::exists(trace_dir)) {
+        return index_json_;
+    }
+    // Appends and compactions hold the lock exclusively, so the snapshot and
+    // the log are consistent with each other while it is held shared.
+    FileLock index_lock(index_lock_path(project_root_), FileLock::Mode::Shared);
+
+    struct stat snapshot_st;
+    uint64_t snapshot_inode = 0;
+    int64_t snapshot_mtime_ns = 0;
+    if (::stat((trace_dir / "index.json").c_str(), &snapshot_st) == 0) {
+        snapshot_inode = static_cast<uint64_t>(snapshot_st.st_ino);
+        snapshot_mtime_ns = static_cast<int64_t>(snapshot_st.st_mtime) * 1000000000LL;
+#if defined(__APPLE__)
+        snapshot_mtime_ns += snapshot_st.st_mtimespec.tv_nsec;
+#else
+        snapshot_mtime_ns += snapshot_st.st_mtim.tv_nsec;
+#endif
+    }
+    uint64_t log_size = file_size_or_zero(log_path_for(project_root_));
+
+    if (!loaded_ || snapshot_inode != snapshot_inode_ || snapshot_mtime_ns != snapshot_mtime_ns_ || log_size < log_offset_) {
+        index_json_ = read_index_unlocked(project_root_);
+        loaded_ = true;
+    } else if (log_size > log_offset_) {
+        std::ifstream log_file(log_path_for(project_root_), std::ios::binary);
+        if (log_file.is_open()) {
+            log_file.seekg(static_cast<std::streamoff>(log_offset_));
+            apply_log_records(log_file, index_json_);
+        }
+    }
+    snapshot_inode_ = snapshot_inode;
+    snapshot_mtime_ns_ = snapshot_mtime_ns;
+    log_offset_ = log_size;
+    return index_json_;
+}
@@ -0,0 +1,95 @@
+#ifndef INDEX_LOG_HPP
+#define INDEX_LOG_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+#include "nlohmann/json.hpp"
+
+/// A batch of index mutations, each mapping a file checksum to a trace ID.
+using IndexEntries = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * @brief Appends index mutations to the '.traceseq/index.log' write-ahead log.
+ *
+ * The batch is written as a single JSON line while holding the index lock
+ * exclusively, so records from concurrent processes never interleave or race
+ * with a compaction, and is durable when this function returns. A failed
+ * write is truncated away again, and a torn line left by a writer that died
+ * is terminated before the new record, so it never swallows a later one. Concurrent callers in the same process
+ * share `fsync` calls (group commit): one thread syncs on behalf of every
+ * record written before it started. When the log outgrows the snapshot it is
+ * folded into 'index.json' by `compact_index`, keeping the amortised cost of
+ * an append independent of the index size.
+ *
+ * @param entries The checksum to trace ID mappings to record.
+ * @param project_root The root directory of the project.
+ * @throws std::runtime_error if the log cannot be written.
+ */
+void append_index(const IndexEntries& entries, const std::filesystem::path& project_root);
+
+/**
+ * @brief Reads the index snapshot and applies the write-ahead log to it.
+ *
+ * Torn lines left by a crash are ignored. The caller must hold the
+ * index lock (see `index_lock_path`); use `load_index` otherwise.
+ *
+ * @param project_root The root directory of the project.
+ * @return The current index.
+ */
+nlohmann::json read_index_unlocked(const std::filesystem::path& project_root);
+
+/**
+ * @brief Replaces the index snapshot and empties the write-ahead log.
+ *
+ * The snapshot is written to a temporary file, synced and renamed into
+ * place, and '.traceseq' is synced, before the log is truncated, so a crash
+ * at any point leaves a readable index. The caller must hold the index lock
+ * exclusively; use `save_index` otherwise.
+ *
+ * @param index_json The complete index to store.
+ * @param project_root The root directory of the project.
+ * @throws std::runtime_error if the snapshot cannot be written or synced; the log is then left untouched.
+ */
+void write_index_unlocked(const nlohmann::json& index_json, const std::filesystem::path& project_root);
+
+/**
+ * @brief An in-memory copy of the index that is kept current incrementally.
+ *
+ * Long-lived processes use this instead of `load_index`: each `refresh`
+ * costs two `stat` calls when nothing changed, applies only the log records
+ * appended since the previous refresh, and reloads the snapshot only after
+ * a compaction or `save_index` replaced it.
+ */
+class IndexView {
+public:
+    /**
+     * @brief Creates an empty view of a project's index; call `refresh` to read it.
+     * @param project_root The root directory of the project.
+     */
+    explicit IndexView(const std::filesystem::path& project_root);
+
+    /**
+     * @brief Brings the view up to date with the index on disk.
+     * @return The current index.
+     */
+    const nlohmann::json& refresh();
+
+private:
+    std::filesystem::path project_root_;
+    nlohmann::json index_json_;
+    uint64_t snapshot_inode_ = 0;   ///< Inode of the 'index.json' that was read.
+    int64_t snapshot_mtime_ns_ = 0; ///< Its modification time.
+    uint64_t log_offset_ = 0;       ///< Bytes of 'index.log' already applied.
+    bool loaded_ = false;
+};
+
+/**
+ * @brief Folds the write-ahead log into a new 'index.json' snapshot.
+ * @param project_root The root directory of the project.
+ */
+void compact_index(const std::filesystem::path& project_root);
+
+#endif // INDEX_LOG_HPP
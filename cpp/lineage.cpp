@@ -1,33 +1,84 @@
+#include "lineage.hpp"
 #include "tracer.hpp"
+#include "hashing.hpp"
+#include "checksum_cache.hpp"
+#include "index_log.hpp"
+#include "storage.hpp"
+#include "profiler.hpp"
+#include "parallel.hpp"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <unordered_set>
 #include <filesystem>
 #include "nlohmann/json.hpp"
 
 namespace fs = std::filesystem;
 
-// Function to load the index.json
+// Function to load the index of the project's storage backend
 nlohmann::json load_index(const fs::path& project_root) {
-    nlohmann::json index_json;
-    fs::path index_path = project_root / ".traceseq" / "index.json";
-    if (fs::exists(index_path)) {
-        std::ifstream index_file(index_path);
-        if (index_file.is_open()) {
-            index_file >> index_json;
-            index_file.close();
-        }
+    ProfileSpan span("load_index");
+    if (!fs::exists(project_root / ".traceseq")) {
+        return nlohmann::json();
     }
+    nlohmann::json index_json = open_storage(project_root)->index();
+    span.set_value("entries", static_cast<int64_t>(index_json.size()));
     return index_json;
 }
 
-// Function to save the index.json
+// Function to replace the index of the project's storage backend
 void save_index(const nlohmann::json& index_json, const fs::path& project_root) {
-    fs::path trace_dir = project_root / ".traceseq";
-    fs::create_directories(trace_dir);
-    std::ofstream output_index_file(trace_dir / "index.json");
-    output_index_file << std::setw(4) << index_json << std::endl;
-    output_index_file.close();
+    ProfileSpan span("save_index");
+    span.set_value("entries", static_cast<int64_t>(index_json.size()));
+    open_storage(project_root)->save_index(index_json);
+}
+
+// Whether the index holds untagged SHA256 checksums written before algorithm
+// tags existed. Keys are sorted, so the run of each "<algorithm>:" prefix is
+// skipped with one lookup instead of visiting every entry.
+static bool has_untagged_checksums(const nlohmann::json& index_json) {
+    if (!index_json.is_object()) {
+        return false;
+    }
+    const auto& entries = index_json.get_ref<const nlohmann::json::object_t&>();
+    auto it = entries.begin();
+    while (it != entries.end()) {
+        size_t colon = it->first.find(':');
+        if (colon == std::string::npos) {
+            return true;
+        }
+        // ';' sorts right after ':', so this is the first key past the prefix
+        it = entries.lower_bound(it->first.substr(0, colon) + ';');
+    }
+    return false;
+}
+
+std::string lookup_trace_id(const nlohmann::json& index_json, const std::string& filepath, const std::string& algorithm, ChecksumCache& checksum_cache) {
+    std::string checksum = checksum_cache.checksum(filepath, algorithm);
+    if (index_json.contains(checksum)) {
+        return index_json[checksum].get<std::string>();
+    }
+    // The index may mix algorithms: try every digest of this file that is
+    // already cached, which costs no extra read
+    for (const auto& other : checksum_algorithms()) {
+        if (other == algorithm) {
+            continue;
+        }
+        checksum = checksum_cache.lookup(filepath, other);
+        if (!checksum.empty() && index_json.contains(checksum)) {
+            return index_json[checksum].get<std::string>();
+        }
+    }
+    // Fall back to untagged SHA256 entries written by older versions, but
+    // only read the file again if the index has any
+    if (algorithm != kSha256Algorithm && has_untagged_checksums(index_json)) {
+        checksum = checksum_cache.checksum(filepath, kSha256Algorithm);
+        if (index_json.contains(checksum)) {
+            return index_json[checksum].get<std::string>();
+        }
+    }
+    return "";
 }
 
 // Map YAML node to TraceNode object
@@ -69,28 +120,107 @@ TraceNode yaml_to_tracenode(const YAML::Node& yaml_node) {
 }
 
 
-TraceNode load_node(const std::string& trace_id, const fs::path& project_root) {
-    fs::path file_path = project_root / ".traceseq" / "nodes" / (trace_id + ".yaml");
-    if (!fs::exists(file_path)) {
-        throw std::runtime_error("Trace node file not found: " + file_path.string());
+TraceNode load_node(const std::string& trace_id, const fs::path& project_root, TraceStorage& storage) {
+    ProfileSpan span("load_node");
+    span.set_detail(trace_id);
+    Profiler::count("nodes_loaded", 1);
+    TraceNode node;
+    if (!storage.load_node(trace_id, node)) {
+        throw std::runtime_error("Trace node not found: " + trace_id + " in " + project_root.string());
     }
-    YAML::Node yaml_node = YAML::LoadFile(file_path.string());
-    return yaml_to_tracenode(yaml_node);
+    return node;
 }
 
-std::vector<TraceNode> resolve_lineage(const std::string& trace_id, const fs::path& project_root) {
-    std::vector<TraceNode> lineage;
+TraceNode load_node(const std::string& trace_id, const fs::path& project_root) {
+    std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+    return load_node(trace_id, project_root, *storage);
+}
+
+// Follows parent pointers from a node to its root. The file layout walks
+// packed nodes through the offset index alone and SQLite reads only the
+// parent column; per-file nodes are parsed on the way.
+static std::vector<std::string> walk_ancestors(const std::string& trace_id, TraceStorage& storage) {
+    std::vector<std::string> ids;
+    std::unordered_set<std::string> visited;
     std::string current_trace_id = trace_id;
 
     while (current_trace_id != "null" && !current_trace_id.empty()) {
+        if (!visited.insert(current_trace_id).second) {
+            std::cerr << "Error resolving lineage: parent cycle at trace node " << current_trace_id << std::endl;
+            break;
+        }
+        std::string parent;
         try {
-            TraceNode node = load_node(current_trace_id, project_root);
-            lineage.insert(lineage.begin(), node); // Add to the front to maintain order from root to current
-            current_trace_id = node.parent;
+            if (!storage.find_parent(current_trace_id, parent)) {
+                std::cerr << "Error resolving lineage: Trace node not found: " << current_trace_id << std::endl;
+                break;
+            }
         } catch (const std::runtime_error& e) {
             std::cerr << "Error resolving lineage: " << e.what() << std::endl;
             break;
         }
+        ids.push_back(current_trace_id);
+        current_trace_id = parent;
     }
+    std::reverse(ids.begin(), ids.end()); // Root first
+    return ids;
+}
+
+std::vector<std::string> resolve_lineage_ids(const std::string& trace_id, const fs::path& project_root) {
+    std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+    return resolve_lineage_ids(trace_id, project_root, *storage);
+}
+
+std::vector<std::string> resolve_lineage_ids(const std::string& trace_id, const fs::path&, TraceStorage& storage) {
+    ProfileSpan span("resolve_lineage_ids");
+    span.set_detail(trace_id);
+    std::vector<std::string> ids = walk_ancestors(trace_id, storage);
+    span.set_value("depth", static_cast<int64_t>(ids.size()));
+    return ids;
+}
+
+std::vector<DescendantId> resolve_descendant_ids(const std::string& trace_id, const fs::path& project_root) {
+    std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+    return resolve_descendant_ids(trace_id, project_root, *storage);
+}
+
+std::vector<DescendantId> resolve_descendant_ids(const std::string& trace_id, const fs::path&, TraceStorage& storage) {
+    ProfileSpan span("resolve_descendant_ids");
+    span.set_detail(trace_id);
+    std::vector<DescendantId> descendants = storage.descendants(trace_id);
+    span.set_value("descendants", static_cast<int64_t>(descendants.size()));
+    return descendants;
+}
+
+std::vector<TraceNode> resolve_lineage(const std::string& trace_id, const fs::path& project_root) {
+    std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+    return resolve_lineage(trace_id, project_root, *storage);
+}
+
+std::vector<TraceNode> resolve_lineage(const std::string& trace_id, const fs::path& project_root, TraceStorage& storage) {
+    ProfileSpan span("resolve_lineage");
+    span.set_detail(trace_id);
+    std::vector<std::string> ids = walk_ancestors(trace_id, storage);
+
+    std::vector<TraceNode> lineage;
+    lineage.reserve(ids.size());
+    for (const auto& id : ids) {
+        try {
+            lineage.push_back(load_node(id, project_root, storage));
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Error resolving lineage: " << e.what() << std::endl;
+            break;
+        }
+    }
+    span.set_value("depth", static_cast<int64_t>(lineage.size()));
     return lineage;
 }
+
+std::vector<std::vector<TraceNode>> resolve_lineages(const std::vector<std::string>& trace_ids, const fs::path& project_root, unsigned int num_threads) {
+    std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+    std::vector<std::vector<TraceNode>> lineages(trace_ids.size());
+    parallel_for(trace_ids.size(), num_threads, [&](size_t i) {
+        lineages[i] = resolve_lineage(trace_ids[i], project_root, *storage);
+    });
+    return lineages;
+}
@@ -4,15 +4,21 @@
 #include <filesystem>
 #include "nlohmann/json.hpp"
 #include "tracer.hpp"
+#include "checksum_cache.hpp"
+#include "storage.hpp"
 
 namespace fs = std::filesystem;
 
 /**
- * @brief Loads the trace index from the '.traceseq/index.json' file.
+ * @brief Loads the trace index of a project.
  *
  * The index maps file checksums to trace node IDs, providing a lookup
- * mechanism for provenance information. If the index file does not exist,
- * an empty JSON object is returned.
+ * mechanism for provenance information. In the file layout the snapshot in
+ * '.traceseq/index.json' is combined with the records appended to
+ * 'index.log' since it was written, under a shared index lock so a
+ * concurrent compaction is never observed half way; a SQLite project reads
+ * its `file_index` table (see `open_storage`). If the project has no
+ * '.traceseq' directory, an empty JSON value is returned.
  *
  * @param project_root The root directory of the project.
  * @return A `nlohmann::json` object representing the loaded index.
@@ -20,22 +26,129 @@ namespace fs = std::filesystem;
 nlohmann::json load_index(const fs::path& project_root);
 
 /**
- * @brief Saves the trace index to the '.traceseq/index.json' file.
+ * @brief Replaces the trace index of a project.
  *
- * This function serializes the provided JSON object to the index file,
- * ensuring that the provenance lookup is up-to-date.
+ * In the file layout the snapshot '.traceseq/index.json' is replaced
+ * atomically under an exclusive index lock and the write-ahead log is
+ * cleared, since the new snapshot supersedes it; a SQLite project replaces
+ * its `file_index` table in one transaction. A load/modify/save cycle
+ * can still lose entries added by other processes in between; use
+ * `append_index` to add individual entries.
  *
  * @param index_json The `nlohmann::json` object representing the index to save.
  * @param project_root The root directory of the project.
  */
 void save_index(const nlohmann::json& index_json, const fs::path& project_root);
 
+/**
+ * @brief Finds the trace ID recorded in the index for a file.
+ *
+ * The file is hashed with the requested algorithm and looked up in the index.
+ * Because an index can hold checksums of several algorithms, a miss then
+ * tries every other algorithm whose checksum of the file is already in the
+ * checksum cache. Finally, if the algorithm is not plain SHA256 and the
+ * index holds untagged entries, the file is hashed again with SHA256 so that
+ * entries written before algorithm tags existed still resolve.
+ *
+ * @param index_json The loaded trace index.
+ * @param filepath The path of the file to look up.
+ * @param algorithm The preferred checksum algorithm (see `checksum_file`).
+ * @param checksum_cache The cache consulted before hashing the file.
+ * @return The trace ID, or an empty string if the file has no provenance.
+ * @throws std::runtime_error if the file cannot be hashed.
+ */
+std::string lookup_trace_id(const nlohmann::json& index_json, const std::string& filepath, const std::string& algorithm, ChecksumCache& checksum_cache);
+
+/**
+ * @brief Maps a parsed trace node YAML document to a TraceNode object.
+ * @param yaml_node The parsed YAML document.
+ * @return The TraceNode.
+ * @throws YAML::Exception if a required key is missing.
+ */
+TraceNode yaml_to_tracenode(const YAML::Node& yaml_node);
+
+/**
+ * @brief Loads a single trace node.
+ *
+ * The node is read from the project's storage backend (see `open_storage`),
+ * falling back to the per-file layout in '.traceseq/nodes'.
+ *
+ * @param trace_id The ID of the trace node to load.
+ * @param project_root The root directory of the project.
+ * @return The TraceNode.
+ * @throws std::runtime_error if the node does not exist.
+ */
+TraceNode load_node(const std::string& trace_id, const fs::path& project_root);
+
+/**
+ * @brief Loads a single trace node through an already opened storage.
+ *
+ * Long-lived callers keep one `TraceStorage` so the packed store's offset
+ * index is read, or the database opened, once.
+ *
+ * @param trace_id The ID of the trace node to load.
+ * @param project_root The root directory of the project.
+ * @param storage The project's storage.
+ * @return The TraceNode.
+ * @throws std::runtime_error if the node does not exist.
+ */
+TraceNode load_node(const std::string& trace_id, const fs::path& project_root, TraceStorage& storage);
+
+/**
+ * @brief Resolves the trace IDs in the lineage of a trace node.
+ *
+ * The ancestor chain is followed through parent pointers alone (see
+ * `TraceStorage::find_parent`): the packed store's offset index or the
+ * `parent` column, so no node payload is read; only nodes still stored as
+ * per-file YAML are parsed. The walk stops at a missing node or a parent
+ * cycle.
+ *
+ * @param trace_id The ID of the trace node for which to resolve the lineage.
+ * @param project_root The root directory of the project.
+ * @return The trace IDs, ordered from the oldest (root) to `trace_id`.
+ */
+std::vector<std::string> resolve_lineage_ids(const std::string& trace_id, const fs::path& project_root);
+
+/**
+ * @brief Resolves the trace IDs in the lineage of a trace node through an already opened storage.
+ * @param trace_id The ID of the trace node for which to resolve the lineage.
+ * @param project_root The root directory of the project.
+ * @param storage The project's storage.
+ * @return The trace IDs, ordered from the oldest (root) to `trace_id`.
+ */
+std::vector<std::string> resolve_lineage_ids(const std::string& trace_id, const fs::path& project_root, TraceStorage& storage);
+
+/**
+ * @brief Resolves the trace IDs of every node derived from a trace node.
+ *
+ * Children are found through the packed store's child lists (see
+ * `NodeStore::descendants`) or the index on the `parent` column, so no node
+ * payload is read and the cost depends on the number of descendants, not on
+ * the size of the store. Nodes still
+ * stored as per-file YAML are parsed once per call. A node reached twice
+ * through a parent cycle is reported once.
+ *
+ * @param trace_id The ID of the trace node whose descendants to resolve.
+ * @param project_root The root directory of the project.
+ * @return The descendants depth first, each after its parent and siblings in creation order; `trace_id` itself is not included.
+ */
+std::vector<DescendantId> resolve_descendant_ids(const std::string& trace_id, const fs::path& project_root);
+
+/**
+ * @brief Resolves the trace IDs of every node derived from a trace node through an already opened storage.
+ * @param trace_id The ID of the trace node whose descendants to resolve.
+ * @param project_root The root directory of the project.
+ * @param storage The project's storage.
+ * @return The descendants depth first, each after its parent; `trace_id` itself is not included.
+ */
+std::vector<DescendantId> resolve_descendant_ids(const std::string& trace_id, const fs::path& project_root, TraceStorage& storage);
+
 /**
  * @brief Resolves the full lineage of a trace node.
  *
  * This function reconstructs the entire provenance chain for a given
- * trace node ID by recursively loading parent nodes until the root
- * of the lineage is reached.
+ * trace node ID: the chain of IDs is computed with `resolve_lineage_ids`,
+ * then each node is loaded once.
  *
  * @param trace_id The ID of the trace node for which to resolve the lineage.
  * @param project_root The root directory of the project.
@@ -44,4 +157,27 @@ void save_index(const nlohmann::json& index_json, const fs::path& project_root);
  */
 std::vector<TraceNode> resolve_lineage(const std::string& trace_id, const fs::path& project_root);
 
+/**
+ * @brief Resolves the full lineage of a trace node through an already opened storage.
+ * @param trace_id The ID of the trace node for which to resolve the lineage.
+ * @param project_root The root directory of the project.
+ * @param storage The project's storage.
+ * @return The lineage, ordered from the oldest (root) to the most recent node.
+ */
+std::vector<TraceNode> resolve_lineage(const std::string& trace_id, const fs::path& project_root, TraceStorage& storage);
+
+/**
+ * @brief Resolves the lineages of many trace nodes concurrently.
+ *
+ * The lineages are resolved on a pool of worker threads sharing one
+ * storage, so the packed store's offset index is read once.
+ *
+ * @param trace_ids The IDs of the trace nodes whose lineages to resolve.
+ * @param project_root The root directory of the project.
+ * @param num_threads The number of worker threads (0 means one per hardware core).
+ * @return One lineage per trace ID, in the order of `trace_ids`; each is
+ *         ordered from the oldest (root) to the most recent node.
+ */
+std::vector<std::vector<TraceNode>> resolve_lineages(const std::vector<std::string>& trace_ids, const fs::path& project_root, unsigned int num_threads = 0);
+
 #endif // LINEAGE_HPP
@@ -0,0 +1,187 @@
+#include "lineage_columns.hpp"
+#include "lineage.hpp"
+#include "profiler.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+const std::vector<std::string>& LineageColumns::column_names() {
+    static const std::vector<std::string> names = {
+        "lineage", "depth", "trace_id", "parent", "timestamp",
+        "operation_class", "operation_method", "input_checksum", "output_checksum"};
+    return names;
+}
+
+const StringColumn* LineageColumns::string_column(const std::string& name) const {
+    if (name == "trace_id") return &trace_id;
+    if (name == "parent") return &parent;
+    if (name == "timestamp") return &timestamp;
+    if (name == "operation_class") return &operation_class;
+    if (name == "operation_method") return &operation_method;
+    if (name == "input_checksum") return &input_checksum;
+    if (name == "output_checksum") return &output_checksum;
+    return nullptr;
+}
+
+LineageColumns resolve_lineage_columns(const std::vector<std::string>& trace_ids, const fs::path& project_root, TraceStorage& storage) {
+    ProfileSpan span("resolve_lineage_columns");
+    LineageColumns columns;
+    // Lineages of one project share most of their ancestors
+    std::unordered_map<std::string, TraceNode> loaded;
+
+    for (size_t i = 0; i < trace_ids.size(); ++i) {
+        std::vector<std::string> ids = resolve_lineage_ids(trace_ids[i], project_root, storage);
+        for (size_t depth = 0; depth < ids.size(); ++depth) {
+            auto it = loaded.find(ids[depth]);
+            if (it == loaded.end()) {
+                try {
+                    it = loaded.emplace(ids[depth], load_node(ids[depth], project_root, storage)).first;
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "Error resolving lineage: " << e.what() << std::endl;
+                    break;
+                }
+            }
+            const TraceNode& node = it->second;
+            columns.lineage.push_back(static_cast<int32_t>(i));
+            columns.depth.push_back(static_cast<int32_t>(depth));
+            columns.trace_id.append(node.trace_id);
+            columns.parent.append(node.parent);
+            columns.timestamp.append(node.timestamp);
+            columns.operation_class.append(node.operation.op_class);
+            columns.operation_method.append(node.operation.method);
+            columns.input_checksum.append(node.input.checksum);
+            columns.output_checksum.append(node.output.checksum);
+        }
+    }
+    span.set_value("rows", static_cast<int64_t>(columns.rows()));
+    return columns;
+}
+
+namespace {
+
+// Every exported child owns a reference to the columns, so a consumer may
+// move a child out of the batch and release it on its own.
+struct ChildArrayData {
+    std::shared_ptr<const LineageColumns> columns;
+    const void* buffers[3] = {nullptr, nullptr, nullptr};
+};
+
+struct BatchArrayData {
+    std::vector<ArrowArray*> children;
+    const void* buffers[1] = {nullptr};
+};
+
+struct BatchSchemaData {
+    std::vector<ArrowSchema*> children;
+};
+
+void release_child_array(ArrowArray* array) {
+    delete static_cast<ChildArrayData*>(array->private_data);
+    array->release = nullptr;
+}
+
+void release_batch_array(ArrowArray* array) {
+    auto* data = static_cast<BatchArrayData*>(array->private_data);
+    for (ArrowArray* child : data->children) {
+        if (child->release) {
+            child->release(child);
+        }
+        delete child;
+    }
+    delete data;
+    array->release = nullptr;
+}
+
+void release_child_schema(ArrowSchema* schema) {
+    schema->release = nullptr;
+}
+
+void release_batch_schema(ArrowSchema* schema) {
+    auto* data = static_cast<BatchSchemaData*>(schema->private_data);
+    for (ArrowSchema* child : data->children) {
+        if (child->release) {
+            child->release(child);
+        }
+        delete child;
+    }
+    delete data;
+    schema->release = nullptr;
+}
+
+ArrowSchema* make_child_schema(const char* format, const char* name) {
+    auto* schema = new ArrowSchema();
+    schema->format = format;
+    schema->name = name;
+    schema->metadata = nullptr;
+    schema->flags = 0;
+    schema->n_children = 0;
+    schema->children = nullptr;
+    schema->dictionary = nullptr;
+    schema->release = release_child_schema;
+    schema->private_data = nullptr;
+    return schema;
+}
+
+ArrowArray* make_child_array(const std::shared_ptr<const LineageColumns>& columns, int64_t length,
+                             int64_t n_buffers, const void* second, const void* third) {
+    auto* data = new ChildArrayData();
+    data->columns = columns;
+    data->buffers[1] = second;
+    data->buffers[2] = third;
+    auto* array = new ArrowArray();
+    array->length = length;
+    array->null_count = 0;
+    array->offset = 0;
+    array->n_buffers = n_buffers;
+    array->n_children = 0;
+    array->buffers = data->buffers;
+    array->children = nullptr;
+    array->dictionary = nullptr;
+    array->release = release_child_array;
+    array->private_data = data;
+    return array;
+}
+
+} // namespace
+
+void export_lineage_columns(const std::shared_ptr<const LineageColumns>& columns, ArrowSchema* schema, ArrowArray* array) {
+    const std::vector<std::string>& names = LineageColumns::column_names();
+    const int64_t rows = static_cast<int64_t>(columns->rows());
+
+    auto* schema_data = new BatchSchemaData();
+    auto* array_data = new BatchArrayData();
+    for (const auto& name : names) {
+        const StringColumn* strings = columns->string_column(name);
+        if (strings) {
+            schema_data->children.push_back(make_child_schema("U", name.c_str()));
+            array_data->children.push_back(make_child_array(columns, rows, 3, strings->offsets.data(), strings->data.data()));
+        } else {
+            const std::vector<int32_t>& values = name == "lineage" ? columns->lineage : columns->depth;
+            schema_data->children.push_back(make_child_schema("i", name.c_str()));
+            array_data->children.push_back(make_child_array(columns, rows, 2, values.data(), nullptr));
+        }
+    }
+
+    schema->format = "+s";
+    schema->name = "";
+    schema->metadata = nullptr;
+    schema->flags = 0;
+    schema->n_children = static_cast<int64_t>(schema_data->children.size());
+    schema->children = schema_data->children.data();
+    schema->dictionary = nullptr;
+    schema->release = release_batch_schema;
+    schema->private_data = schema_data;
+
+    array->length = rows;
+    array->null_count = 0;
+    array->offset = 0;
+    array->n_buffers = 1;
+    array->n_children = static_cast<int64_t>(array_data->children.size());
+    array->buffers = array_data->buffers;
+    array->children = array_data->children.data();
+    array->dictionary = nullptr;
+    array->release = release_batch_array;
+    array->private_data = array_data;
+}
@@ -0,0 +1,125 @@
+#ifndef LINEAGE_COLUMNS_HPP
+#define LINEAGE_COLUMNS_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include "storage.hpp"
+
+// Arrow C data interface structures, declared exactly as the Arrow
+// specification requires so that any Arrow implementation can import them.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+/**
+ * @brief A string column in Arrow "large utf8" layout.
+ *
+ * Row i is `data[offsets[i], offsets[i + 1])`; `offsets` always holds one
+ * more entry than there are rows.
+ */
+struct StringColumn {
+    std::vector<int64_t> offsets{0}; ///< Start of every row plus the end of the last.
+    std::string data;                ///< All values back to back.
+
+    /// Appends a row.
+    void append(const std::string& value) {
+        data.append(value);
+        offsets.push_back(static_cast<int64_t>(data.size()));
+    }
+
+    /// Returns row `row` as a new string.
+    std::string at(size_t row) const {
+        return data.substr(static_cast<size_t>(offsets[row]), static_cast<size_t>(offsets[row + 1] - offsets[row]));
+    }
+};
+
+/**
+ * @brief The lineages of many trace nodes as one table of columns.
+ *
+ * Each row is one node of one requested lineage: rows of a lineage are
+ * contiguous and ordered from the root, and `lineage` gives the position of
+ * the requested trace ID. Ancestors shared by several lineages appear once
+ * per lineage but are read from the store once.
+ */
+struct LineageColumns {
+    std::vector<int32_t> lineage;  ///< Index into the requested trace IDs.
+    std::vector<int32_t> depth;    ///< Position within the lineage, 0 for the root.
+    StringColumn trace_id;
+    StringColumn parent;
+    StringColumn timestamp;
+    StringColumn operation_class;
+    StringColumn operation_method;
+    StringColumn input_checksum;
+    StringColumn output_checksum;
+
+    /// Number of rows.
+    size_t rows() const { return lineage.size(); }
+
+    /// Column names in table order, as exported to Arrow.
+    static const std::vector<std::string>& column_names();
+
+    /// The string column with the given name, or nullptr for a numeric or unknown column.
+    const StringColumn* string_column(const std::string& name) const;
+};
+
+/**
+ * @brief Resolves many lineages into columns.
+ *
+ * A lineage that cannot be resolved (unknown trace ID, missing ancestor)
+ * contributes only the rows that could be read, as `resolve_lineage` does.
+ *
+ * @param trace_ids The trace IDs whose lineages to resolve.
+ * @param project_root The root directory of the project.
+ * @param storage The project's storage.
+ * @return The rows of every lineage, in request order.
+ */
+LineageColumns resolve_lineage_columns(const std::vector<std::string>& trace_ids, const std::filesystem::path& project_root, TraceStorage& storage);
+
+/**
+ * @brief Exports columns through the Arrow C data interface without copying.
+ *
+ * The table is exported as a struct array (an Arrow record batch) of two
+ * int32 columns followed by large utf8 columns, in `column_names()` order.
+ * The exported buffers point into `columns`, which is kept alive until both
+ * structures have been released by their consumer.
+ *
+ * @param columns The columns to export.
+ * @param schema Filled with the table schema; the caller must release it.
+ * @param array Filled with the table data; the caller must release it.
+ */
+void export_lineage_columns(const std::shared_ptr<const LineageColumns>& columns, ArrowSchema* schema, ArrowArray* array);
+
+#endif // LINEAGE_COLUMNS_HPP
@@ -0,0 +1,329 @@
+#include "lineage_diff.hpp"
+#include "lineage.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// FNV-1a over length-prefixed fields, so ("ab", "c") and ("a", "bc") differ
+class SignatureHasher {
+public:
+    void add(const std::string& field) {
+        uint64_t length = field.size();
+        mix(reinterpret_cast<const char*>(&length), sizeof(length));
+        mix(field.data(), field.size());
+    }
+    uint64_t value() const { return hash_; }
+
+private:
+    void mix(const char* data, size_t length) {
+        for (size_t i = 0; i < length; ++i) {
+            hash_ ^= static_cast<unsigned char>(data[i]);
+            hash_ *= 1099511628211ull;
+        }
+    }
+    uint64_t hash_ = 14695981039346656037ull;
+};
+
+std::vector<std::string> sorted(std::vector<std::string> values) {
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+uint64_t kind_signature(const TraceNode& node) {
+    SignatureHasher hasher;
+    hasher.add(node.operation.op_class);
+    return hasher.value();
+}
+
+using Matches = std::vector<std::pair<size_t, size_t>>;
+
+// Finds a point on an optimal edit path through a[a0, a1) and b[b0, b1) by
+// running Myers' search from both ends until the paths overlap (the
+// "middle snake"). Returns false if the ranges share no element.
+bool middle_split(const std::vector<uint64_t>& a, size_t a0, size_t a1,
+                  const std::vector<uint64_t>& b, size_t b0, size_t b1,
+                  size_t& split_a, size_t& split_b) {
+    const long n = static_cast<long>(a1 - a0);
+    const long m = static_cast<long>(b1 - b0);
+    const long max_d = (n + m + 1) / 2;
+    const long v_offset = max_d;
+    const long v_length = 2 * max_d;
+    // v1[k] / v2[k]: furthest x reached on diagonal k from the front / back
+    std::vector<long> v1(static_cast<size_t>(v_length + 2), -1);
+    std::vector<long> v2(static_cast<size_t>(v_length + 2), -1);
+    v1[v_offset + 1] = 0;
+    v2[v_offset + 1] = 0;
+    const long delta = n - m;
+    // With an odd delta the front search detects the overlap, else the back
+    const bool front = (delta % 2 != 0);
+    long k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+    for (long d = 0; d < max_d; ++d) {
+        for (long k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+            const long k1_offset = v_offset + k1;
+            long x1 = (k1 == -d || (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1]))
+                          ? v1[k1_offset + 1] : v1[k1_offset - 1] + 1;
+            long y1 = x1 - k1;
+            while (x1 < n && y1 < m && a[a0 + x1] == b[b0 + y1]) {
+                ++x1;
+                ++y1;
+            }
+            v1[k1_offset] = x1;
+            if (x1 > n) {
+                k1end += 2;
+            } else if (y1 > m) {
+                k1start += 2;
+            } else if (front) {
+                const long k2_offset = v_offset + delta - k1;
+                if (k2_offset >= 0 && k2_offset < v_length && v2[k2_offset] != -1 && x1 >= n - v2[k2_offset]) {
+                    split_a = a0 + static_cast<size_t>(x1);
+                    split_b = b0 + static_cast<size_t>(y1);
+                    return true;
+                }
+            }
+        }
+        for (long k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+            const long k2_offset = v_offset + k2;
+            long x2 = (k2 == -d || (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1]))
+                          ? v2[k2_offset + 1] : v2[k2_offset - 1] + 1;
+            long y2 = x2 - k2;
+            while (x2 < n && y2 < m && a[a0 + n - x2 - 1] == b[b0 + m - y2 - 1]) {
+                ++x2;
+                ++y2;
+            }
+            v2[k2_offset] = x2;
+            if (x2 > n) {
+                k2end += 2;
+            } else if (y2 > m) {
+                k2start += 2;
+            } else if (!front) {
+                const long k1_offset = v_offset + delta - k2;
+                if (k1_offset >= 0 && k1_offset < v_length && v1[k1_offset] != -1) {
+                    const long x1 = v1[k1_offset];
+                    const long y1 = v_offset + x1 - k1_offset;
+                    if (x1 >= n - x2) {
+                        split_a = a0 + static_cast<size_t>(x1);
+                        split_b = b0 + static_cast<size_t>(y1);
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Appends the matched positions of a[a0, a1) and b[b0, b1), in order
+void match_range(const std::vector<uint64_t>& a, size_t a0, size_t a1,
+                 const std::vector<uint64_t>& b, size_t b0, size_t b1, Matches& matches) {
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0]) {
+        matches.emplace_back(a0++, b0++);
+    }
+    size_t suffix = 0;
+    while (a1 > a0 && b1 > b0 && a[a1 - 1] == b[b1 - 1]) {
+        --a1;
+        --b1;
+        ++suffix;
+    }
+    size_t split_a = 0, split_b = 0;
+    if (a0 < a1 && b0 < b1 && middle_split(a, a0, a1, b, b0, b1, split_a, split_b) &&
+        !(split_a == a0 && split_b == b0) && !(split_a == a1 && split_b == b1)) {
+        match_range(a, a0, split_a, b, b0, split_b, matches);
+        match_range(a, split_a, a1, b, split_b, b1, matches);
+    }
+    for (size_t i = 0; i < suffix; ++i) {
+        matches.emplace_back(a1 + i, b1 + i);
+    }
+}
+
+StepDiff make_step(StepChange change, long index_a, long index_b) {
+    StepDiff step;
+    step.change = change;
+    step.index_a = index_a;
+    step.index_b = index_b;
+    return step;
+}
+
+} // namespace
+
+uint64_t step_signature(const TraceNode& node) {
+    SignatureHasher hasher;
+    hasher.add(node.operation.op_class);
+    hasher.add(node.operation.method);
+    for (const auto& parameter : node.operation.parameters) {
+        hasher.add(parameter.first);
+        hasher.add(parameter.second);
+    }
+    hasher.add("|assumptions");
+    for (const auto& assumption : sorted(node.assumptions)) {
+        hasher.add(assumption);
+    }
+    hasher.add(node.data_class);
+    hasher.add(node.output.data_class);
+    hasher.add(node.output.unit);
+    hasher.add(node.environment.language);
+    hasher.add(node.environment.tool);
+    hasher.add(node.environment.version);
+    return hasher.value();
+}
+
+std::vector<std::string> step_differences(const TraceNode& a, const TraceNode& b) {
+    std::vector<std::string> fields;
+    if (a.operation.op_class != b.operation.op_class) fields.push_back("operation.class");
+    if (a.operation.method != b.operation.method) fields.push_back("operation.method");
+    if (a.operation.parameters != b.operation.parameters) fields.push_back("operation.parameters");
+    if (sorted(a.assumptions) != sorted(b.assumptions)) fields.push_back("assumptions");
+    if (a.data_class != b.data_class) fields.push_back("data_class");
+    if (a.output.data_class != b.output.data_class) fields.push_back("output.data_class");
+    if (a.output.unit != b.output.unit) fields.push_back("output.unit");
+    if (a.environment.language != b.environment.language || a.environment.tool != b.environment.tool ||
+        a.environment.version != b.environment.version) {
+        fields.push_back("environment");
+    }
+    return fields;
+}
+
+std::vector<StepDiff> align_steps(const std::vector<uint64_t>& signatures_a, const std::vector<uint64_t>& kinds_a,
+                                  const std::vector<uint64_t>& signatures_b, const std::vector<uint64_t>& kinds_b) {
+    Matches matches;
+    match_range(signatures_a, 0, signatures_a.size(), signatures_b, 0, signatures_b.size(), matches);
+
+    std::vector<StepDiff> steps;
+    size_t ia = 0, ib = 0;
+    // Steps between two matches: pair those of the same operation class as
+    // changed, report the rest as removed or inserted
+    auto emit_gap = [&](size_t a_end, size_t b_end) {
+        Matches kind_matches;
+        match_range(kinds_a, ia, a_end, kinds_b, ib, b_end, kind_matches);
+        for (const auto& match : kind_matches) {
+            while (ia < match.first) {
+                steps.push_back(make_step(StepChange::Removed, static_cast<long>(ia++), -1));
+            }
+            while (ib < match.second) {
+                steps.push_back(make_step(StepChange::Inserted, -1, static_cast<long>(ib++)));
+            }
+            steps.push_back(make_step(StepChange::Changed, static_cast<long>(ia++), static_cast<long>(ib++)));
+        }
+        while (ia < a_end) {
+            steps.push_back(make_step(StepChange::Removed, static_cast<long>(ia++), -1));
+        }
+        while (ib < b_end) {
+            steps.push_back(make_step(StepChange::Inserted, -1, static_cast<long>(ib++)));
+        }
+    };
+    for (const auto& match : matches) {
+        emit_gap(match.first, match.second);
+        steps.push_back(make_step(StepChange::Unchanged, static_cast<long>(ia++), static_cast<long>(ib++)));
+    }
+    emit_gap(signatures_a.size(), signatures_b.size());
+    return steps;
+}
+
+LineageDiffer::LineageDiffer(const fs::path& project_root, TraceStorage& storage)
+    : project_root_(project_root), storage_(storage) {}
+
+const LineageDiffer::Step& LineageDiffer::step(const std::string& trace_id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = steps_.find(trace_id);
+        if (it != steps_.end()) {
+            return it->second;
+        }
+    }
+    Step loaded;
+    loaded.node = load_node(trace_id, project_root_, storage_);
+    loaded.signature = step_signature(loaded.node);
+    loaded.kind = kind_signature(loaded.node);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return steps_.emplace(trace_id, std::move(loaded)).first->second;
+}
+
+const TraceNode& LineageDiffer::node(const std::string& trace_id) {
+    return step(trace_id).node;
+}
+
+const std::vector<std::string>& LineageDiffer::lineage_ids(const std::string& trace_id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = lineages_.find(trace_id);
+        if (it != lineages_.end()) {
+            return it->second;
+        }
+    }
+    std::vector<std::string> ids = resolve_lineage_ids(trace_id, project_root_, storage_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lineages_.emplace(trace_id, std::move(ids)).first->second;
+}
+
+LineageDiff LineageDiffer::diff(const std::string& trace_id_a, const std::string& trace_id_b) {
+    ProfileSpan span("diff_lineages");
+    LineageDiff result;
+    result.trace_id_a = trace_id_a;
+    result.trace_id_b = trace_id_b;
+    result.lineage_a = lineage_ids(trace_id_a);
+    result.lineage_b = lineage_ids(trace_id_b);
+    const auto& ids_a = result.lineage_a;
+    const auto& ids_b = result.lineage_b;
+
+    // A common ancestry is the very same nodes; it needs no loading
+    size_t shared = 0;
+    while (shared < ids_a.size() && shared < ids_b.size() && ids_a[shared] == ids_b[shared]) {
+        ++shared;
+    }
+    result.shared_ancestors = shared;
+    result.unchanged = shared;
+
+    std::vector<uint64_t> signatures_a, kinds_a, signatures_b, kinds_b;
+    for (size_t i = shared; i < ids_a.size(); ++i) {
+        const Step& s = step(ids_a[i]);
+        signatures_a.push_back(s.signature);
+        kinds_a.push_back(s.kind);
+    }
+    for (size_t i = shared; i < ids_b.size(); ++i) {
+        const Step& s = step(ids_b[i]);
+        signatures_b.push_back(s.signature);
+        kinds_b.push_back(s.kind);
+    }
+
+    result.steps = align_steps(signatures_a, kinds_a, signatures_b, kinds_b);
+    for (auto& step_diff : result.steps) {
+        if (step_diff.index_a >= 0) {
+            step_diff.index_a += static_cast<long>(shared);
+        }
+        if (step_diff.index_b >= 0) {
+            step_diff.index_b += static_cast<long>(shared);
+        }
+        if (step_diff.change == StepChange::Unchanged || step_diff.change == StepChange::Changed) {
+            // Also guards against signature collisions
+            step_diff.fields = step_differences(node(ids_a[step_diff.index_a]), node(ids_b[step_diff.index_b]));
+            step_diff.change = step_diff.fields.empty() ? StepChange::Unchanged : StepChange::Changed;
+        }
+        switch (step_diff.change) {
+            case StepChange::Unchanged: ++result.unchanged; break;
+            case StepChange::Changed: ++result.changed; break;
+            case StepChange::Removed: ++result.removed; break;
+            case StepChange::Inserted: ++result.inserted; break;
+        }
+    }
+    span.set_value("steps", static_cast<int64_t>(result.steps.size()));
+    return result;
+}
+
+std::vector<LineageDiff> LineageDiffer::diff_many(const std::string& reference, const std::vector<std::string>& others, unsigned int num_threads) {
+    std::vector<LineageDiff> diffs(others.size());
+    parallel_for(others.size(), num_threads, [&](size_t i) {
+        try {
+            diffs[i] = diff(reference, others[i]);
+        } catch (const std::exception& e) {
+            diffs[i].trace_id_a = reference;
+            diffs[i].trace_id_b = others[i];
+            diffs[i].error = e.what();
+        }
+    });
+    return diffs;
+}
@@ -0,0 +1,150 @@
+#ifndef LINEAGE_DIFF_HPP
+#define LINEAGE_DIFF_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "tracer.hpp"
+#include "storage.hpp"
+
+/**
+ * @brief Canonical 64-bit digest of what a step did.
+ *
+ * Covers the operation class, method and parameters, the assumptions (in
+ * sorted order), the input and output data classes, the output unit and the
+ * environment. Trace IDs, parents, timestamps and checksums are excluded, so
+ * re-running the same step on new data gives the same signature.
+ *
+ * @param node The step.
+ * @return The signature.
+ */
+uint64_t step_signature(const TraceNode& node);
+
+/**
+ * @brief Names the semantic fields in which two steps differ.
+ * @param a The first step.
+ * @param b The second step.
+ * @return Field names such as "operation.method" or "assumptions"; empty if the steps are equivalent.
+ */
+std::vector<std::string> step_differences(const TraceNode& a, const TraceNode& b);
+
+/// How one aligned step relates the two lineages.
+enum class StepChange {
+    Unchanged, ///< Present in both with the same semantics.
+    Changed,   ///< Same operation class in both, but other fields differ.
+    Removed,   ///< Only in lineage A.
+    Inserted,  ///< Only in lineage B.
+};
+
+/**
+ * @brief One step of an aligned pair of lineages.
+ */
+struct StepDiff {
+    StepChange change = StepChange::Unchanged;
+    long index_a = -1;                ///< Position in lineage A (root is 0), -1 if inserted.
+    long index_b = -1;                ///< Position in lineage B (root is 0), -1 if removed.
+    std::vector<std::string> fields;  ///< For changed steps, the differing fields.
+};
+
+/**
+ * @brief Aligns two sequences of step signatures.
+ *
+ * Uses Myers' O(ND) difference algorithm in linear space (divide and
+ * conquer on the middle snake), trimming common prefixes and suffixes at
+ * every level. Steps left unmatched between two matches are aligned again
+ * by `kinds_*` (the operation class); pairs found there are reported as
+ * changed, the rest as removed or inserted.
+ *
+ * @param signatures_a Signatures of lineage A, root first.
+ * @param kinds_a Operation-class digests of lineage A.
+ * @param signatures_b Signatures of lineage B, root first.
+ * @param kinds_b Operation-class digests of lineage B.
+ * @return The aligned steps in lineage order; changed steps carry no field names.
+ */
+std::vector<StepDiff> align_steps(const std::vector<uint64_t>& signatures_a, const std::vector<uint64_t>& kinds_a,
+                                  const std::vector<uint64_t>& signatures_b, const std::vector<uint64_t>& kinds_b);
+
+/**
+ * @brief The aligned difference of two lineages.
+ */
+struct LineageDiff {
+    std::string trace_id_a;                ///< Latest node of lineage A.
+    std::string trace_id_b;                ///< Latest node of lineage B.
+    std::vector<std::string> lineage_a;    ///< Trace IDs of lineage A, root first.
+    std::vector<std::string> lineage_b;    ///< Trace IDs of lineage B, root first.
+    size_t shared_ancestors = 0;           ///< Leading steps that are the very same trace nodes.
+    std::vector<StepDiff> steps;           ///< Aligned steps after the shared ancestors.
+    size_t unchanged = 0;                  ///< Unchanged steps, shared ancestors included.
+    size_t changed = 0;
+    size_t removed = 0;
+    size_t inserted = 0;
+    std::string error;                     ///< Set by `diff_many` when this diff could not be computed.
+
+    /// Whether both lineages describe the same sequence of steps.
+    bool identical() const { return changed == 0 && removed == 0 && inserted == 0; }
+};
+
+/**
+ * @brief Diffs lineages, sharing loaded nodes between diffs.
+ *
+ * Leading steps with identical trace IDs (a common ancestry) are counted as
+ * unchanged without loading them. Every other node is loaded and its
+ * signature computed once per differ, so diffing one reference against
+ * many outputs loads the reference and common ancestors once. A differ may
+ * be used from several threads.
+ */
+class LineageDiffer {
+public:
+    /**
+     * @param project_root The root directory of the project.
+     * @param storage The project's storage.
+     */
+    LineageDiffer(const std::filesystem::path& project_root, TraceStorage& storage);
+
+    /**
+     * @brief Diffs the lineages ending at two trace nodes.
+     * @param trace_id_a The latest node of lineage A.
+     * @param trace_id_b The latest node of lineage B.
+     * @return The aligned difference.
+     * @throws std::runtime_error if a node of either lineage cannot be loaded.
+     */
+    LineageDiff diff(const std::string& trace_id_a, const std::string& trace_id_b);
+
+    /**
+     * @brief Diffs one reference lineage against many others concurrently.
+     * @param reference The latest node of the reference lineage (A).
+     * @param others The latest nodes of the lineages to compare (B).
+     * @param num_threads The number of worker threads (0 means one per hardware core).
+     * @return One diff per entry of `others`, in order; failures are reported in `LineageDiff::error`.
+     */
+    std::vector<LineageDiff> diff_many(const std::string& reference, const std::vector<std::string>& others, unsigned int num_threads = 0);
+
+    /**
+     * @brief Returns a loaded node, loading it on first use.
+     * @param trace_id The node to return.
+     * @return The node; the reference stays valid for the differ's lifetime.
+     * @throws std::runtime_error if the node cannot be loaded.
+     */
+    const TraceNode& node(const std::string& trace_id);
+
+private:
+    struct Step {
+        TraceNode node;
+        uint64_t signature = 0;
+        uint64_t kind = 0;
+    };
+
+    const Step& step(const std::string& trace_id);
+    const std::vector<std::string>& lineage_ids(const std::string& trace_id);
+
+    std::filesystem::path project_root_;
+    TraceStorage& storage_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Step> steps_;
+    std::unordered_map<std::string, std::vector<std::string>> lineages_;
+};
+
+#endif // LINEAGE_DIFF_HPP
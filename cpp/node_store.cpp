@@ -0,0 +1,1151 @@
+#include "node_store.hpp"
+#include "file_lock.hpp"
+#include "lineage.hpp"
+#include "node_yaml.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// offsets.idx: a 16-byte header (magic, then a u64 LE identifier picked
+// whenever the file is created or replaced) followed by fixed 128-byte records
+//   [0, 48)    trace_id, NUL padded
+//   [48, 96)   parent, NUL padded
+//   [96, 100)  segment number (u32 LE)
+//   [100, 108) payload offset (u64 LE)
+//   [108, 112) payload length (u32 LE)
+//   [112]      payload format
+//   [116, 120) FNV-1a of bytes [0, 116), to detect torn records
+static const char kIndexMagic[16] = {'T', 'S', 'O', 'F', 'F', 'v', '1', '\0'};
+static const size_t kIndexHeaderSize = sizeof(kIndexMagic);
+static const size_t kIndexMagicSize = 8;
+static const size_t kIndexRecordSize = 128;
+static const size_t kRecordChecksumOffset = 116;
+
+// Each segment record is an 8-byte header ("TSNR" + u32 LE length) then the payload
+static const char kSegmentRecordMagic[4] = {'T', 'S', 'N', 'R'};
+static const size_t kSegmentRecordHeaderSize = 8;
+
+static void put_u32(char* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+static void put_u64(char* out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const char* in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+static uint64_t get_u64(const char* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+static uint32_t fnv1a(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static std::string segment_name(uint32_t segment) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "seg-%06u.dat", segment);
+    return name;
+}
+
+static void write_fully(int fd, const char* data, size_t length, const fs::path& path) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::write(fd, data + done, length - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Could not write: " + path.string());
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+// Identifies one offset index file, so that readers notice when a
+// compaction replaces it even if the new file reuses an inode
+static uint64_t new_index_id() {
+    std::random_device random;
+    uint64_t id = (static_cast<uint64_t>(random()) << 32) ^ random();
+    id ^= static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    return id ^ static_cast<uint64_t>(::getpid());
+}
+
+static std::string index_header() {
+    std::string header(kIndexMagic, kIndexHeaderSize);
+    put_u64(&header[kIndexMagicSize], new_index_id());
+    return header;
+}
+
+// Appends `data` to `fd`, whose end is `start`, and syncs it. On failure the
+// file is cut back to `start` so that no partial record shifts later ones.
+static void append_durably(int fd, const std::string& data, off_t start, const fs::path& path) {
+    try {
+        write_fully(fd, data.data(), data.size(), path);
+        if (::fsync(fd) != 0) {
+            throw std::runtime_error("Could not sync: " + path.string());
+        }
+    } catch (...) {
+        if (::ftruncate(fd, start) != 0) {
+            throw std::runtime_error("Could not write, and could not remove the partial record: " + path.string());
+        }
+        throw;
+    }
+}
+
+// Writes a whole offset index next to `index_path` and renames it into place
+static void replace_index_file(const fs::path& index_path, const std::string& index_data) {
+    fs::path tmp_path = index_path;
+    tmp_path += ".tmp" + std::to_string(::getpid());
+    int idx_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (idx_fd < 0) {
+        throw std::runtime_error("Could not open offset index: " + tmp_path.string());
+    }
+    try {
+        write_fully(idx_fd, index_data.data(), index_data.size(), tmp_path);
+        if (::fsync(idx_fd) != 0) {
+            throw std::runtime_error("Could not sync offset index: " + tmp_path.string());
+        }
+    } catch (...) {
+        ::close(idx_fd);
+        fs::remove(tmp_path);
+        throw;
+    }
+    ::close(idx_fd);
+    fs::rename(tmp_path, index_path);
+    sync_directory(index_path.parent_path());
+}
+
+static bool valid_index_record(const char* record) {
+    return get_u32(record + kRecordChecksumOffset) == fnv1a(record, kRecordChecksumOffset);
+}
+
+// Fills a zeroed kIndexRecordSize-byte offset index record
+static void encode_index_record(const NodeLocation& location, char* record) {
+    std::memcpy(record, location.trace_id.data(), location.trace_id.size());
+    std::memcpy(record + 48, location.parent.data(), location.parent.size());
+    put_u32(record + 96, location.segment);
+    put_u64(record + 100, location.offset);
+    put_u32(record + 108, location.length);
+    record[112] = static_cast<char>(location.format);
+    put_u32(record + kRecordChecksumOffset, fnv1a(record, kRecordChecksumOffset));
+}
+
+// Returns the highest existing segment number, or 0 if there is none
+static uint32_t last_segment(const fs::path& store_dir) {
+    uint32_t last = 0;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(store_dir, ec)) {
+        std::string name = entry.path().filename().string();
+        unsigned int number = 0;
+        if (std::sscanf(name.c_str(), "seg-%u.dat", &number) == 1 && number > last) {
+            last = number;
+        }
+    }
+    return last;
+}
+
+// Creates the offset index with its header, or replaces one whose header is
+// torn (left by stores that wrote the header in place), keeping the records
+// behind it. Only the header is read unless it is torn. Called under store.lock.
+static void ensure_index_file(const fs::path& index_path) {
+    std::string contents;
+    int fd = ::open(index_path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        char header[kIndexHeaderSize];
+        ssize_t n = ::pread(fd, header, sizeof(header), 0);
+        if (n == static_cast<ssize_t>(sizeof(header)) && std::memcmp(header, kIndexMagic, kIndexMagicSize) == 0) {
+            ::close(fd);
+            return;
+        }
+        struct stat st;
+        if (n < 0 || ::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not read offset index: " + index_path.string());
+        }
+        contents.resize(static_cast<size_t>(st.st_size));
+        n = ::pread(fd, &contents[0], contents.size(), 0);
+        ::close(fd);
+        if (n != static_cast<ssize_t>(contents.size())) {
+            throw std::runtime_error("Could not read offset index: " + index_path.string());
+        }
+    } else if (errno != ENOENT) {
+        throw std::runtime_error("Could not open offset index: " + index_path.string());
+    }
+
+    // Records follow however much of the header made it to disk
+    std::string index_data = index_header();
+    for (size_t start = 0; start < kIndexHeaderSize && start + kIndexRecordSize <= contents.size(); ++start) {
+        if (!valid_index_record(&contents[start])) {
+            continue;
+        }
+        for (size_t at = start; at + kIndexRecordSize <= contents.size() && valid_index_record(&contents[at]);
+             at += kIndexRecordSize) {
+            index_data.append(contents, at, kIndexRecordSize);
+        }
+        break;
+    }
+    replace_index_file(index_path, index_data);
+}
+
+// Returns the end of the last whole, valid record of an offset index of
+// `size` bytes. An interrupted append leaves a partial record and possibly
+// whole records that never reached the disk, all at the end of the file, so
+// only that tail is read: the partial bytes are skipped by size and the
+// records before them are checked backwards until one is valid.
+static uint64_t valid_index_end(int fd, uint64_t size, const fs::path& index_path) {
+    uint64_t end = size - (size - kIndexHeaderSize) % kIndexRecordSize;
+    char record[kIndexRecordSize];
+    while (end > kIndexHeaderSize) {
+        ssize_t n = ::pread(fd, record, sizeof(record), static_cast<off_t>(end - kIndexRecordSize));
+        if (n != static_cast<ssize_t>(sizeof(record))) {
+            throw std::runtime_error("Could not read offset index: " + index_path.string());
+        }
+        if (valid_index_record(record)) {
+            break;
+        }
+        end -= kIndexRecordSize;
+    }
+    return end;
+}
+
+NodeStore::NodeStore(const fs::path& project_root)
+    : store_dir_(project_root / ".traceseq" / "segments") {}
+
+NodeStore::~NodeStore() {
+    for (const auto& pair : segment_fds_) {
+        ::close(pair.second);
+    }
+}
+
+void NodeStore::append(const std::vector<TraceNode>& nodes) {
+    if (nodes.empty()) {
+        return;
+    }
+    for (const auto& node : nodes) {
+        if (!fits_packed_store(node)) {
+            throw std::invalid_argument("Trace ID too long for the packed store: " + node.trace_id);
+        }
+    }
+
+    if (fs::create_directories(store_dir_)) {
+        sync_directory(store_dir_.parent_path());
+    }
+    FileLock store_lock(store_dir_ / "store.lock", FileLock::Mode::Exclusive);
+
+    // 1. Pick the active segment, rotating when it is full
+    uint32_t segment = std::max<uint32_t>(last_segment(store_dir_), 1);
+    fs::path segment_path = store_dir_ / segment_name(segment);
+    struct stat st;
+    bool new_segment = ::stat(segment_path.c_str(), &st) != 0;
+    if (!new_segment && static_cast<uint64_t>(st.st_size) >= kSegmentRotateBytes) {
+        ++segment;
+        segment_path = store_dir_ / segment_name(segment);
+        new_segment = true;
+    }
+    int seg_fd = ::open(segment_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (seg_fd < 0) {
+        throw std::runtime_error("Could not open segment: " + segment_path.string());
+    }
+    uint64_t segment_size = 0;
+    if (::fstat(seg_fd, &st) == 0) {
+        segment_size = static_cast<uint64_t>(st.st_size);
+    }
+
+    // 2. Append every payload to the segment and make it durable
+    std::string segment_data;
+    std::string index_data(nodes.size() * kIndexRecordSize, '\0');
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const TraceNode& node = nodes[i];
+        std::string payload = encode_node_binary(node);
+
+        char header[kSegmentRecordHeaderSize];
+        std::memcpy(header, kSegmentRecordMagic, sizeof(kSegmentRecordMagic));
+        put_u32(header + 4, static_cast<uint32_t>(payload.size()));
+        segment_data.append(header, sizeof(header));
+        uint64_t payload_offset = segment_size + segment_data.size();
+        segment_data.append(payload);
+
+        NodeLocation location;
+        location.trace_id = node.trace_id;
+        location.parent = node.parent;
+        location.segment = segment;
+        location.offset = payload_offset;
+        location.length = static_cast<uint32_t>(payload.size());
+        location.format = NodeFormat::Binary;
+        encode_index_record(location, &index_data[i * kIndexRecordSize]);
+    }
+    try {
+        append_durably(seg_fd, segment_data, static_cast<off_t>(segment_size), segment_path);
+    } catch (...) {
+        ::close(seg_fd);
+        throw;
+    }
+    ::close(seg_fd);
+    // A segment created here must not be lost once the index points into it
+    if (new_segment) {
+        sync_directory(store_dir_);
+    }
+
+    // 3. Publish the nodes by appending their offset records after the last
+    // whole one, dropping any tail a failed or interrupted append left behind
+    fs::path index_path = store_dir_ / "offsets.idx";
+    ensure_index_file(index_path);
+    int idx_fd = ::open(index_path.c_str(), O_RDWR | O_APPEND);
+    if (idx_fd < 0) {
+        throw std::runtime_error("Could not open offset index: " + index_path.string());
+    }
+    uint64_t valid_end = 0;
+    uint64_t index_id = 0;
+    try {
+        char header[kIndexHeaderSize];
+        if (::fstat(idx_fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < kIndexHeaderSize ||
+            ::pread(idx_fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+            throw std::runtime_error("Could not read offset index: " + index_path.string());
+        }
+        index_id = get_u64(header + kIndexMagicSize);
+        valid_end = valid_index_end(idx_fd, static_cast<uint64_t>(st.st_size), index_path);
+        if (static_cast<uint64_t>(st.st_size) > valid_end && ::ftruncate(idx_fd, static_cast<off_t>(valid_end)) != 0) {
+            throw std::runtime_error("Could not remove a torn record from the offset index: " + index_path.string());
+        }
+        append_durably(idx_fd, index_data, static_cast<off_t>(valid_end), index_path);
+    } catch (...) {
+        ::close(idx_fd);
+        throw;
+    }
+    ::close(idx_fd);
+
+    // 4. A view that had read up to where the new records went takes them
+    // as they are; any other catches up on its next refresh
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_id == index_id_ && index_offset_ == valid_end) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            add_record_locked(&index_data[i * kIndexRecordSize]);
+        }
+    }
+}
+
+// Maps the offset index and parses the records appended since the last
+// refresh, so opening a large store costs one mapping rather than a stream
+// read per record.
+void NodeStore::refresh() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refresh_locked();
+}
+
+// Returns false if the index exists but could not be read
+bool NodeStore::refresh_locked() {
+    fs::path index_path = store_dir_ / "offsets.idx";
+    int fd = ::open(index_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    char header[kIndexHeaderSize];
+    if (static_cast<uint64_t>(st.st_size) < kIndexHeaderSize ||
+        ::pread(fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        std::memcmp(header, kIndexMagic, kIndexMagicSize) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if (get_u64(header + kIndexMagicSize) != index_id_) {
+        // Replaced by a compaction: start over with the new index
+        reset_locked();
+        index_id_ = get_u64(header + kIndexMagicSize);
+    }
+    if (index_offset_ == 0) {
+        index_offset_ = kIndexHeaderSize;
+    }
+    if (static_cast<uint64_t>(st.st_size) < index_offset_ + kIndexRecordSize) {
+        ::close(fd);
+        return true;
+    }
+    size_t file_size = static_cast<size_t>(st.st_size);
+    void* mapping = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    const char* data = static_cast<const char*>(mapping);
+
+    size_t new_records = (file_size - index_offset_) / kIndexRecordSize;
+    entries_.reserve(entries_.size() + new_records);
+    by_id_.reserve(entries_.size() + new_records);
+
+    while (index_offset_ + kIndexRecordSize <= file_size) {
+        const char* record = data + index_offset_;
+        if (!valid_index_record(record)) {
+            break; // Torn record; it will be complete on a later refresh
+        }
+        add_record_locked(record);
+    }
+    ::munmap(mapping, file_size);
+    return true;
+}
+
+// Applies one valid offset index record and advances past it
+void NodeStore::add_record_locked(const char* record) {
+    NodeLocation location;
+    location.trace_id.assign(record, strnlen(record, kMaxPackedIdLength));
+    location.parent.assign(record + 48, strnlen(record + 48, kMaxPackedIdLength));
+    location.segment = get_u32(record + 96);
+    location.offset = get_u64(record + 100);
+    location.length = get_u32(record + 108);
+    location.format = static_cast<NodeFormat>(record[112]);
+
+    auto inserted = by_id_.emplace(location.trace_id, entries_.size());
+    const size_t position = inserted.first->second;
+    if (inserted.second) {
+        entries_.push_back(std::move(location));
+        if (children_indexed_) {
+            add_node_locked(position);
+        }
+    } else if (children_indexed_ && entries_[position].parent != location.parent) {
+        unlink_parent_locked(position);
+        entries_[position] = std::move(location);
+        link_parent_locked(position);
+    } else {
+        entries_[position] = std::move(location);
+    }
+    index_offset_ += kIndexRecordSize;
+}
+
+bool NodeStore::find(const std::string& trace_id, NodeLocation& location) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_id_.find(trace_id);
+    if (it == by_id_.end()) {
+        refresh_locked();
+        it = by_id_.find(trace_id);
+        if (it == by_id_.end()) {
+            return false;
+        }
+    }
+    location = entries_[it->second];
+    return true;
+}
+
+int NodeStore::segment_fd(uint32_t segment) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = segment_fds_.find(segment);
+    if (it != segment_fds_.end()) {
+        return it->second;
+    }
+    fs::path segment_path = store_dir_ / segment_name(segment);
+    int fd = ::open(segment_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open segment: " + segment_path.string());
+    }
+    segment_fds_[segment] = fd;
+    return fd;
+}
+
+std::string NodeStore::read_payload(const NodeLocation& location) {
+    int fd = segment_fd(location.segment);
+    std::string payload(location.length, '\0');
+    size_t done = 0;
+    while (done < payload.size()) {
+        ssize_t n = ::pread(fd, &payload[done], payload.size() - done, static_cast<off_t>(location.offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Could not read trace node " + location.trace_id + " from " + segment_name(location.segment));
+        }
+        done += static_cast<size_t>(n);
+    }
+    return payload;
+}
+
+// Segment descriptors stay open across a reset: segment numbers are never
+// reused, so a cached descriptor always refers to the segment it was opened for.
+void NodeStore::reset_locked() {
+    entries_.clear();
+    by_id_.clear();
+    first_child_.clear();
+    last_child_.clear();
+    next_sibling_.clear();
+    orphans_.clear();
+    children_indexed_ = false;
+    index_offset_ = 0;
+}
+
+void NodeStore::build_children_locked() {
+    first_child_.assign(entries_.size(), kNoNode);
+    last_child_.assign(entries_.size(), kNoNode);
+    next_sibling_.assign(entries_.size(), kNoNode);
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        link_parent_locked(i);
+    }
+    children_indexed_ = true;
+}
+
+// Indexes a node appended after the child lists were built, adopting
+// children that were appended before it
+void NodeStore::add_node_locked(size_t position) {
+    first_child_.push_back(kNoNode);
+    last_child_.push_back(kNoNode);
+    next_sibling_.push_back(kNoNode);
+    link_parent_locked(position);
+    auto orphans = orphans_.find(entries_[position].trace_id);
+    if (orphans != orphans_.end()) {
+        for (size_t child : orphans->second) {
+            link_child_locked(position, child);
+        }
+        orphans_.erase(orphans);
+    }
+}
+
+void NodeStore::link_parent_locked(size_t position) {
+    const std::string& parent = entries_[position].parent;
+    if (parent.empty() || parent == "null") {
+        return;
+    }
+    auto it = by_id_.find(parent);
+    if (it != by_id_.end()) {
+        link_child_locked(it->second, position);
+    } else {
+        orphans_[parent].push_back(position);
+    }
+}
+
+// Only needed when a trace ID is appended again with another parent
+void NodeStore::unlink_parent_locked(size_t position) {
+    const std::string& parent = entries_[position].parent;
+    auto it = by_id_.find(parent);
+    if (it == by_id_.end()) {
+        auto orphans = orphans_.find(parent);
+        if (orphans != orphans_.end()) {
+            auto& siblings = orphans->second;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), position), siblings.end());
+        }
+        return;
+    }
+    size_t previous = kNoNode;
+    for (size_t child = first_child_[it->second]; child != kNoNode; previous = child, child = next_sibling_[child]) {
+        if (child != position) {
+            continue;
+        }
+        (previous == kNoNode ? first_child_[it->second] : next_sibling_[previous]) = next_sibling_[child];
+        if (last_child_[it->second] == child) {
+            last_child_[it->second] = previous;
+        }
+        next_sibling_[child] = kNoNode;
+        return;
+    }
+}
+
+void NodeStore::link_child_locked(size_t parent, size_t child) {
+    next_sibling_[child] = kNoNode;
+    if (first_child_[parent] == kNoNode) {
+        first_child_[parent] = child;
+    } else {
+        next_sibling_[last_child_[parent]] = child;
+    }
+    last_child_[parent] = child;
+}
+
+std::vector<NodeLocation> NodeStore::children(const std::string& trace_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!children_indexed_) {
+        build_children_locked();
+    }
+    std::vector<NodeLocation> locations;
+    auto it = by_id_.find(trace_id);
+    if (it != by_id_.end()) {
+        for (size_t child = first_child_[it->second]; child != kNoNode; child = next_sibling_[child]) {
+            locations.push_back(entries_[child]);
+        }
+    } else {
+        auto orphans = orphans_.find(trace_id);
+        if (orphans != orphans_.end()) {
+            for (size_t child : orphans->second) {
+                locations.push_back(entries_[child]);
+            }
+        }
+    }
+    return locations;
+}
+
+std::vector<DescendantId> NodeStore::descendants(const std::string& trace_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!children_indexed_) {
+        build_children_locked();
+    }
+    std::vector<DescendantId> found;
+    std::vector<std::pair<size_t, size_t>> stack; // Position and depth
+    auto push_children = [&](size_t first, size_t depth) {
+        const size_t begin = stack.size();
+        for (size_t child = first; child != kNoNode; child = next_sibling_[child]) {
+            stack.emplace_back(child, depth);
+        }
+        std::reverse(stack.begin() + static_cast<std::ptrdiff_t>(begin), stack.end());
+    };
+    auto it = by_id_.find(trace_id);
+    if (it != by_id_.end()) {
+        push_children(first_child_[it->second], 1);
+    } else {
+        auto orphans = orphans_.find(trace_id);
+        if (orphans != orphans_.end()) {
+            for (auto child = orphans->second.rbegin(); child != orphans->second.rend(); ++child) {
+                stack.emplace_back(*child, 1);
+            }
+        }
+    }
+    std::vector<char> visited(entries_.size(), 0);
+    if (it != by_id_.end()) {
+        visited[it->second] = 1;
+    }
+    while (!stack.empty()) {
+        const size_t position = stack.back().first;
+        const size_t depth = stack.back().second;
+        stack.pop_back();
+        if (visited[position]) {
+            continue; // Parent cycle
+        }
+        visited[position] = 1;
+        found.push_back(DescendantId{entries_[position].trace_id, depth});
+        push_children(first_child_[position], depth + 1);
+    }
+    return found;
+}
+
+bool NodeStore::load(const std::string& trace_id, TraceNode& node) {
+    NodeLocation location;
+    if (!find(trace_id, location)) {
+        return false;
+    }
+    std::string payload;
+    try {
+        payload = read_payload(location);
+    } catch (const std::runtime_error&) {
+        // A compaction may have moved the node since its location was read
+        refresh();
+        NodeLocation moved;
+        if (!find(trace_id, moved) || (moved.segment == location.segment && moved.offset == location.offset)) {
+            throw;
+        }
+        location = moved;
+        payload = read_payload(location);
+    }
+    node = decode_node_payload(location.format, payload);
+    return true;
+}
+
+std::vector<NodeLocation> NodeStore::locations() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refresh_locked();
+    return entries_;
+}
+
+std::vector<NodeLocation> NodeStore::locations(size_t first, uint64_t& generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refresh_locked();
+    generation = index_id_;
+    if (first >= entries_.size()) {
+        return {};
+    }
+    return std::vector<NodeLocation>(entries_.begin() + static_cast<std::ptrdiff_t>(first), entries_.end());
+}
+
+bool NodeStore::locations_at(const std::vector<uint32_t>& positions, uint64_t generation, std::vector<NodeLocation>& locations) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation != index_id_) {
+        return false;
+    }
+    locations.clear();
+    locations.reserve(positions.size());
+    for (uint32_t position : positions) {
+        if (position >= entries_.size()) {
+            return false;
+        }
+        locations.push_back(entries_[position]);
+    }
+    return true;
+}
+
+std::map<uint32_t, uint64_t> NodeStore::segment_sizes() const {
+    std::map<uint32_t, uint64_t> sizes;
+    std::error_code ec;
+    for (fs::directory_iterator it(store_dir_, ec), end; !ec && it != end; it.increment(ec)) {
+        unsigned int number = 0;
+        std::string name = it->path().filename().string();
+        if (std::sscanf(name.c_str(), "seg-%u.dat", &number) == 1) {
+            std::error_code size_ec;
+            uint64_t size = fs::file_size(it->path(), size_ec);
+            sizes[number] = size_ec ? 0 : size;
+        }
+    }
+    return sizes;
+}
+
+// 'compacted' lists the segments written by compactions, one number per line
+std::set<uint32_t> NodeStore::compacted_segments() const {
+    std::set<uint32_t> segments;
+    std::ifstream in(store_dir_ / "compacted");
+    uint32_t number = 0;
+    while (in >> number) {
+        if (fs::exists(store_dir_ / segment_name(number))) {
+            segments.insert(number);
+        }
+    }
+    return segments;
+}
+
+CompactionResult NodeStore::compact(const CompactionPlan& plan, unsigned int num_threads) {
+    ProfileSpan span("NodeStore::compact");
+    fs::create_directories(store_dir_);
+    FileLock store_lock(store_dir_ / "store.lock", FileLock::Mode::Exclusive);
+
+    std::vector<NodeLocation> current;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refresh_locked();
+        current = entries_;
+    }
+    CompactionResult result;
+    const std::map<uint32_t, uint64_t> sizes_before = segment_sizes();
+    for (const auto& pair : sizes_before) {
+        result.bytes_before += pair.second;
+    }
+
+    // 1. Sort what is kept into nodes that stay and nodes to copy, the
+    //    latter in the planned order
+    struct Copy {
+        size_t rank;                       ///< Position in plan.order, or SIZE_MAX.
+        size_t sequence;                   ///< Append order, to break ties.
+        const NodeLocation* location;      ///< Packed source, or nullptr.
+        const TraceNode* node;             ///< Unpacked source, or nullptr.
+    };
+    std::unordered_map<std::string, size_t> rank;
+    for (size_t i = 0; i < plan.order.size(); ++i) {
+        rank.emplace(plan.order[i], i);
+    }
+    auto rank_of = [&rank](const std::string& trace_id) {
+        auto it = rank.find(trace_id);
+        return it == rank.end() ? SIZE_MAX : it->second;
+    };
+    std::vector<Copy> copies;
+    std::vector<NodeLocation> kept;
+    std::unordered_set<std::string> packed;
+    for (size_t i = 0; i < current.size(); ++i) {
+        const NodeLocation& location = current[i];
+        packed.insert(location.trace_id);
+        if (plan.drop.count(location.trace_id)) {
+            ++result.nodes_dropped;
+        } else if (plan.rewrite_segments.count(location.segment)) {
+            copies.push_back(Copy{rank_of(location.trace_id), i, &location, nullptr});
+        } else {
+            kept.push_back(location);
+        }
+    }
+    for (size_t i = 0; i < plan.unpacked.size(); ++i) {
+        const TraceNode& node = plan.unpacked[i];
+        if (packed.count(node.trace_id) || plan.drop.count(node.trace_id) || !fits_packed_store(node)) {
+            continue;
+        }
+        copies.push_back(Copy{rank_of(node.trace_id), current.size() + i, nullptr, &node});
+    }
+    std::sort(copies.begin(), copies.end(), [](const Copy& a, const Copy& b) {
+        return a.rank != b.rank ? a.rank < b.rank : a.sequence < b.sequence;
+    });
+
+    // 2. Copy them into new segments, numbered above every existing one
+    uint32_t segment = last_segment(store_dir_) + 1;
+    std::vector<fs::path> written;
+    std::vector<NodeLocation> copied;
+    copied.reserve(copies.size());
+    int seg_fd = -1;
+    uint64_t segment_size = 0;
+    std::string data;
+    auto flush_segment = [&](bool close_after) {
+        write_fully(seg_fd, data.data(), data.size(), written.back());
+        data.clear();
+        if (close_after) {
+            if (::fsync(seg_fd) != 0) {
+                throw std::runtime_error("Could not sync segment: " + written.back().string());
+            }
+            ::close(seg_fd);
+            seg_fd = -1;
+        }
+    };
+    try {
+        const size_t batch_size = 4096;
+        for (size_t start = 0; start < copies.size(); start += batch_size) {
+            const size_t count = std::min(batch_size, copies.size() - start);
+            std::vector<std::string> payloads(count);
+            parallel_for(count, num_threads, [&](size_t k) {
+                const Copy& copy = copies[start + k];
+                payloads[k] = copy.location ? read_payload(*copy.location) : encode_node_binary(*copy.node);
+            });
+            for (size_t k = 0; k < count; ++k) {
+                if (seg_fd >= 0 && segment_size >= kSegmentRotateBytes) {
+                    flush_segment(true);
+                    ++segment;
+                }
+                if (seg_fd < 0) {
+                    written.push_back(store_dir_ / segment_name(segment));
+                    seg_fd = ::open(written.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    if (seg_fd < 0) {
+                        throw std::runtime_error("Could not open segment: " + written.back().string());
+                    }
+                    segment_size = 0;
+                }
+                const Copy& copy = copies[start + k];
+                NodeLocation location;
+                location.trace_id = copy.location ? copy.location->trace_id : copy.node->trace_id;
+                location.parent = copy.location ? copy.location->parent : copy.node->parent;
+                location.segment = segment;
+                location.offset = segment_size + kSegmentRecordHeaderSize;
+                location.length = static_cast<uint32_t>(payloads[k].size());
+                location.format = copy.location ? copy.location->format : NodeFormat::Binary;
+
+                char header[kSegmentRecordHeaderSize];
+                std::memcpy(header, kSegmentRecordMagic, sizeof(kSegmentRecordMagic));
+                put_u32(header + 4, location.length);
+                data.append(header, sizeof(header));
+                data.append(payloads[k]);
+                segment_size += kSegmentRecordHeaderSize + payloads[k].size();
+                copied.push_back(std::move(location));
+            }
+            if (seg_fd >= 0) {
+                flush_segment(false);
+            }
+        }
+        if (seg_fd >= 0) {
+            flush_segment(true);
+        }
+        if (!written.empty()) {
+            sync_directory(store_dir_);
+        }
+
+        // 3. Replace the offset index in one rename
+        fs::path index_path = store_dir_ / "offsets.idx";
+        std::string index_data = index_header();
+        index_data.resize(kIndexHeaderSize + (kept.size() + copied.size()) * kIndexRecordSize, '\0');
+        char* record = &index_data[kIndexHeaderSize];
+        for (const auto* group : {&kept, &copied}) {
+            for (const NodeLocation& location : *group) {
+                encode_index_record(location, record);
+                record += kIndexRecordSize;
+            }
+        }
+        replace_index_file(index_path, index_data);
+    } catch (...) {
+        if (seg_fd >= 0) {
+            ::close(seg_fd);
+        }
+        for (const auto& path : written) {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+        throw;
+    }
+    result.nodes_copied = copied.size();
+    result.segments_written = written.size();
+
+    // 4. Drop the rewritten segments and record which segments are compacted
+    std::set<uint32_t> compacted = compacted_segments();
+    for (uint32_t old_segment : plan.rewrite_segments) {
+        std::error_code ec;
+        if (fs::remove(store_dir_ / segment_name(old_segment), ec)) {
+            ++result.segments_removed;
+        }
+        compacted.erase(old_segment);
+    }
+    for (const auto& path : written) {
+        unsigned int number = 0;
+        std::sscanf(path.filename().c_str(), "seg-%u.dat", &number);
+        compacted.insert(number);
+    }
+    // Appends go to the highest segment, which must not be a compacted one
+    uint32_t highest = last_segment(store_dir_);
+    if (highest == 0 || compacted.count(highest)) {
+        fs::path next_path = store_dir_ / segment_name(highest + 1);
+        int next_fd = ::open(next_path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (next_fd < 0) {
+            throw std::runtime_error("Could not create segment: " + next_path.string());
+        }
+        ::close(next_fd);
+    }
+    std::string listing;
+    for (uint32_t number : compacted) {
+        listing += std::to_string(number) + '\n';
+    }
+    fs::path compacted_path = store_dir_ / "compacted";
+    fs::path compacted_tmp = store_dir_ / ("compacted.tmp" + std::to_string(::getpid()));
+    int list_fd = ::open(compacted_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (list_fd < 0) {
+        throw std::runtime_error("Could not open compacted segment list: " + compacted_tmp.string());
+    }
+    try {
+        write_fully(list_fd, listing.data(), listing.size(), compacted_tmp);
+        if (::fsync(list_fd) != 0) {
+            throw std::runtime_error("Could not sync compacted segment list: " + compacted_tmp.string());
+        }
+    } catch (...) {
+        ::close(list_fd);
+        fs::remove(compacted_tmp);
+        throw;
+    }
+    ::close(list_fd);
+    fs::rename(compacted_tmp, compacted_path);
+    sync_directory(store_dir_);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refresh_locked();
+    }
+    for (const auto& pair : segment_sizes()) {
+        result.bytes_after += pair.second;
+    }
+    span.set_value("nodes_copied", static_cast<int64_t>(result.nodes_copied));
+    return result;
+}
+
+// Field tags of the binary node format. Tags are never reused; a removed
+// field keeps its number reserved.
+enum BinaryNodeTag : uint32_t {
+    kTagTraceId = 1,
+    kTagParent = 2,
+    kTagTimestamp = 3,
+    kTagDataClass = 4,
+    kTagOperationClass = 5,
+    kTagOperationMethod = 6,
+    kTagOperationParameter = 7,   // varint key length, key, value
+    kTagAssumption = 8,
+    kTagInputShape = 9,
+    kTagInputChecksum = 10,
+    kTagOutputDataClass = 11,
+    kTagOutputUnit = 12,
+    kTagOutputChecksum = 13,
+    kTagEnvironmentLanguage = 14,
+    kTagEnvironmentTool = 15,
+    kTagEnvironmentVersion = 16,
+    kTagOntologyVersion = 17,
+};
+
+static void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static uint64_t get_varint(const char*& in, const char* end) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in == end) {
+            break;
+        }
+        unsigned char byte = static_cast<unsigned char>(*in++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Truncated binary trace node");
+}
+
+static void put_field(std::string& out, uint32_t tag, const std::string& value) {
+    if (value.empty()) {
+        return;
+    }
+    put_varint(out, tag);
+    put_varint(out, value.size());
+    out.append(value);
+}
+
+std::string encode_node_binary(const TraceNode& node) {
+    std::string out;
+    out.reserve(512);
+    out.push_back(static_cast<char>(kBinaryNodeVersion));
+    put_field(out, kTagTraceId, node.trace_id);
+    put_field(out, kTagParent, node.parent);
+    put_field(out, kTagTimestamp, node.timestamp);
+    put_field(out, kTagDataClass, node.data_class);
+    put_field(out, kTagOperationClass, node.operation.op_class);
+    put_field(out, kTagOperationMethod, node.operation.method);
+    for (const auto& parameter : node.operation.parameters) {
+        put_varint(out, kTagOperationParameter);
+        std::string key_length;
+        put_varint(key_length, parameter.first.size());
+        put_varint(out, key_length.size() + parameter.first.size() + parameter.second.size());
+        out.append(key_length);
+        out.append(parameter.first);
+        out.append(parameter.second);
+    }
+    for (const auto& assumption : node.assumptions) {
+        put_varint(out, kTagAssumption);
+        put_varint(out, assumption.size());
+        out.append(assumption);
+    }
+    put_field(out, kTagInputShape, node.input.shape);
+    put_field(out, kTagInputChecksum, node.input.checksum);
+    put_field(out, kTagOutputDataClass, node.output.data_class);
+    put_field(out, kTagOutputUnit, node.output.unit);
+    put_field(out, kTagOutputChecksum, node.output.checksum);
+    put_field(out, kTagEnvironmentLanguage, node.environment.language);
+    put_field(out, kTagEnvironmentTool, node.environment.tool);
+    put_field(out, kTagEnvironmentVersion, node.environment.version);
+    put_field(out, kTagOntologyVersion, node.ontology_version);
+    return out;
+}
+
+TraceNode decode_node_binary(const char* data, size_t length) {
+    if (length == 0) {
+        throw std::runtime_error("Empty binary trace node");
+    }
+    const char* in = data;
+    const char* end = data + length;
+    uint8_t version = static_cast<uint8_t>(*in++);
+    if (version == 0 || version > kBinaryNodeVersion) {
+        throw std::runtime_error("Unsupported binary trace node version: " + std::to_string(version));
+    }
+
+    TraceNode node = blank_trace_node();
+    while (in < end) {
+        uint64_t tag = get_varint(in, end);
+        uint64_t size = get_varint(in, end);
+        if (size > static_cast<uint64_t>(end - in)) {
+            throw std::runtime_error("Truncated binary trace node");
+        }
+        const char* field = in;
+        in += size;
+        std::string* target = nullptr;
+        switch (tag) {
+            case kTagTraceId: target = &node.trace_id; break;
+            case kTagParent: target = &node.parent; break;
+            case kTagTimestamp: target = &node.timestamp; break;
+            case kTagDataClass: target = &node.data_class; break;
+            case kTagOperationClass: target = &node.operation.op_class; break;
+            case kTagOperationMethod: target = &node.operation.method; break;
+            case kTagAssumption:
+                node.assumptions.emplace_back(field, static_cast<size_t>(size));
+                break;
+            case kTagOperationParameter: {
+                const char* cursor = field;
+                uint64_t key_length = get_varint(cursor, in);
+                if (key_length > static_cast<uint64_t>(in - cursor)) {
+                    throw std::runtime_error("Truncated binary trace node");
+                }
+                node.operation.parameters[std::string(cursor, static_cast<size_t>(key_length))] =
+                    std::string(cursor + key_length, in);
+                break;
+            }
+            case kTagInputShape: target = &node.input.shape; break;
+            case kTagInputChecksum: target = &node.input.checksum; break;
+            case kTagOutputDataClass: target = &node.output.data_class; break;
+            case kTagOutputUnit: target = &node.output.unit; break;
+            case kTagOutputChecksum: target = &node.output.checksum; break;
+            case kTagEnvironmentLanguage: target = &node.environment.language; break;
+            case kTagEnvironmentTool: target = &node.environment.tool; break;
+            case kTagEnvironmentVersion: target = &node.environment.version; break;
+            case kTagOntologyVersion: target = &node.ontology_version; break;
+            default: break; // A field added by a newer version
+        }
+        if (target) {
+            target->assign(field, static_cast<size_t>(size));
+        }
+    }
+    return node;
+}
+
+TraceNode decode_node_payload(NodeFormat format, const std::string& payload) {
+    switch (format) {
+        case NodeFormat::Yaml:
+            return parse_node_yaml(payload);
+        case NodeFormat::Binary:
+            return decode_node_binary(payload.data(), payload.size());
+    }
+    throw std::runtime_error("Unknown trace node format: " + std::to_string(static_cast<int>(format)));
+}
+
+size_t migrate_node_files(const fs::path& project_root) {
+    fs::path nodes_dir = project_root / ".traceseq" / "nodes";
+    if (!fs::exists(nodes_dir)) {
+        return 0;
+    }
+    NodeStore store(project_root);
+    const size_t batch_size = 4096;
+    std::vector<TraceNode> batch;
+    std::vector<fs::path> batch_files;
+    size_t migrated = 0;
+
+    auto flush = [&]() {
+        store.append(batch);
+        for (const auto& file : batch_files) {
+            fs::remove(file);
+        }
+        migrated += batch.size();
+        batch.clear();
+        batch_files.clear();
+    };
+
+    for (const auto& entry : fs::directory_iterator(nodes_dir)) {
+        if (entry.path().extension() != ".yaml") {
+            continue;
+        }
+        TraceNode node;
+        try {
+            node = load_node_yaml_file(entry.path());
+        } catch (const std::exception&) {
+            continue; // Leave unreadable files for a human to inspect
+        }
+        if (!fits_packed_store(node)) {
+            continue;
+        }
+        NodeLocation existing;
+        if (store.find(node.trace_id, existing)) {
+            fs::remove(entry.path()); // Already packed by an earlier, interrupted migration
+            continue;
+        }
+        batch.push_back(node);
+        batch_files.push_back(entry.path());
+        if (batch.size() == batch_size) {
+            flush();
+        }
+    }
+    if (!batch.empty()) {
+        flush();
+    }
+    return migrated;
+}
@@ -0,0 +1,323 @@
+#ifndef NODE_STORE_HPP
+#define NODE_STORE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "tracer.hpp"
+
+/// Longest trace or parent ID that fits in an offset index record.
+constexpr std::size_t kMaxPackedIdLength = 48;
+
+/// Whether a node can be packed; other nodes keep the per-file YAML layout.
+inline bool fits_packed_store(const TraceNode& node) {
+    return !node.trace_id.empty() && node.trace_id.size() <= kMaxPackedIdLength &&
+           node.parent.size() <= kMaxPackedIdLength;
+}
+
+/// Payload encodings of a packed node record.
+enum class NodeFormat : uint8_t {
+    Yaml = 1,   ///< The YAML document produced by `trace_node_to_yaml`.
+    Binary = 2, ///< The tagged binary encoding produced by `encode_node_binary`.
+};
+
+/// Schema version at the start of every binary node payload.
+constexpr uint8_t kBinaryNodeVersion = 1;
+
+/**
+ * @brief Where a packed node lives and who its parent is.
+ */
+struct NodeLocation {
+    std::string trace_id;   ///< The node's trace ID.
+    std::string parent;     ///< The node's parent trace ID ("null" for a root node).
+    uint32_t segment = 0;   ///< Number of the segment file holding the record.
+    uint64_t offset = 0;    ///< Byte offset of the payload within the segment.
+    uint32_t length = 0;    ///< Payload length in bytes.
+    NodeFormat format = NodeFormat::Yaml; ///< Payload encoding.
+};
+
+/**
+ * @brief A node below another in the lineage forest.
+ */
+struct DescendantId {
+    std::string trace_id;
+    size_t depth = 0;   ///< 1 for a child of the starting node, 2 for a grandchild, ...
+};
+
+/**
+ * @brief What `NodeStore::compact` should remove and rewrite.
+ */
+struct CompactionPlan {
+    std::unordered_set<std::string> drop;  ///< Trace IDs to remove from the store.
+    std::set<uint32_t> rewrite_segments;   ///< Segments whose remaining nodes are copied to new segments.
+    std::vector<std::string> order;        ///< Layout of copied nodes; nodes not listed follow in append order.
+    std::vector<TraceNode> unpacked;       ///< Nodes not yet in the store to write along, placed per `order`.
+};
+
+/**
+ * @brief What `NodeStore::compact` did.
+ */
+struct CompactionResult {
+    size_t nodes_dropped = 0;           ///< Index records removed.
+    size_t nodes_copied = 0;            ///< Nodes written to new segments.
+    size_t segments_written = 0;        ///< New segments.
+    size_t segments_removed = 0;        ///< Segments deleted after the rewrite.
+    uint64_t bytes_before = 0;          ///< Size of all segments before.
+    uint64_t bytes_after = 0;           ///< Size of all segments after.
+};
+
+/**
+ * @brief Packed, append-only storage for trace nodes.
+ *
+ * Nodes are appended to large segment files in '.traceseq/segments'
+ * ('seg-000001.dat', ...) instead of one YAML file per node, and located
+ * through the append-only offset index 'offsets.idx', which holds one
+ * fixed-size record per node: trace ID, parent ID, segment, offset, length
+ * and payload format. New nodes are stored in `NodeFormat::Binary`; records
+ * written as YAML by earlier versions remain readable. Segments are rotated once they exceed
+ * `kSegmentRotateBytes`.
+ *
+ * Appends hold an exclusive lock on 'store.lock' and make the segment data
+ * durable before the offset records that point at it, so any node visible
+ * in the index is complete. A newly created segment and a replaced offset
+ * index are followed by a sync of the segments directory, so their entries
+ * survive a crash as well. Readers need no lock: a partially written
+ * trailing index record is ignored until it is complete.
+ *
+ * `compact` replaces 'offsets.idx' with a new file rather than appending to
+ * it; readers notice the new identifier in its header on their next refresh
+ * and re-read it.
+ *
+ * A NodeStore may be shared by threads; payloads are read with `pread`
+ * outside the internal lock.
+ */
+class NodeStore {
+public:
+    /// Segment size after which appends start a new segment file.
+    static constexpr uint64_t kSegmentRotateBytes = 256ull * 1024 * 1024;
+
+    /**
+     * @brief Opens the packed node store of a project.
+     * @param project_root The root directory of the project.
+     */
+    explicit NodeStore(const std::filesystem::path& project_root);
+    ~NodeStore();
+
+    NodeStore(const NodeStore&) = delete;
+    NodeStore& operator=(const NodeStore&) = delete;
+
+    /**
+     * @brief Appends trace nodes to the store with one lock, write and sync.
+     *
+     * A torn tail left in the offset index by an interrupted append is cut
+     * off first, so the new records are never hidden behind it. Only the
+     * index header and tail are read, so the cost does not grow with the
+     * store, and a view that was current takes the new records directly.
+     * @param nodes The nodes to store; each must pass `fits_packed_store`.
+     * @throws std::invalid_argument if a node cannot be packed.
+     * @throws std::runtime_error if the store cannot be written.
+     */
+    void append(const std::vector<TraceNode>& nodes);
+
+    /**
+     * @brief Looks up where a node is stored.
+     * @param trace_id The trace ID to find.
+     * @param location Filled with the node's location when found.
+     * @return true if the node is in the packed store.
+     */
+    bool find(const std::string& trace_id, NodeLocation& location);
+
+    /**
+     * @brief Loads a node from the packed store.
+     * @param trace_id The trace ID to load.
+     * @param node Filled with the node when found.
+     * @return true if the node is in the packed store.
+     * @throws std::runtime_error if the node's record cannot be read or decoded.
+     */
+    bool load(const std::string& trace_id, TraceNode& node);
+
+    /**
+     * @brief Reads the raw payload of a stored node.
+     * @param location The node's location, as returned by `find`.
+     * @return The payload bytes, encoded as `location.format`.
+     */
+    std::string read_payload(const NodeLocation& location);
+
+    /**
+     * @brief Returns the locations of every packed node, in append order.
+     *
+     * If a trace ID was appended more than once only its latest location is kept.
+     */
+    std::vector<NodeLocation> locations();
+
+    /**
+     * @brief Returns the locations of packed nodes from a position on, after a refresh.
+     *
+     * A node's position is its place in `locations()`; positions are the same
+     * in every process reading the same offset index, and are only renumbered
+     * when `compact` replaces it.
+     *
+     * @param first The position of the first location to return.
+     * @param generation Set to the identity of the offset index the positions refer to.
+     * @return The locations at positions `first` and later, in append order.
+     */
+    std::vector<NodeLocation> locations(size_t first, uint64_t& generation);
+
+    /**
+     * @brief Returns the locations of packed nodes by position.
+     * @param positions Positions as numbered by `locations(first, generation)`.
+     * @param generation The generation those positions were read under.
+     * @param locations Filled with one location per position.
+     * @return false if a compaction has renumbered the positions since, or a position is out of range.
+     */
+    bool locations_at(const std::vector<uint32_t>& positions, uint64_t generation, std::vector<NodeLocation>& locations);
+
+    /// Re-reads offset index records appended by other processes.
+    void refresh();
+
+    /**
+     * @brief Returns the packed nodes whose parent is a given node.
+     *
+     * The child lists are built from the parent IDs of the offset index on
+     * the first call and then kept up to date by every refresh, so a call
+     * costs one hash lookup. They reflect the records read by the last
+     * refresh; call `refresh` first to include nodes appended since.
+     *
+     * @param trace_id The parent's trace ID.
+     * @return The children's locations, in append order.
+     */
+    std::vector<NodeLocation> children(const std::string& trace_id);
+
+    /**
+     * @brief Returns every packed node below a given node.
+     *
+     * Walks the child lists of `children` by position, so the cost is
+     * proportional to the number of descendants. Like `children`, it does not
+     * refresh. A node reached again through a parent cycle is skipped.
+     *
+     * @param trace_id The trace ID to start from; it need not be packed itself.
+     * @return The descendants depth first, each followed by its subtree, siblings in append order.
+     */
+    std::vector<DescendantId> descendants(const std::string& trace_id);
+
+    /**
+     * @brief Returns the size of every segment file.
+     * @return Segment number to size in bytes.
+     */
+    std::map<uint32_t, uint64_t> segment_sizes() const;
+
+    /**
+     * @brief Returns the segments written by earlier compactions that still exist.
+     *
+     * Appends never go into these segments, so their nodes keep the layout
+     * the compaction gave them.
+     *
+     * @return The segment numbers.
+     */
+    std::set<uint32_t> compacted_segments() const;
+
+    /**
+     * @brief Removes nodes and rewrites segments under the store lock.
+     *
+     * Every node in `plan.rewrite_segments` that is not dropped, and every
+     * node of `plan.unpacked` that `fits_packed_store` and is not packed yet,
+     * is copied into new segments in `plan.order`.
+     * Nodes in other segments stay where they are; dropped nodes there only
+     * lose their index record, and their bytes are reclaimed when that
+     * segment is rewritten later. The new segments and their directory
+     * entries are made durable and the offset index is then replaced
+     * atomically and synced before any old segment is removed, so readers,
+     * and a crash, see either the old or the new store. Nodes appended after the plan was made are kept.
+     * Afterwards appends go to a new segment, not the compacted ones.
+     *
+     * @param plan What to remove and rewrite.
+     * @param num_threads Threads reading the payloads to copy (0 means one per hardware core).
+     * @return What was done.
+     * @throws std::runtime_error if the store cannot be read or written; the old store is then left intact.
+     */
+    CompactionResult compact(const CompactionPlan& plan, unsigned int num_threads = 0);
+
+private:
+    int segment_fd(uint32_t segment);
+    bool refresh_locked();
+    void add_record_locked(const char* record);
+    void reset_locked();
+    void build_children_locked();
+    void add_node_locked(size_t position);
+    void link_parent_locked(size_t position);
+    void unlink_parent_locked(size_t position);
+    void link_child_locked(size_t parent, size_t child);
+
+    std::mutex mutex_;
+
+    std::filesystem::path store_dir_;
+    std::unordered_map<std::string, size_t> by_id_;   ///< Trace ID to position in `entries_`.
+    std::vector<NodeLocation> entries_;               ///< Offset index records in file order.
+    uint64_t index_offset_ = 0;                       ///< Bytes of 'offsets.idx' already read.
+    uint64_t index_id_ = 0;                           ///< Identifier in that file's header, to notice a compaction.
+    // Child lists, by position in `entries_`; kNoNode ends a list. Built on
+    // the first `children` or `descendants` call.
+    static constexpr size_t kNoNode = SIZE_MAX;
+    bool children_indexed_ = false;
+    std::vector<size_t> first_child_;
+    std::vector<size_t> last_child_;
+    std::vector<size_t> next_sibling_;
+    std::unordered_map<std::string, std::vector<size_t>> orphans_; ///< Children of parents not in the index (yet).
+    std::map<uint32_t, int> segment_fds_;             ///< Open read descriptors per segment.
+};
+
+/**
+ * @brief Encodes a TraceNode in the compact binary node format.
+ *
+ * The payload is the schema version byte followed by tagged fields: a
+ * varint field tag, a varint byte length and the field bytes. Empty
+ * strings are omitted; assumptions and operation parameters repeat their
+ * tag once per element. New fields get new tags, so decoders skip tags
+ * they do not know and older payloads simply lack the newer fields.
+ *
+ * @param node The TraceNode to encode.
+ * @return The encoded payload.
+ */
+std::string encode_node_binary(const TraceNode& node);
+
+/**
+ * @brief Decodes a payload produced by `encode_node_binary`.
+ *
+ * Missing fields are left empty rather than treated as errors.
+ *
+ * @param data The payload bytes.
+ * @param length The payload length.
+ * @return The decoded TraceNode.
+ * @throws std::runtime_error if the payload is truncated or has an unknown schema version.
+ */
+TraceNode decode_node_binary(const char* data, size_t length);
+
+/**
+ * @brief Decodes a packed node payload.
+ * @param format The payload encoding.
+ * @param payload The payload bytes.
+ * @return The decoded TraceNode.
+ * @throws std::runtime_error if the payload cannot be decoded.
+ */
+TraceNode decode_node_payload(NodeFormat format, const std::string& payload);
+
+/**
+ * @brief Moves per-file nodes from '.traceseq/nodes' into the packed store.
+ *
+ * Nodes are appended in batches, and each YAML file is deleted only after
+ * its batch is durable in the packed store. Nodes that are already packed
+ * are not appended again. Files that cannot be parsed, or whose IDs are
+ * too long to pack, are left in place.
+ *
+ * @param project_root The root directory of the project.
+ * @return The number of nodes migrated.
+ */
+size_t migrate_node_files(const std::filesystem::path& project_root);
+
+#endif // NODE_STORE_HPP
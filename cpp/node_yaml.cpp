@@ -0,0 +1,497 @@
+#include "node_yaml.hpp"
+#include "lineage.hpp"
+#include "profiler.hpp"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// One bit per key yaml_to_tracenode requires, plus the optional blocks, so
+// that a missing or repeated key sends the document to yaml-cpp
+enum FieldBit : uint32_t {
+    kTraceIdBit = 1u << 0,
+    kParentBit = 1u << 1,
+    kTimestampBit = 1u << 2,
+    kDataClassBit = 1u << 3,
+    kOpClassBit = 1u << 4,
+    kMethodBit = 1u << 5,
+    kShapeBit = 1u << 6,
+    kInputChecksumBit = 1u << 7,
+    kOutputDataClassBit = 1u << 8,
+    kUnitBit = 1u << 9,
+    kOutputChecksumBit = 1u << 10,
+    kLanguageBit = 1u << 11,
+    kToolBit = 1u << 12,
+    kVersionBit = 1u << 13,
+    kOntologyVersionBit = 1u << 14,
+    kOperationBit = 1u << 15,
+    kParametersBit = 1u << 16,
+    kAssumptionsBit = 1u << 17,
+    kInputBit = 1u << 18,
+    kOutputBit = 1u << 19,
+    kEnvironmentBit = 1u << 20,
+};
+
+const uint32_t kRequiredBits = (1u << 15) - 1;
+
+// The collection a more deeply indented line belongs to
+enum class Block { None, Operation, Parameters, Assumptions, Input, Output, Environment };
+
+struct Slot {
+    std::string* target;
+    uint32_t bit;
+};
+
+bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+std::string_view trim_trailing(std::string_view text) {
+    while (!text.empty() && is_blank(text.back())) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+std::string_view trim_leading(std::string_view text) {
+    while (!text.empty() && is_blank(text.front())) {
+        text.remove_prefix(1);
+    }
+    return text;
+}
+
+bool append_utf8(uint32_t code_point, std::string& out) {
+    if ((code_point >= 0xD800 && code_point <= 0xDFFF) || code_point > 0x10FFFF) {
+        return false;
+    }
+    if (code_point < 0x80) {
+        out += static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+        out += static_cast<char>(0xC0 | (code_point >> 6));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += static_cast<char>(0xE0 | (code_point >> 12));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code_point >> 18));
+        out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    return true;
+}
+
+bool parse_hex(std::string_view digits, uint32_t& value) {
+    value = 0;
+    for (char c : digits) {
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= static_cast<uint32_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value |= static_cast<uint32_t>(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            value |= static_cast<uint32_t>(c - 'A' + 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decodes a double-quoted scalar that starts and ends on this line;
+// `rest` is set to what follows the closing quote
+bool parse_double_quoted(std::string_view text, std::string& out, std::string_view& rest) {
+    out.clear();
+    size_t i = 1;
+    while (i < text.size()) {
+        size_t run = i;
+        while (i < text.size() && text[i] != '"' && text[i] != '\\') {
+            ++i;
+        }
+        out.append(text.data() + run, i - run);
+        if (i == text.size()) {
+            return false; // Continues on the next line
+        }
+        if (text[i] == '"') {
+            rest = text.substr(i + 1);
+            return true;
+        }
+        if (++i == text.size()) {
+            return false; // Escaped line break
+        }
+        char escape = text[i++];
+        size_t hex_digits = 0;
+        switch (escape) {
+            case '0': out += '\0'; break;
+            case 'a': out += '\a'; break;
+            case 'b': out += '\b'; break;
+            case 't': case '\t': out += '\t'; break;
+            case 'n': out += '\n'; break;
+            case 'v': out += '\v'; break;
+            case 'f': out += '\f'; break;
+            case 'r': out += '\r'; break;
+            case 'e': out += '\x1b'; break;
+            case ' ': case '"': case '/': case '\\': out += escape; break;
+            case 'x': hex_digits = 2; break;
+            case 'u': hex_digits = 4; break;
+            case 'U': hex_digits = 8; break;
+            default: return false; // \N, \_, \L and \P are left to yaml-cpp
+        }
+        if (hex_digits) {
+            uint32_t code_point;
+            if (text.size() - i < hex_digits || !parse_hex(text.substr(i, hex_digits), code_point) ||
+                !append_utf8(code_point, out)) {
+                return false;
+            }
+            i += hex_digits;
+        }
+    }
+    return false;
+}
+
+// Decodes a single-quoted scalar that starts and ends on this line
+bool parse_single_quoted(std::string_view text, std::string& out, std::string_view& rest) {
+    out.clear();
+    size_t i = 1;
+    while (i < text.size()) {
+        size_t quote = text.find('\'', i);
+        if (quote == std::string_view::npos) {
+            return false;
+        }
+        out.append(text.data() + i, quote - i);
+        if (quote + 1 < text.size() && text[quote + 1] == '\'') {
+            out += '\'';
+            i = quote + 2;
+            continue;
+        }
+        rest = text.substr(quote + 1);
+        return true;
+    }
+    return false;
+}
+
+// A plain scalar yaml-cpp reads back as exactly this text: no indicator
+// up front, nothing that starts a comment or a mapping, and not a null
+bool is_simple_plain(std::string_view text) {
+    if (text.empty()) {
+        return false;
+    }
+    char first = text.front();
+    if (std::strchr("[]{}#&*!|>'\"%@`,", first)) {
+        return false;
+    }
+    if ((first == '-' || first == '?' || first == ':') && (text.size() == 1 || is_blank(text[1]))) {
+        return false;
+    }
+    for (size_t i = 0; i + 1 < text.size(); ++i) {
+        if ((text[i] == ':' && is_blank(text[i + 1])) || (is_blank(text[i]) && text[i + 1] == '#')) {
+            return false;
+        }
+    }
+    if (text.back() == ':') {
+        return false;
+    }
+    return text != "~" && text != "null" && text != "Null" && text != "NULL";
+}
+
+// Decodes the value after 'key: ' or '- ' to the end of the line
+bool parse_value(std::string_view text, std::string& out) {
+    std::string_view rest;
+    if (!text.empty() && text.front() == '"') {
+        return parse_double_quoted(text, out, rest) && trim_leading(rest).empty();
+    }
+    if (!text.empty() && text.front() == '\'') {
+        return parse_single_quoted(text, out, rest) && trim_leading(rest).empty();
+    }
+    text = trim_trailing(text);
+    if (!is_simple_plain(text)) {
+        return false;
+    }
+    out.assign(text.data(), text.size());
+    return true;
+}
+
+// Splits 'key: value' (or 'key:' opening a block); a quoted key is decoded
+// into `buffer`
+bool split_key(std::string_view line, std::string& buffer, std::string_view& key, std::string_view& value) {
+    std::string_view rest;
+    if (line.front() == '"' || line.front() == '\'') {
+        bool parsed = line.front() == '"' ? parse_double_quoted(line, buffer, rest) : parse_single_quoted(line, buffer, rest);
+        if (!parsed || rest.empty() || rest.front() != ':') {
+            return false;
+        }
+        key = buffer;
+        rest.remove_prefix(1);
+    } else {
+        size_t colon = 0;
+        while ((colon = line.find(':', colon)) != std::string_view::npos) {
+            if (colon + 1 == line.size() || is_blank(line[colon + 1])) {
+                break;
+            }
+            ++colon;
+        }
+        if (colon == std::string_view::npos) {
+            return false;
+        }
+        key = line.substr(0, colon);
+        if (!is_simple_plain(key) || is_blank(key.back())) {
+            return false;
+        }
+        rest = line.substr(colon + 1);
+    }
+    if (!rest.empty() && !is_blank(rest.front())) {
+        return false;
+    }
+    value = trim_trailing(trim_leading(rest));
+    return true;
+}
+
+} // namespace
+
+bool parse_node_yaml_fast(std::string_view text, TraceNode& node) {
+    node = blank_trace_node();
+    if (text.find('\0') != std::string_view::npos) {
+        return false; // yaml-cpp's reader gives NUL bytes a meaning of their own
+    }
+    const Slot top_fields[] = {
+        {&node.trace_id, kTraceIdBit}, {&node.parent, kParentBit}, {&node.timestamp, kTimestampBit},
+        {&node.data_class, kDataClassBit}, {&node.ontology_version, kOntologyVersionBit},
+    };
+    const char* const top_keys[] = {"trace_id", "parent", "timestamp", "data_class", "ontology_version"};
+
+    uint32_t seen = 0;
+    Block block = Block::None;
+    size_t child_indent = std::string_view::npos;  // Of the current block's entries
+    size_t entry_indent = std::string_view::npos;  // Of the parameters or assumptions entries
+    std::string key_buffer;
+    std::string value;
+
+    // Sets a scalar field once
+    auto set_field = [&](const Slot& slot, std::string_view raw) {
+        if ((seen & slot.bit) || !parse_value(raw, *slot.target)) {
+            return false;
+        }
+        seen |= slot.bit;
+        return true;
+    };
+    // Opens a block for the lines that follow, once
+    auto open_block = [&](Block opened, uint32_t bit, std::string_view raw) {
+        if ((seen & bit) || !raw.empty()) {
+            return false;
+        }
+        seen |= bit;
+        block = opened;
+        child_indent = std::string_view::npos;
+        entry_indent = std::string_view::npos;
+        return true;
+    };
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        std::string_view line = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (end < text.size() && !line.empty() && line.back() == '\r') { // Only CRLF is a line break
+
+            line.remove_suffix(1);
+        }
+        size_t indent = 0;
+        while (indent < line.size() && line[indent] == ' ') {
+            ++indent;
+        }
+        if (indent < line.size() && line[indent] == '\t') {
+            return false; // Tabs are not indentation, even on a blank line
+        }
+        std::string_view body = trim_trailing(line.substr(indent));
+        if (body.empty()) {
+            continue;
+        }
+        if (body.front() == '#') {
+            return false;
+        }
+
+        // An empty flow sequence as the whole assumptions block, as the
+        // emitter writes it; nothing may follow in that block
+        if (body == "[]" && block == Block::Assumptions && indent > 0 && entry_indent == std::string_view::npos) {
+            block = Block::None;
+            continue;
+        }
+
+        // Sequence entries: assumptions, indented or not
+        if (body.front() == '-' && (body.size() == 1 || is_blank(body[1]))) {
+            if (block != Block::Assumptions || (entry_indent != std::string_view::npos && indent != entry_indent)) {
+                return false;
+            }
+            entry_indent = indent;
+            if (body.size() == 1 || !parse_value(trim_leading(body.substr(2)), value)) {
+                return false;
+            }
+            node.assumptions.push_back(std::move(value));
+            continue;
+        }
+
+        std::string_view key;
+        std::string_view raw;
+        if (!split_key(body, key_buffer, key, raw)) {
+            return false;
+        }
+
+        if (indent == 0) {
+            block = Block::None;
+            if (key == "operation") {
+                if (!open_block(Block::Operation, kOperationBit, raw)) {
+                    return false;
+                }
+            } else if (key == "input") {
+                if (!open_block(Block::Input, kInputBit, raw)) {
+                    return false;
+                }
+            } else if (key == "output") {
+                if (!open_block(Block::Output, kOutputBit, raw)) {
+                    return false;
+                }
+            } else if (key == "environment") {
+                if (!open_block(Block::Environment, kEnvironmentBit, raw)) {
+                    return false;
+                }
+            } else if (key == "assumptions") {
+                if (raw == "[]" && !(seen & kAssumptionsBit)) {
+                    seen |= kAssumptionsBit;
+                } else if (!open_block(Block::Assumptions, kAssumptionsBit, raw)) {
+                    return false;
+                }
+            } else {
+                size_t i = 0;
+                while (i < 5 && key != top_keys[i]) {
+                    ++i;
+                }
+                if (i == 5 || !set_field(top_fields[i], raw)) {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        if (block == Block::Parameters) {
+            if (indent > child_indent) {
+                if (entry_indent != std::string_view::npos && indent != entry_indent) {
+                    return false;
+                }
+                entry_indent = indent;
+                if (!parse_value(raw, value)) {
+                    return false;
+                }
+                node.operation.parameters[std::string(key)] = std::move(value);
+                continue;
+            }
+            block = Block::Operation; // Back to the operation's own keys
+        }
+        if (block == Block::None || block == Block::Assumptions ||
+            (child_indent != std::string_view::npos && indent != child_indent)) {
+            return false;
+        }
+        child_indent = indent;
+
+        bool ok = false;
+        switch (block) {
+            case Block::Operation:
+                if (key == "class") {
+                    ok = set_field({&node.operation.op_class, kOpClassBit}, raw);
+                } else if (key == "method") {
+                    ok = set_field({&node.operation.method, kMethodBit}, raw);
+                } else if (key == "parameters" && !(seen & kParametersBit)) {
+                    seen |= kParametersBit;
+                    if (raw.empty()) {
+                        block = Block::Parameters;
+                        entry_indent = std::string_view::npos;
+                        ok = true;
+                    } else {
+                        ok = raw == "{}";
+                    }
+                }
+                break;
+            case Block::Input:
+                if (key == "shape") {
+                    ok = set_field({&node.input.shape, kShapeBit}, raw);
+                } else if (key == "checksum") {
+                    ok = set_field({&node.input.checksum, kInputChecksumBit}, raw);
+                }
+                break;
+            case Block::Output:
+                if (key == "data_class") {
+                    ok = set_field({&node.output.data_class, kOutputDataClassBit}, raw);
+                } else if (key == "unit") {
+                    ok = set_field({&node.output.unit, kUnitBit}, raw);
+                } else if (key == "checksum") {
+                    ok = set_field({&node.output.checksum, kOutputChecksumBit}, raw);
+                }
+                break;
+            case Block::Environment:
+                if (key == "language") {
+                    ok = set_field({&node.environment.language, kLanguageBit}, raw);
+                } else if (key == "tool") {
+                    ok = set_field({&node.environment.tool, kToolBit}, raw);
+                } else if (key == "version") {
+                    ok = set_field({&node.environment.version, kVersionBit}, raw);
+                }
+                break;
+            default:
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return (seen & kRequiredBits) == kRequiredBits;
+}
+
+TraceNode parse_node_yaml(std::string_view text) {
+    TraceNode node = blank_trace_node(); // The default constructor draws a UUID and a timestamp
+    if (parse_node_yaml_fast(text, node)) {
+        return node;
+    }
+    Profiler::count("node_yaml_fallbacks", 1);
+    return yaml_to_tracenode(YAML::Load(std::string(text)));
+}
+
+TraceNode load_node_yaml_file(const fs::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open trace node file: " + path.string());
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not stat trace node file: " + path.string());
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return parse_node_yaml(std::string_view());
+    }
+    // Node files are replaced by rename, never rewritten in place, so the
+    // mapping cannot shrink underneath the parser
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map trace node file: " + path.string());
+    }
+    struct Unmap {
+        void* mapping;
+        size_t size;
+        ~Unmap() { ::munmap(mapping, size); }
+    } unmap{mapping, size};
+    return parse_node_yaml(std::string_view(static_cast<const char*>(mapping), size));
+}
@@ -0,0 +1,52 @@
+#ifndef NODE_YAML_HPP
+#define NODE_YAML_HPP
+
+#include <filesystem>
+#include <string_view>
+#include "tracer.hpp"
+
+/**
+ * @brief Parses a trace node YAML document in a single pass, without yaml-cpp.
+ *
+ * The scanner understands the block layout that `trace_node_to_yaml` emits
+ * (and the R package's `write_yaml` output): top-level keys in column 0,
+ * one level of nested mappings, `operation.parameters`, a block or empty
+ * flow sequence of assumptions (`[]` after the key or on the next line, as
+ * the emitter writes it), and plain, single-quoted or double-quoted
+ * scalars on one line. Values are sliced out of `text` as views and copied
+ * once into the node. Anything else (comments, anchors, tags, block or
+ * multi-line scalars, nulls, unknown or repeated keys, missing fields)
+ * makes it give up, so a document is never parsed differently from
+ * yaml-cpp.
+ *
+ * @param text The YAML document.
+ * @param node Filled with the node if the document was understood.
+ * @return false if the document needs the general YAML parser.
+ */
+bool parse_node_yaml_fast(std::string_view text, TraceNode& node);
+
+/**
+ * @brief Parses a trace node YAML document.
+ *
+ * Uses `parse_node_yaml_fast` and falls back to yaml-cpp and
+ * `yaml_to_tracenode` for documents it does not understand.
+ *
+ * @param text The YAML document.
+ * @return The parsed TraceNode.
+ * @throws YAML::Exception if the document is not a valid trace node.
+ */
+TraceNode parse_node_yaml(std::string_view text);
+
+/**
+ * @brief Loads a trace node from a YAML file such as '.traceseq/nodes/<id>.yaml'.
+ *
+ * The file is memory-mapped and parsed in place with `parse_node_yaml`.
+ *
+ * @param path The YAML file.
+ * @return The parsed TraceNode.
+ * @throws std::runtime_error if the file cannot be read.
+ * @throws YAML::Exception if the file is not a valid trace node.
+ */
+TraceNode load_node_yaml_file(const std::filesystem::path& path);
+
+#endif // NODE_YAML_HPP
@@ -0,0 +1,93 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Returns the number of worker threads to use for a parallel task.
+ *
+ * @param requested The requested number of threads (0 means one per hardware core).
+ * @param work_items The number of independent work items available.
+ * @return A thread count between 1 and `work_items` (or 1 if there is no work).
+ */
+inline unsigned int resolve_thread_count(unsigned int requested, std::size_t work_items) {
+    unsigned int threads = requested;
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    if (work_items < threads) {
+        threads = static_cast<unsigned int>(std::max<std::size_t>(work_items, 1));
+    }
+    return threads;
+}
+
+/**
+ * @brief Runs `fn(i)` for every `i` in `[0, count)` on a pool of worker threads.
+ *
+ * Work items are handed out dynamically, so uneven item costs balance across
+ * workers. The calling thread participates as one of the workers. If any call
+ * throws, the remaining items are skipped and the first exception is rethrown
+ * once all workers have stopped.
+ *
+ * @param count The number of work items.
+ * @param num_threads The number of threads to use (0 means one per hardware core).
+ * @param fn The callable invoked with each work item index.
+ */
+template <typename Fn>
+void parallel_for(std::size_t count, unsigned int num_threads, Fn&& fn) {
+    unsigned int threads = resolve_thread_count(num_threads, count);
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr first_error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        while (!failed.load(std::memory_order_relaxed)) {
+            std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= count) {
+                break;
+            }
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!first_error) {
+                    first_error = std::current_exception();
+                }
+                failed.store(true, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned int t = 0; t + 1 < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    if (first_error) {
+        std::rethrow_exception(first_error);
+    }
+}
+
+#endif // PARALLEL_HPP
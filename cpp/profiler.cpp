@@ -0,0 +1,126 @@
+#include "profiler.hpp"
+#include "nlohmann/json.hpp"
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct ProfileEvent {
+    char phase;                 // 'X' for spans, 'C' for counters
+    const char* name;
+    double ts_us;               // Microseconds since Profiler::start
+    double dur_us;
+    uint32_t tid;
+    std::string detail;
+    const char* value_name;
+    int64_t value;
+};
+
+struct ProfileState {
+    std::mutex mutex;
+    Profiler::Clock::time_point origin = Profiler::Clock::now();
+    std::vector<ProfileEvent> events;
+    std::map<std::string, int64_t> counters;
+};
+
+ProfileState& state() {
+    static ProfileState profile_state;
+    return profile_state;
+}
+
+// Small stable per-thread IDs read better in trace viewers than native ones
+uint32_t thread_track() {
+    static std::atomic<uint32_t> next_track{1};
+    thread_local uint32_t track = next_track++;
+    return track;
+}
+
+double micros_since(Profiler::Clock::time_point origin, Profiler::Clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t - origin).count();
+}
+
+} // namespace
+
+void Profiler::start() {
+    ProfileState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.events.clear();
+    s.counters.clear();
+    s.origin = Clock::now();
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::stop() {
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+void Profiler::record_span(const char* name, Clock::time_point start, Clock::time_point end,
+                           const std::string& detail, const char* value_name, int64_t value) {
+    uint32_t tid = thread_track();
+    ProfileState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    double duration = std::chrono::duration<double, std::micro>(end - start).count();
+    s.events.push_back({'X', name, micros_since(s.origin, start), duration, tid, detail, value_name, value});
+}
+
+void Profiler::record_counter(const char* name, int64_t delta) {
+    Clock::time_point now = Clock::now();
+    ProfileState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    int64_t total = s.counters[name] += delta;
+    s.events.push_back({'C', name, micros_since(s.origin, now), 0.0, 0, std::string(), name, total});
+}
+
+std::string Profiler::chrome_trace_json() {
+    ProfileState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    const int pid = static_cast<int>(getpid());
+
+    nlohmann::json events = nlohmann::json::array();
+    events.push_back({{"name", "process_name"}, {"ph", "M"}, {"pid", pid}, {"tid", 0},
+                      {"args", {{"name", "traceseq"}}}});
+    for (const auto& event : s.events) {
+        nlohmann::json e = {{"name", event.name}, {"cat", "traceseq"}, {"ph", std::string(1, event.phase)},
+                            {"ts", event.ts_us}, {"pid", pid}, {"tid", event.tid}};
+        nlohmann::json args = nlohmann::json::object();
+        if (event.phase == 'X') {
+            e["dur"] = event.dur_us;
+            if (!event.detail.empty()) {
+                args["detail"] = event.detail;
+            }
+        }
+        if (event.value_name) {
+            args[event.value_name] = event.value;
+        }
+        if (!args.empty()) {
+            e["args"] = args;
+        }
+        events.push_back(e);
+    }
+
+    nlohmann::json counters = nlohmann::json::object();
+    for (const auto& counter : s.counters) {
+        counters[counter.first] = counter.second;
+    }
+    nlohmann::json trace = {{"traceEvents", events}, {"displayTimeUnit", "ms"},
+                            {"otherData", {{"counters", counters}}}};
+    return trace.dump();
+}
+
+void Profiler::write_chrome_trace(const fs::path& path) {
+    std::string json = chrome_trace_json();
+    std::ofstream out(path, std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not write profile: " + path.string());
+    }
+    out << json << '\n';
+    if (!out) {
+        throw std::runtime_error("Could not write profile: " + path.string());
+    }
+}
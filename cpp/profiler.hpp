@@ -0,0 +1,115 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief Process-wide recorder of timed spans and counters.
+ *
+ * While profiling is off every probe is a single relaxed atomic load. While
+ * it is on, finished spans and counter updates are appended to an in-memory
+ * event list, which can be written as Chrome trace-event JSON and opened in
+ * Perfetto or chrome://tracing. Recording is thread-safe; each thread gets
+ * its own track.
+ */
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Whether spans and counters are currently recorded.
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    /// Discards recorded events and starts recording.
+    static void start();
+
+    /// Stops recording; recorded events are kept until the next `start`.
+    static void stop();
+
+    /**
+     * @brief Adds to a cumulative counter (e.g. bytes hashed, nodes loaded).
+     * @param name The counter name; must be a string literal or otherwise outlive the profiler.
+     * @param delta The amount to add.
+     */
+    static void count(const char* name, int64_t delta) {
+        if (enabled()) {
+            record_counter(name, delta);
+        }
+    }
+
+    /**
+     * @brief Serializes the recorded events as Chrome trace-event JSON.
+     * @return A JSON object with a `traceEvents` array.
+     */
+    static std::string chrome_trace_json();
+
+    /**
+     * @brief Writes the recorded events as Chrome trace-event JSON.
+     * @param path The file to write.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    static void write_chrome_trace(const std::filesystem::path& path);
+
+    /// Records a finished span; use `ProfileSpan` instead of calling this directly.
+    static void record_span(const char* name, Clock::time_point start, Clock::time_point end,
+                            const std::string& detail, const char* value_name, int64_t value);
+
+private:
+    static void record_counter(const char* name, int64_t delta);
+
+    static inline std::atomic<bool> enabled_{false};
+};
+
+/**
+ * @brief Times the enclosing scope as one profiler span.
+ *
+ * A span may carry a detail string (a path or trace ID) and one numeric
+ * argument (bytes, nodes, entries). Both setters are no-ops unless the span
+ * is being recorded, so callers can pass existing strings freely.
+ */
+class ProfileSpan {
+public:
+    /// @param name The span name; must be a string literal.
+    explicit ProfileSpan(const char* name) : name_(Profiler::enabled() ? name : nullptr) {
+        if (name_) {
+            start_ = Profiler::Clock::now();
+        }
+    }
+
+    ~ProfileSpan() {
+        if (name_) {
+            Profiler::record_span(name_, start_, Profiler::Clock::now(), detail_, value_name_, value_);
+        }
+    }
+
+    ProfileSpan(const ProfileSpan&) = delete;
+    ProfileSpan& operator=(const ProfileSpan&) = delete;
+
+    /// Whether this span is being recorded.
+    bool active() const { return name_ != nullptr; }
+
+    /// Attaches a detail string, shown as the `detail` argument.
+    void set_detail(const std::string& detail) {
+        if (name_) {
+            detail_ = detail;
+        }
+    }
+
+    /// Attaches a numeric argument; `name` must be a string literal.
+    void set_value(const char* name, int64_t value) {
+        value_name_ = name;
+        value_ = value;
+    }
+
+private:
+    const char* name_;
+    Profiler::Clock::time_point start_;
+    std::string detail_;
+    const char* value_name_ = nullptr;
+    int64_t value_ = 0;
+};
+
+#endif // PROFILER_HPP
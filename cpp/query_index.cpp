@@ -0,0 +1,630 @@
+#include "query_index.hpp"
+#include "node_yaml.hpp"
+#include "profiler.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Query index file: magic, offset index generation, node count, the
+// timestamps, then per field its term count and per term the value length,
+// value, posting count and positions (integers in host byte order)
+static const char kQueryIndexMagic[8] = {'T', 'S', 'Q', 'I', 'D', 'X', '1', '\n'};
+
+// '%Y-%m-%dT%H:%M:%SZ'; shorter timestamps are padded with NULs
+static const size_t kTimestampSize = 20;
+
+// Nodes decoded per parallel batch
+static const size_t kDecodeBatch = 65536;
+
+// The index is saved once this many nodes were added since the last save, or
+// an eighth of its size, whichever comes first
+static const size_t kSaveEvery = 65536;
+
+// Intersections binary search the longer list when it is this much longer
+static const size_t kGallopRatio = 16;
+
+struct QueryIndex::QueryNode {
+    enum class Kind { Term, Range, And, Or };
+    Kind kind = Kind::Term;
+    QueryField field = QueryField::OpClass;
+    std::string value;          ///< Term value, without the trailing '*' of a prefix.
+    bool prefix = false;        ///< Term matches every value starting with `value`.
+    std::string since;          ///< Range lower bound (inclusive), or empty.
+    std::string until;          ///< Range upper bound (exclusive), or empty.
+    std::vector<QueryNode> children;
+};
+
+namespace {
+
+struct Token {
+    enum class Kind { Open, Close, And, Or, Term, End };
+    Kind kind = Kind::End;
+    std::string field;
+    std::string value;
+};
+
+std::vector<Token> tokenize(const std::string& expression) {
+    std::vector<Token> tokens;
+    size_t i = 0;
+    while (i < expression.size()) {
+        char c = expression[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            ++i;
+            continue;
+        }
+        Token token;
+        if (c == '(' || c == ')') {
+            token.kind = c == '(' ? Token::Kind::Open : Token::Kind::Close;
+            tokens.push_back(token);
+            ++i;
+            continue;
+        }
+        size_t start = i;
+        while (i < expression.size() && expression[i] != '=' && expression[i] != '(' && expression[i] != ')' &&
+               !std::isspace(static_cast<unsigned char>(expression[i]))) {
+            ++i;
+        }
+        std::string word = expression.substr(start, i - start);
+        if (i >= expression.size() || expression[i] != '=') {
+            std::string upper = word;
+            std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char ch) { return static_cast<char>(std::toupper(ch)); });
+            if (upper == "AND" || upper == "OR") {
+                token.kind = upper == "AND" ? Token::Kind::And : Token::Kind::Or;
+                tokens.push_back(token);
+                continue;
+            }
+            throw std::invalid_argument("Expected field=value in query at '" + word + "'");
+        }
+        token.kind = Token::Kind::Term;
+        std::transform(word.begin(), word.end(), word.begin(), [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+        token.field = word;
+        ++i; // '='
+        if (i < expression.size() && expression[i] == '"') {
+            size_t close = expression.find('"', i + 1);
+            if (close == std::string::npos) {
+                throw std::invalid_argument("Unterminated quoted value in query for '" + word + "'");
+            }
+            token.value = expression.substr(i + 1, close - i - 1);
+            i = close + 1;
+        } else {
+            start = i;
+            while (i < expression.size() && expression[i] != '(' && expression[i] != ')' &&
+                   !std::isspace(static_cast<unsigned char>(expression[i]))) {
+                ++i;
+            }
+            token.value = expression.substr(start, i - start);
+        }
+        tokens.push_back(token);
+    }
+    tokens.push_back(Token());
+    return tokens;
+}
+
+bool field_named(const std::string& name, QueryField& field) {
+    static const std::pair<const char*, QueryField> kNames[] = {
+        {"class", QueryField::OpClass},
+        {"op_class", QueryField::OpClass},
+        {"operation.class", QueryField::OpClass},
+        {"method", QueryField::Method},
+        {"operation.method", QueryField::Method},
+        {"assumption", QueryField::Assumption},
+        {"assumptions", QueryField::Assumption},
+        {"data_class", QueryField::DataClass},
+        {"input.data_class", QueryField::DataClass},
+        {"output.data_class", QueryField::OutputDataClass},
+        {"output_data_class", QueryField::OutputDataClass},
+        {"language", QueryField::Language},
+        {"environment.language", QueryField::Language},
+        {"tool", QueryField::Tool},
+        {"environment.tool", QueryField::Tool},
+        {"version", QueryField::Version},
+        {"environment.version", QueryField::Version},
+    };
+    for (const auto& pair : kNames) {
+        if (name == pair.first) {
+            field = pair.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+// Recursive descent over: or := and (OR and)*; and := primary (AND primary)*;
+// primary := '(' or ')' | field=value
+class QueryParser {
+public:
+    explicit QueryParser(const std::string& expression) : tokens_(tokenize(expression)) {}
+
+    void parse(QueryIndex::QueryNode& root) {
+        if (tokens_.front().kind == Token::Kind::End) {
+            throw std::invalid_argument("Empty query");
+        }
+        parse_or(root);
+        if (peek().kind != Token::Kind::End) {
+            throw std::invalid_argument("Expected AND or OR in query");
+        }
+    }
+
+private:
+    const Token& peek() const { return tokens_[next_]; }
+
+    void parse_or(QueryIndex::QueryNode& node) {
+        parse_and(node);
+        if (peek().kind != Token::Kind::Or) {
+            return;
+        }
+        QueryIndex::QueryNode combined;
+        combined.kind = QueryIndex::QueryNode::Kind::Or;
+        combined.children.push_back(std::move(node));
+        while (peek().kind == Token::Kind::Or) {
+            ++next_;
+            combined.children.emplace_back();
+            parse_and(combined.children.back());
+        }
+        node = std::move(combined);
+    }
+
+    void parse_and(QueryIndex::QueryNode& node) {
+        parse_primary(node);
+        if (peek().kind != Token::Kind::And) {
+            return;
+        }
+        QueryIndex::QueryNode combined;
+        combined.kind = QueryIndex::QueryNode::Kind::And;
+        combined.children.push_back(std::move(node));
+        while (peek().kind == Token::Kind::And) {
+            ++next_;
+            combined.children.emplace_back();
+            parse_primary(combined.children.back());
+        }
+        node = std::move(combined);
+    }
+
+    void parse_primary(QueryIndex::QueryNode& node) {
+        const Token& token = tokens_[next_++];
+        if (token.kind == Token::Kind::Open) {
+            parse_or(node);
+            if (tokens_[next_++].kind != Token::Kind::Close) {
+                throw std::invalid_argument("Missing ')' in query");
+            }
+            return;
+        }
+        if (token.kind != Token::Kind::Term) {
+            throw std::invalid_argument("Expected field=value in query");
+        }
+        if (token.field == "since" || token.field == "until") {
+            if (token.value.empty()) {
+                throw std::invalid_argument("Empty time for '" + token.field + "' in query");
+            }
+            node.kind = QueryIndex::QueryNode::Kind::Range;
+            (token.field == "since" ? node.since : node.until) = token.value;
+            return;
+        }
+        if (!field_named(token.field, node.field)) {
+            throw std::invalid_argument("Unknown query field '" + token.field + "'");
+        }
+        node.kind = QueryIndex::QueryNode::Kind::Term;
+        node.value = token.value;
+        if (!node.value.empty() && node.value.back() == '*') {
+            node.prefix = true;
+            node.value.pop_back();
+        }
+    }
+
+    std::vector<Token> tokens_;
+    size_t next_ = 0;
+};
+
+// Intersects two sorted lists, `small` being the shorter one
+static std::vector<uint32_t> intersect(const std::vector<uint32_t>& small, const std::vector<uint32_t>& large) {
+    std::vector<uint32_t> result;
+    if (large.size() / kGallopRatio > small.size()) {
+        auto from = large.begin();
+        for (uint32_t position : small) {
+            from = std::lower_bound(from, large.end(), position);
+            if (from == large.end()) {
+                break;
+            }
+            if (*from == position) {
+                result.push_back(position);
+            }
+        }
+        return result;
+    }
+    std::set_intersection(small.begin(), small.end(), large.begin(), large.end(), std::back_inserter(result));
+    return result;
+}
+
+QueryIndex::QueryIndex(const fs::path& project_root, NodeStore& store)
+    : project_root_(project_root), path_(project_root / ".traceseq" / "query.idx"), store_(store) {}
+
+void QueryIndex::clear() {
+    covered_ = 0;
+    saved_ = 0;
+    for (auto& dictionary : dictionaries_) {
+        dictionary.clear();
+    }
+    timestamps_.clear();
+}
+
+size_t QueryIndex::refresh(unsigned int num_threads) {
+    ProfileSpan span("QueryIndex::refresh");
+    if (!loaded_) {
+        loaded_ = true;
+        if (!load()) {
+            clear();
+        }
+    }
+    size_t added = 0;
+    for (;;) {
+        uint64_t generation = 0;
+        std::vector<NodeLocation> fresh = store_.locations(covered_, generation);
+        if (generation != generation_) {
+            // Compacted since: positions were renumbered
+            clear();
+            generation_ = generation;
+            continue;
+        }
+        if (fresh.size() + covered_ > UINT32_MAX) {
+            throw std::runtime_error("Too many trace nodes to index");
+        }
+        bool moved = false;
+        for (size_t begin = 0; begin < fresh.size() && !moved; begin += kDecodeBatch) {
+            size_t count = std::min(kDecodeBatch, fresh.size() - begin);
+            std::vector<TraceNode> nodes(count);
+            try {
+                parallel_for(count, num_threads, [&](size_t i) {
+                    const NodeLocation& location = fresh[begin + i];
+                    nodes[i] = decode_node_payload(location.format, store_.read_payload(location));
+                });
+            } catch (const std::runtime_error&) {
+                // A compaction may have removed the segments; start over if so
+                std::vector<NodeLocation> none;
+                store_.refresh();
+                if (store_.locations_at({}, generation_, none)) {
+                    throw;
+                }
+                moved = true;
+                break;
+            }
+            timestamps_.resize((covered_ + count) * kTimestampSize, '\0');
+            for (size_t i = 0; i < count; ++i) {
+                const TraceNode& node = nodes[i];
+                const uint32_t position = static_cast<uint32_t>(covered_ + i);
+                auto add = [&](QueryField field, const std::string& value) {
+                    PostingList& postings = dictionaries_[static_cast<size_t>(field)][value];
+                    if (postings.empty() || postings.back() != position) {
+                        postings.push_back(position);
+                    }
+                };
+                add(QueryField::OpClass, node.operation.op_class);
+                add(QueryField::Method, node.operation.method);
+                for (const auto& assumption : node.assumptions) {
+                    add(QueryField::Assumption, assumption);
+                }
+                add(QueryField::DataClass, node.data_class);
+                add(QueryField::OutputDataClass, node.output.data_class);
+                add(QueryField::Language, node.environment.language);
+                add(QueryField::Tool, node.environment.tool);
+                add(QueryField::Version, node.environment.version);
+                std::memcpy(&timestamps_[position * kTimestampSize], node.timestamp.data(),
+                            std::min(node.timestamp.size(), kTimestampSize));
+            }
+            covered_ += count;
+            added += count;
+        }
+        if (!moved) {
+            break;
+        }
+    }
+    size_t pending = covered_ - saved_;
+    if (pending > 0 && (pending >= kSaveEvery || pending * 8 >= covered_)) {
+        save();
+    }
+    span.set_value("added", static_cast<int64_t>(added));
+    return covered_;
+}
+
+bool QueryIndex::load() {
+    std::ifstream in(path_, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    auto take = [&](void* out, size_t size) {
+        if (data.size() - pos < size) {
+            return false;
+        }
+        std::memcpy(out, data.data() + pos, size);
+        pos += size;
+        return true;
+    };
+    char magic[sizeof(kQueryIndexMagic)];
+    uint64_t header[2];
+    if (!take(magic, sizeof(magic)) || std::memcmp(magic, kQueryIndexMagic, sizeof(magic)) != 0 ||
+        !take(header, sizeof(header)) || header[1] > UINT32_MAX ||
+        (data.size() - pos) / kTimestampSize < header[1]) {
+        return false;
+    }
+    clear();
+    generation_ = header[0];
+    const size_t count = static_cast<size_t>(header[1]);
+    timestamps_.assign(data, pos, count * kTimestampSize);
+    pos += count * kTimestampSize;
+    for (auto& dictionary : dictionaries_) {
+        uint64_t terms = 0;
+        if (!take(&terms, sizeof(terms)) || terms > data.size() - pos) {
+            return false;
+        }
+        dictionary.reserve(static_cast<size_t>(terms));
+        for (uint64_t t = 0; t < terms; ++t) {
+            uint32_t length = 0;
+            if (!take(&length, sizeof(length)) || length > data.size() - pos) {
+                return false;
+            }
+            std::string value(data, pos, length);
+            pos += length;
+            uint64_t postings = 0;
+            if (!take(&postings, sizeof(postings)) || postings > count ||
+                (data.size() - pos) / sizeof(uint32_t) < postings) {
+                return false;
+            }
+            PostingList& list = dictionary[value];
+            list.resize(static_cast<size_t>(postings));
+            take(list.data(), list.size() * sizeof(uint32_t));
+            if (!list.empty() && list.back() >= count) {
+                return false;
+            }
+        }
+    }
+    covered_ = count;
+    saved_ = count;
+    return true;
+}
+
+// Written to a temporary file and renamed into place, so readers never see
+// a partial index. A failed write only costs re-decoding the nodes later.
+void QueryIndex::save() {
+    std::string data(kQueryIndexMagic, sizeof(kQueryIndexMagic));
+    uint64_t header[2] = {generation_, static_cast<uint64_t>(covered_)};
+    data.append(reinterpret_cast<const char*>(header), sizeof(header));
+    data.append(timestamps_);
+    for (const auto& dictionary : dictionaries_) {
+        uint64_t terms = dictionary.size();
+        data.append(reinterpret_cast<const char*>(&terms), sizeof(terms));
+        for (const auto& pair : dictionary) {
+            uint32_t length = static_cast<uint32_t>(pair.first.size());
+            uint64_t postings = pair.second.size();
+            data.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            data.append(pair.first);
+            data.append(reinterpret_cast<const char*>(&postings), sizeof(postings));
+            data.append(reinterpret_cast<const char*>(pair.second.data()), pair.second.size() * sizeof(uint32_t));
+        }
+    }
+    fs::path tmp_path = path_;
+    tmp_path += ".tmp" + std::to_string(::getpid());
+    std::error_code ec;
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open() || !out.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+    fs::rename(tmp_path, path_, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        return;
+    }
+    saved_ = covered_;
+}
+
+QueryIndex::PostingList QueryIndex::lookup(QueryField field, const std::string& value) const {
+    const Dictionary& dictionary = dictionaries_[static_cast<size_t>(field)];
+    auto it = dictionary.find(value);
+    return it == dictionary.end() ? PostingList() : it->second;
+}
+
+QueryIndex::PostingList QueryIndex::time_range(const std::string& since, const std::string& until, const PostingList* within) const {
+    auto in_range = [&](uint32_t position) {
+        const char* timestamp = timestamps_.data() + static_cast<size_t>(position) * kTimestampSize;
+        std::string_view value(timestamp, strnlen(timestamp, kTimestampSize));
+        return value >= since && (until.empty() || value < until);
+    };
+    PostingList result;
+    if (within) {
+        std::copy_if(within->begin(), within->end(), std::back_inserter(result), in_range);
+        return result;
+    }
+    for (uint32_t position = 0; position < covered_; ++position) {
+        if (in_range(position)) {
+            result.push_back(position);
+        }
+    }
+    return result;
+}
+
+QueryIndex::PostingList QueryIndex::evaluate(const QueryNode& node) const {
+    switch (node.kind) {
+    case QueryNode::Kind::Term: {
+        if (!node.prefix) {
+            return lookup(node.field, node.value);
+        }
+        PostingList result;
+        for (const auto& pair : dictionaries_[static_cast<size_t>(node.field)]) {
+            if (pair.first.compare(0, node.value.size(), node.value) == 0) {
+                PostingList merged;
+                std::set_union(result.begin(), result.end(), pair.second.begin(), pair.second.end(), std::back_inserter(merged));
+                result.swap(merged);
+            }
+        }
+        return result;
+    }
+    case QueryNode::Kind::Range:
+        return time_range(node.since, node.until, nullptr);
+    case QueryNode::Kind::Or: {
+        PostingList result;
+        for (const auto& child : node.children) {
+            PostingList list = evaluate(child);
+            PostingList merged;
+            std::set_union(result.begin(), result.end(), list.begin(), list.end(), std::back_inserter(merged));
+            result.swap(merged);
+        }
+        return result;
+    }
+    case QueryNode::Kind::And:
+        break;
+    }
+
+    // Ranges only filter what the other terms matched, so fold them into one
+    std::string since;
+    std::string until;
+    bool ranged = false;
+    std::vector<PostingList> lists;
+    for (const auto& child : node.children) {
+        if (child.kind == QueryNode::Kind::Range) {
+            ranged = true;
+            since = std::max(since, child.since);
+            if (!child.until.empty() && (until.empty() || child.until < until)) {
+                until = child.until;
+            }
+            continue;
+        }
+        lists.push_back(evaluate(child));
+        if (lists.back().empty()) {
+            return PostingList();
+        }
+    }
+    if (lists.empty()) {
+        return time_range(since, until, nullptr);
+    }
+    std::sort(lists.begin(), lists.end(), [](const PostingList& a, const PostingList& b) { return a.size() < b.size(); });
+    PostingList result = std::move(lists.front());
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i) {
+        result = intersect(result, lists[i]);
+    }
+    return ranged ? time_range(since, until, &result) : result;
+}
+
+// The same semantics as `evaluate`, for a single node without a position
+bool QueryIndex::matches(const QueryNode& query, const TraceNode& node) {
+    switch (query.kind) {
+    case QueryNode::Kind::Term: {
+        auto match = [&](const std::string& value) {
+            return query.prefix ? value.compare(0, query.value.size(), query.value) == 0 : value == query.value;
+        };
+        switch (query.field) {
+        case QueryField::OpClass: return match(node.operation.op_class);
+        case QueryField::Method: return match(node.operation.method);
+        case QueryField::Assumption: return std::any_of(node.assumptions.begin(), node.assumptions.end(), match);
+        case QueryField::DataClass: return match(node.data_class);
+        case QueryField::OutputDataClass: return match(node.output.data_class);
+        case QueryField::Language: return match(node.environment.language);
+        case QueryField::Tool: return match(node.environment.tool);
+        case QueryField::Version: return match(node.environment.version);
+        }
+        return false;
+    }
+    case QueryNode::Kind::Range: {
+        std::string_view timestamp(node.timestamp.data(), std::min(node.timestamp.size(), kTimestampSize));
+        return timestamp >= query.since && (query.until.empty() || timestamp < query.until);
+    }
+    case QueryNode::Kind::And:
+        return std::all_of(query.children.begin(), query.children.end(),
+                           [&](const QueryNode& child) { return matches(child, node); });
+    case QueryNode::Kind::Or:
+        return std::any_of(query.children.begin(), query.children.end(),
+                           [&](const QueryNode& child) { return matches(child, node); });
+    }
+    return false;
+}
+
+// Matches the per-file nodes that are not also packed, reading only the
+// files that are new or changed since the previous call
+std::vector<std::string> QueryIndex::match_node_files(const QueryNode& query) {
+    std::unordered_map<std::string, FileNode> current;
+    std::vector<std::pair<fs::path, FileNode*>> stale;
+    std::error_code ec;
+    for (fs::directory_iterator it(project_root_ / ".traceseq" / "nodes", ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".yaml") {
+            continue;
+        }
+        std::error_code stat_ec;
+        FileNode file;
+        file.size = it->file_size(stat_ec);
+        file.mtime = it->last_write_time(stat_ec);
+        if (stat_ec) {
+            continue; // Removed since it was listed
+        }
+        const std::string name = it->path().filename().string();
+        auto cached = file_nodes_.find(name);
+        if (cached != file_nodes_.end() && cached->second.size == file.size && cached->second.mtime == file.mtime) {
+            file.node = std::move(cached->second.node);
+        }
+        FileNode& entry = current.emplace(name, std::move(file)).first->second;
+        if (!entry.node) {
+            stale.emplace_back(it->path(), &entry);
+        }
+    }
+    std::vector<char> unreadable(stale.size(), 0);
+    parallel_for(stale.size(), 0, [&](size_t i) {
+        try {
+            stale[i].second->node = std::make_shared<const TraceNode>(load_node_yaml_file(stale[i].first));
+        } catch (const std::exception& e) {
+            std::cerr << "Error querying trace node: " << stale[i].first.string() << ": " << e.what() << std::endl;
+            unreadable[i] = 1;
+        }
+    });
+    for (size_t i = 0; i < stale.size(); ++i) {
+        if (unreadable[i] || stale[i].second->node->trace_id.empty()) {
+            current.erase(stale[i].first.filename().string());
+        }
+    }
+    file_nodes_ = std::move(current);
+
+    std::vector<std::string> trace_ids;
+    NodeLocation location;
+    for (const auto& pair : file_nodes_) {
+        const TraceNode& node = *pair.second.node;
+        if (matches(query, node) && !store_.find(node.trace_id, location)) {
+            trace_ids.push_back(node.trace_id);
+        }
+    }
+    std::sort(trace_ids.begin(), trace_ids.end());
+    return trace_ids;
+}
+
+std::vector<std::string> QueryIndex::query(const std::string& expression, unsigned int num_threads) {
+    ProfileSpan span("QueryIndex::query");
+    QueryNode root;
+    QueryParser(expression).parse(root);
+    for (;;) {
+        refresh(num_threads);
+        PostingList matches = evaluate(root);
+        std::vector<NodeLocation> locations;
+        if (!store_.locations_at(matches, generation_, locations)) {
+            continue; // Compacted between the refresh and the lookup
+        }
+        std::vector<std::string> trace_ids;
+        trace_ids.reserve(locations.size());
+        for (const auto& location : locations) {
+            trace_ids.push_back(location.trace_id);
+        }
+        std::vector<std::string> in_files = match_node_files(root);
+        trace_ids.insert(trace_ids.end(), in_files.begin(), in_files.end());
+        span.set_value("matches", static_cast<int64_t>(trace_ids.size()));
+        return trace_ids;
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef QUERY_INDEX_HPP
+#define QUERY_INDEX_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "node_store.hpp"
+
+/// The trace node fields `QueryIndex` keeps posting lists for.
+enum class QueryField : uint8_t {
+    OpClass,          ///< `operation.class`
+    Method,           ///< `operation.method`
+    Assumption,       ///< Each entry of `assumptions`
+    DataClass,        ///< Input `data_class`
+    OutputDataClass,  ///< `output.data_class`
+    Language,         ///< `environment.language`
+    Tool,             ///< `environment.tool`
+    Version,          ///< `environment.version`
+};
+
+/// Number of `QueryField` values.
+constexpr size_t kQueryFieldCount = 8;
+
+/**
+ * @brief Inverted indexes over the packed trace nodes of a project.
+ *
+ * For every field of `QueryField` and every value it takes, the index keeps
+ * the sorted positions (see `NodeStore::locations`) of the nodes with that
+ * value; node timestamps are kept per position for range filters. Queries
+ * combine these posting lists: AND intersects them, smallest first and with
+ * binary search when one list is much shorter, and OR merges them.
+ *
+ * The index is saved to '.traceseq/query.idx' together with the number of
+ * nodes it covers. `refresh` decodes only the nodes appended since, on
+ * worker threads, and saves the index again once enough new nodes were
+ * added, so it grows with the store instead of being rebuilt. After a
+ * compaction has renumbered the nodes it is rebuilt from scratch.
+ *
+ * Nodes stored as per-file YAML in '.traceseq/nodes' (written by the R
+ * package, too long to pack, or kept by gc) have no positions; `query`
+ * matches them one by one after the packed nodes, re-reading only files
+ * that changed since the previous query. Run `migrate_node_files` to pack
+ * them.
+ *
+ * A QueryIndex is not thread-safe.
+ */
+class QueryIndex {
+public:
+    /**
+     * @brief Opens the query index of a project; call `refresh` or `query` to read it.
+     * @param project_root The root directory of the project.
+     * @param store The project's packed node store.
+     */
+    QueryIndex(const std::filesystem::path& project_root, NodeStore& store);
+
+    /**
+     * @brief Brings the index up to date with the store.
+     * @param num_threads Threads decoding new nodes (0 means one per hardware core).
+     * @return The number of indexed nodes.
+     * @throws std::runtime_error if a node cannot be read.
+     */
+    size_t refresh(unsigned int num_threads = 0);
+
+    /**
+     * @brief Finds the nodes matching a query, after a refresh.
+     *
+     * A query is made of terms `field=value`, combined with AND and OR
+     * (AND binds tighter) and grouped with parentheses. Fields are `class`
+     * (or `operation.class`), `method`, `assumption`, `data_class`,
+     * `output.data_class`, `language`, `tool` and `version`; a value ending
+     * in `*` matches every value with that prefix. `since=<time>` and
+     * `until=<time>` keep nodes with `since <= timestamp < until`, where a
+     * time may be any prefix of an ISO 8601 timestamp, such as `2026-06`.
+     * Values containing spaces or parentheses are written in double quotes.
+     *
+     * @param expression The query, e.g. `class=normalization AND assumption=reference_version:hg38 AND since=2026-06`.
+     * @param num_threads Threads decoding new nodes during the refresh.
+     * @return The matching packed trace IDs in append order, then the matching per-file nodes ordered by trace ID.
+     * @throws std::invalid_argument if the query is malformed.
+     * @throws std::runtime_error if a node cannot be read.
+     */
+    std::vector<std::string> query(const std::string& expression, unsigned int num_threads = 0);
+
+    /// The number of indexed (packed) nodes.
+    size_t size() const { return covered_; }
+
+    /// The number of per-file nodes the last `query` matched against; unreadable files are not counted.
+    size_t file_nodes() const { return file_nodes_.size(); }
+
+private:
+    using PostingList = std::vector<uint32_t>;
+    using Dictionary = std::unordered_map<std::string, PostingList>;
+
+    struct QueryNode;
+    friend class QueryParser;
+
+    /// A per-file node as it was read, with the file's size and modification time then.
+    struct FileNode {
+        uintmax_t size = 0;
+        std::filesystem::file_time_type mtime;
+        std::shared_ptr<const TraceNode> node;  ///< Null until the file is read.
+    };
+
+    void clear();
+    bool load();
+    void save();
+    PostingList evaluate(const QueryNode& node) const;
+    PostingList lookup(QueryField field, const std::string& value) const;
+    PostingList time_range(const std::string& since, const std::string& until, const PostingList* within) const;
+    static bool matches(const QueryNode& query, const TraceNode& node);
+    std::vector<std::string> match_node_files(const QueryNode& query);
+
+    std::filesystem::path project_root_;
+    std::filesystem::path path_;
+    NodeStore& store_;
+    bool loaded_ = false;
+    uint64_t generation_ = 0;       ///< Offset index the positions refer to.
+    size_t covered_ = 0;            ///< Nodes indexed, at positions [0, covered_).
+    size_t saved_ = 0;              ///< Nodes covered by the saved file.
+    Dictionary dictionaries_[kQueryFieldCount];
+    std::string timestamps_;        ///< kTimestampSize bytes per position.
+    std::unordered_map<std::string, FileNode> file_nodes_;  ///< Per-file nodes by file name.
+};
+
+#endif // QUERY_INDEX_HPP
@@ -0,0 +1,79 @@
+#include "session.hpp"
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+ProjectSession::ProjectSession(const fs::path& project_root)
+    : project_root_(project_root) {}
+
+const nlohmann::json& ProjectSession::index() {
+    return storage().index();
+}
+
+const Ontology& ProjectSession::ontology() {
+    FileIdentity operation_identity = stat_file_identity((project_root_ / "core" / "operation_ontology.yaml").string());
+    FileIdentity assumption_identity = stat_file_identity((project_root_ / "core" / "assumption_ontology.yaml").string());
+    if (!ontology_ || operation_identity != operation_ontology_identity_ ||
+        assumption_identity != assumption_ontology_identity_) {
+        auto ontology = std::make_unique<Ontology>();
+        // Reads the compiled snapshot unless the YAML ontologies changed
+        ontology->load_project(project_root_);
+        ontology_ = std::move(ontology);
+        operation_ontology_identity_ = operation_identity;
+        assumption_ontology_identity_ = assumption_identity;
+    }
+    return *ontology_;
+}
+
+ChecksumCache& ProjectSession::checksum_cache(bool enabled) {
+    std::unique_ptr<ChecksumCache>& cache = enabled ? checksum_cache_ : uncached_checksums_;
+    if (!cache) {
+        cache = std::make_unique<ChecksumCache>(project_root_, enabled);
+        for (const auto& pinned : pinned_) {
+            cache->pin(pinned);
+        }
+    }
+    return *cache;
+}
+
+void ProjectSession::pin_checksums(const std::vector<PinnedChecksum>& checksums) {
+    pinned_.insert(pinned_.end(), checksums.begin(), checksums.end());
+    for (ChecksumCache* cache : {checksum_cache_.get(), uncached_checksums_.get()}) {
+        for (size_t i = 0; cache && i < checksums.size(); ++i) {
+            cache->pin(checksums[i]);
+        }
+    }
+}
+
+void ProjectSession::clear_pinned_checksums() {
+    pinned_.clear();
+    for (ChecksumCache* cache : {checksum_cache_.get(), uncached_checksums_.get()}) {
+        if (cache) {
+            cache->clear_pins();
+        }
+    }
+}
+
+TraceStorage& ProjectSession::storage() {
+    if (!storage_ || storage_->backend() != storage_backend(project_root_)) {
+        // The query index points into the packed store it was built over
+        query_index_.reset();
+        storage_ = open_storage(project_root_);
+    }
+    return *storage_;
+}
+
+NodeStore& ProjectSession::node_store() {
+    auto* files = dynamic_cast<FileStorage*>(&storage());
+    if (!files) {
+        throw std::runtime_error("This project uses SQLite storage; convert it with --convert-store files first");
+    }
+    return files->node_store();
+}
+
+QueryIndex& ProjectSession::query_index() {
+    if (!query_index_) {
+        query_index_ = std::make_unique<QueryIndex>(project_root_, node_store());
+    }
+    return *query_index_;
+}
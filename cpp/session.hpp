@@ -0,0 +1,95 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "tracer.hpp"
+#include "checksum_cache.hpp"
+#include "index_log.hpp"
+#include "query_index.hpp"
+#include "storage.hpp"
+
+/**
+ * @brief The per-project state shared by the commands of one process.
+ *
+ * Each piece of state is loaded on first use. A one-shot CLI invocation uses
+ * a session once; the `traceseqd` daemon keeps one alive so the index,
+ * compiled ontology, opened storage and checksum cache stay in memory
+ * between requests. Every accessor revalidates its state against the files
+ * on disk, so changes made by other processes are always observed.
+ *
+ * A session is not thread-safe; the daemon serves one request at a time.
+ */
+class ProjectSession {
+public:
+    /**
+     * @brief Creates a session for a project.
+     * @param project_root The root directory of the project.
+     */
+    explicit ProjectSession(const std::filesystem::path& project_root);
+
+    /// The root directory of the project.
+    const std::filesystem::path& root() const { return project_root_; }
+
+    /**
+     * @brief Returns the current index of the project's storage.
+     * @return The index, refreshed incrementally from disk.
+     */
+    const nlohmann::json& index();
+
+    /**
+     * @brief Returns the compiled ontology, reloading it if the YAML files changed.
+     * @return The ontology.
+     * @throws std::runtime_error if the ontology cannot be loaded.
+     */
+    const Ontology& ontology();
+
+    /**
+     * @brief Returns the project's checksum cache.
+     * @param enabled Whether the cache may be used; a disabled cache always re-hashes.
+     * @return The checksum cache.
+     */
+    ChecksumCache& checksum_cache(bool enabled = true);
+
+    /**
+     * @brief Pins checksums computed by the client in both checksum caches (see `ChecksumCache::pin`).
+     * @param checksums The checksums, each with the identity of the file it was computed for.
+     */
+    void pin_checksums(const std::vector<PinnedChecksum>& checksums);
+
+    /// Forgets the checksums given to `pin_checksums`.
+    void clear_pinned_checksums();
+
+    /**
+     * @brief Returns the project's storage, reopened if the project switched backends.
+     * @return The storage.
+     * @throws std::runtime_error if the SQLite database cannot be opened.
+     */
+    TraceStorage& storage();
+
+    /**
+     * @brief Returns the project's packed node store.
+     * @return The node store of the file layout.
+     * @throws std::runtime_error if the project uses SQLite storage.
+     */
+    NodeStore& node_store();
+
+    /// Returns the query index over the node store; `QueryIndex::query` brings it up to date.
+    QueryIndex& query_index();
+
+private:
+    std::filesystem::path project_root_;
+    std::unique_ptr<Ontology> ontology_;
+    FileIdentity operation_ontology_identity_;   ///< Identity of the operation ontology that was loaded.
+    FileIdentity assumption_ontology_identity_;  ///< Identity of the assumption ontology that was loaded.
+    std::unique_ptr<ChecksumCache> checksum_cache_;
+    std::unique_ptr<ChecksumCache> uncached_checksums_;
+    std::vector<PinnedChecksum> pinned_;         ///< Pins applied to caches created later.
+    std::unique_ptr<TraceStorage> storage_;
+    std::unique_ptr<QueryIndex> query_index_;
+};
+
+#endif // SESSION_HPP
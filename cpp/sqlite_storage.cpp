@@ -0,0 +1,399 @@
+#include "sqlite_storage.hpp"
+#include "profiler.hpp"
+#include <stdexcept>
+#include <sqlite3.h>
+
+namespace fs = std::filesystem;
+
+// How long a writer waits for another process's transaction to finish
+static const int kBusyTimeoutMs = 60000;
+
+// Node columns besides the payload are what lineage walks and queries read
+// without decoding; the seq columns keep the order rows were first stored in.
+static const int kSchemaVersion = 1;
+static const char kSchema[] =
+    "CREATE TABLE IF NOT EXISTS nodes ("
+    "  seq INTEGER PRIMARY KEY,"
+    "  trace_id TEXT NOT NULL UNIQUE,"
+    "  parent TEXT NOT NULL,"
+    "  op_class TEXT NOT NULL,"
+    "  timestamp TEXT NOT NULL,"
+    "  format INTEGER NOT NULL,"
+    "  payload BLOB NOT NULL);"
+    // Covers the child lookups of descendant walks
+    "CREATE INDEX IF NOT EXISTS nodes_parent ON nodes (parent, trace_id);"
+    "CREATE INDEX IF NOT EXISTS nodes_op_class ON nodes (op_class);"
+    // AUTOINCREMENT: a replaced entry always gets a higher seq than any
+    // entry a reader has applied, so readers catch up by seq alone
+    "CREATE TABLE IF NOT EXISTS file_index ("
+    "  seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "  checksum TEXT NOT NULL UNIQUE,"
+    "  trace_id TEXT NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value INTEGER NOT NULL);"
+    "INSERT OR IGNORE INTO meta (key, value) VALUES ('index_epoch', 0);";
+
+namespace {
+
+// Resets a shared prepared statement once a call is done with it
+class StatementScope {
+public:
+    explicit StatementScope(sqlite3_stmt* statement) : statement_(statement) {}
+    ~StatementScope() {
+        sqlite3_reset(statement_);
+        sqlite3_clear_bindings(statement_);
+    }
+    StatementScope(const StatementScope&) = delete;
+    StatementScope& operator=(const StatementScope&) = delete;
+
+private:
+    sqlite3_stmt* statement_;
+};
+
+void bind_text(sqlite3_stmt* statement, int index, const std::string& value) {
+    sqlite3_bind_text(statement, index, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+}
+
+std::string column_text(sqlite3_stmt* statement, int index) {
+    const unsigned char* text = sqlite3_column_text(statement, index);
+    return text ? std::string(reinterpret_cast<const char*>(text), static_cast<size_t>(sqlite3_column_bytes(statement, index))) : std::string();
+}
+
+} // namespace
+
+fs::path sqlite_database_path(const fs::path& project_root) {
+    return project_root / ".traceseq" / "traceseq.db";
+}
+
+void remove_sqlite_database(const fs::path& database_path) {
+    std::error_code ec;
+    for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+        fs::path path = database_path;
+        path += suffix;
+        fs::remove(path, ec);
+    }
+}
+
+// Runs `body` in one write transaction, rolled back if it throws. Taken
+// IMMEDIATE so that concurrent writers queue on the busy timeout up front
+// rather than failing when they upgrade a read transaction.
+template <typename Body>
+static void write_transaction(sqlite3* db, const fs::path& database_path, Body&& body) {
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Could not start a transaction on " + database_path.string() + ": " + sqlite3_errmsg(db));
+    }
+    try {
+        body();
+        if (sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+            throw std::runtime_error("Could not commit to " + database_path.string() + ": " + sqlite3_errmsg(db));
+        }
+    } catch (...) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
+
+SqliteStorage::SqliteStorage(const fs::path& project_root)
+    : SqliteStorage(project_root, sqlite_database_path(project_root)) {}
+
+SqliteStorage::SqliteStorage(const fs::path& project_root, const fs::path& database_path)
+    : TraceStorage(project_root), database_path_(database_path) {
+    fs::create_directories(database_path_.parent_path());
+    // One connection shared by all threads, serialized by mutex_
+    int rc = sqlite3_open_v2(database_path_.c_str(), &db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr);
+    if (rc != SQLITE_OK) {
+        std::string message = db_ ? sqlite3_errmsg(db_) : "out of memory";
+        sqlite3_close(db_);
+        throw std::runtime_error("Could not open SQLite database " + database_path_.string() + ": " + message);
+    }
+    try {
+        sqlite3_busy_timeout(db_, kBusyTimeoutMs);
+        execute("PRAGMA journal_mode=WAL");
+        execute("PRAGMA synchronous=FULL");
+        // Creating the schema takes the write lock, so it is done once per
+        // database rather than by every connection
+        if (schema_version() < kSchemaVersion) {
+            write_transaction(db_, database_path_, [&]() {
+                execute(kSchema);
+                execute(("PRAGMA user_version = " + std::to_string(kSchemaVersion)).c_str());
+            });
+        }
+        upsert_node_ = prepare(
+            "INSERT INTO nodes (trace_id, parent, op_class, timestamp, format, payload) VALUES (?1, ?2, ?3, ?4, ?5, ?6) "
+            "ON CONFLICT (trace_id) DO UPDATE SET parent = excluded.parent, op_class = excluded.op_class, "
+            "timestamp = excluded.timestamp, format = excluded.format, payload = excluded.payload");
+        select_node_ = prepare("SELECT format, payload FROM nodes WHERE trace_id = ?1");
+        select_parent_ = prepare("SELECT parent FROM nodes WHERE trace_id = ?1");
+        select_children_ = prepare("SELECT trace_id FROM nodes WHERE parent = ?1 ORDER BY seq");
+        select_trace_ids_ = prepare("SELECT trace_id FROM nodes ORDER BY seq");
+        upsert_index_ = prepare("INSERT OR REPLACE INTO file_index (checksum, trace_id) VALUES (?1, ?2)");
+        select_index_since_ = prepare("SELECT seq, checksum, trace_id FROM file_index WHERE seq > ?1 ORDER BY seq");
+        select_trace_id_ = prepare("SELECT trace_id FROM file_index WHERE checksum = ?1");
+        select_index_epoch_ = prepare("SELECT value FROM meta WHERE key = 'index_epoch'");
+        data_version_ = prepare("PRAGMA data_version");
+    } catch (...) {
+        for (sqlite3_stmt* statement : statements_) {
+            sqlite3_finalize(statement);
+        }
+        sqlite3_close(db_);
+        throw;
+    }
+}
+
+// Closing the last connection checkpoints the WAL into the database file
+SqliteStorage::~SqliteStorage() {
+    for (sqlite3_stmt* statement : statements_) {
+        sqlite3_finalize(statement);
+    }
+    sqlite3_close(db_);
+}
+
+void SqliteStorage::fail(const char* what) const {
+    throw std::runtime_error(std::string("SQLite ") + what + " failed on " + database_path_.string() + ": " + sqlite3_errmsg(db_));
+}
+
+void SqliteStorage::execute(const char* sql) {
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        fail(sql);
+    }
+}
+
+int SqliteStorage::schema_version() {
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v2(db_, "PRAGMA user_version", -1, &statement, nullptr) != SQLITE_OK) {
+        fail("PRAGMA user_version");
+    }
+    int version = sqlite3_step(statement) == SQLITE_ROW ? sqlite3_column_int(statement, 0) : 0;
+    sqlite3_finalize(statement);
+    return version;
+}
+
+sqlite3_stmt* SqliteStorage::prepare(const char* sql) {
+    sqlite3_stmt* statement = nullptr;
+    if (sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &statement, nullptr) != SQLITE_OK) {
+        fail("prepare");
+    }
+    statements_.push_back(statement);
+    return statement;
+}
+
+void SqliteStorage::write_nodes(const std::vector<TraceNode>& nodes) {
+    if (nodes.empty()) {
+        return;
+    }
+    ProfileSpan span("SqliteStorage::write_nodes");
+    span.set_value("nodes", static_cast<int64_t>(nodes.size()));
+    std::vector<std::string> payloads;
+    payloads.reserve(nodes.size());
+    for (const auto& node : nodes) {
+        payloads.push_back(encode_node_binary(node));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_transaction(db_, database_path_, [&]() {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            StatementScope scope(upsert_node_);
+            bind_text(upsert_node_, 1, nodes[i].trace_id);
+            bind_text(upsert_node_, 2, nodes[i].parent);
+            bind_text(upsert_node_, 3, nodes[i].operation.op_class);
+            bind_text(upsert_node_, 4, nodes[i].timestamp);
+            sqlite3_bind_int(upsert_node_, 5, static_cast<int>(NodeFormat::Binary));
+            sqlite3_bind_blob(upsert_node_, 6, payloads[i].data(), static_cast<int>(payloads[i].size()), SQLITE_STATIC);
+            if (sqlite3_step(upsert_node_) != SQLITE_DONE) {
+                fail("insert into nodes");
+            }
+        }
+    });
+}
+
+bool SqliteStorage::load_node(const std::string& trace_id, TraceNode& node) {
+    int format = 0;
+    std::string payload;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StatementScope scope(select_node_);
+        bind_text(select_node_, 1, trace_id);
+        int rc = sqlite3_step(select_node_);
+        if (rc == SQLITE_ROW) {
+            format = sqlite3_column_int(select_node_, 0);
+            const void* blob = sqlite3_column_blob(select_node_, 1);
+            payload.assign(static_cast<const char*>(blob), static_cast<size_t>(sqlite3_column_bytes(select_node_, 1)));
+        } else if (rc != SQLITE_DONE) {
+            fail("select from nodes");
+        }
+    }
+    if (format == 0) {
+        return load_node_file(trace_id, node);
+    }
+    // Decoded outside the lock, so other threads can query meanwhile
+    node = decode_node_payload(static_cast<NodeFormat>(format), payload);
+    return true;
+}
+
+bool SqliteStorage::find_parent(const std::string& trace_id, std::string& parent) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StatementScope scope(select_parent_);
+        bind_text(select_parent_, 1, trace_id);
+        int rc = sqlite3_step(select_parent_);
+        if (rc == SQLITE_ROW) {
+            parent = column_text(select_parent_, 0);
+            return true;
+        }
+        if (rc != SQLITE_DONE) {
+            fail("select from nodes");
+        }
+    }
+    TraceNode node;
+    if (!load_node_file(trace_id, node)) {
+        return false;
+    }
+    parent = node.parent;
+    return true;
+}
+
+std::vector<std::string> SqliteStorage::children_locked(const std::string& trace_id) {
+    std::vector<std::string> ids;
+    StatementScope scope(select_children_);
+    bind_text(select_children_, 1, trace_id);
+    int rc;
+    while ((rc = sqlite3_step(select_children_)) == SQLITE_ROW) {
+        ids.push_back(column_text(select_children_, 0));
+    }
+    if (rc != SQLITE_DONE) {
+        fail("select from nodes");
+    }
+    return ids;
+}
+
+std::vector<DescendantId> SqliteStorage::descendants(const std::string& trace_id) {
+    return walk_descendants(trace_id, node_files(), [&](const std::string& id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return children_locked(id);
+    });
+}
+
+std::vector<std::string> SqliteStorage::trace_ids() {
+    std::vector<std::string> ids;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StatementScope scope(select_trace_ids_);
+        int rc;
+        while ((rc = sqlite3_step(select_trace_ids_)) == SQLITE_ROW) {
+            ids.push_back(column_text(select_trace_ids_, 0));
+        }
+        if (rc != SQLITE_DONE) {
+            fail("select from nodes");
+        }
+    }
+    append_node_file_ids(ids);
+    return ids;
+}
+
+void SqliteStorage::append_index(const IndexEntries& entries) {
+    if (entries.empty()) {
+        return;
+    }
+    ProfileSpan span("SqliteStorage::append_index");
+    span.set_value("entries", static_cast<int64_t>(entries.size()));
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_transaction(db_, database_path_, [&]() {
+        for (const auto& entry : entries) {
+            StatementScope scope(upsert_index_);
+            bind_text(upsert_index_, 1, entry.first);
+            bind_text(upsert_index_, 2, entry.second);
+            if (sqlite3_step(upsert_index_) != SQLITE_DONE) {
+                fail("insert into file_index");
+            }
+        }
+    });
+    index_data_version_ = -1; // data_version only counts other connections' commits
+}
+
+int64_t SqliteStorage::data_version_locked() {
+    StatementScope scope(data_version_);
+    if (sqlite3_step(data_version_) != SQLITE_ROW) {
+        fail("PRAGMA data_version");
+    }
+    return sqlite3_column_int64(data_version_, 0);
+}
+
+// Applies only the entries added since the last call, like IndexView does
+// with the index log, unless save_index replaced the whole table meanwhile
+const nlohmann::json& SqliteStorage::index() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t version = data_version_locked();
+    if (index_loaded_ && version == index_data_version_) {
+        return index_json_;
+    }
+    ProfileSpan span("SqliteStorage::index");
+    execute("BEGIN"); // One snapshot for the epoch and the rows
+    try {
+        int64_t epoch = 0;
+        {
+            StatementScope scope(select_index_epoch_);
+            if (sqlite3_step(select_index_epoch_) == SQLITE_ROW) {
+                epoch = sqlite3_column_int64(select_index_epoch_, 0);
+            }
+        }
+        if (!index_loaded_ || epoch != index_epoch_) {
+            index_json_ = nlohmann::json::object();
+            index_seq_ = 0;
+        }
+        StatementScope scope(select_index_since_);
+        sqlite3_bind_int64(select_index_since_, 1, index_seq_);
+        int rc;
+        while ((rc = sqlite3_step(select_index_since_)) == SQLITE_ROW) {
+            index_seq_ = sqlite3_column_int64(select_index_since_, 0);
+            index_json_[column_text(select_index_since_, 1)] = column_text(select_index_since_, 2);
+        }
+        if (rc != SQLITE_DONE) {
+            fail("select from file_index");
+        }
+        index_epoch_ = epoch;
+    } catch (...) {
+        sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+        index_loaded_ = false;
+        throw;
+    }
+    execute("COMMIT");
+    index_loaded_ = true;
+    index_data_version_ = version;
+    span.set_value("entries", static_cast<int64_t>(index_json_.size()));
+    return index_json_;
+}
+
+std::string SqliteStorage::find_trace_id(const std::string& checksum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StatementScope scope(select_trace_id_);
+    bind_text(select_trace_id_, 1, checksum);
+    int rc = sqlite3_step(select_trace_id_);
+    if (rc == SQLITE_ROW) {
+        return column_text(select_trace_id_, 0);
+    }
+    if (rc != SQLITE_DONE) {
+        fail("select from file_index");
+    }
+    return "";
+}
+
+void SqliteStorage::save_index(const nlohmann::json& index_json) {
+    ProfileSpan span("SqliteStorage::save_index");
+    span.set_value("entries", static_cast<int64_t>(index_json.size()));
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_transaction(db_, database_path_, [&]() {
+        execute("DELETE FROM file_index");
+        execute("UPDATE meta SET value = value + 1 WHERE key = 'index_epoch'");
+        for (auto it = index_json.begin(); it != index_json.end(); ++it) {
+            if (!it->is_string()) {
+                continue;
+            }
+            std::string trace_id = it->get<std::string>();
+            StatementScope scope(upsert_index_);
+            bind_text(upsert_index_, 1, it.key());
+            bind_text(upsert_index_, 2, trace_id);
+            if (sqlite3_step(upsert_index_) != SQLITE_DONE) {
+                fail("insert into file_index");
+            }
+        }
+    });
+    index_data_version_ = -1;
+}
@@ -0,0 +1,105 @@
+#ifndef SQLITE_STORAGE_HPP
+#define SQLITE_STORAGE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "storage.hpp"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+/**
+ * @brief Trace nodes and the index in one embedded SQLite database.
+ *
+ * The database '.traceseq/traceseq.db' runs in WAL mode, so readers never
+ * block the writer and a crash loses no committed transaction. Nodes live in
+ * table `nodes` with their binary encoding (see `encode_node_binary`) and
+ * the columns lineage walks and queries need, indexed on parent and
+ * operation class; the index lives in table `file_index`, keyed by file
+ * checksum. Every batch of nodes or index entries is one transaction, and
+ * all statements are prepared once per connection.
+ *
+ * Any number of processes may open the database; writers wait for each
+ * other for up to a minute. Within a process, one connection is shared by
+ * all threads and serialized by a mutex.
+ */
+class SqliteStorage : public TraceStorage {
+public:
+    /**
+     * @brief Opens (and creates if needed) the database of a project.
+     * @param project_root The root directory of the project.
+     * @throws std::runtime_error if the database cannot be opened.
+     */
+    explicit SqliteStorage(const std::filesystem::path& project_root);
+
+    /**
+     * @brief Opens (and creates if needed) a database at another path.
+     * @param project_root The root directory of the project, for per-file nodes.
+     * @param database_path The database file.
+     * @throws std::runtime_error if the database cannot be opened.
+     */
+    SqliteStorage(const std::filesystem::path& project_root, const std::filesystem::path& database_path);
+
+    ~SqliteStorage() override;
+
+    SqliteStorage(const SqliteStorage&) = delete;
+    SqliteStorage& operator=(const SqliteStorage&) = delete;
+
+    StorageBackend backend() const override { return StorageBackend::Sqlite; }
+    void write_nodes(const std::vector<TraceNode>& nodes) override;
+    bool load_node(const std::string& trace_id, TraceNode& node) override;
+    bool find_parent(const std::string& trace_id, std::string& parent) override;
+    std::vector<DescendantId> descendants(const std::string& trace_id) override;
+    std::vector<std::string> trace_ids() override;
+    void append_index(const IndexEntries& entries) override;
+    const nlohmann::json& index() override;
+    std::string find_trace_id(const std::string& checksum) override;
+    void save_index(const nlohmann::json& index_json) override;
+
+private:
+    void execute(const char* sql);
+    sqlite3_stmt* prepare(const char* sql);
+    int schema_version();
+    [[noreturn]] void fail(const char* what) const;
+    std::vector<std::string> children_locked(const std::string& trace_id);
+    int64_t data_version_locked();
+
+    std::filesystem::path database_path_;
+    std::mutex mutex_;
+    sqlite3* db_ = nullptr;
+    std::vector<sqlite3_stmt*> statements_;  ///< Every prepared statement, finalized on close.
+    sqlite3_stmt* upsert_node_ = nullptr;
+    sqlite3_stmt* select_node_ = nullptr;
+    sqlite3_stmt* select_parent_ = nullptr;
+    sqlite3_stmt* select_children_ = nullptr;
+    sqlite3_stmt* select_trace_ids_ = nullptr;
+    sqlite3_stmt* upsert_index_ = nullptr;
+    sqlite3_stmt* select_index_since_ = nullptr;
+    sqlite3_stmt* select_trace_id_ = nullptr;
+    sqlite3_stmt* select_index_epoch_ = nullptr;
+    sqlite3_stmt* data_version_ = nullptr;
+
+    nlohmann::json index_json_;
+    bool index_loaded_ = false;
+    int64_t index_data_version_ = -1;  ///< `PRAGMA data_version` when the index was read.
+    int64_t index_epoch_ = -1;         ///< Bumped by every `save_index`.
+    int64_t index_seq_ = 0;            ///< Highest `file_index.seq` applied.
+};
+
+/**
+ * @brief Returns the path of a project's SQLite database.
+ * @param project_root The root directory of the project.
+ * @return '.traceseq/traceseq.db' below the project root.
+ */
+std::filesystem::path sqlite_database_path(const std::filesystem::path& project_root);
+
+/**
+ * @brief Removes a SQLite database together with its WAL and shared-memory files.
+ * @param database_path The database file.
+ */
+void remove_sqlite_database(const std::filesystem::path& database_path);
+
+#endif // SQLITE_STORAGE_HPP
@@ -0,0 +1,304 @@
+#include "storage.hpp"
+#include "sqlite_storage.hpp"
+#include "lineage.hpp"
+#include "node_yaml.hpp"
+#include "file_lock.hpp"
+#include "profiler.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Nodes copied per batch by convert_storage
+static const size_t kConvertBatch = 4096;
+
+bool TraceStorage::load_node_file(const std::string& trace_id, TraceNode& node) const {
+    fs::path file_path = project_root_ / ".traceseq" / "nodes" / (trace_id + ".yaml");
+    if (!fs::exists(file_path)) {
+        return false;
+    }
+    node = load_node_yaml_file(file_path);
+    return true;
+}
+
+std::vector<fs::path> TraceStorage::node_files() const {
+    std::vector<fs::path> files;
+    fs::path nodes_dir = project_root_ / ".traceseq" / "nodes";
+    if (fs::exists(nodes_dir)) {
+        for (const auto& entry : fs::directory_iterator(nodes_dir)) {
+            if (entry.path().extension() == ".yaml") {
+                files.push_back(entry.path());
+            }
+        }
+    }
+    return files;
+}
+
+std::vector<DescendantId> TraceStorage::walk_descendants(
+    const std::string& trace_id, const std::vector<fs::path>& files,
+    const std::function<std::vector<std::string>(const std::string&)>& children) const {
+    // Per-file nodes have no child lists; map them once and walk both
+    std::vector<TraceNode> nodes(files.size());
+    parallel_for(files.size(), 0, [&](size_t i) {
+        try {
+            nodes[i] = load_node_yaml_file(files[i]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error resolving descendants: " << files[i].string() << ": " << e.what() << std::endl;
+        }
+    });
+    std::unordered_map<std::string, std::vector<std::string>> file_children;
+    for (const auto& node : nodes) {
+        if (!node.trace_id.empty()) {
+            file_children[node.parent].push_back(node.trace_id);
+        }
+    }
+
+    std::vector<DescendantId> descendants;
+    std::unordered_set<std::string> visited{trace_id};
+    std::vector<DescendantId> stack{{trace_id, 0}};
+    while (!stack.empty()) {
+        DescendantId current = std::move(stack.back());
+        stack.pop_back();
+        if (current.depth > 0) {
+            descendants.push_back(current);
+        }
+        std::vector<std::string> ids = children(current.trace_id);
+        auto in_files = file_children.find(current.trace_id);
+        if (in_files != file_children.end()) {
+            ids.insert(ids.end(), in_files->second.begin(), in_files->second.end());
+        }
+        // Pushed in reverse so that the first child is visited first
+        for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+            if (visited.insert(*it).second) {
+                stack.push_back(DescendantId{*it, current.depth + 1});
+            }
+        }
+    }
+    return descendants;
+}
+
+void TraceStorage::append_node_file_ids(std::vector<std::string>& ids) const {
+    std::vector<fs::path> files = node_files();
+    if (files.empty()) {
+        return;
+    }
+    std::unordered_set<std::string> known(ids.begin(), ids.end());
+    for (const auto& file : files) {
+        std::string trace_id = file.stem().string();
+        if (known.insert(trace_id).second) {
+            ids.push_back(trace_id);
+        }
+    }
+}
+
+FileStorage::FileStorage(const fs::path& project_root)
+    : TraceStorage(project_root), store_(project_root), index_(project_root) {}
+
+// Legacy layout: one YAML file per node in '.traceseq/nodes'
+static void write_node_file(const TraceNode& node, const fs::path& project_root) {
+    // Ensure .traceseq/nodes directory exists
+    fs::path nodes_dir = project_root / ".traceseq" / "nodes";
+    fs::create_directories(nodes_dir);
+
+    // Write to a temporary name and rename so readers never see a partial
+    // node; the name is private to this thread, as two writers of one node
+    // must not share (and rename away) each other's half-written file
+    fs::path node_path = nodes_dir / (node.trace_id + ".yaml");
+    fs::path tmp_path = nodes_dir / (node.trace_id + ".yaml.tmp" + std::to_string(::getpid()) + "-" +
+                                     std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())));
+    std::ofstream file(tmp_path);
+    file << trace_node_to_yaml(node);
+    file.close();
+    if (!file) {
+        fs::remove(tmp_path);
+        throw std::runtime_error("Could not write trace node: " + node_path.string());
+    }
+    fs::rename(tmp_path, node_path);
+}
+
+void FileStorage::write_nodes(const std::vector<TraceNode>& nodes) {
+    std::vector<TraceNode> packed;
+    packed.reserve(nodes.size());
+    for (const auto& node : nodes) {
+        // Nodes an offset index record cannot hold (empty or long IDs) keep
+        // the per-file layout rather than failing the whole batch
+        if (!fits_packed_store(node)) {
+            write_node_file(node, root());
+        } else {
+            packed.push_back(node);
+        }
+    }
+    store_.append(packed);
+}
+
+bool FileStorage::load_node(const std::string& trace_id, TraceNode& node) {
+    return store_.load(trace_id, node) || load_node_file(trace_id, node);
+}
+
+bool FileStorage::find_parent(const std::string& trace_id, std::string& parent) {
+    NodeLocation location;
+    if (store_.find(trace_id, location)) {
+        parent = location.parent;
+        return true;
+    }
+    TraceNode node;
+    if (!load_node_file(trace_id, node)) {
+        return false;
+    }
+    parent = node.parent;
+    return true;
+}
+
+std::vector<DescendantId> FileStorage::descendants(const std::string& trace_id) {
+    store_.refresh();
+    std::vector<fs::path> files = node_files();
+    if (files.empty()) {
+        return store_.descendants(trace_id);
+    }
+    return walk_descendants(trace_id, files, [&](const std::string& id) {
+        std::vector<std::string> ids;
+        for (const auto& location : store_.children(id)) {
+            ids.push_back(location.trace_id);
+        }
+        return ids;
+    });
+}
+
+std::vector<std::string> FileStorage::trace_ids() {
+    std::vector<std::string> ids;
+    for (const auto& location : store_.locations()) {
+        ids.push_back(location.trace_id);
+    }
+    append_node_file_ids(ids);
+    return ids;
+}
+
+void FileStorage::append_index(const IndexEntries& entries) {
+    ::append_index(entries, root());
+}
+
+const nlohmann::json& FileStorage::index() {
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    return index_.refresh();
+}
+
+std::string FileStorage::find_trace_id(const std::string& checksum) {
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    const nlohmann::json& index_json = index_.refresh();
+    auto it = index_json.is_object() ? index_json.find(checksum) : index_json.end();
+    return it != index_json.end() && it->is_string() ? it->get<std::string>() : "";
+}
+
+void FileStorage::save_index(const nlohmann::json& index_json) {
+    FileLock index_lock(index_lock_path(root()), FileLock::Mode::Exclusive);
+    write_index_unlocked(index_json, root());
+}
+
+StorageBackend storage_backend(const fs::path& project_root) {
+    return fs::exists(sqlite_database_path(project_root)) ? StorageBackend::Sqlite : StorageBackend::Files;
+}
+
+std::unique_ptr<TraceStorage> open_storage(const fs::path& project_root) {
+    if (storage_backend(project_root) == StorageBackend::Sqlite) {
+        return std::make_unique<SqliteStorage>(project_root);
+    }
+    return std::make_unique<FileStorage>(project_root);
+}
+
+// Copies every node, loaded on worker threads, then the index
+static size_t copy_storage(TraceStorage& from, TraceStorage& to) {
+    std::vector<std::string> ids = from.trace_ids();
+    for (size_t begin = 0; begin < ids.size(); begin += kConvertBatch) {
+        std::vector<TraceNode> batch(std::min(kConvertBatch, ids.size() - begin));
+        parallel_for(batch.size(), 0, [&](size_t i) {
+            if (!from.load_node(ids[begin + i], batch[i])) {
+                throw std::runtime_error("Trace node disappeared during conversion: " + ids[begin + i]);
+            }
+        });
+        to.write_nodes(batch);
+    }
+    const nlohmann::json& index_json = from.index();
+    to.save_index(index_json.is_null() ? nlohmann::json::object() : index_json);
+    return ids.size();
+}
+
+size_t convert_storage(const fs::path& project_root, StorageBackend target) {
+    ProfileSpan span("convert_storage");
+    if (storage_backend(project_root) == target) {
+        return 0;
+    }
+    fs::path database_path = sqlite_database_path(project_root);
+    FileStorage files(project_root);
+    size_t copied = 0;
+    if (target == StorageBackend::Sqlite) {
+        // Built under a temporary name so the project switches over only
+        // once the database is complete
+        fs::path tmp_path = database_path;
+        tmp_path += ".tmp" + std::to_string(::getpid());
+        remove_sqlite_database(tmp_path);
+        try {
+            SqliteStorage sqlite(project_root, tmp_path);
+            copied = copy_storage(files, sqlite);
+        } catch (...) {
+            remove_sqlite_database(tmp_path);
+            throw;
+        }
+        fs::rename(tmp_path, database_path);
+    } else {
+        {
+            SqliteStorage sqlite(project_root, database_path);
+            copied = copy_storage(sqlite, files);
+        }
+        remove_sqlite_database(database_path);
+    }
+    span.set_value("nodes", static_cast<int64_t>(copied));
+    return copied;
+}
+
+size_t export_nodes_yaml(const fs::path& project_root, const fs::path& output_dir) {
+    fs::create_directories(output_dir);
+    size_t exported = 0;
+
+    std::unique_ptr<TraceStorage> storage = open_storage(project_root);
+    if (auto* files = dynamic_cast<FileStorage*>(storage.get())) {
+        // Packed YAML payloads are copied as stored
+        NodeStore& store = files->node_store();
+        for (const auto& location : store.locations()) {
+            std::string payload = store.read_payload(location);
+            std::ofstream out(output_dir / (location.trace_id + ".yaml"));
+            if (location.format == NodeFormat::Yaml) {
+                out << payload;
+            } else {
+                out << trace_node_to_yaml(decode_node_payload(location.format, payload));
+            }
+            ++exported;
+        }
+        fs::path nodes_dir = project_root / ".traceseq" / "nodes";
+        if (fs::exists(nodes_dir)) {
+            for (const auto& entry : fs::directory_iterator(nodes_dir)) {
+                if (entry.path().extension() == ".yaml") {
+                    fs::copy_file(entry.path(), output_dir / entry.path().filename(), fs::copy_options::overwrite_existing);
+                    ++exported;
+                }
+            }
+        }
+        return exported;
+    }
+
+    for (const auto& trace_id : storage->trace_ids()) {
+        TraceNode node;
+        if (storage->load_node(trace_id, node)) {
+            std::ofstream out(output_dir / (trace_id + ".yaml"));
+            out << trace_node_to_yaml(node);
+            ++exported;
+        }
+    }
+    return exported;
+}
@@ -0,0 +1,219 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "tracer.hpp"
+#include "index_log.hpp"
+#include "node_store.hpp"
+
+/// The ways a project can store its trace nodes and index.
+enum class StorageBackend {
+    Files,   ///< Packed segments, per-file YAML nodes and 'index.json' plus 'index.log'.
+    Sqlite,  ///< One SQLite database, '.traceseq/traceseq.db'.
+};
+
+/**
+ * @brief Where a project keeps its trace nodes and the index of file checksums.
+ *
+ * Every node and index access of the library goes through this interface,
+ * so the CLI, the daemon and the Python bindings work on either backend.
+ * Both backends also read nodes still stored as '.traceseq/nodes/<id>.yaml'
+ * by older versions and by the R package.
+ *
+ * Implementations are safe to use from several threads at once, except
+ * that the reference returned by `index` is only valid until the next call.
+ */
+class TraceStorage {
+public:
+    virtual ~TraceStorage() = default;
+
+    /// The root directory of the project.
+    const std::filesystem::path& root() const { return project_root_; }
+
+    /// The backend this storage implements.
+    virtual StorageBackend backend() const = 0;
+
+    /**
+     * @brief Stores trace nodes durably, as one batch.
+     *
+     * A node whose trace ID is already stored replaces the stored one; a
+     * file layout storage that has already read that node may keep
+     * returning the old one, as trace nodes are not meant to change.
+     *
+     * @param nodes The nodes to store.
+     * @throws std::runtime_error if the nodes cannot be written.
+     */
+    virtual void write_nodes(const std::vector<TraceNode>& nodes) = 0;
+
+    /**
+     * @brief Loads a trace node.
+     * @param trace_id The trace ID to look up.
+     * @param node Filled with the node if it exists.
+     * @return false if no such node is stored.
+     * @throws std::runtime_error if the node exists but cannot be read.
+     */
+    virtual bool load_node(const std::string& trace_id, TraceNode& node) = 0;
+
+    /**
+     * @brief Finds a node's parent without decoding the whole node where the backend allows.
+     * @param trace_id The trace ID to look up.
+     * @param parent Set to the parent trace ID ("null" for a root node).
+     * @return false if no such node is stored.
+     * @throws std::runtime_error if the node exists but cannot be read.
+     */
+    virtual bool find_parent(const std::string& trace_id, std::string& parent) = 0;
+
+    /**
+     * @brief Returns every node derived from a trace node, depth first.
+     *
+     * Children are visited in the order they were stored; each node is
+     * reported once, with its distance from `trace_id`.
+     *
+     * @param trace_id The trace ID to start from.
+     * @return The descendants, not including `trace_id` itself.
+     */
+    virtual std::vector<DescendantId> descendants(const std::string& trace_id) = 0;
+
+    /**
+     * @brief Returns the trace IDs of every stored node, in the order they were stored.
+     * @return The trace IDs.
+     */
+    virtual std::vector<std::string> trace_ids() = 0;
+
+    /**
+     * @brief Durably adds index entries, as one batch.
+     * @param entries Pairs of file checksum and trace ID; later entries win.
+     * @throws std::runtime_error if the entries cannot be written.
+     */
+    virtual void append_index(const IndexEntries& entries) = 0;
+
+    /**
+     * @brief Returns the current index, reloaded only when it changed.
+     * @return The index, mapping file checksums to trace IDs.
+     */
+    virtual const nlohmann::json& index() = 0;
+
+    /**
+     * @brief Looks up one checksum in the index.
+     * @param checksum The file checksum.
+     * @return The trace ID recorded for it, or an empty string.
+     */
+    virtual std::string find_trace_id(const std::string& checksum) = 0;
+
+    /**
+     * @brief Replaces the whole index.
+     * @param index_json The new index, mapping file checksums to trace IDs.
+     * @throws std::runtime_error if the index cannot be written.
+     */
+    virtual void save_index(const nlohmann::json& index_json) = 0;
+
+protected:
+    explicit TraceStorage(const std::filesystem::path& project_root) : project_root_(project_root) {}
+
+    /// Loads '.traceseq/nodes/<trace_id>.yaml'; false if there is no such file.
+    bool load_node_file(const std::string& trace_id, TraceNode& node) const;
+
+    /// The per-file YAML nodes in '.traceseq/nodes'.
+    std::vector<std::filesystem::path> node_files() const;
+
+    /// Walks `children` together with the parents of `files` depth first.
+    std::vector<DescendantId> walk_descendants(
+        const std::string& trace_id, const std::vector<std::filesystem::path>& files,
+        const std::function<std::vector<std::string>(const std::string&)>& children) const;
+
+    /// Appends the trace IDs of the per-file nodes to `ids`, skipping those already in it.
+    void append_node_file_ids(std::vector<std::string>& ids) const;
+
+private:
+    std::filesystem::path project_root_;
+};
+
+/**
+ * @brief The file layout: packed segments, per-file YAML nodes and the index log.
+ *
+ * Nodes go to the `NodeStore` in '.traceseq/segments' (IDs too long to pack
+ * are written as per-file YAML), the index to 'index.json' and its
+ * write-ahead log 'index.log'. Lineage walks and descendant queries use the
+ * parent pointers and child lists of the packed store's offset index.
+ */
+class FileStorage : public TraceStorage {
+public:
+    /**
+     * @brief Opens the file layout of a project.
+     * @param project_root The root directory of the project.
+     */
+    explicit FileStorage(const std::filesystem::path& project_root);
+
+    StorageBackend backend() const override { return StorageBackend::Files; }
+    void write_nodes(const std::vector<TraceNode>& nodes) override;
+    bool load_node(const std::string& trace_id, TraceNode& node) override;
+    bool find_parent(const std::string& trace_id, std::string& parent) override;
+    std::vector<DescendantId> descendants(const std::string& trace_id) override;
+    std::vector<std::string> trace_ids() override;
+    void append_index(const IndexEntries& entries) override;
+    const nlohmann::json& index() override;
+    std::string find_trace_id(const std::string& checksum) override;
+    void save_index(const nlohmann::json& index_json) override;
+
+    /// The packed node store, for maintenance that is specific to it.
+    NodeStore& node_store() { return store_; }
+
+private:
+    NodeStore store_;
+    IndexView index_;
+    std::mutex index_mutex_;
+};
+
+/**
+ * @brief Returns the backend a project uses.
+ *
+ * A project uses SQLite once '.traceseq/traceseq.db' exists (see
+ * `convert_storage`) and the file layout otherwise.
+ *
+ * @param project_root The root directory of the project.
+ * @return The backend.
+ */
+StorageBackend storage_backend(const std::filesystem::path& project_root);
+
+/**
+ * @brief Opens the storage of a project with the backend it uses.
+ * @param project_root The root directory of the project.
+ * @return The storage.
+ * @throws std::runtime_error if the SQLite database cannot be opened.
+ */
+std::unique_ptr<TraceStorage> open_storage(const std::filesystem::path& project_root);
+
+/**
+ * @brief Moves a project's trace nodes and index to another backend.
+ *
+ * Every node and index entry is copied in batches, then the project is
+ * switched over: converting to SQLite creates '.traceseq/traceseq.db' last,
+ * converting back to files removes it. The files of the old backend are
+ * left in place. Run it while no other process writes to the project.
+ *
+ * @param project_root The root directory of the project.
+ * @param target The backend to convert to.
+ * @return The number of nodes copied (0 if the project already uses `target`).
+ * @throws std::runtime_error if a node cannot be read or written.
+ */
+size_t convert_storage(const std::filesystem::path& project_root, StorageBackend target);
+
+/**
+ * @brief Writes every stored node as '<trace_id>.yaml' into a directory.
+ *
+ * This is the human-readable export of either backend; per-file nodes that
+ * were never migrated are exported as well.
+ *
+ * @param project_root The root directory of the project.
+ * @param output_dir The directory to write the YAML files into.
+ * @return The number of nodes exported.
+ */
+size_t export_nodes_yaml(const std::filesystem::path& project_root, const std::filesystem::path& output_dir);
+
+#endif // STORAGE_HPP
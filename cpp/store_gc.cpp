@@ -0,0 +1,280 @@
+#include "store_gc.hpp"
+#include "checksum_cache.hpp"
+#include "lineage.hpp"
+#include "index_log.hpp"
+#include "node_yaml.hpp"
+#include "file_lock.hpp"
+#include "profiler.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include "nlohmann/json.hpp"
+
+namespace fs = std::filesystem;
+
+// Node timestamps are UTC in '%Y-%m-%dT%H:%M:%SZ', so they compare as strings
+static std::string timestamp_seconds_ago(int64_t seconds) {
+    std::time_t cutoff = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) - static_cast<std::time_t>(seconds);
+    std::tm gmt;
+    gmtime_r(&cutoff, &gmt);
+    std::stringstream ss;
+    ss << std::put_time(&gmt, "%Y-%m-%dT%H:%M:%SZ");
+    return ss.str();
+}
+
+// Removes the stored chunk lists of checksums that are no index key
+static size_t sweep_chunk_lists(const fs::path& project_root, const GcOptions& options) {
+    std::unordered_set<std::string> keys;
+    nlohmann::json index_json = load_index(project_root);
+    for (const auto& item : index_json.items()) {
+        keys.insert(item.key());
+    }
+    ChecksumCache checksum_cache(project_root);
+    return checksum_cache.sweep_chunks(keys, options.grace_seconds, options.dry_run);
+}
+
+GcReport collect_garbage(const fs::path& project_root, NodeStore& store, const GcOptions& options) {
+    ProfileSpan span("collect_garbage");
+    GcReport report;
+    fs::path store_dir = project_root / ".traceseq" / "segments";
+    fs::create_directories(store_dir);
+    FileLock gc_lock(store_dir / "gc.lock", FileLock::Mode::Exclusive);
+
+    // 1. The node graph: packed nodes first, in append order, then per-file
+    //    YAML nodes that were never migrated
+    std::vector<NodeLocation> locations = store.locations();
+    const size_t packed_count = locations.size();
+    std::vector<std::string> ids;
+    std::vector<std::string> parents;
+    ids.reserve(packed_count);
+    parents.reserve(packed_count);
+    for (const auto& location : locations) {
+        ids.push_back(location.trace_id);
+        parents.push_back(location.parent);
+    }
+
+    std::vector<fs::path> node_files;
+    fs::path nodes_dir = project_root / ".traceseq" / "nodes";
+    if (fs::exists(nodes_dir)) {
+        for (const auto& entry : fs::directory_iterator(nodes_dir)) {
+            if (entry.path().extension() == ".yaml") {
+                node_files.push_back(entry.path());
+            }
+        }
+    }
+    std::vector<TraceNode> file_nodes(node_files.size());
+    std::vector<char> file_readable(node_files.size(), 0);
+    parallel_for(node_files.size(), options.num_threads, [&](size_t i) {
+        try {
+            file_nodes[i] = load_node_yaml_file(node_files[i]);
+            file_readable[i] = 1;
+        } catch (const std::exception&) {
+            // Left for a human to inspect, like --migrate-store does
+        }
+    });
+
+    std::unordered_map<std::string, size_t> position;
+    position.reserve(packed_count + node_files.size());
+    for (size_t i = 0; i < packed_count; ++i) {
+        position.emplace(ids[i], i);
+    }
+    std::vector<size_t> file_of;            // Graph node to index into node_files
+    std::vector<fs::path> files_to_remove;  // Swept, or already packed
+    for (size_t i = 0; i < node_files.size(); ++i) {
+        if (!file_readable[i]) {
+            continue;
+        }
+        if (!position.emplace(file_nodes[i].trace_id, ids.size()).second) {
+            files_to_remove.push_back(node_files[i]); // Left behind by an interrupted migration
+            continue;
+        }
+        ids.push_back(file_nodes[i].trace_id);
+        parents.push_back(file_nodes[i].parent);
+        file_of.push_back(i);
+    }
+    const size_t node_count = ids.size();
+
+    // 2. Mark everything reachable from the roots through parent pointers
+    std::vector<char> marked(node_count, 0);
+    auto mark = [&](size_t i) {
+        while (!marked[i]) {
+            marked[i] = 1;
+            auto parent = position.find(parents[i]);
+            if (parent == position.end()) {
+                break;
+            }
+            i = parent->second;
+        }
+    };
+    std::unordered_set<std::string> roots;
+    if (options.restrict_roots) {
+        roots.insert(options.live_trace_ids.begin(), options.live_trace_ids.end());
+    } else {
+        nlohmann::json index_json = load_index(project_root);
+        for (const auto& item : index_json.items()) {
+            roots.insert(item.value().get<std::string>());
+        }
+    }
+    roots.erase("");
+    report.roots = roots.size();
+    for (const auto& root : roots) {
+        auto it = position.find(root);
+        if (it != position.end()) {
+            mark(it->second);
+        }
+    }
+    report.reachable = static_cast<size_t>(std::count(marked.begin(), marked.end(), 1));
+
+    // 3. Keep recent nodes: their index entry may not have been written yet
+    if (options.grace_seconds > 0) {
+        const std::string cutoff = timestamp_seconds_ago(options.grace_seconds);
+        std::vector<size_t> unreached;
+        for (size_t i = 0; i < node_count; ++i) {
+            if (!marked[i]) {
+                unreached.push_back(i);
+            }
+        }
+        std::vector<char> recent(unreached.size(), 0);
+        parallel_for(unreached.size(), options.num_threads, [&](size_t k) {
+            size_t i = unreached[k];
+            if (i >= packed_count) {
+                recent[k] = file_nodes[file_of[i - packed_count]].timestamp >= cutoff;
+                return;
+            }
+            TraceNode node;
+            try {
+                recent[k] = !store.load(ids[i], node) || node.timestamp >= cutoff;
+            } catch (const std::runtime_error&) {
+                recent[k] = 1; // Unreadable: keep it rather than guess
+            }
+        });
+        for (size_t k = 0; k < unreached.size(); ++k) {
+            if (recent[k]) {
+                mark(unreached[k]);
+            }
+        }
+        report.in_grace = static_cast<size_t>(std::count(marked.begin(), marked.end(), 1)) - report.reachable;
+    }
+
+    // 4. Sweep the rest, and pick the segments to rewrite: those appended to
+    //    since the last run and compacted ones that lost too much
+    CompactionPlan plan;
+    std::unordered_set<std::string> swept;
+    std::map<uint32_t, uint64_t> live_bytes;
+    for (size_t i = 0; i < node_count; ++i) {
+        if (i < packed_count) {
+            if (marked[i]) {
+                live_bytes[locations[i].segment] += locations[i].length + 8; // Plus the record header
+            } else {
+                plan.drop.insert(ids[i]);
+                swept.insert(ids[i]);
+            }
+        } else if (marked[i]) {
+            // Only files whose node is packed along may go; the rest stay
+            // per-file, as FileStorage writes them
+            const TraceNode& node = file_nodes[file_of[i - packed_count]];
+            if (fits_packed_store(node)) {
+                plan.unpacked.push_back(node);
+                files_to_remove.push_back(node_files[file_of[i - packed_count]]);
+            }
+        } else {
+            swept.insert(ids[i]);
+            files_to_remove.push_back(node_files[file_of[i - packed_count]]);
+        }
+    }
+    report.removed = swept.size();
+
+    const std::set<uint32_t> compacted = store.compacted_segments();
+    const std::map<uint32_t, uint64_t> sizes = store.segment_sizes();
+    const uint32_t active = sizes.empty() ? 0 : sizes.rbegin()->first;
+    for (const auto& pair : sizes) {
+        report.bytes_before += pair.second;
+        if (pair.second == 0) {
+            if (pair.first != active) {
+                plan.rewrite_segments.insert(pair.first); // Emptied by an earlier run; just removed
+            }
+            continue;
+        }
+        if (!compacted.count(pair.first) ||
+            static_cast<double>(live_bytes[pair.first]) < options.min_live_fraction * static_cast<double>(pair.second)) {
+            plan.rewrite_segments.insert(pair.first);
+        } else {
+            ++report.segments_kept;
+        }
+    }
+
+    // 5. Lay out the live forest depth first, children in append order
+    std::vector<std::vector<size_t>> children(node_count);
+    std::vector<size_t> forest;
+    for (size_t i = 0; i < node_count; ++i) {
+        if (!marked[i]) {
+            continue;
+        }
+        auto parent = position.find(parents[i]);
+        if (parent != position.end() && marked[parent->second] && parent->second != i) {
+            children[parent->second].push_back(i);
+        } else {
+            forest.push_back(i);
+        }
+    }
+    std::vector<size_t> stack(forest.rbegin(), forest.rend());
+    while (!stack.empty()) {
+        size_t i = stack.back();
+        stack.pop_back();
+        plan.order.push_back(ids[i]);
+        stack.insert(stack.end(), children[i].rbegin(), children[i].rend());
+    }
+
+    if (options.dry_run) {
+        report.chunk_lists_removed = sweep_chunk_lists(project_root, options);
+        report.files_packed = plan.unpacked.size();
+        report.segments_rewritten = plan.rewrite_segments.size();
+        report.bytes_after = report.bytes_before;
+        span.set_value("removed", static_cast<int64_t>(report.removed));
+        return report;
+    }
+
+    // 6. Drop index entries of swept nodes before the nodes themselves go
+    if (!swept.empty()) {
+        FileLock index_lock(index_lock_path(project_root), FileLock::Mode::Exclusive);
+        nlohmann::json index_json = read_index_unlocked(project_root);
+        for (auto it = index_json.begin(); it != index_json.end();) {
+            if (it->is_string() && swept.count(it->get<std::string>())) {
+                it = index_json.erase(it);
+                ++report.index_entries_removed;
+            } else {
+                ++it;
+            }
+        }
+        if (report.index_entries_removed > 0) {
+            write_index_unlocked(index_json, project_root);
+        }
+    }
+
+    // 7. Rewrite; nothing to do on a store that is already compacted
+    if (!plan.drop.empty() || !plan.rewrite_segments.empty() || !plan.unpacked.empty()) {
+        CompactionResult result = store.compact(plan, options.num_threads);
+        report.nodes_copied = result.nodes_copied;
+        report.segments_rewritten = result.segments_removed;
+        report.bytes_after = result.bytes_after;
+    } else {
+        report.bytes_after = report.bytes_before;
+    }
+    report.files_packed = plan.unpacked.size();
+    for (const auto& file : files_to_remove) {
+        fs::remove(file);
+    }
+
+    // 8. Chunk lists of checksums no index entry or cached file leads to
+    report.chunk_lists_removed = sweep_chunk_lists(project_root, options);
+    span.set_value("removed", static_cast<int64_t>(report.removed));
+    return report;
+}
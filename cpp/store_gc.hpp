@@ -0,0 +1,75 @@
+#ifndef STORE_GC_HPP
+#define STORE_GC_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "node_store.hpp"
+
+/**
+ * @brief Options of a garbage collection run.
+ */
+struct GcOptions {
+    /// Keep only the lineages of `live_trace_ids` instead of every index entry.
+    bool restrict_roots = false;
+    std::vector<std::string> live_trace_ids;   ///< Roots when `restrict_roots` is set.
+    int64_t grace_seconds = 3600;              ///< Unreachable nodes younger than this are kept.
+    double min_live_fraction = 0.75;           ///< Compacted segments with less live data are rewritten.
+    unsigned int num_threads = 0;              ///< Worker threads (0 means one per hardware core).
+    bool dry_run = false;                      ///< Only report what would be done.
+};
+
+/**
+ * @brief What a garbage collection run found and did.
+ */
+struct GcReport {
+    size_t roots = 0;                  ///< Distinct trace IDs the mark started from.
+    size_t reachable = 0;              ///< Nodes reachable from the roots.
+    size_t in_grace = 0;               ///< Unreachable nodes kept because they are recent, with their ancestors.
+    size_t removed = 0;                ///< Nodes removed (packed records and YAML files).
+    size_t index_entries_removed = 0;  ///< Index entries that pointed at removed nodes.
+    size_t files_packed = 0;           ///< Per-file YAML nodes moved into the packed store.
+    size_t nodes_copied = 0;           ///< Nodes written to new segments.
+    size_t segments_rewritten = 0;     ///< Segments replaced by new ones.
+    size_t segments_kept = 0;          ///< Compacted segments left untouched.
+    uint64_t bytes_before = 0;         ///< Size of all segments before the run.
+    uint64_t bytes_after = 0;          ///< Size of all segments after the run.
+    size_t chunk_lists_removed = 0;    ///< Stored `sha256-cdc` chunk lists nothing refers to any more.
+};
+
+/**
+ * @brief Removes unreachable trace nodes and lays out the rest by lineage.
+ *
+ * Marks every node reachable through parent pointers from the index entries
+ * (or from `GcOptions::live_trace_ids`), plus every node created within the
+ * grace period and its ancestors, so nodes of an annotation still in flight
+ * survive. Everything else is swept: its packed index record is removed,
+ * index entries pointing at it are deleted and per-file YAML nodes are
+ * unlinked.
+ *
+ * Surviving nodes in segments that were not compacted yet, or in compacted
+ * segments whose live fraction dropped below `min_live_fraction`, are copied
+ * into new segments in depth-first order of the lineage forest, so a parent
+ * is followed by its children and a lineage is read from few, nearby pages.
+ * Per-file YAML nodes are packed along, except those whose IDs do not fit
+ * the packed store (see `fits_packed_store`), which keep their files.
+ * Segments compacted by an earlier run and still dense enough are left
+ * alone, so repeated runs only rewrite what was appended since. Payloads are
+ * read and copied on `num_threads` workers.
+ *
+ * Stored `sha256-cdc` chunk lists are swept too, unless an index entry or the
+ * checksum cache still refers to them (see `ChecksumCache::sweep_chunks`).
+ *
+ * Runs are serialized by '.traceseq/segments/gc.lock'; appends and lookups
+ * by other processes may continue throughout.
+ *
+ * @param project_root The root directory of the project.
+ * @param store The project's packed node store.
+ * @param options What to keep and how.
+ * @return What was found and done.
+ * @throws std::runtime_error if the index or store cannot be read or written.
+ */
+GcReport collect_garbage(const std::filesystem::path& project_root, NodeStore& store, const GcOptions& options);
+
+#endif // STORE_GC_HPP
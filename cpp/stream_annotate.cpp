@@ -0,0 +1,104 @@
+#include "stream_annotate.hpp"
+#include "storage.hpp"
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+StreamAnnotator::StreamAnnotator(const AnnotationRequest& request, const Ontology& ontology,
+                                 const std::string& algorithm, const fs::path& project_root)
+    : request_(request), project_root_(project_root), digest_(algorithm) {
+    if (!ontology.validate_operation(request.operation_class)) {
+        throw std::invalid_argument("Invalid operation class '" + request.operation_class + "'");
+    }
+    for (const auto& assump : request.assumptions) {
+        if (!ontology.validate_assumption(assump)) {
+            throw std::invalid_argument("Invalid assumption '" + assump + "'");
+        }
+    }
+    if (request_.filepath.empty()) {
+        request_.filepath = "-";
+    }
+    if (request_.filepath != "-") {
+        output_fd_ = ::open(request_.filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (output_fd_ < 0) {
+            throw std::runtime_error("Could not create output file: " + request_.filepath);
+        }
+    }
+}
+
+StreamAnnotator::StreamAnnotator(const AnnotationRequest& request, const Ontology& ontology,
+                                 const std::string& algorithm, TraceStorage& storage)
+    : StreamAnnotator(request, ontology, algorithm, storage.root()) {
+    storage_ = &storage;
+}
+
+StreamAnnotator::~StreamAnnotator() {
+    if (output_fd_ >= 0) {
+        ::close(output_fd_);
+    }
+}
+
+void StreamAnnotator::set_input_checksum(const std::string& checksum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    input_checksum_ = checksum;
+}
+
+void StreamAnnotator::write(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        throw std::logic_error("StreamAnnotator::write called after close");
+    }
+    digest_.update(data, length);
+    while (output_fd_ >= 0 && length > 0) {
+        ssize_t n = ::write(output_fd_, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Could not write output file: " + request_.filepath);
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+}
+
+AnnotationResult StreamAnnotator::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        throw std::logic_error("StreamAnnotator::close called twice");
+    }
+    closed_ = true;
+    if (output_fd_ >= 0) {
+        int rc = ::close(output_fd_);
+        output_fd_ = -1;
+        if (rc != 0) {
+            throw std::runtime_error("Could not write output file: " + request_.filepath);
+        }
+    }
+
+    AnnotationResult result;
+    result.filepath = request_.filepath;
+    result.checksum = digest_.finish();
+
+    TraceNode node = create_trace_node(
+        request_.parent_id,
+        "quantitative_matrix", // Placeholder, as in the single-file annotate command
+        request_.operation_class,
+        request_.operation_method,
+        request_.assumptions
+    );
+    std::string input_checksum = input_checksum_.empty() ? result.checksum : input_checksum_;
+    node.input.checksum = input_checksum;
+    node.input.shape = "unknown";
+    if (storage_) {
+        node.save(input_checksum, result.checksum, "quantitative_matrix", *storage_);
+    } else {
+        node.save(input_checksum, result.checksum, "quantitative_matrix", project_root_);
+    }
+
+    result.trace_id = node.trace_id;
+    return result;
+}
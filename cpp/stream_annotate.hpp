@@ -0,0 +1,96 @@
+#ifndef STREAM_ANNOTATE_HPP
+#define STREAM_ANNOTATE_HPP
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include "batch.hpp"
+#include "hashing.hpp"
+#include "tracer.hpp"
+
+/**
+ * @brief Annotates an output while it is being produced.
+ *
+ * The producer writes its output through `write` (or tees a copy of it
+ * into the annotator); the bytes are hashed as they pass and, when an
+ * output path was given, written to that file. `close` finishes the digest
+ * and records the trace node and index entries, so the output is never
+ * read back just to checksum it. All methods are thread-safe; writes from
+ * several threads are serialized in the order they take the lock.
+ */
+class StreamAnnotator {
+public:
+    /**
+     * @brief Starts a streaming annotation.
+     *
+     * The operation and assumptions are validated up front so an invalid
+     * annotation fails before any data is streamed.
+     *
+     * @param request The annotation; `filepath` is the file to write the
+     *        stream to, or empty / "-" to only hash it.
+     * @param ontology The loaded ontology to validate against.
+     * @param algorithm The checksum algorithm (see `checksum_file`).
+     * @param project_root The root directory of the project.
+     * @throws std::invalid_argument if the operation, an assumption or the algorithm is invalid.
+     * @throws std::runtime_error if the output file cannot be created.
+     */
+    StreamAnnotator(const AnnotationRequest& request, const Ontology& ontology,
+                    const std::string& algorithm, const std::filesystem::path& project_root);
+
+    /**
+     * @brief Starts a streaming annotation that records through an already opened storage.
+     * @param request The annotation, as for the other constructor.
+     * @param ontology The loaded ontology to validate against.
+     * @param algorithm The checksum algorithm (see `checksum_file`).
+     * @param storage The project's storage; it must outlive the annotator.
+     * @throws std::invalid_argument if the operation, an assumption or the algorithm is invalid.
+     * @throws std::runtime_error if the output file cannot be created.
+     */
+    StreamAnnotator(const AnnotationRequest& request, const Ontology& ontology,
+                    const std::string& algorithm, TraceStorage& storage);
+    ~StreamAnnotator();
+
+    StreamAnnotator(const StreamAnnotator&) = delete;
+    StreamAnnotator& operator=(const StreamAnnotator&) = delete;
+
+    /**
+     * @brief Sets the checksum of the data the output was derived from.
+     *
+     * Without it the input checksum defaults to the output checksum, as for
+     * the single-file annotate command.
+     *
+     * @param checksum The input checksum.
+     */
+    void set_input_checksum(const std::string& checksum);
+
+    /**
+     * @brief Hashes the next bytes of the output and writes them through.
+     * @param data The bytes.
+     * @param length The number of bytes.
+     * @throws std::runtime_error if the output file cannot be written.
+     * @throws std::logic_error if the annotator was already closed.
+     */
+    void write(const char* data, size_t length);
+
+    /**
+     * @brief Finishes the output and records its trace node.
+     * @return The annotated file (or "-"), its trace ID and checksum.
+     * @throws std::runtime_error if the output or the trace cannot be written.
+     */
+    AnnotationResult close();
+
+    /// The number of bytes streamed so far.
+    uint64_t bytes() const { return digest_.bytes(); }
+
+private:
+    AnnotationRequest request_;
+    std::filesystem::path project_root_;
+    TraceStorage* storage_ = nullptr;   ///< Storage to record through, or null to open the project's.
+    std::mutex mutex_;                  ///< Guards the state below.
+    DigestSink digest_;
+    std::string input_checksum_;
+    int output_fd_ = -1;
+    bool closed_ = false;
+};
+
+#endif // STREAM_ANNOTATE_HPP
@@ -0,0 +1,1723 @@
+// Unit tests of the traceseq library, one group per feature.
+#include <gtest/gtest.h>
+#include <openssl/evp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "batch.hpp"
+#include "checksum_cache.hpp"
+#include "daemon_protocol.hpp"
+#include "hashing.hpp"
+#include "index_log.hpp"
+#include "lineage.hpp"
+#include "lineage_columns.hpp"
+#include "lineage_diff.hpp"
+#include "nlohmann/json.hpp"
+#include "node_store.hpp"
+#include "node_yaml.hpp"
+#include "profiler.hpp"
+#include "query_index.hpp"
+#include "sqlite_storage.hpp"
+#include "storage.hpp"
+#include "store_gc.hpp"
+#include "stream_annotate.hpp"
+#include "tracer.hpp"
+#include "validation.hpp"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// A fresh project directory, removed again at the end of the test
+struct TempProject {
+    fs::path root;
+
+    TempProject() {
+        std::string pattern = (fs::temp_directory_path() / "traceseq-test-XXXXXX").string();
+        if (::mkdtemp(&pattern[0]) == nullptr) {
+            throw std::runtime_error("Could not create a temporary directory");
+        }
+        root = pattern;
+    }
+    ~TempProject() {
+        std::error_code ec;
+        fs::remove_all(root, ec);
+    }
+    TempProject(const TempProject&) = delete;
+    TempProject& operator=(const TempProject&) = delete;
+};
+
+std::string evp_sha256_hex(const std::string& data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data.data(), data.size(), digest, &length, EVP_sha256(), nullptr);
+    static const char kHex[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned int i = 0; i < length; ++i) {
+        hex += kHex[digest[i] >> 4];
+        hex += kHex[digest[i] & 0xf];
+    }
+    return hex;
+}
+
+std::string random_bytes(size_t length, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::string data(length, '\0');
+    for (auto& c : data) {
+        c = static_cast<char>(rng());
+    }
+    return data;
+}
+
+void write_file(const fs::path& path, const std::string& data, std::ios::openmode mode = std::ios::trunc) {
+    std::ofstream out(path, std::ios::binary | mode);
+    out << data;
+}
+
+using Ids = std::vector<std::string>;
+
+void expect_same_node(const TraceNode& a, const TraceNode& b) {
+    EXPECT_EQ(a.trace_id, b.trace_id);
+    EXPECT_EQ(a.parent, b.parent);
+    EXPECT_EQ(a.timestamp, b.timestamp);
+    EXPECT_EQ(a.data_class, b.data_class);
+    EXPECT_EQ(a.operation.op_class, b.operation.op_class);
+    EXPECT_EQ(a.operation.method, b.operation.method);
+    EXPECT_EQ(a.operation.parameters, b.operation.parameters);
+    EXPECT_EQ(a.assumptions, b.assumptions);
+    EXPECT_EQ(a.input.shape, b.input.shape);
+    EXPECT_EQ(a.input.checksum, b.input.checksum);
+    EXPECT_EQ(a.output.data_class, b.output.data_class);
+    EXPECT_EQ(a.output.unit, b.output.unit);
+    EXPECT_EQ(a.output.checksum, b.output.checksum);
+    EXPECT_EQ(a.environment.language, b.environment.language);
+    EXPECT_EQ(a.environment.tool, b.environment.tool);
+    EXPECT_EQ(a.environment.version, b.environment.version);
+    EXPECT_EQ(a.ontology_version, b.ontology_version);
+}
+
+TraceNode sample_node() {
+    TraceNode node = create_trace_node("parent-1", "quantitative_matrix", "normalization", "TPM",
+                                       {"data_distribution:negative_binomial", "library_size:normalized"});
+    node.trace_id = "node-1";
+    node.timestamp = "2026-06-01T12:00:00Z";
+    node.operation.parameters = {{"min_count", "5"}, {"reference", "GRCh38"}};
+    node.input.shape = "20000x12";
+    node.input.checksum = "sha256:aa";
+    node.output.data_class = "quantitative_matrix";
+    node.output.unit = "TPM";
+    node.output.checksum = "sha256:bb";
+    return node;
+}
+
+TraceNode sample_node(const std::string& trace_id, const std::string& parent) {
+    TraceNode node = sample_node();
+    node.trace_id = trace_id;
+    node.parent = parent;
+    return node;
+}
+
+std::vector<std::pair<std::string, size_t>> flatten(const std::vector<DescendantId>& descendants) {
+    std::vector<std::pair<std::string, size_t>> flat;
+    for (const auto& descendant : descendants) {
+        flat.emplace_back(descendant.trace_id, descendant.depth);
+    }
+    return flat;
+}
+
+const std::string kOperationOntology =
+    "operation_classes:\n"
+    "  normalization:\n    description: \"Rescaling data to a common scale.\"\n"
+    "  filtering:\n    description: \"Removing data points.\"\n";
+const std::string kAssumptionOntology =
+    "assumption_classes:\n"
+    "  reference_version:\n    allowed_values:\n      - hg38\n      - mm10\n"
+    "  library_size:\n    allowed_values:\n      - normalized\n"
+    "  data_distribution:\n    allowed_values:\n      - negative_binomial\n";
+
+// A small ontology in the project's 'core/' directory, loaded
+Ontology write_ontology(const fs::path& root) {
+    fs::create_directories(root / "core");
+    write_file(root / "core" / "operation_ontology.yaml", kOperationOntology);
+    write_file(root / "core" / "assumption_ontology.yaml", kAssumptionOntology);
+    Ontology ontology;
+    ontology.load((root / "core" / "operation_ontology.yaml").string(),
+                  (root / "core" / "assumption_ontology.yaml").string());
+    return ontology;
+}
+
+} // namespace
+
+namespace {
+
+// The sha256-tree definition, recomputed from its leaves with OpenSSL
+std::string reference_tree_checksum(const std::string& data) {
+    std::string root = "traceseq-tree-v1";
+    for (uint64_t field : {static_cast<uint64_t>(kTreeHashChunkSize), static_cast<uint64_t>(data.size())}) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            root += static_cast<char>(field >> shift);
+        }
+    }
+    for (size_t offset = 0; offset < data.size(); offset += kTreeHashChunkSize) {
+        unsigned char leaf[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        EVP_Digest(data.data() + offset, std::min(kTreeHashChunkSize, data.size() - offset), leaf, &length,
+                   EVP_sha256(), nullptr);
+        root.append(reinterpret_cast<const char*>(leaf), length);
+    }
+    return kSha256TreeAlgorithm + ":" + evp_sha256_hex(root);
+}
+
+} // namespace
+
+TEST(Sha256Tree, SameDigestForAnyThreadCount) {
+    TempProject project;
+    const fs::path path = project.root / "matrix.bin";
+    std::set<std::string> digests;
+    // Empty, around one leaf, and several leaves with a short last one
+    for (size_t length : {size_t(0), kTreeHashChunkSize - 1, kTreeHashChunkSize, kTreeHashChunkSize + 1,
+                          3 * kTreeHashChunkSize + 5}) {
+        SCOPED_TRACE(length);
+        const std::string data = random_bytes(length, 1);
+        write_file(path, data);
+        const std::string digest = sha256_tree_file(path.string(), 1);
+        EXPECT_EQ(digest, reference_tree_checksum(data));
+        for (unsigned int threads : {2u, 3u, 8u, 0u}) {
+            EXPECT_EQ(sha256_tree_file(path.string(), threads), digest) << threads << " threads";
+        }
+        EXPECT_EQ(checksum_file(path.string(), kSha256TreeAlgorithm), digest);
+        digests.insert(digest);
+    }
+    EXPECT_EQ(digests.size(), 5u);
+}
+
+TEST(Sha256Tree, PlainSha256StaysUntagged) {
+    TempProject project;
+    const fs::path path = project.root / "abc.txt";
+    write_file(path, "abc");
+    const std::string plain = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    EXPECT_EQ(checksum_file(path.string(), kSha256Algorithm), plain);
+    EXPECT_EQ(sha256_file(path.string()), plain);
+    EXPECT_EQ(checksum_algorithm(plain), kSha256Algorithm);
+    EXPECT_EQ(checksum_algorithm(checksum_file(path.string(), kSha256TreeAlgorithm)), kSha256TreeAlgorithm);
+    EXPECT_THROW(checksum_file(path.string(), "md5"), std::invalid_argument);
+}
+
+TEST(ChecksumCache, MissesOnAnyIdentityChange) {
+    TempProject project;
+    const fs::path path = project.root / "data.tsv";
+    write_file(path, "gene\tcount\nA\t1\n");
+    const fs::path replacement = project.root / "data.tsv.new";
+    write_file(replacement, "gene\tcount\nA\t3\n");
+    // Checksums of files changed within the last two seconds are not cached
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    {
+        ChecksumCache cache(project.root);
+        EXPECT_EQ(cache.lookup(path.string(), kSha256Algorithm), "");
+        EXPECT_EQ(cache.checksum(path.string(), kSha256Algorithm), evp_sha256_hex("gene\tcount\nA\t1\n"));
+    }
+    // Read back from the cache file by a new process
+    ChecksumCache cache(project.root);
+    EXPECT_EQ(cache.lookup(path.string(), kSha256Algorithm), evp_sha256_hex("gene\tcount\nA\t1\n"));
+    EXPECT_EQ(cache.lookup(path.string(), kSha256TreeAlgorithm), "");
+
+    // Same size with the old mtime put back: the ctime still gives it away
+    const fs::file_time_type mtime = fs::last_write_time(path);
+    write_file(path, "gene\tcount\nA\t2\n");
+    fs::last_write_time(path, mtime);
+    EXPECT_EQ(cache.lookup(path.string(), kSha256Algorithm), "");
+    EXPECT_EQ(cache.checksum(path.string(), kSha256Algorithm), evp_sha256_hex("gene\tcount\nA\t2\n"));
+
+    // Replaced by another file under the same name
+    fs::rename(replacement, path);
+    EXPECT_EQ(cache.lookup(path.string(), kSha256Algorithm), "");
+    EXPECT_EQ(cache.checksum(path.string(), kSha256Algorithm), evp_sha256_hex("gene\tcount\nA\t3\n"));
+
+    cache.set_enabled(false);
+    EXPECT_EQ(cache.lookup(path.string(), kSha256Algorithm), "");
+}
+
+TEST(ChecksumCache, PinsServeLookupsWhileTheFileIsUnchanged) {
+    TempProject project;
+    const fs::path path = project.root / "fresh.tsv";
+    write_file(path, "gene\tcount\nA\t1\n");
+    // A fresh file, inside the racy window, and a value no hash would give
+    const PinnedChecksum pinned{stat_file_identity(path.string()), kSha256Algorithm, "pinned"};
+    ChecksumCache cache(project.root);
+    ChecksumCache disabled(project.root, false);
+    for (ChecksumCache* target : {&cache, &disabled}) {
+        target->pin(pinned);
+        EXPECT_EQ(target->lookup(path.string(), kSha256Algorithm), "pinned");
+        EXPECT_EQ(target->checksum(path.string(), kSha256Algorithm), "pinned");
+        EXPECT_EQ(target->lookup(path.string(), kSha256TreeAlgorithm), "");
+    }
+    // Pins are not written to the cache file
+    EXPECT_EQ(ChecksumCache(project.root).lookup(path.string(), kSha256Algorithm), "");
+
+    write_file(path, "gene\tcount\nA\t2\n");
+    EXPECT_EQ(cache.checksum(path.string(), kSha256Algorithm), evp_sha256_hex("gene\tcount\nA\t2\n"));
+    disabled.pin(PinnedChecksum{stat_file_identity(path.string()), kSha256Algorithm, "pinned again"});
+    EXPECT_EQ(disabled.lookup(path.string(), kSha256Algorithm), "pinned again");
+    disabled.clear_pins();
+    EXPECT_EQ(disabled.lookup(path.string(), kSha256Algorithm), "");
+}
+
+TEST(IndexLog, TornLineIsSkippedAndTerminated) {
+    TempProject project;
+    append_index({{"sha256:aa", "a"}}, project.root);
+    // A writer that died part way through its record
+    write_file(project.root / ".traceseq" / "index.log", "{\"sha256:bb\": \"b", std::ios::app);
+    EXPECT_EQ(read_index_unlocked(project.root), (nlohmann::json{{"sha256:aa", "a"}}));
+
+    // The next record starts on a line of its own instead of continuing the torn one
+    append_index({{"sha256:cc", "c"}, {"sha256:aa", "a2"}}, project.root);
+    EXPECT_EQ(read_index_unlocked(project.root), (nlohmann::json{{"sha256:aa", "a2"}, {"sha256:cc", "c"}}));
+}
+
+TEST(IndexLog, CompactionFoldsTheLogIntoTheSnapshot) {
+    TempProject project;
+    write_index_unlocked(nlohmann::json{{"sha256:aa", "a"}}, project.root);
+    append_index({{"sha256:bb", "b"}}, project.root);
+    append_index({{"sha256:aa", "a2"}}, project.root);
+    const nlohmann::json expected{{"sha256:aa", "a2"}, {"sha256:bb", "b"}};
+
+    compact_index(project.root);
+    EXPECT_EQ(fs::file_size(project.root / ".traceseq" / "index.log"), 0u);
+    std::ifstream snapshot(project.root / ".traceseq" / "index.json");
+    EXPECT_EQ(nlohmann::json::parse(snapshot), expected);
+    EXPECT_EQ(read_index_unlocked(project.root), expected);
+}
+
+TEST(IndexLog, ViewFollowsAppendsAndCompactions) {
+    TempProject project;
+    IndexView view(project.root);
+    append_index({{"sha256:aa", "a"}}, project.root);
+    EXPECT_EQ(view.refresh(), (nlohmann::json{{"sha256:aa", "a"}}));
+
+    append_index({{"sha256:bb", "b"}}, project.root);
+    EXPECT_EQ(view.refresh(), (nlohmann::json{{"sha256:aa", "a"}, {"sha256:bb", "b"}}));
+
+    // A compaction truncates the log the view has already read past
+    compact_index(project.root);
+    append_index({{"sha256:cc", "c"}}, project.root);
+    EXPECT_EQ(view.refresh(), (nlohmann::json{{"sha256:aa", "a"}, {"sha256:bb", "b"}, {"sha256:cc", "c"}}));
+    write_file(project.root / ".traceseq" / "index.log", "{\"sha256:dd\"", std::ios::app);
+    EXPECT_EQ(view.refresh().size(), 3u);
+}
+
+namespace {
+
+AnnotationRequest annotation(const fs::path& file, const std::string& op_class, const std::string& method,
+                             const std::vector<std::string>& assumptions) {
+    AnnotationRequest request;
+    request.filepath = file.string();
+    request.operation_class = op_class;
+    request.operation_method = method;
+    request.assumptions = assumptions;
+    return request;
+}
+
+} // namespace
+
+TEST(Batch, ReadsManifestRows) {
+    TempProject project;
+    const fs::path manifest = project.root / "manifest.tsv";
+    write_file(manifest,
+               "file\toperation\tmethod\tassumptions\tparent\n"
+               "# a comment\n"
+               "counts.tsv\tnormalization\tTPM\treference_version:hg38,library_size:normalized\tp-1\r\n"
+               "\n"
+               "/data/other.tsv\tfiltering\tmin count\t-\n");
+    const std::vector<AnnotationRequest> requests = read_annotation_manifest(manifest.string());
+    ASSERT_EQ(requests.size(), 2u);
+    EXPECT_EQ(requests[0].filepath, (project.root / "counts.tsv").string());
+    EXPECT_EQ(requests[0].operation_class, "normalization");
+    EXPECT_EQ(requests[0].operation_method, "TPM");
+    EXPECT_EQ(requests[0].assumptions, (std::vector<std::string>{"reference_version:hg38", "library_size:normalized"}));
+    EXPECT_EQ(requests[0].parent_id, "p-1");
+    EXPECT_EQ(requests[1].filepath, "/data/other.tsv");
+    EXPECT_EQ(requests[1].operation_method, "min count");
+    EXPECT_TRUE(requests[1].assumptions.empty());
+    EXPECT_EQ(requests[1].parent_id, "null");
+
+    write_file(manifest, "counts.tsv\tnormalization\n");
+    EXPECT_THROW(read_annotation_manifest(manifest.string()), std::runtime_error);
+}
+
+TEST(Batch, CommitsOneIndexEntryPerRowAndReportsBadRows) {
+    TempProject project;
+    const Ontology ontology = write_ontology(project.root);
+    write_file(project.root / "a.tsv", "gene\tcount\nA\t1\n");
+    write_file(project.root / "b.tsv", "gene\tcount\nB\t2\n");
+    const std::vector<AnnotationRequest> requests = {
+        annotation(project.root / "a.tsv", "normalization", "TPM", {"reference_version:hg38"}),
+        annotation(project.root / "a.tsv", "astrology", "TPM", {}),
+        annotation(project.root / "b.tsv", "normalization", "TPM", {"reference_version:hg19"}),
+        annotation(project.root / "missing.tsv", "normalization", "TPM", {}),
+        annotation(project.root / "b.tsv", "filtering", "min count", {}),
+    };
+    ChecksumCache cache(project.root);
+    const std::vector<AnnotationResult> results =
+        annotate_batch(requests, ontology, cache, kSha256Algorithm, project.root, 2);
+    ASSERT_EQ(results.size(), requests.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        EXPECT_EQ(results[i].filepath, requests[i].filepath);
+        EXPECT_EQ(results[i].trace_id.empty(), !results[i].error.empty()) << i;
+    }
+    EXPECT_EQ(results[0].checksum, evp_sha256_hex("gene\tcount\nA\t1\n"));
+    EXPECT_NE(results[1].error.find("astrology"), std::string::npos);
+    EXPECT_NE(results[2].error.find("reference_version:hg19"), std::string::npos);
+    EXPECT_FALSE(results[3].error.empty());
+    EXPECT_EQ(results[4].checksum, evp_sha256_hex("gene\tcount\nB\t2\n"));
+
+    // Only the good rows are committed, one index entry each
+    const nlohmann::json index = load_index(project.root);
+    EXPECT_EQ(index, (nlohmann::json{{results[0].checksum, results[0].trace_id},
+                                     {results[4].checksum, results[4].trace_id}}));
+    const std::vector<TraceNode> lineage = resolve_lineage(results[4].trace_id, project.root);
+    ASSERT_EQ(lineage.size(), 1u);
+    const TraceNode& node = lineage[0];
+    EXPECT_EQ(node.operation.op_class, "filtering");
+    EXPECT_EQ(node.operation.method, "min count");
+    EXPECT_EQ(node.output.checksum, results[4].checksum);
+}
+
+TEST(Ontology, SnapshotFollowsTheYamlFiles) {
+    TempProject project;
+    write_ontology(project.root);
+    fs::create_directories(project.root / ".traceseq");
+    const fs::path snapshot = project.root / ".traceseq" / "ontology.cache";
+    {
+        Ontology ontology;
+        ontology.load_project(project.root);
+        EXPECT_TRUE(ontology.validate_operation("filtering"));
+        EXPECT_FALSE(ontology.validate_operation("alignment"));
+        EXPECT_TRUE(ontology.validate_assumption("reference_version:hg38"));
+        EXPECT_FALSE(ontology.validate_assumption("reference_version:hg19"));
+        EXPECT_FALSE(ontology.validate_assumption("batch_correction:combat"));
+    }
+    ASSERT_TRUE(fs::exists(snapshot));
+
+    // A current snapshot is read instead of the YAML: a class renamed in it shows through
+    std::string bytes;
+    {
+        std::ifstream in(snapshot, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    const size_t at = bytes.find("filtering");
+    ASSERT_NE(at, std::string::npos);
+    bytes[at + 8] = 'G';
+    write_file(snapshot, bytes);
+    {
+        Ontology ontology;
+        ontology.load_project(project.root);
+        EXPECT_TRUE(ontology.validate_operation("filterinG"));
+        EXPECT_FALSE(ontology.validate_operation("filtering"));
+    }
+
+    // Editing either YAML file invalidates it
+    write_file(project.root / "core" / "operation_ontology.yaml",
+               kOperationOntology + "  alignment:\n    description: \"Mapping reads.\"\n");
+    {
+        Ontology ontology;
+        ontology.load_project(project.root);
+        EXPECT_TRUE(ontology.validate_operation("alignment"));
+        EXPECT_TRUE(ontology.validate_operation("filtering"));
+        EXPECT_FALSE(ontology.validate_operation("filterinG"));
+    }
+    write_file(project.root / "core" / "assumption_ontology.yaml",
+               kAssumptionOntology + "  batch_correction:\n    allowed_values:\n      - combat\n");
+    Ontology ontology;
+    ontology.load_project(project.root);
+    EXPECT_TRUE(ontology.validate_assumption("batch_correction:combat"));
+    EXPECT_TRUE(ontology.validate_operation("alignment"));
+}
+
+TEST(Ontology, ValidatesWhileReloading) {
+    TempProject project;
+    Ontology ontology = write_ontology(project.root);
+    const Ontology copy = ontology;
+    EXPECT_TRUE(copy.validate_operation("normalization"));
+    std::thread loader([&] {
+        for (int i = 0; i < 20; ++i) {
+            ontology.load((project.root / "core" / "operation_ontology.yaml").string(),
+                          (project.root / "core" / "assumption_ontology.yaml").string());
+        }
+    });
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_TRUE(ontology.validate_operation("normalization"));
+        ASSERT_FALSE(ontology.validate_operation("unknown"));
+    }
+    loader.join();
+}
+
+TEST(NodeStore, AppendedNodesLoadBack) {
+    TempProject project;
+    {
+        NodeStore store(project.root);
+        store.append({sample_node("a", "null"), sample_node("b", "a")});
+        store.append({sample_node("c", "b")});
+    }
+    NodeStore store(project.root);
+    std::vector<std::string> ids;
+    for (const auto& location : store.locations()) {
+        ids.push_back(location.trace_id + "<" + location.parent);
+    }
+    EXPECT_EQ(ids, (std::vector<std::string>{"a<null", "b<a", "c<b"}));
+    for (const auto& id_parent : std::vector<std::pair<std::string, std::string>>{{"a", "null"}, {"b", "a"}, {"c", "b"}}) {
+        TraceNode node;
+        ASSERT_TRUE(store.load(id_parent.first, node)) << id_parent.first;
+        expect_same_node(node, sample_node(id_parent.first, id_parent.second));
+    }
+    TraceNode node;
+    EXPECT_FALSE(store.load("missing", node));
+}
+
+TEST(NodeStore, AppendCutsTornIndexTail) {
+    TempProject project;
+    NodeStore store(project.root);
+    store.append({sample_node("a", "null"), sample_node("b", "a"), sample_node("c", "b")});
+    const fs::path index_path = project.root / ".traceseq" / "segments" / "offsets.idx";
+    const uintmax_t whole_size = fs::file_size(index_path);
+
+    // An append that died part way: one whole record that never reached the
+    // disk and a partial one
+    {
+        std::ofstream index(index_path, std::ios::binary | std::ios::app);
+        index << std::string(128, '\0') << std::string(50, 'x');
+    }
+    store.append({sample_node("d", "c"), sample_node("e", "d")});
+    EXPECT_EQ(fs::file_size(index_path), whole_size + 2 * 128);
+
+    NodeStore reopened(project.root);
+    std::vector<std::string> ids;
+    for (const auto& location : reopened.locations()) {
+        ids.push_back(location.trace_id);
+    }
+    EXPECT_EQ(ids, (std::vector<std::string>{"a", "b", "c", "d", "e"}));
+    TraceNode node;
+    ASSERT_TRUE(reopened.load("e", node));
+    expect_same_node(node, sample_node("e", "d"));
+}
+
+TEST(NodeStore, AppendKeepsViewsCurrent) {
+    TempProject project;
+    NodeStore writer(project.root);
+    NodeStore other(project.root);
+    writer.append({sample_node("a", "null")});
+    writer.refresh();
+    ASSERT_EQ(writer.children("a").size(), 0u);
+
+    // The writer's own records, and a child list built before them
+    writer.append({sample_node("b", "a")});
+    ASSERT_EQ(writer.children("a").size(), 1u);
+    EXPECT_EQ(writer.children("a")[0].trace_id, "b");
+
+    // Another store's records are picked up by a refresh, and the writer's
+    // later records follow them
+    other.append({sample_node("c", "a")});
+    writer.append({sample_node("d", "c")});
+    writer.refresh();
+    std::vector<std::string> ids;
+    for (const auto& location : writer.locations()) {
+        ids.push_back(location.trace_id);
+    }
+    EXPECT_EQ(ids, (std::vector<std::string>{"a", "b", "c", "d"}));
+    EXPECT_EQ(writer.descendants("a").size(), 3u);
+}
+
+TEST(Lineage, FollowsParentsAcrossStores) {
+    TempProject project;
+    NodeStore store(project.root);
+    // a <- b packed, c <- b per-file, d <- c packed; o has a missing parent
+    // and x <-> y is a parent cycle
+    store.append({sample_node("a", "null"), sample_node("b", "a"), sample_node("d", "c"),
+                  sample_node("o", "gone"), sample_node("x", "y"), sample_node("y", "x")});
+    fs::create_directories(project.root / ".traceseq" / "nodes");
+    write_file(project.root / ".traceseq" / "nodes" / "c.yaml", trace_node_to_yaml(sample_node("c", "b")));
+
+    EXPECT_EQ(resolve_lineage_ids("d", project.root), (Ids{"a", "b", "c", "d"}));
+    EXPECT_EQ(resolve_lineage_ids("a", project.root), (Ids{"a"}));
+    EXPECT_EQ(resolve_lineage_ids("o", project.root), (Ids{"o"}));
+    EXPECT_EQ(resolve_lineage_ids("x", project.root), (Ids{"y", "x"}));
+    EXPECT_TRUE(resolve_lineage_ids("missing", project.root).empty());
+
+    const std::vector<TraceNode> lineage = resolve_lineage("d", project.root);
+    ASSERT_EQ(lineage.size(), 4u);
+    EXPECT_EQ(lineage[0].parent, "null");
+    EXPECT_EQ(lineage[2].trace_id, "c");
+    EXPECT_EQ(lineage[3].parent, "c");
+}
+
+namespace {
+
+// Both ends of a connected Unix stream socket
+struct SocketPair {
+    int fds[2] = {-1, -1};
+    SocketPair() {
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("socketpair failed");
+        }
+    }
+    ~SocketPair() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+    // Closes the writing end so the reader sees the end of the stream
+    void hang_up() {
+        ::close(fds[0]);
+        fds[0] = -1;
+    }
+};
+
+} // namespace
+
+TEST(DaemonProtocol, FramesRoundTrip) {
+    SocketPair sockets;
+    const std::vector<std::string> messages = {"{\"args\":[\"traceseq\"]}", "", random_bytes(1024 * 1024, 5)};
+    // Larger frames than the socket buffer need a reader running concurrently
+    std::thread writer([&] {
+        for (const std::string& message : messages) {
+            EXPECT_TRUE(write_frame(sockets.fds[0], message));
+        }
+        sockets.hang_up();
+    });
+    for (const std::string& message : messages) {
+        std::string received = "stale";
+        ASSERT_TRUE(read_frame(sockets.fds[1], received));
+        EXPECT_EQ(received, message);
+    }
+    writer.join();
+    std::string received;
+    EXPECT_FALSE(read_frame(sockets.fds[1], received));
+}
+
+TEST(DaemonProtocol, RejectsOversizedAndTruncatedFrames) {
+    {
+        SocketPair sockets;
+        const char header[4] = {0, 0, 0, static_cast<char>(0x80)};
+        ASSERT_EQ(::send(sockets.fds[0], header, sizeof(header), 0), 4);
+        std::string received;
+        EXPECT_FALSE(read_frame(sockets.fds[1], received));
+    }
+    {
+        SocketPair sockets;
+        const char frame[6] = {10, 0, 0, 0, 'a', 'b'};
+        ASSERT_EQ(::send(sockets.fds[0], frame, sizeof(frame), 0), 6);
+        sockets.hang_up();
+        std::string received;
+        EXPECT_FALSE(read_frame(sockets.fds[1], received));
+    }
+    SocketPair sockets;
+    EXPECT_FALSE(write_frame(sockets.fds[0], std::string(64 * 1024 * 1024 + 1, 'x')));
+}
+
+TEST(DaemonProtocol, LongRootsUseAPrivateSocketDirectory) {
+    TempProject project;
+    EXPECT_EQ(daemon_socket_path(project.root), project.root / ".traceseq" / "traceseqd.sock");
+
+    const fs::path long_root = project.root / std::string(120, 'p');
+    const fs::path other_root = project.root / std::string(121, 'p');
+    const char* saved = std::getenv("XDG_RUNTIME_DIR");
+    const std::string saved_value = saved ? saved : "";
+    ::setenv("XDG_RUNTIME_DIR", project.root.c_str(), 1);
+    const fs::path socket_path = daemon_socket_path(long_root);
+    EXPECT_EQ(socket_path.parent_path(), project.root / "traceseq");
+    EXPECT_EQ(daemon_socket_path(long_root), socket_path);
+    EXPECT_NE(daemon_socket_path(other_root), socket_path);
+    ::unsetenv("XDG_RUNTIME_DIR");
+    EXPECT_EQ(daemon_socket_path(long_root).parent_path(),
+              fs::temp_directory_path() / ("traceseq-" + std::to_string(::geteuid())));
+    if (saved) {
+        ::setenv("XDG_RUNTIME_DIR", saved_value.c_str(), 1);
+    }
+
+    const fs::path directory = socket_path.parent_path();
+    ensure_private_directory(directory);
+    EXPECT_EQ(fs::status(directory).permissions() & fs::perms::all, fs::perms::owner_all);
+    ensure_private_directory(directory); // An existing private directory is accepted
+    fs::permissions(directory, fs::perms::group_read | fs::perms::group_exec, fs::perm_options::add);
+    EXPECT_THROW(ensure_private_directory(directory), std::runtime_error);
+    fs::remove(directory);
+    fs::create_directory_symlink(project.root, directory);
+    EXPECT_THROW(ensure_private_directory(directory), std::runtime_error);
+}
+
+TEST(DaemonProtocol, ChecksThePeerUser) {
+    SocketPair sockets;
+    EXPECT_TRUE(peer_is_current_user(sockets.fds[0]));
+    EXPECT_FALSE(peer_is_current_user(-1));
+}
+
+TEST(DaemonProtocol, ChecksumsRoundTrip) {
+    PinnedChecksum pinned;
+    pinned.identity.device = 2049;
+    pinned.identity.inode = UINT64_MAX;
+    pinned.identity.size = 1ull << 40;
+    pinned.identity.mtime_ns = 1790000000123456789LL;
+    pinned.identity.ctime_ns = -1;
+    pinned.algorithm = kSha256TreeAlgorithm;
+    pinned.checksum = "sha256-tree:abc";
+    nlohmann::json encoded = nlohmann::json::parse(encode_checksums({pinned}).dump());
+    encoded.push_back({{"device", "not a number"}});
+    const std::vector<PinnedChecksum> decoded = decode_checksums(encoded);
+    ASSERT_EQ(decoded.size(), 1u);
+    EXPECT_EQ(decoded[0].identity, pinned.identity);
+    EXPECT_EQ(decoded[0].algorithm, pinned.algorithm);
+    EXPECT_EQ(decoded[0].checksum, pinned.checksum);
+    EXPECT_TRUE(decode_checksums(nlohmann::json()).empty());
+}
+
+TEST(DigestSink, ChunkedUpdatesMatchChecksumFile) {
+    TempProject project;
+    const fs::path path = project.root / "output.bin";
+    // Crosses a tree leaf boundary at an arbitrary point
+    const std::string data = random_bytes(kTreeHashChunkSize + 300000, 7);
+    write_file(path, data);
+    std::mt19937 rng(8);
+    for (const std::string& algorithm : checksum_algorithms()) {
+        SCOPED_TRACE(algorithm);
+        DigestSink sink(algorithm);
+        for (size_t offset = 0; offset < data.size();) {
+            const size_t piece = std::min<size_t>(data.size() - offset, rng() % 200000);
+            sink.update(data.data() + offset, piece);
+            offset += piece;
+        }
+        EXPECT_EQ(sink.bytes(), data.size());
+        const std::string checksum = sink.finish();
+        EXPECT_EQ(checksum, checksum_file(path.string(), algorithm));
+        EXPECT_EQ(sink.finish(), checksum);
+        EXPECT_THROW(sink.update("x", 1), std::logic_error);
+
+        write_file(project.root / "empty.bin", "");
+        DigestSink empty(algorithm);
+        EXPECT_EQ(empty.finish(), checksum_file((project.root / "empty.bin").string(), algorithm));
+    }
+    EXPECT_THROW(DigestSink("md5"), std::invalid_argument);
+}
+
+TEST(DigestSink, ConcurrentUpdatesAreSerialized) {
+    // Identical blocks hash the same in any order, so only lost or torn updates show
+    const std::string block = random_bytes(4096, 9);
+    const int threads = 4;
+    const int blocks_per_thread = 500;
+    std::string data;
+    for (int i = 0; i < threads * blocks_per_thread; ++i) {
+        data += block;
+    }
+    TempProject project;
+    write_file(project.root / "blocks.bin", data);
+    for (const std::string& algorithm : {kSha256Algorithm, kSha256TreeAlgorithm}) {
+        SCOPED_TRACE(algorithm);
+        DigestSink sink(algorithm);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&] {
+                for (int i = 0; i < blocks_per_thread; ++i) {
+                    sink.update(block.data(), block.size());
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        EXPECT_EQ(sink.bytes(), data.size());
+        EXPECT_EQ(sink.finish(), checksum_file((project.root / "blocks.bin").string(), algorithm));
+    }
+}
+
+TEST(StreamAnnotator, RecordsTheStreamedOutput) {
+    TempProject project;
+    const Ontology ontology = write_ontology(project.root);
+    AnnotationRequest request;
+    request.filepath = (project.root / "streamed.tsv").string();
+    request.operation_class = "normalization";
+    request.operation_method = "TPM";
+    request.assumptions = {"library_size:normalized"};
+    StreamAnnotator annotator(request, ontology, kSha256Algorithm, project.root);
+    annotator.set_input_checksum("sha256:input");
+    const std::string data = random_bytes(100000, 9);
+    annotator.write(data.data(), 60000);
+    annotator.write(data.data() + 60000, data.size() - 60000);
+    EXPECT_EQ(annotator.bytes(), data.size());
+    const AnnotationResult result = annotator.close();
+    EXPECT_TRUE(result.error.empty()) << result.error;
+    EXPECT_EQ(result.checksum, checksum_file(request.filepath, kSha256Algorithm));
+    EXPECT_THROW(annotator.write("x", 1), std::logic_error);
+
+    const TraceNode node = load_node(result.trace_id, project.root);
+    EXPECT_EQ(node.output.checksum, result.checksum);
+    EXPECT_EQ(node.input.checksum, "sha256:input");
+    EXPECT_EQ(node.assumptions, request.assumptions);
+    // Both checksums lead to the node, as for the annotate command
+    EXPECT_EQ(load_index(project.root),
+              (nlohmann::json{{result.checksum, result.trace_id}, {"sha256:input", result.trace_id}}));
+
+    request.operation_class = "astrology";
+    EXPECT_THROW(StreamAnnotator(request, ontology, kSha256Algorithm, project.root), std::invalid_argument);
+}
+
+TEST(Sha256Resume, ResumedHashEqualsOneShot) {
+    TempProject project;
+    const fs::path path = project.root / "growing.bin";
+    std::string contents = random_bytes(2 * kTreeHashChunkSize + 4097, 5);
+    write_file(path, contents);
+
+    Sha256Midstate first;
+    EXPECT_EQ(sha256_file_resume(path.string(), nullptr, first), evp_sha256_hex(contents));
+    EXPECT_EQ(sha256_file(path.string()), evp_sha256_hex(contents));
+    ASSERT_GT(first.length, 0u);
+    ASSERT_EQ(first.length % 64, 0u);
+
+    const std::string appended = random_bytes(kTreeHashChunkSize + 5, 6);
+    write_file(path, appended, std::ios::app);
+    contents += appended;
+    Sha256Midstate second;
+    EXPECT_EQ(sha256_file_resume(path.string(), &first, second), evp_sha256_hex(contents));
+    EXPECT_GT(second.length, first.length);
+
+    // The midstate was really resumed from: a corrupted one changes the result
+    Sha256Midstate corrupted = first;
+    corrupted.state[0] ^= 1;
+    Sha256Midstate unused;
+    EXPECT_NE(sha256_file_resume(path.string(), &corrupted, unused), evp_sha256_hex(contents));
+}
+
+TEST(Sha256Resume, EditedPrefixIsHashedAgain) {
+    TempProject project;
+    const fs::path path = project.root / "edited.bin";
+    std::string contents = random_bytes(3 * kTreeHashChunkSize + 100, 7);
+    write_file(path, contents);
+    Sha256Midstate first;
+    sha256_file_resume(path.string(), nullptr, first);
+    ASSERT_EQ(first.length, 3 * kTreeHashChunkSize);
+
+    // One byte flipped well inside the prefix, away from its ends, then grown
+    const size_t edit_at = kTreeHashChunkSize + 12345;
+    contents[edit_at] = static_cast<char>(contents[edit_at] ^ 0x20);
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(static_cast<std::streamoff>(edit_at));
+        file.put(contents[edit_at]);
+    }
+    const std::string appended = random_bytes(1000, 8);
+    write_file(path, appended, std::ios::app);
+    contents += appended;
+
+    Sha256Midstate second;
+    EXPECT_EQ(sha256_file_resume(path.string(), &first, second), evp_sha256_hex(contents));
+    EXPECT_EQ(second.prefix_digest, sha256_prefix_digest(path.string(), second.length));
+}
+
+TEST(ChecksumCache, GrowingFileMatchesFullHash) {
+    TempProject project;
+    const fs::path path = project.root / "growing.bin";
+    std::string contents = random_bytes(kResumableHashMinBytes + kTreeHashChunkSize + 17, 9);
+    write_file(path, contents);
+    ChecksumCache cache(project.root);
+    EXPECT_EQ(cache.checksum(path.string(), kSha256Algorithm), evp_sha256_hex(contents));
+
+    const std::string appended = random_bytes(4096, 10);
+    write_file(path, appended, std::ios::app);
+    contents += appended;
+    EXPECT_EQ(cache.checksum(path.string(), kSha256Algorithm), evp_sha256_hex(contents));
+
+    // Edited in place and grown again: still the checksum of the bytes
+    contents[100] = static_cast<char>(contents[100] ^ 1);
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(100);
+        file.put(contents[100]);
+    }
+    write_file(path, appended, std::ios::app);
+    contents += appended;
+    EXPECT_EQ(cache.checksum(path.string(), kSha256Algorithm), evp_sha256_hex(contents));
+}
+
+namespace {
+
+const std::vector<Sha256Blocks> kSha256BlockFunctions = {Sha256Blocks::Portable, Sha256Blocks::X86, Sha256Blocks::Auto};
+
+} // namespace
+
+// FIPS 180-2, appendix B, and the empty message
+TEST(Sha256Blocks, KnownAnswers) {
+    const std::vector<std::pair<std::string, std::string>> vectors = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+         "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    for (Sha256Blocks blocks : kSha256BlockFunctions) {
+        if (!sha256_blocks_available(blocks)) {
+            EXPECT_THROW(sha256_resumable_hex({"abc"}, blocks), std::invalid_argument);
+            continue;
+        }
+        SCOPED_TRACE(static_cast<int>(blocks));
+        for (const auto& vector : vectors) {
+            EXPECT_EQ(sha256_resumable_hex({vector.first}, blocks), vector.second);
+        }
+    }
+    if (!sha256_blocks_available(Sha256Blocks::X86)) {
+        GTEST_SKIP() << "No SHA extensions on this CPU; only the portable code was checked";
+    }
+}
+
+TEST(Sha256Blocks, MatchesOpenSslAcrossBlockBoundaries) {
+    const std::string data = random_bytes(1000, 3);
+    for (Sha256Blocks blocks : kSha256BlockFunctions) {
+        if (!sha256_blocks_available(blocks)) {
+            continue;
+        }
+        SCOPED_TRACE(static_cast<int>(blocks));
+        // Every length around the padding cut-offs, fed whole and split in three
+        for (size_t length : {0, 1, 55, 56, 63, 64, 65, 119, 120, 127, 128, 129, 191, 192, 1000}) {
+            const std::string message = data.substr(0, length);
+            const std::string expected = evp_sha256_hex(message);
+            EXPECT_EQ(sha256_resumable_hex({message}, blocks), expected);
+            for (size_t cut : {size_t(1), size_t(63), size_t(64), length / 2}) {
+                if (cut > length) {
+                    continue;
+                }
+                EXPECT_EQ(sha256_resumable_hex({message.substr(0, cut), "", message.substr(cut)}, blocks), expected)
+                    << "length " << length << ", cut at " << cut;
+            }
+        }
+    }
+}
+
+TEST(ChecksumAlgorithms, KnownAnswers) {
+    TempProject project;
+    const fs::path path = project.root / "data.bin";
+    std::string counting;
+    for (int i = 0; i < 4 * 256; ++i) {
+        counting += static_cast<char>(i);
+    }
+    // The reference XXH64 (seed 0) vectors, covering the 32-byte stripes and
+    // every tail length class, and RFC 7693's BLAKE2b-512 ones
+    const std::vector<std::pair<std::string, std::string>> xxh64 = {
+        {"", "ef46db3751d8e999"},
+        {"abc", "44bc2cf5ad770999"},
+        {"Nobody inspects the spammish repetition", "fbcea83c8a378bf1"},
+        {counting + "xyz", "e146cb31b65bc21a"},
+    };
+    for (const auto& vector : xxh64) {
+        write_file(path, vector.first);
+        EXPECT_EQ(checksum_file(path.string(), kXxh64Algorithm), "xxh64:" + vector.second) << vector.first.size();
+    }
+    const std::vector<std::pair<std::string, std::string>> blake2b = {
+        {"", "786a02f742015903c6c6fd852552d272912f4740e15847618a86e217f71f5419"
+             "d25e1031afee585313896444934eb04b903a685b1448b755d56f701afe9be2ce"},
+        {"abc", "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+                "7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923"},
+    };
+    for (const auto& vector : blake2b) {
+        write_file(path, vector.first);
+        EXPECT_EQ(checksum_file(path.string(), kBlake2bAlgorithm), "blake2b:" + vector.second);
+    }
+
+    // Larger than any read buffer, against OpenSSL
+    const std::string data = random_bytes(3 * 1024 * 1024 + 7, 4);
+    write_file(path, data);
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data.data(), data.size(), digest, &length, EVP_blake2b512(), nullptr);
+    static const char* hex = "0123456789abcdef";
+    std::string expected = "blake2b:";
+    for (unsigned int i = 0; i < length; ++i) {
+        expected += hex[digest[i] >> 4];
+        expected += hex[digest[i] & 0xf];
+    }
+    EXPECT_EQ(checksum_file(path.string(), kBlake2bAlgorithm), expected);
+}
+
+TEST(ChecksumAlgorithms, TagsRoundTrip) {
+    TempProject project;
+    const fs::path path = project.root / "data.bin";
+    write_file(path, random_bytes(100000, 6));
+    for (const std::string& algorithm : checksum_algorithms()) {
+        EXPECT_EQ(checksum_algorithm(checksum_file(path.string(), algorithm)), algorithm);
+    }
+    EXPECT_EQ(checksum_algorithm("xxh64:44bc2cf5ad770999"), kXxh64Algorithm);
+    EXPECT_THROW(checksum_file(path.string(), "crc32"), std::invalid_argument);
+}
+
+TEST(Validation, ChecksSharedAncestorsOnce) {
+    TempProject project;
+    const Ontology ontology = write_ontology(project.root);
+    TraceNode bad = sample_node("bad", "b");
+    bad.operation.op_class = "astrology";
+    // Three outputs below a <- b, a node whose parent is gone, an invalid
+    // node and a parent cycle x <-> y
+    FileStorage storage(project.root);
+    storage.write_nodes({sample_node("a", "null"), sample_node("b", "a"), sample_node("o1", "b"), sample_node("o2", "b"),
+                        sample_node("o3", "b"), sample_node("orphan", "gone"), bad, sample_node("x", "y"),
+                        sample_node("y", "x")});
+    nlohmann::json index = nlohmann::json::object();
+    std::vector<std::string> files;
+    for (const std::string& id : {"o1", "o2", "o3", "orphan", "bad", "x", "untracked"}) {
+        const fs::path file = project.root / (id + ".tsv");
+        write_file(file, "output of " + id + "\n");
+        if (id != "untracked") {
+            index[evp_sha256_hex("output of " + id + "\n")] = id;
+        }
+        files.push_back(file.string());
+    }
+    ChecksumCache cache(project.root);
+    const ValidationReport report =
+        validate_files(files, index, ontology, cache, kSha256Algorithm, storage, project.root, 4);
+    ASSERT_EQ(report.files.size(), files.size());
+    EXPECT_EQ(report.passed, 3u);
+    EXPECT_EQ(report.failed, 3u);
+    EXPECT_EQ(report.untracked, 1u);
+    // Every node once, including the missing parent
+    EXPECT_EQ(report.nodes_checked, 10u);
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_TRUE(report.files[i].valid) << report.files[i].error;
+        EXPECT_EQ(report.files[i].steps, 3u);
+    }
+    EXPECT_EQ(report.files[3].failed_trace_id, "gone");
+    EXPECT_EQ(report.files[4].failed_trace_id, "bad");
+    EXPECT_NE(report.files[4].error.find("astrology"), std::string::npos);
+    EXPECT_EQ(report.files[5].failed_trace_id, "y");
+    EXPECT_NE(report.files[5].error.find("cycle"), std::string::npos);
+    EXPECT_TRUE(report.files[6].trace_id.empty());
+    EXPECT_TRUE(report.files[6].error.empty());
+}
+
+TEST(Profiler, WritesChromeTraceEvents) {
+    Profiler::start();
+    {
+        ProfileSpan span("hash");
+        span.set_detail("counts.tsv");
+        span.set_value("bytes", 42);
+    }
+    Profiler::count("bytes_hashed", 10);
+    Profiler::count("bytes_hashed", 5);
+    std::thread([] { ProfileSpan span("worker"); }).join();
+    Profiler::stop();
+    // Nothing is recorded once stopped
+    Profiler::count("bytes_hashed", 100);
+    EXPECT_FALSE(ProfileSpan("late").active());
+
+    const nlohmann::json trace = nlohmann::json::parse(Profiler::chrome_trace_json());
+    const nlohmann::json& events = trace.at("traceEvents");
+    ASSERT_EQ(events.size(), 5u);
+    EXPECT_EQ(events[0].at("ph"), "M");
+    const nlohmann::json& hash = events[1];
+    EXPECT_EQ(hash.at("name"), "hash");
+    EXPECT_EQ(hash.at("ph"), "X");
+    EXPECT_GE(hash.at("dur").get<double>(), 0.0);
+    EXPECT_EQ(hash.at("args"), (nlohmann::json{{"detail", "counts.tsv"}, {"bytes", 42}}));
+    EXPECT_EQ(events[2].at("ph"), "C");
+    EXPECT_EQ(events[2].at("args").at("bytes_hashed"), 10);
+    EXPECT_EQ(events[3].at("args").at("bytes_hashed"), 15);
+    EXPECT_EQ(events[4].at("name"), "worker");
+    EXPECT_NE(events[4].at("tid"), hash.at("tid"));
+    EXPECT_EQ(trace.at("otherData").at("counters"), (nlohmann::json{{"bytes_hashed", 15}}));
+
+    TempProject project;
+    const fs::path path = project.root / "trace.json";
+    Profiler::write_chrome_trace(path);
+    std::ifstream in(path);
+    EXPECT_EQ(nlohmann::json::parse(in), trace);
+}
+
+TEST(NodeBinary, RoundTrip) {
+    TraceNode node = sample_node();
+    std::string payload = encode_node_binary(node);
+    expect_same_node(decode_node_binary(payload.data(), payload.size()), node);
+
+    // Empty strings are omitted and come back empty
+    TraceNode sparse = node;
+    sparse.input.shape.clear();
+    sparse.output.unit.clear();
+    sparse.operation.parameters = {{"", "v"}, {"k", ""}};
+    sparse.assumptions = {"a", "a", "b"};
+    payload = encode_node_binary(sparse);
+    expect_same_node(decode_node_binary(payload.data(), payload.size()), sparse);
+}
+
+TEST(NodeBinary, SkipsUnknownTags) {
+    TraceNode node = sample_node();
+    const std::string payload = encode_node_binary(node);
+
+    // Fields added by a newer version: single and multi-byte tags, an empty
+    // field, and one between known fields
+    std::string extended = payload;
+    extended += std::string("\x7f\x03xyz", 5);
+    extended += std::string("\xc8\x01\x02hi", 5);
+    extended += std::string("\x40\x00", 2);
+    expect_same_node(decode_node_binary(extended.data(), extended.size()), node);
+
+    std::string inserted = payload.substr(0, 1) + std::string("\x63\x01z", 3) + payload.substr(1);
+    expect_same_node(decode_node_binary(inserted.data(), inserted.size()), node);
+}
+
+TEST(NodeBinary, RejectsTruncatedPayloads) {
+    const std::string payload = encode_node_binary(sample_node());
+    EXPECT_THROW(decode_node_binary(payload.data(), 0), std::runtime_error);
+    EXPECT_THROW(decode_node_binary(payload.data(), payload.size() - 1), std::runtime_error);
+
+    // Every other prefix either ends on a field boundary and decodes fewer
+    // fields, or is rejected; none reads past its end
+    size_t decoded = 0;
+    for (size_t length = 1; length < payload.size(); ++length) {
+        std::string prefix = payload.substr(0, length);
+        try {
+            decode_node_binary(prefix.data(), prefix.size());
+            ++decoded;
+        } catch (const std::runtime_error&) {
+        }
+    }
+    EXPECT_GT(decoded, 0u);
+    EXPECT_LT(decoded, payload.size() - 1);
+
+    // A tag without its length, a field longer than the payload, and a
+    // varint that never ends
+    const std::string head = payload.substr(0, 1);
+    for (const auto& tail : {std::string("\x01", 1), std::string("\x01\x05" "abc", 5),
+                                   std::string("\x01\xff\xff", 3), std::string("\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", 11)}) {
+        std::string bad = head + tail;
+        EXPECT_THROW(decode_node_binary(bad.data(), bad.size()), std::runtime_error);
+    }
+}
+
+TEST(NodeBinary, RejectsUnknownVersions) {
+    std::string payload = encode_node_binary(sample_node());
+    payload[0] = 0;
+    EXPECT_THROW(decode_node_binary(payload.data(), payload.size()), std::runtime_error);
+    payload[0] = static_cast<char>(0x7f);
+    EXPECT_THROW(decode_node_binary(payload.data(), payload.size()), std::runtime_error);
+}
+
+TEST(LineageColumns, ResolvesAndExportsLineages) {
+    TempProject project;
+    FileStorage storage(project.root);
+    storage.write_nodes({sample_node("a", "null"), sample_node("b", "a"), sample_node("c", "b"), sample_node("d", "a")});
+    auto columns = std::make_shared<LineageColumns>(
+        resolve_lineage_columns({"c", "d", "missing"}, project.root, storage));
+    ASSERT_EQ(columns->rows(), 5u);
+    EXPECT_EQ(columns->lineage, (std::vector<int32_t>{0, 0, 0, 1, 1}));
+    EXPECT_EQ(columns->depth, (std::vector<int32_t>{0, 1, 2, 0, 1}));
+    const std::vector<std::string> ids = {"a", "b", "c", "a", "d"};
+    const std::vector<std::string> parents = {"null", "a", "b", "null", "a"};
+    for (size_t row = 0; row < ids.size(); ++row) {
+        EXPECT_EQ(columns->trace_id.at(row), ids[row]);
+        EXPECT_EQ(columns->parent.at(row), parents[row]);
+        EXPECT_EQ(columns->operation_class.at(row), "normalization");
+        EXPECT_EQ(columns->output_checksum.at(row), "sha256:bb");
+    }
+    EXPECT_EQ(LineageColumns::column_names().size(), 9u);
+    EXPECT_EQ(columns->string_column("trace_id"), &columns->trace_id);
+    EXPECT_EQ(columns->string_column("depth"), nullptr);
+    EXPECT_EQ(columns->string_column("unknown"), nullptr);
+
+    ArrowSchema schema;
+    ArrowArray array;
+    export_lineage_columns(columns, &schema, &array);
+    EXPECT_STREQ(schema.format, "+s");
+    ASSERT_EQ(schema.n_children, 9);
+    EXPECT_STREQ(schema.children[0]->format, "i");
+    EXPECT_STREQ(schema.children[2]->name, "trace_id");
+    EXPECT_STREQ(schema.children[2]->format, "U");
+    EXPECT_EQ(array.length, 5);
+    ASSERT_EQ(array.n_children, 9);
+    EXPECT_EQ(array.children[2]->buffers[2], columns->trace_id.data.data());
+    schema.release(&schema);
+    array.release(&array);
+    EXPECT_EQ(schema.release, nullptr);
+    EXPECT_EQ(array.release, nullptr);
+}
+
+namespace {
+
+struct AlignedStep {
+    StepChange change;
+    long index_a;
+    long index_b;
+};
+
+std::vector<AlignedStep> align(const std::vector<uint64_t>& signatures_a, const std::vector<uint64_t>& kinds_a,
+                               const std::vector<uint64_t>& signatures_b, const std::vector<uint64_t>& kinds_b) {
+    std::vector<AlignedStep> steps;
+    for (const auto& step : align_steps(signatures_a, kinds_a, signatures_b, kinds_b)) {
+        steps.push_back({step.change, step.index_a, step.index_b});
+    }
+    return steps;
+}
+
+void expect_steps(const std::vector<AlignedStep>& actual, const std::vector<AlignedStep>& expected) {
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        SCOPED_TRACE("step " + std::to_string(i));
+        EXPECT_EQ(actual[i].change, expected[i].change);
+        EXPECT_EQ(actual[i].index_a, expected[i].index_a);
+        EXPECT_EQ(actual[i].index_b, expected[i].index_b);
+    }
+}
+
+const StepChange kSame = StepChange::Unchanged;
+const StepChange kChanged = StepChange::Changed;
+const StepChange kRemoved = StepChange::Removed;
+const StepChange kInserted = StepChange::Inserted;
+
+} // namespace
+
+TEST(AlignSteps, Identical) {
+    expect_steps(align({1, 2, 3}, {10, 20, 30}, {1, 2, 3}, {10, 20, 30}),
+                 {{kSame, 0, 0}, {kSame, 1, 1}, {kSame, 2, 2}});
+    expect_steps(align({}, {}, {}, {}), {});
+}
+
+TEST(AlignSteps, Insert) {
+    expect_steps(align({1, 2, 3}, {10, 20, 30}, {1, 2, 9, 3}, {10, 20, 90, 30}),
+                 {{kSame, 0, 0}, {kSame, 1, 1}, {kInserted, -1, 2}, {kSame, 2, 3}});
+    expect_steps(align({1}, {10}, {7, 8, 1}, {70, 80, 10}),
+                 {{kInserted, -1, 0}, {kInserted, -1, 1}, {kSame, 0, 2}});
+    expect_steps(align({}, {}, {4, 5}, {40, 50}), {{kInserted, -1, 0}, {kInserted, -1, 1}});
+}
+
+TEST(AlignSteps, Delete) {
+    expect_steps(align({1, 2, 9, 3}, {10, 20, 90, 30}, {1, 2, 3}, {10, 20, 30}),
+                 {{kSame, 0, 0}, {kSame, 1, 1}, {kRemoved, 2, -1}, {kSame, 3, 2}});
+    expect_steps(align({1, 2, 3}, {10, 20, 30}, {1}, {10}),
+                 {{kSame, 0, 0}, {kRemoved, 1, -1}, {kRemoved, 2, -1}});
+    expect_steps(align({4, 5}, {40, 50}, {}, {}), {{kRemoved, 0, -1}, {kRemoved, 1, -1}});
+}
+
+TEST(AlignSteps, Replace) {
+    // Same operation class with other parameters: one changed step
+    expect_steps(align({1, 2, 3}, {10, 20, 30}, {1, 7, 3}, {10, 20, 30}),
+                 {{kSame, 0, 0}, {kChanged, 1, 1}, {kSame, 2, 2}});
+    // A different operation class: removed and inserted
+    std::vector<AlignedStep> steps = align({1, 2, 3}, {10, 20, 30}, {1, 7, 3}, {10, 70, 30});
+    ASSERT_EQ(steps.size(), 4u);
+    expect_steps({steps[0], steps[3]}, {{kSame, 0, 0}, {kSame, 2, 2}});
+    std::vector<AlignedStep> middle{steps[1], steps[2]};
+    if (middle[0].change == kInserted) {
+        std::swap(middle[0], middle[1]);
+    }
+    expect_steps(middle, {{kRemoved, 1, -1}, {kInserted, -1, 1}});
+    // Changed steps are paired by class even when the order around them shifts
+    expect_steps(align({1, 2, 3, 4}, {10, 20, 30, 40}, {1, 5, 9, 4}, {10, 20, 90, 40}),
+                 {{kSame, 0, 0}, {kChanged, 1, 1}, {kRemoved, 2, -1}, {kInserted, -1, 2}, {kSame, 3, 3}});
+}
+
+TEST(ChunkFile, ReusesDigestsOfUnchangedRanges) {
+    TempProject project;
+    const fs::path path = project.root / "matrix.bin";
+    std::string contents = random_bytes(2 * 1024 * 1024, 11);
+    write_file(path, contents);
+    const ChunkList before = chunk_file(path.string());
+    ASSERT_GT(before.chunks.size(), 8u);
+    EXPECT_EQ(before.size, contents.size());
+
+    // An edit in place, then an insertion that shifts everything after it
+    for (const bool insert : {false, true}) {
+        SCOPED_TRACE(insert ? "insert" : "edit");
+        if (insert) {
+            contents.insert(contents.size() / 3, random_bytes(1000, 12));
+        } else {
+            contents[contents.size() / 2] = static_cast<char>(contents[contents.size() / 2] ^ 1);
+        }
+        write_file(path, contents);
+        const ChunkList fresh = chunk_file(path.string());
+        const ChunkList reused = chunk_file(path.string(), &before);
+        EXPECT_EQ(reused.checksum(), fresh.checksum());
+        EXPECT_NE(reused.checksum(), before.checksum());
+        ASSERT_EQ(reused.chunks.size(), fresh.chunks.size());
+        for (size_t i = 0; i < fresh.chunks.size(); ++i) {
+            EXPECT_EQ(reused.chunks[i].length, fresh.chunks[i].length);
+            EXPECT_EQ(std::string(reinterpret_cast<const char*>(reused.chunks[i].digest), 32),
+                      std::string(reinterpret_cast<const char*>(fresh.chunks[i].digest), 32));
+        }
+        // Boundaries depend on nearby content only, so most chunks survive
+        const ChunkOverlap overlap = chunk_overlap(fresh, before);
+        EXPECT_GE(overlap.total_chunks - overlap.shared_chunks, 1u);
+        EXPECT_LE(overlap.total_chunks - overlap.shared_chunks, 3u);
+    }
+}
+
+TEST(ChunkFile, CacheKeepsListsOfRecordedChecksums) {
+    TempProject project;
+    const fs::path path = project.root / "matrix.bin";
+    write_file(path, random_bytes(512 * 1024, 13));
+    ChecksumCache cache(project.root);
+    const std::string plain = cache.checksum(path.string(), kSha256CdcAlgorithm);
+    EXPECT_EQ(plain, chunk_file(path.string()).checksum());
+    EXPECT_TRUE(cache.stored_chunk_checksums().empty());
+
+    const std::string recorded = cache.recorded_checksum(path.string(), kSha256CdcAlgorithm);
+    EXPECT_EQ(recorded, plain);
+    ChunkList list;
+    ASSERT_TRUE(cache.stored_chunks(recorded, list));
+    EXPECT_EQ(list.checksum(), recorded);
+    EXPECT_EQ(cache.stored_chunk_checksums(), Ids{recorded});
+    // Still the latest list of a cached file, so the sweep keeps it
+    EXPECT_EQ(cache.sweep_chunks({}, 0, false), 0u);
+}
+
+namespace {
+
+Ids packed_ids(NodeStore& store) {
+    Ids ids;
+    for (const auto& location : store.locations()) {
+        ids.push_back(location.trace_id);
+    }
+    return ids;
+}
+
+// Packed lineages a <- b and c <- d, the latter created just now, and an old
+// orphan e; the index refers to b and e
+void write_gc_project(FileStorage& storage) {
+    TraceNode recent = create_trace_node("c", "quantitative_matrix", "normalization", "TPM", {});
+    recent.trace_id = "d";
+    storage.write_nodes({sample_node("a", "null"), sample_node("c", "null"), sample_node("e", "null"),
+                         sample_node("b", "a"), recent});
+    storage.append_index({{"sha256:b", "b"}, {"sha256:e", "e"}});
+}
+
+} // namespace
+
+TEST(StoreGc, KeepsReachableAndRecentNodes) {
+    TempProject project;
+    FileStorage storage(project.root);
+    write_gc_project(storage);
+    ASSERT_EQ(packed_ids(storage.node_store()), (Ids{"a", "c", "e", "b", "d"}));
+    // An old unreferenced per-file node, and an indexed one that is too long
+    // to pack, which keeps its parent
+    const fs::path nodes_dir = project.root / ".traceseq" / "nodes";
+    fs::create_directories(nodes_dir);
+    const std::string long_id(kMaxPackedIdLength + 1, 'x');
+    write_file(nodes_dir / "f.yaml", trace_node_to_yaml(sample_node("f", "null")));
+    storage.write_nodes({sample_node(long_id, "a")});
+    storage.append_index({{"sha256:long", long_id}});
+
+    GcOptions options;
+    options.dry_run = true;
+    GcReport report = collect_garbage(project.root, storage.node_store(), options);
+    EXPECT_EQ(report.removed, 1u);
+    EXPECT_TRUE(fs::exists(nodes_dir / "f.yaml"));
+
+    options.dry_run = false;
+    report = collect_garbage(project.root, storage.node_store(), options);
+    EXPECT_EQ(report.roots, 3u);
+    EXPECT_EQ(report.reachable, 4u);  // a, b, e and the long one
+    EXPECT_EQ(report.in_grace, 2u);   // d and its parent c
+    EXPECT_EQ(report.removed, 1u);    // f
+    EXPECT_EQ(report.index_entries_removed, 0u);
+    EXPECT_FALSE(fs::exists(nodes_dir / "f.yaml"));
+    EXPECT_TRUE(fs::exists(nodes_dir / (long_id + ".yaml")));
+
+    // Children follow their parents after the rewrite
+    NodeStore reopened(project.root);
+    EXPECT_EQ(packed_ids(reopened), (Ids{"a", "b", "c", "d", "e"}));
+    TraceNode node;
+    ASSERT_TRUE(reopened.load("d", node));
+    EXPECT_EQ(node.parent, "c");
+    ASSERT_TRUE(storage.load_node(long_id, node));
+    EXPECT_EQ(node.trace_id, long_id);
+}
+
+TEST(StoreGc, RestrictedRootsDropOtherIndexEntries) {
+    TempProject project;
+    FileStorage storage(project.root);
+    write_gc_project(storage);
+
+    GcOptions options;
+    options.restrict_roots = true;
+    options.live_trace_ids = {"b", "missing"};
+    options.grace_seconds = 0;
+    GcReport report = collect_garbage(project.root, storage.node_store(), options);
+    EXPECT_EQ(report.roots, 2u);
+    EXPECT_EQ(report.reachable, 2u);
+    EXPECT_EQ(report.in_grace, 0u);
+    EXPECT_EQ(report.removed, 3u);
+    EXPECT_EQ(report.index_entries_removed, 1u);
+
+    NodeStore reopened(project.root);
+    EXPECT_EQ(packed_ids(reopened), (Ids{"a", "b"}));
+    EXPECT_EQ(load_index(project.root), (nlohmann::json{{"sha256:b", "b"}}));
+}
+
+TEST(NodeStore, DescendantsDepthFirstInAppendOrder) {
+    TempProject project;
+    NodeStore store(project.root);
+    // Children of b appended in two batches around a grandchild, and a
+    // parent cycle x <-> y below d
+    store.append({sample_node("a", "null"), sample_node("b", "a"), sample_node("c", "b")});
+    store.append({sample_node("e", "c"), sample_node("d", "b"), sample_node("x", "y"), sample_node("y", "d")});
+    store.refresh();
+    using Flat = std::vector<std::pair<std::string, size_t>>;
+    EXPECT_EQ(flatten(store.descendants("a")),
+              (Flat{{"b", 1}, {"c", 2}, {"e", 3}, {"d", 2}, {"y", 3}, {"x", 4}}));
+    EXPECT_EQ(flatten(store.descendants("c")), (Flat{{"e", 1}}));
+    EXPECT_TRUE(store.descendants("e").empty());
+    EXPECT_TRUE(store.descendants("missing").empty());
+
+    // Appends after the child lists were built extend them, adopting
+    // children that arrived before their parent
+    store.append({sample_node("h", "g"), sample_node("g", "e")});
+    EXPECT_EQ(flatten(store.descendants("c")), (Flat{{"e", 1}, {"g", 2}, {"h", 3}}));
+    NodeStore other(project.root);
+    other.refresh();
+    EXPECT_EQ(flatten(other.descendants("c")), (Flat{{"e", 1}, {"g", 2}, {"h", 3}}));
+
+    // Per-file nodes join in through the lineage resolver
+    const fs::path nodes_dir = project.root / ".traceseq" / "nodes";
+    fs::create_directories(nodes_dir);
+    write_file(nodes_dir / "f.yaml", trace_node_to_yaml(sample_node("f", "e")));
+    EXPECT_EQ(flatten(resolve_descendant_ids("e", project.root)), (Flat{{"g", 1}, {"h", 2}, {"f", 1}}));
+}
+
+namespace {
+
+TraceNode query_node(const std::string& trace_id, const std::string& op_class, const std::string& method,
+                     const std::vector<std::string>& assumptions, const std::string& timestamp) {
+    TraceNode node = sample_node(trace_id, "null");
+    node.operation.op_class = op_class;
+    node.operation.method = method;
+    node.assumptions = assumptions;
+    node.timestamp = timestamp;
+    return node;
+}
+
+// A project with four packed nodes and one per-file node
+void write_query_project(const fs::path& root) {
+    FileStorage storage(root);
+    storage.write_nodes({
+        query_node("n1", "normalization", "TPM", {"reference_version:hg38"}, "2026-05-30T10:00:00Z"),
+        query_node("n2", "normalization", "RPKM", {"reference_version:hg19"}, "2026-06-01T10:00:00Z"),
+        query_node("n3", "filtering", "min count", {"reference_version:hg38", "library_size:normalized"},
+                   "2026-06-15T10:00:00Z"),
+        query_node("n4", "alignment", "STAR", {}, "2026-07-01T10:00:00Z"),
+    });
+    fs::create_directories(root / ".traceseq" / "nodes");
+    write_file(root / ".traceseq" / "nodes" / "f1.yaml",
+               trace_node_to_yaml(query_node("f1", "normalization", "TPM", {"reference_version:hg38"},
+                                             "2026-06-20T10:00:00Z")));
+}
+
+} // namespace
+
+TEST(QueryIndex, Operators) {
+    TempProject project;
+    write_query_project(project.root);
+    FileStorage storage(project.root);
+    QueryIndex index(project.root, storage.node_store());
+
+    EXPECT_EQ(index.query("class=normalization"), (Ids{"n1", "n2", "f1"}));
+    EXPECT_EQ(index.query("operation.class=filtering"), (Ids{"n3"}));
+    EXPECT_EQ(index.query("class=normalization AND assumption=reference_version:hg38"), (Ids{"n1", "f1"}));
+    EXPECT_EQ(index.query("class=alignment OR method=RPKM"), (Ids{"n2", "n4"}));
+    // AND binds tighter than OR, unless grouped
+    EXPECT_EQ(index.query("class=alignment OR class=normalization AND method=TPM"), (Ids{"n1", "n4", "f1"}));
+    EXPECT_EQ(index.query("(class=alignment OR class=normalization) and method=TPM"), (Ids{"n1", "f1"}));
+    EXPECT_EQ(index.query("assumption=reference_version:*"), (Ids{"n1", "n2", "n3", "f1"}));
+    EXPECT_EQ(index.query("method=\"min count\""), (Ids{"n3"}));
+    EXPECT_EQ(index.query("since=2026-06"), (Ids{"n2", "n3", "n4", "f1"}));
+    EXPECT_EQ(index.query("since=2026-06 AND until=2026-06-16"), (Ids{"n2", "n3"}));
+    EXPECT_EQ(index.query("class=normalization AND until=2026-06"), (Ids{"n1"}));
+    EXPECT_EQ(index.query("class=none"), Ids{});
+    EXPECT_EQ(index.size(), 4u);
+    EXPECT_EQ(index.file_nodes(), 1u);
+
+    for (const std::string bad : {"", "class", "class=a AND", "(class=a", "colour=red", "since=", "class=a class=b",
+                                  "method=\"open"}) {
+        EXPECT_THROW(index.query(bad), std::invalid_argument) << bad;
+    }
+}
+
+TEST(QueryIndex, CatchesUpWithNewAndMigratedNodes) {
+    TempProject project;
+    write_query_project(project.root);
+    {
+        FileStorage storage(project.root);
+        QueryIndex index(project.root, storage.node_store());
+        EXPECT_EQ(index.query("method=TPM"), (Ids{"n1", "f1"}));
+    }
+
+    // Appended and per-file nodes after the index was saved, then a packed
+    // copy of a per-file node, which is reported once
+    FileStorage storage(project.root);
+    storage.write_nodes({query_node("n5", "normalization", "TPM", {}, "2026-08-01T10:00:00Z")});
+    write_file(project.root / ".traceseq" / "nodes" / "f2.yaml",
+               trace_node_to_yaml(query_node("f2", "qc", "TPM", {}, "2026-08-02T10:00:00Z")));
+    QueryIndex index(project.root, storage.node_store());
+    EXPECT_EQ(index.query("method=TPM"), (Ids{"n1", "n5", "f1", "f2"}));
+    EXPECT_EQ(migrate_node_files(project.root), 2u);
+    EXPECT_EQ(index.query("method=TPM"), (Ids{"n1", "n5", "f1", "f2"}));
+    EXPECT_EQ(index.file_nodes(), 0u);
+}
+
+namespace {
+
+// A lineage a <- b <- {c, d}, one node too long to pack, and an index
+void write_storage_project(TraceStorage& storage) {
+    storage.write_nodes({sample_node("a", "null"), sample_node("b", "a"), sample_node("c", "b")});
+    storage.write_nodes({sample_node("d", "b"), sample_node(std::string(kMaxPackedIdLength + 1, 'x'), "c")});
+    storage.append_index({{"sha256:a", "a"}, {"sha256:c", "c"}});
+    storage.append_index({{"sha256:c", "d"}});
+}
+
+// Compares everything a backend exposes with what `write_storage_project` stored
+void expect_storage_project(TraceStorage& storage) {
+    const std::string long_id(kMaxPackedIdLength + 1, 'x');
+    Ids ids = storage.trace_ids();
+    std::sort(ids.begin(), ids.end());
+    EXPECT_EQ(ids, (Ids{"a", "b", "c", "d", long_id}));
+    for (const auto& id : ids) {
+        TraceNode node;
+        ASSERT_TRUE(storage.load_node(id, node)) << id;
+        SCOPED_TRACE(id);
+        expect_same_node(node, sample_node(id, id == "a" ? "null" : id == "b" ? "a" : id == long_id ? "c" : "b"));
+    }
+    TraceNode missing;
+    EXPECT_FALSE(storage.load_node("nope", missing));
+
+    std::string parent;
+    ASSERT_TRUE(storage.find_parent(long_id, parent));
+    EXPECT_EQ(parent, "c");
+    EXPECT_FALSE(storage.find_parent("nope", parent));
+
+    std::vector<std::pair<std::string, size_t>> descendants;
+    for (const auto& descendant : storage.descendants("a")) {
+        descendants.emplace_back(descendant.trace_id, descendant.depth);
+    }
+    std::sort(descendants.begin(), descendants.end());
+    EXPECT_EQ(descendants, (std::vector<std::pair<std::string, size_t>>{{"b", 1}, {"c", 2}, {"d", 2}, {long_id, 3}}));
+
+    EXPECT_EQ(storage.index(), (nlohmann::json{{"sha256:a", "a"}, {"sha256:c", "d"}}));
+    EXPECT_EQ(storage.find_trace_id("sha256:c"), "d");
+    EXPECT_EQ(storage.find_trace_id("sha256:zz"), "");
+}
+
+} // namespace
+
+TEST(Storage, FileAndSqliteBackendsAgree) {
+    TempProject files_project;
+    FileStorage files(files_project.root);
+    write_storage_project(files);
+    expect_storage_project(files);
+
+    TempProject sqlite_project;
+    SqliteStorage sqlite(sqlite_project.root);
+    write_storage_project(sqlite);
+    expect_storage_project(sqlite);
+    EXPECT_EQ(storage_backend(sqlite_project.root), StorageBackend::Sqlite);
+
+    for (TraceStorage* storage : std::initializer_list<TraceStorage*>{&files, &sqlite}) {
+        storage->save_index(nlohmann::json{{"sha256:b", "b"}});
+        EXPECT_EQ(storage->index(), (nlohmann::json{{"sha256:b", "b"}}));
+    }
+}
+
+TEST(Storage, ConvertRoundTrip) {
+    TempProject project;
+    {
+        FileStorage files(project.root);
+        write_storage_project(files);
+    }
+    EXPECT_EQ(convert_storage(project.root, StorageBackend::Sqlite), 5u);
+    EXPECT_EQ(convert_storage(project.root, StorageBackend::Sqlite), 0u);
+    std::unique_ptr<TraceStorage> storage = open_storage(project.root);
+    ASSERT_EQ(storage->backend(), StorageBackend::Sqlite);
+    expect_storage_project(*storage);
+
+    // Nodes written after the switch come back along with the others
+    storage->write_nodes({sample_node("e", "d")});
+    storage.reset();
+    EXPECT_EQ(convert_storage(project.root, StorageBackend::Files), 6u);
+    storage = open_storage(project.root);
+    ASSERT_EQ(storage->backend(), StorageBackend::Files);
+    TraceNode node;
+    ASSERT_TRUE(storage->load_node("e", node));
+    expect_same_node(node, sample_node("e", "d"));
+    EXPECT_EQ(storage->descendants("d").size(), 1u);
+}
+
+namespace {
+
+// The single-pass scanner may give up on a document, but whatever it
+// accepts must parse exactly as it does through yaml-cpp
+bool parse_both(const std::string& doc) {
+    TraceNode fast;
+    if (!parse_node_yaml_fast(doc, fast)) {
+        return false;
+    }
+    TraceNode slow;
+    try {
+        slow = yaml_to_tracenode(YAML::Load(doc));
+    } catch (const std::exception& e) {
+        ADD_FAILURE() << "accepted a document yaml-cpp rejects (" << e.what() << "):\n" << doc;
+        return true;
+    }
+    SCOPED_TRACE(doc);
+    expect_same_node(fast, slow);
+    return true;
+}
+
+
+// Header and trailer around an `assumptions` block
+const std::string kDocHead =
+    "trace_id: a\nparent: \"null\"\ntimestamp: t\ndata_class: d\noperation:\n  class: c\n  method: m\n";
+const std::string kDocTail =
+    "input:\n  shape: s\n  checksum: c\noutput:\n  data_class: d\n  unit: u\n  checksum: o\n"
+    "environment:\n  language: l\n  tool: t\n  version: v\nontology_version: x\n";
+
+
+} // namespace
+
+TEST(NodeYaml, FastParserMatchesYamlCppOnEmitterOutput) {
+    std::vector<TraceNode> nodes;
+    nodes.push_back(sample_node());
+    // Values the emitter has to quote or escape
+    const std::vector<std::string> awkward = {
+        "null", "true", "~", "1.5", "0x1F", "a: b", "x #y", "#lead", "- item", "'single'", "\"double\"",
+        "back\\slash", " padded ", "tab\there", "trailing\t", "line\nbreak", "cr\rhere", "[flow]", "{map}",
+        "é 日本", "*alias", "&anchor", "!tag", "|", ">", "%", "@", "`", "",
+    };
+    for (const auto& value : awkward) {
+        TraceNode node = sample_node();
+        node.trace_id = "id-" + value;
+        node.operation.method = value;
+        node.input.shape = value;
+        node.output.unit = value;
+        node.operation.parameters[value.empty() ? "empty" : value] = value;
+        node.assumptions = {value, "x:" + value};
+        nodes.push_back(node);
+    }
+    TraceNode bare = sample_node();
+    bare.operation.parameters.clear();
+    bare.assumptions.clear();
+    nodes.push_back(bare);
+
+    for (const auto& node : nodes) {
+        const std::string doc = trace_node_to_yaml(node);
+        SCOPED_TRACE(doc);
+        TraceNode parsed;
+        ASSERT_TRUE(parse_node_yaml_fast(doc, parsed));
+        expect_same_node(parsed, node);
+        parse_both(doc);
+    }
+}
+
+TEST(NodeYaml, EmptyAssumptions) {
+    // As the emitter writes them, and flow sequences in other positions
+    for (const std::string block : {"assumptions: []\n", "assumptions:\n  []\n", "assumptions:\n    []\n"}) {
+        SCOPED_TRACE(block);
+        TraceNode node;
+        ASSERT_TRUE(parse_node_yaml_fast(kDocHead + block + kDocTail, node));
+        EXPECT_TRUE(node.assumptions.empty());
+        parse_both(kDocHead + block + kDocTail);
+    }
+    TraceNode emitted = sample_node();
+    emitted.assumptions.clear();
+    TraceNode parsed;
+    ASSERT_TRUE(parse_node_yaml_fast(trace_node_to_yaml(emitted), parsed));
+    EXPECT_TRUE(parsed.assumptions.empty());
+
+    // Combinations a flow sequence cannot appear in; never parsed differently
+    for (const std::string block : {"assumptions:\n[]\n", "assumptions:\n  []\n  - x\n", "assumptions:\n  []\n- x\n",
+                                    "assumptions:\n  []\n  []\n", "assumptions:\n  - x\n  []\n", "assumptions:\n  [ ]\n",
+                                    "assumptions:\n  []\n\n", "assumptions:\n\n  []\n", "assumptions:\n  []\n  foo: bar\n"}) {
+        SCOPED_TRACE(block);
+        parse_both(kDocHead + block + kDocTail);
+        parse_both(block + kDocHead + kDocTail);
+    }
+}
+
+TEST(NodeYaml, QuotedScalarsAndEscapes) {
+    const std::string doc = kDocHead +
+        "assumptions:\n"
+        "  - 'it''s: quoted'\n"
+        "  - \"tab\\there \\\"q\\\" back\\\\slash\"\n"
+        "  - \"\\x41\\u00e9\\U0001F600\\/\"\n"
+        "  - \"line\\nbreak\"\n"
+        "  - '#not a comment'\n"
+        "  - \"\"\n" +
+        kDocTail;
+    TraceNode node;
+    ASSERT_TRUE(parse_node_yaml_fast(doc, node));
+    ASSERT_EQ(node.assumptions.size(), 6u);
+    EXPECT_EQ(node.assumptions[0], "it's: quoted");
+    EXPECT_EQ(node.assumptions[1], "tab\there \"q\" back\\slash");
+    EXPECT_EQ(node.assumptions[2], "A\xC3\xA9\xF0\x9F\x98\x80/");
+    EXPECT_EQ(node.assumptions[3], "line\nbreak");
+    EXPECT_EQ(node.assumptions[4], "#not a comment");
+    EXPECT_EQ(node.assumptions[5], "");
+    parse_both(doc);
+
+    // Escapes the scanner leaves to yaml-cpp, and malformed ones
+    for (const std::string value : {"\"\\0\"", "\"\\e\"", "\"\\N\"", "\"\\ud800\"", "\"\\q\"", "\"\\x4\"", "\"\\u12\"",
+                                    "'unterminated", "\"unterminated", "'a' trailing", "plain # comment"}) {
+        SCOPED_TRACE(value);
+        parse_both(kDocHead + "assumptions:\n  - " + value + "\n" + kDocTail);
+    }
+}
+
+TEST(NodeYaml, CrlfLineEndings) {
+    std::string doc;
+    for (char c : kDocHead + "assumptions:\n  - one\n  - 'two'\n" + kDocTail) {
+        if (c == '\n') {
+            doc += '\r';
+        }
+        doc += c;
+    }
+    TraceNode node;
+    EXPECT_TRUE(parse_both(doc));
+    ASSERT_TRUE(parse_node_yaml_fast(doc, node));
+    EXPECT_EQ(node.trace_id, "a");
+    EXPECT_EQ(node.assumptions, (std::vector<std::string>{"one", "two"}));
+    EXPECT_EQ(node.ontology_version, "x");
+
+    // A stray carriage return on a single line
+    parse_both(kDocHead + "assumptions:\n  - one\r\n" + kDocTail);
+    parse_both("trace_id: a\r" + kDocHead.substr(kDocHead.find('\n')) + kDocTail);
+}
+
+TEST(NodeYaml, Tabs) {
+    // Trailing tabs after a plain scalar are not part of the value
+    TraceNode node;
+    const std::string trailing = kDocHead + "assumptions:\n  - one\t\n" + kDocTail;
+    ASSERT_TRUE(parse_node_yaml_fast(trailing, node));
+    EXPECT_EQ(node.assumptions, std::vector<std::string>{"one"});
+    parse_both(trailing);
+
+    parse_both(kDocHead + "assumptions:\n  - a\tb\n" + kDocTail);
+    parse_both(kDocHead + "assumptions:\n  - '\t'\n" + kDocTail);
+    parse_both(kDocHead + "assumptions:\n\t- one\n" + kDocTail);
+    parse_both("trace_id:\ta\n" + kDocHead.substr(kDocHead.find('\n') + 1) + kDocTail);
+}
+
+TEST(NodeYaml, GivesUpOnUnsupportedSyntax) {
+    TraceNode node;
+    EXPECT_FALSE(parse_node_yaml_fast("# comment\n" + kDocHead + kDocTail, node));
+    EXPECT_FALSE(parse_node_yaml_fast(kDocHead + "assumptions:\n  - &a one\n" + kDocTail, node));
+    EXPECT_FALSE(parse_node_yaml_fast(kDocHead + "assumptions:\n  - |\n    block\n" + kDocTail, node));
+    EXPECT_FALSE(parse_node_yaml_fast(kDocHead + kDocHead + kDocTail, node)); // Repeated keys
+    EXPECT_FALSE(parse_node_yaml_fast(kDocHead, node));                       // Missing fields
+    EXPECT_FALSE(parse_node_yaml_fast(kDocHead + "extra: 1\n" + kDocTail, node));
+}
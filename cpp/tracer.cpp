@@ -2,12 +2,19 @@
 #include <iostream>
 #include <fstream>
 #include <chrono> // For std::chrono
-#include <ctime>    // For std::time_t, std::tm, std::gmtime
+#include <ctime>    // For std::time_t, std::tm, gmtime_r
 #include <iomanip>  // For std::put_time
 #include <filesystem> // For std::filesystem::create_directories
 #include "nlohmann/json.hpp"
 #include <uuid/uuid.h> // For UUID generation
 #include "lineage.hpp"
+#include "index_log.hpp"
+#include "hashing.hpp"
+#include "storage.hpp"
+#include "profiler.hpp"
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -15,9 +22,10 @@ namespace fs = std::filesystem;
 std::string get_current_timestamp() {
     auto now = std::chrono::system_clock::now();
     std::time_t current_time = std::chrono::system_clock::to_time_t(now);
-    std::tm* gmt = std::gmtime(&current_time);
+    std::tm gmt;
+    gmtime_r(&current_time, &gmt); // Reentrant; nodes are created on worker threads
     std::stringstream ss;
-    ss << std::put_time(gmt, "%Y-%m-%dT%H:%M:%SZ");
+    ss << std::put_time(&gmt, "%Y-%m-%dT%H:%M:%SZ");
     return ss.str();
 }
 
@@ -50,26 +58,34 @@ TraceNode::TraceNode() :
     environment.version = "0.1.0";
 }
 
+// Decoders copy this instead of paying for the constructor's UUID and timestamp
+const TraceNode& blank_trace_node() {
+    static const TraceNode blank = [] {
+        TraceNode node;
+        node.trace_id.clear();
+        node.parent.clear();
+        node.timestamp.clear();
+        node.ontology_version.clear();
+        node.environment = TraceNode::Environment();
+        return node;
+    }();
+    return blank;
+}
 
-void TraceNode::save(const std::string& input_file_checksum, const std::string& output_file_checksum, const std::string& output_file_data_class, const fs::path& project_root) {
-    // Ensure .traceseq/nodes directory exists
-    fs::path nodes_dir = project_root / ".traceseq" / "nodes";
-    fs::create_directories(nodes_dir);
-
-    // Save TraceNode to YAML file
+std::string trace_node_to_yaml(const TraceNode& node) {
     YAML::Emitter out;
     out << YAML::BeginMap;
-    out << YAML::Key << "trace_id" << YAML::Value << trace_id;
-    out << YAML::Key << "parent" << YAML::Value << parent;
-    out << YAML::Key << "timestamp" << YAML::Value << timestamp;
-    out << YAML::Key << "data_class" << YAML::Value << data_class;
+    out << YAML::Key << "trace_id" << YAML::Value << node.trace_id;
+    out << YAML::Key << "parent" << YAML::Value << node.parent;
+    out << YAML::Key << "timestamp" << YAML::Value << node.timestamp;
+    out << YAML::Key << "data_class" << YAML::Value << node.data_class;
 
     out << YAML::Key << "operation" << YAML::Value << YAML::BeginMap;
-    out << YAML::Key << "class" << YAML::Value << operation.op_class;
-    out << YAML::Key << "method" << YAML::Value << operation.method;
-    if (!operation.parameters.empty()) {
+    out << YAML::Key << "class" << YAML::Value << node.operation.op_class;
+    out << YAML::Key << "method" << YAML::Value << node.operation.method;
+    if (!node.operation.parameters.empty()) {
         out << YAML::Key << "parameters" << YAML::Value << YAML::BeginMap;
-        for (const auto& pair : operation.parameters) {
+        for (const auto& pair : node.operation.parameters) {
             out << YAML::Key << pair.first << YAML::Value << pair.second;
         }
         out << YAML::EndMap;
@@ -77,94 +93,249 @@ void TraceNode::save(const std::string& input_file_checksum, const std::string&
     out << YAML::EndMap; // End operation
 
     out << YAML::Key << "assumptions" << YAML::Value << YAML::BeginSeq;
-    for (const auto& assump : assumptions) {
+    for (const auto& assump : node.assumptions) {
         out << assump;
     }
     out << YAML::EndSeq; // End assumptions
 
     out << YAML::Key << "input" << YAML::Value << YAML::BeginMap;
-    out << YAML::Key << "shape" << YAML::Value << input.shape;
-    out << YAML::Key << "checksum" << YAML::Value << input.checksum;
+    out << YAML::Key << "shape" << YAML::Value << node.input.shape;
+    out << YAML::Key << "checksum" << YAML::Value << node.input.checksum;
     out << YAML::EndMap; // End input
 
     out << YAML::Key << "output" << YAML::Value << YAML::BeginMap;
-    out << YAML::Key << "data_class" << YAML::Value << output_file_data_class; // Use passed data_class
-    out << YAML::Key << "unit" << YAML::Value << output.unit;
-    out << YAML::Key << "checksum" << YAML::Value << output_file_checksum; // Use passed checksum
+    out << YAML::Key << "data_class" << YAML::Value << node.output.data_class;
+    out << YAML::Key << "unit" << YAML::Value << node.output.unit;
+    out << YAML::Key << "checksum" << YAML::Value << node.output.checksum;
     out << YAML::EndMap; // End output
 
     out << YAML::Key << "environment" << YAML::Value << YAML::BeginMap;
-    out << YAML::Key << "language" << YAML::Value << environment.language;
-    out << YAML::Key << "tool" << YAML::Value << environment.tool;
-    out << YAML::Key << "version" << YAML::Value << environment.version;
+    out << YAML::Key << "language" << YAML::Value << node.environment.language;
+    out << YAML::Key << "tool" << YAML::Value << node.environment.tool;
+    out << YAML::Key << "version" << YAML::Value << node.environment.version;
     out << YAML::EndMap; // End environment
 
-    out << YAML::Key << "ontology_version" << YAML::Value << ontology_version;
+    out << YAML::Key << "ontology_version" << YAML::Value << node.ontology_version;
     out << YAML::EndMap; // End TraceNode
 
-    std::ofstream file(nodes_dir / (trace_id + ".yaml"));
-    file << out.c_str();
-    file.close();
+    return out.c_str();
+}
 
-    // Update index.json
-    nlohmann::json index_json = load_index(project_root);
-    
-    // Create an entry for the input_file_checksum pointing to the trace__id
-    index_json[input_file_checksum] = trace_id;
+void write_trace_nodes(const std::vector<TraceNode>& nodes, const fs::path& project_root) {
+    ProfileSpan span("write_trace_nodes");
+    span.set_value("nodes", static_cast<int64_t>(nodes.size()));
+    open_storage(project_root)->write_nodes(nodes);
+    Profiler::count("nodes_written", static_cast<int64_t>(nodes.size()));
+}
+
+void write_trace_node(const TraceNode& node, const fs::path& project_root) {
+    write_trace_nodes({node}, project_root);
+}
+
+void TraceNode::save(const std::string& input_file_checksum, const std::string& output_file_checksum, const std::string& output_file_data_class, const fs::path& project_root) {
+    save(input_file_checksum, output_file_checksum, output_file_data_class, *open_storage(project_root));
+}
+
+void TraceNode::save(const std::string& input_file_checksum, const std::string& output_file_checksum, const std::string& output_file_data_class, TraceStorage& storage) {
+    ProfileSpan span("TraceNode::save");
+    span.set_detail(trace_id);
+    // Save TraceNode with the passed output data_class and checksum
+    TraceNode stored = *this;
+    stored.output.data_class = output_file_data_class;
+    stored.output.checksum = output_file_checksum;
+    storage.write_nodes({stored});
+    Profiler::count("nodes_written", 1);
 
-    // Create an entry for the output_file_checksum pointing to the trace_id
+    // Update the index (the write-ahead log or the file_index table)
+    // The input and output checksums both point at this trace_id.
     // This assumes a 1:1 relationship between output file and a single trace node
     // In a more complex scenario, an output might be influenced by multiple traces
-    index_json[output_file_checksum] = trace_id;
+    storage.append_index({{input_file_checksum, trace_id}, {output_file_checksum, trace_id}});
+}
+
+Ontology::Ontology(const Ontology& other) {
+    std::shared_lock<std::shared_mutex> lock(other.mutex_);
+    operation_classes_ = other.operation_classes_;
+    valid_assumptions_ = other.valid_assumptions_;
+}
 
-    save_index(index_json, project_root);
+Ontology& Ontology::operator=(const Ontology& other) {
+    if (this != &other) {
+        std::unique_lock<std::shared_mutex> lock(mutex_, std::defer_lock);
+        std::shared_lock<std::shared_mutex> other_lock(other.mutex_, std::defer_lock);
+        std::lock(lock, other_lock);
+        operation_classes_ = other.operation_classes_;
+        valid_assumptions_ = other.valid_assumptions_;
+    }
+    return *this;
 }
 
 void Ontology::load(const std::string& op_path, const std::string& assump_path) {
-    operations = YAML::LoadFile(op_path);
-    assumptions = YAML::LoadFile(assump_path);
+    ProfileSpan span("Ontology::load");
+    YAML::Node operations = YAML::LoadFile(op_path);
+    YAML::Node assumptions = YAML::LoadFile(assump_path);
+
+    std::unordered_set<std::string> operation_classes;
+    std::unordered_set<std::string> valid_assumptions;
+
+    const YAML::Node& op_classes = operations["operation_classes"];
+    if (op_classes.IsMap()) {
+        for (YAML::const_iterator it = op_classes.begin(); it != op_classes.end(); ++it) {
+            operation_classes.insert(it->first.as<std::string>());
+        }
+    }
+
+    const YAML::Node& assump_classes = assumptions["assumption_classes"];
+    if (assump_classes.IsMap()) {
+        for (YAML::const_iterator it = assump_classes.begin(); it != assump_classes.end(); ++it) {
+            std::string assump_class = it->first.as<std::string>();
+            if (assump_class.find(':') != std::string::npos) {
+                continue; // Could never be named, since validation splits at the first colon
+            }
+            valid_assumptions.insert(assump_class);
+            // A value is only valid if it is listed in allowed_values
+            const YAML::Node& allowed_values_node = it->second["allowed_values"];
+            if (allowed_values_node.IsDefined() && allowed_values_node.IsSequence()) {
+                for (const auto& value_item : allowed_values_node) {
+                    valid_assumptions.insert(assump_class + ":" + value_item.as<std::string>());
+                }
+            }
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    operation_classes_ = std::move(operation_classes);
+    valid_assumptions_ = std::move(valid_assumptions);
 }
 
-bool Ontology::validate_operation(const std::string& op_class) const {
-    return operations["operation_classes"][op_class].IsDefined();
+// Snapshot layout: magic, SHA256 of both YAML files, then the operation
+// classes and valid assumptions as counted, length-prefixed strings.
+static const char kOntologySnapshotMagic[8] = {'T', 'S', 'O', 'N', 'T', 'v', '1', '\0'};
+
+static void write_u32(std::ostream& out, uint32_t value) {
+    unsigned char bytes[4] = {
+        static_cast<unsigned char>(value), static_cast<unsigned char>(value >> 8),
+        static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 24)};
+    out.write(reinterpret_cast<const char*>(bytes), 4);
 }
 
-bool Ontology::validate_assumption(const std::string& assump_full_str) const {
-    std::string assump_class = assump_full_str;
-    std::string assump_value = "";
-    size_t colon_pos = assump_full_str.find(":");
-    if (colon_pos != std::string::npos) {
-        assump_class = assump_full_str.substr(0, colon_pos);
-        assump_value = assump_full_str.substr(colon_pos + 1);
+static bool read_u32(std::istream& in, uint32_t& value) {
+    unsigned char bytes[4];
+    if (!in.read(reinterpret_cast<char*>(bytes), 4)) {
+        return false;
     }
+    value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    return true;
+}
 
-    if (!assumptions["assumption_classes"][assump_class].IsDefined()) {
-        return false;
+static void write_string_set(std::ostream& out, const std::unordered_set<std::string>& strings) {
+    write_u32(out, static_cast<uint32_t>(strings.size()));
+    for (const auto& str : strings) {
+        write_u32(out, static_cast<uint32_t>(str.size()));
+        out.write(str.data(), static_cast<std::streamsize>(str.size()));
     }
+}
 
-    // If a value is provided, check against allowed_values
-    if (!assump_value.empty()) {
-        const YAML::Node& allowed_values_node = assumptions["assumption_classes"][assump_class]["allowed_values"];
-        if (allowed_values_node.IsDefined() && allowed_values_node.IsSequence()) {
-            bool value_found = false;
-            for (const auto& value_item : allowed_values_node) {
-                if (value_item.as<std::string>() == assump_value) {
-                    value_found = true;
-                    break;
-                }
-            }
-            if (!value_found) {
-                return false;
-            }
-        } else {
-            // No allowed_values defined, but a value was provided - this might be an error or just not explicitly allowed
-            // For now, if no allowed_values, any value is considered invalid.
+static bool read_string_set(std::istream& in, std::unordered_set<std::string>& strings) {
+    uint32_t count = 0;
+    if (!read_u32(in, count)) {
+        return false;
+    }
+    strings.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t length = 0;
+        if (!read_u32(in, length) || length > (1u << 20)) {
+            return false;
+        }
+        std::string str(length, '\0');
+        if (!in.read(&str[0], length)) {
             return false;
         }
+        strings.insert(std::move(str));
+    }
+    return true;
+}
+
+bool Ontology::read_snapshot(const std::string& cache_path, const std::string& digest) {
+    std::ifstream in(cache_path, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    char magic[sizeof(kOntologySnapshotMagic)];
+    std::string stored_digest(digest.size(), '\0');
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kOntologySnapshotMagic, sizeof(magic)) != 0 ||
+        !in.read(&stored_digest[0], static_cast<std::streamsize>(stored_digest.size())) || stored_digest != digest) {
+        return false;
     }
+    std::unordered_set<std::string> operation_classes;
+    std::unordered_set<std::string> valid_assumptions;
+    if (!read_string_set(in, operation_classes) || !read_string_set(in, valid_assumptions)) {
+        return false;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    operation_classes_ = std::move(operation_classes);
+    valid_assumptions_ = std::move(valid_assumptions);
     return true;
 }
 
+void Ontology::write_snapshot(const std::string& cache_path, const std::string& digest) const {
+    std::error_code ec;
+    fs::create_directories(fs::path(cache_path).parent_path(), ec);
+    std::string tmp_path = cache_path + ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            return;
+        }
+        out.write(kOntologySnapshotMagic, sizeof(kOntologySnapshotMagic));
+        out.write(digest.data(), static_cast<std::streamsize>(digest.size()));
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        write_string_set(out, operation_classes_);
+        write_string_set(out, valid_assumptions_);
+        if (!out) {
+            out.close();
+            fs::remove(tmp_path, ec);
+            return;
+        }
+    }
+    fs::rename(tmp_path, cache_path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+    }
+}
+
+void Ontology::load_cached(const std::string& op_path, const std::string& assump_path, const std::string& cache_path) {
+    ProfileSpan span("Ontology::load_cached");
+    // The ontology files are small, so hashing them is far cheaper than parsing
+    std::string digest = sha256_file(op_path) + sha256_file(assump_path);
+    if (read_snapshot(cache_path, digest)) {
+        return;
+    }
+    load(op_path, assump_path);
+    write_snapshot(cache_path, digest);
+}
+
+void Ontology::load_project(const fs::path& project_root) {
+    load_cached((project_root / "core" / "operation_ontology.yaml").string(),
+                (project_root / "core" / "assumption_ontology.yaml").string(),
+                (project_root / ".traceseq" / "ontology.cache").string());
+}
+
+bool Ontology::validate_operation(const std::string& op_class) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return operation_classes_.count(op_class) > 0;
+}
+
+bool Ontology::validate_assumption(const std::string& assump_full_str) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    // "class:" carries no value, so only the class has to exist
+    size_t colon_pos = assump_full_str.find(':');
+    if (colon_pos != std::string::npos && colon_pos + 1 == assump_full_str.size()) {
+        return valid_assumptions_.count(assump_full_str.substr(0, colon_pos)) > 0;
+    }
+    return valid_assumptions_.count(assump_full_str) > 0;
+}
+
 TraceNode create_trace_node(
     const std::string& parent_id,
     const std::string& input_data_class, // Renamed for clarity: this is the data_class of the input
@@ -187,18 +358,16 @@ TraceNode create_trace_node(
 }
 
 // Simplified validation for now
-bool validate_node(const TraceNode& node, const Ontology& ontology) {
+std::string node_validation_error(const TraceNode& node, const Ontology& ontology) {
     // Check if operation class is valid
     if (!ontology.validate_operation(node.operation.op_class)) {
-        std::cerr << "Validation Error: Invalid operation class: " << node.operation.op_class << std::endl;
-        return false;
+        return "Invalid operation class: " + node.operation.op_class;
     }
 
     // Check if all assumption classes are valid
     for (const auto& assump_full_str : node.assumptions) {
         if (!ontology.validate_assumption(assump_full_str)) {
-            std::cerr << "Validation Error: Invalid assumption: " << assump_full_str << std::endl;
-            return false;
+            return "Invalid assumption: " + assump_full_str;
         }
     }
     
@@ -208,9 +377,17 @@ bool validate_node(const TraceNode& node, const Ontology& ontology) {
         node.input.checksum.empty() || node.output.checksum.empty() ||
         node.environment.language.empty() || node.environment.tool.empty() || node.environment.version.empty() ||
         node.ontology_version.empty()) {
-        std::cerr << "Validation Error: Missing required field in TraceNode." << std::endl;
-        return false;
+        return "Missing required field in TraceNode.";
     }
 
+    return "";
+}
+
+bool validate_node(const TraceNode& node, const Ontology& ontology) {
+    std::string error = node_validation_error(node, ontology);
+    if (!error.empty()) {
+        std::cerr << "Validation Error: " << error << std::endl;
+        return false;
+    }
     return true;
 }
@@ -5,8 +5,12 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <shared_mutex>
+#include <unordered_set>
 #include "yaml-cpp/yaml.h"
 
+class TraceStorage;
+
 /**
  * @brief Generates a universally unique identifier (UUID).
  *
@@ -78,11 +82,11 @@ public:
     TraceNode();
 
     /**
-     * @brief Saves the TraceNode to a YAML file and updates the global index.
+     * @brief Saves the TraceNode to the node store and updates the global index.
      *
-     * This method serializes the TraceNode object into a YAML file within the
-     * '.traceseq/nodes' directory and updates the 'index.json' to link the
-     * input and output file checksums to this trace node.
+     * This method writes the TraceNode to the project's storage backend
+     * (see `open_storage`) and adds index entries linking the input and
+     * output file checksums to this trace node.
      *
      * @param input_file_checksum The SHA256 checksum of the input file associated with this node.
      * @param output_file_checksum The SHA256 checksum of the output file generated by this node.
@@ -90,18 +94,82 @@ public:
      * @param project_root The root directory of the project.
      */
     void save(const std::string& input_file_checksum, const std::string& output_file_checksum, const std::string& output_file_data_class, const std::filesystem::path& project_root);
+
+    /**
+     * @brief Saves the TraceNode through an already opened storage.
+     *
+     * Long-lived callers (the daemon, streaming annotation) keep one
+     * `TraceStorage`, so a save appends to the node store and the index
+     * without reading either again, whatever the size of the project.
+     *
+     * @param input_file_checksum The SHA256 checksum of the input file associated with this node.
+     * @param output_file_checksum The SHA256 checksum of the output file generated by this node.
+     * @param output_file_data_class The data class of the output file.
+     * @param storage The project's storage.
+     */
+    void save(const std::string& input_file_checksum, const std::string& output_file_checksum, const std::string& output_file_data_class, TraceStorage& storage);
 };
 
+/**
+ * @brief Returns a TraceNode with every field empty.
+ *
+ * The constructor draws a UUID and a timestamp; decoders copy this node
+ * instead, so fields absent from the input come out empty and cost nothing.
+ *
+ * @return The shared blank node.
+ */
+const TraceNode& blank_trace_node();
+
+/**
+ * @brief Serializes a TraceNode to the YAML document stored in '.traceseq/nodes'.
+ * @param node The TraceNode to serialize.
+ * @return The YAML text of the node.
+ */
+std::string trace_node_to_yaml(const TraceNode& node);
+
+/**
+ * @brief Writes a TraceNode to the node store without touching the index.
+ *
+ * The node goes to the project's storage backend (see `open_storage`);
+ * concurrent readers never observe a partially written node.
+ *
+ * @param node The TraceNode to store, with its output fields already set.
+ * @param project_root The root directory of the project.
+ * @throws std::runtime_error if the node cannot be written.
+ */
+void write_trace_node(const TraceNode& node, const std::filesystem::path& project_root);
+
+/**
+ * @brief Writes many TraceNodes to the node store as one batch.
+ *
+ * The batch is a single append to the packed store, or one transaction in
+ * a SQLite project (see `TraceStorage::write_nodes`).
+ *
+ * @param nodes The TraceNodes to store.
+ * @param project_root The root directory of the project.
+ * @throws std::runtime_error if the nodes cannot be written.
+ */
+void write_trace_nodes(const std::vector<TraceNode>& nodes, const std::filesystem::path& project_root);
+
 /**
  * @brief Manages operation and assumption ontologies.
  *
  * This class provides functionality to load and validate operations and
- * assumptions against predefined YAML ontology files.
+ * assumptions against predefined YAML ontology files. The YAML is compiled
+ * once into hash sets, so each validation is a single hash probe: operation
+ * classes are stored by name and assumptions as both "class" and
+ * "class:value" for every allowed value. The compiled tables can be cached
+ * in a binary snapshot keyed by the SHA256 of both YAML files, which lets
+ * later loads skip yaml-cpp entirely.
+ *
+ * All methods are thread-safe: a load builds new tables and swaps them in,
+ * so concurrent validations see either the old or the new ontology.
  */
 class Ontology {
 public:
-    YAML::Node operations;  ///< YAML node containing operation definitions.
-    YAML::Node assumptions; ///< YAML node containing assumption definitions.
+    Ontology() = default;
+    Ontology(const Ontology& other);
+    Ontology& operator=(const Ontology& other);
 
     /**
      * @brief Loads operation and assumption ontologies from YAML files.
@@ -110,6 +178,25 @@ public:
      */
     void load(const std::string& op_path, const std::string& assump_path);
 
+    /**
+     * @brief Loads the ontologies, using a compiled snapshot when it is current.
+     *
+     * If `cache_path` holds a snapshot built from YAML files with the same
+     * digests it is read directly; otherwise the YAML is parsed and a new
+     * snapshot is written (failures to write it are ignored).
+     *
+     * @param op_path Path to the operation ontology YAML file.
+     * @param assump_path Path to the assumption ontology YAML file.
+     * @param cache_path Path of the compiled snapshot.
+     */
+    void load_cached(const std::string& op_path, const std::string& assump_path, const std::string& cache_path);
+
+    /**
+     * @brief Loads the project's ontologies from 'core/' with the snapshot in '.traceseq/ontology.cache'.
+     * @param project_root The root directory of the project.
+     */
+    void load_project(const std::filesystem::path& project_root);
+
     /**
      * @brief Validates if an operation class is defined in the ontology.
      * @param op_class The operation class string to validate.
@@ -123,6 +210,14 @@ public:
      * @return true if the assumption is valid, false otherwise.
      */
     bool validate_assumption(const std::string& assump_class_value) const;
+
+private:
+    bool read_snapshot(const std::string& cache_path, const std::string& digest);
+    void write_snapshot(const std::string& cache_path, const std::string& digest) const;
+
+    mutable std::shared_mutex mutex_;                    ///< Guards the tables below.
+    std::unordered_set<std::string> operation_classes_;  ///< Defined operation classes.
+    std::unordered_set<std::string> valid_assumptions_;  ///< Assumption classes and "class:value" pairs.
 };
 
 /**
@@ -158,4 +253,13 @@ TraceNode create_trace_node(
  */
 bool validate_node(const TraceNode& node, const Ontology& ontology);
 
+/**
+ * @brief Checks a TraceNode like `validate_node` without printing.
+ *
+ * @param node The TraceNode object to validate.
+ * @param ontology The Ontology object containing definitions for operations and assumptions.
+ * @return The first validation error, or an empty string if the node is valid.
+ */
+std::string node_validation_error(const TraceNode& node, const Ontology& ontology);
+
 #endif // TRACER_HPP
@@ -0,0 +1,169 @@
+#include "validation.hpp"
+#include "lineage.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+ValidatedNodeCache::ValidatedNodeCache(const Ontology& ontology, TraceStorage& storage, const fs::path& project_root)
+    : ontology_(ontology), storage_(storage), project_root_(project_root) {}
+
+bool ValidatedNodeCache::lookup(const std::string& trace_id, Entry& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(trace_id);
+    if (it == entries_.end()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+size_t ValidatedNodeCache::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void ValidatedNodeCache::validate_lineage(const std::string& trace_id, FileValidation& result) {
+    // 1. Walk up until the root or the first ancestor that is already checked
+    std::vector<std::pair<std::string, Entry>> pending;
+    Entry top;          // The checked ancestor above `pending`, if any
+    bool have_top = false;
+    std::string current = trace_id;
+    std::unordered_set<std::string> walked = {trace_id};
+    while (current != "null" && !current.empty()) {
+        if (lookup(current, top)) {
+            have_top = true;
+            break;
+        }
+        Entry entry;
+        try {
+            TraceNode node = load_node(current, project_root_, storage_);
+            entry.parent = node.parent;
+            if (node.trace_id != current) {
+                entry.error = "Stored node has trace ID '" + node.trace_id + "'";
+            } else {
+                entry.error = node_validation_error(node, ontology_);
+            }
+        } catch (const std::exception& e) {
+            entry.error = e.what();
+            entry.parent = "null"; // Nothing above a node that cannot be read
+        }
+        if (!walked.insert(entry.parent).second) {
+            entry.error = "Parent cycle at trace node " + entry.parent;
+            entry.parent = "null";
+        }
+        pending.emplace_back(current, entry);
+        current = entry.parent;
+    }
+
+    // 2. Settle the new nodes from the oldest down and publish them
+    for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+        Entry& entry = it->second;
+        entry.depth = have_top ? top.depth + 1 : 1;
+        if (!entry.error.empty()) {
+            entry.failed_trace_id = it->first;
+            entry.lineage_valid = false;
+        } else if (have_top && !top.lineage_valid) {
+            entry.failed_trace_id = top.failed_trace_id;
+            entry.error = top.error;
+            entry.lineage_valid = false;
+        } else {
+            entry.lineage_valid = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.emplace(it->first, entry); // Another thread may have settled it first
+        }
+        top = entry;
+        have_top = true;
+    }
+
+    result.steps = top.depth;
+    result.valid = have_top && top.lineage_valid;
+    result.failed_trace_id = top.failed_trace_id;
+    result.error = top.error;
+}
+
+std::vector<std::string> collect_validation_files(const std::string& target) {
+    if (!fs::is_directory(target)) {
+        return {target};
+    }
+    std::vector<std::string> files;
+    for (auto it = fs::recursive_directory_iterator(target, fs::directory_options::skip_permission_denied);
+         it != fs::recursive_directory_iterator(); ++it) {
+        std::string name = it->path().filename().string();
+        if (!name.empty() && name[0] == '.') {
+            if (it->is_directory()) {
+                it.disable_recursion_pending(); // Skips .traceseq, .git and the like
+            }
+            continue;
+        }
+        if (it->is_regular_file()) {
+            files.push_back(it->path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::vector<std::string> read_validation_list(const std::string& list_path) {
+    std::ifstream list(list_path);
+    if (!list.is_open()) {
+        throw std::runtime_error("Could not open file list: " + list_path);
+    }
+    std::vector<std::string> files;
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#') {
+            files.push_back(line);
+        }
+    }
+    return files;
+}
+
+ValidationReport validate_files(
+    const std::vector<std::string>& files,
+    const nlohmann::json& index_json,
+    const Ontology& ontology,
+    ChecksumCache& checksum_cache,
+    const std::string& algorithm,
+    TraceStorage& storage,
+    const fs::path& project_root,
+    unsigned int num_threads
+) {
+    ValidationReport report;
+    report.files.resize(files.size());
+    ValidatedNodeCache node_cache(ontology, storage, project_root);
+
+    parallel_for(files.size(), num_threads, [&](size_t i) {
+        FileValidation& result = report.files[i];
+        result.filepath = files[i];
+        try {
+            result.trace_id = lookup_trace_id(index_json, files[i], algorithm, checksum_cache);
+            if (!result.trace_id.empty()) {
+                node_cache.validate_lineage(result.trace_id, result);
+            }
+        } catch (const std::exception& e) {
+            result.valid = false;
+            result.error = e.what();
+        }
+    });
+
+    for (const auto& result : report.files) {
+        if (result.trace_id.empty() && result.error.empty()) {
+            ++report.untracked;
+        } else if (result.valid) {
+            ++report.passed;
+        } else {
+            ++report.failed;
+        }
+    }
+    report.nodes_checked = node_cache.size();
+    return report;
+}
@@ -0,0 +1,130 @@
+#ifndef VALIDATION_HPP
+#define VALIDATION_HPP
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "tracer.hpp"
+#include "checksum_cache.hpp"
+#include "storage.hpp"
+
+/**
+ * @brief The validation outcome of one file.
+ */
+struct FileValidation {
+    std::string filepath;   ///< The validated file.
+    std::string trace_id;   ///< The file's latest trace ID, empty if it has no provenance.
+    size_t steps = 0;       ///< Length of the file's lineage.
+    bool valid = false;     ///< Whether every node in the lineage is valid.
+    std::string failed_trace_id; ///< The nearest invalid node of the lineage, if any.
+    std::string error;      ///< Why the file or that node failed validation.
+};
+
+/**
+ * @brief The aggregate outcome of validating many files.
+ */
+struct ValidationReport {
+    std::vector<FileValidation> files; ///< One entry per file, in input order.
+    size_t passed = 0;                 ///< Files whose lineage is valid.
+    size_t failed = 0;                 ///< Files whose lineage has an invalid node or could not be checked.
+    size_t untracked = 0;              ///< Files without provenance.
+    size_t nodes_checked = 0;          ///< Distinct trace nodes loaded and validated.
+};
+
+/**
+ * @brief Validated trace nodes shared by concurrent lineage checks.
+ *
+ * Every node is loaded and checked once; a node's entry also records whether
+ * its whole lineage is valid, so a check that reaches a cached ancestor
+ * stops there. Thousands of outputs with a common upstream lineage therefore
+ * cost one check of the shared ancestors. All methods are thread-safe.
+ */
+class ValidatedNodeCache {
+public:
+    /**
+     * @brief Creates an empty cache.
+     * @param ontology The loaded ontology nodes are validated against.
+     * @param storage The project's storage.
+     * @param project_root The root directory of the project.
+     */
+    ValidatedNodeCache(const Ontology& ontology, TraceStorage& storage, const std::filesystem::path& project_root);
+
+    /**
+     * @brief Validates the lineage ending at a trace node.
+     * @param trace_id The newest node of the lineage.
+     * @param result Filled with the lineage length, validity and first failure.
+     */
+    void validate_lineage(const std::string& trace_id, FileValidation& result);
+
+    /// The number of distinct nodes checked so far.
+    size_t size();
+
+private:
+    struct Entry {
+        std::string parent;          ///< The node's parent trace ID.
+        size_t depth = 0;            ///< Number of nodes from the root to this node.
+        bool lineage_valid = false;  ///< This node and all its ancestors are valid.
+        std::string failed_trace_id; ///< Nearest invalid node at or above this one.
+        std::string error;           ///< Why `failed_trace_id` is invalid.
+    };
+
+    bool lookup(const std::string& trace_id, Entry& entry);
+
+    const Ontology& ontology_;
+    TraceStorage& storage_;
+    std::filesystem::path project_root_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+/**
+ * @brief Expands a validation target into the files to validate.
+ *
+ * A directory is walked recursively, skipping '.traceseq' and other hidden
+ * entries; any other path is returned as is.
+ *
+ * @param target A file or directory.
+ * @return The regular files to validate, sorted.
+ */
+std::vector<std::string> collect_validation_files(const std::string& target);
+
+/**
+ * @brief Reads a list of files to validate, one path per line.
+ * @param list_path The list file; blank lines and lines starting with '#' are skipped.
+ * @return The listed paths.
+ * @throws std::runtime_error if the list cannot be read.
+ */
+std::vector<std::string> read_validation_list(const std::string& list_path);
+
+/**
+ * @brief Validates the provenance of many files concurrently.
+ *
+ * Files are hashed through the checksum cache and looked up in the index on
+ * a thread pool; their lineages are checked through one shared
+ * `ValidatedNodeCache`, so common ancestors are loaded and validated once.
+ *
+ * @param files The files to validate.
+ * @param index_json The loaded trace index.
+ * @param ontology The loaded ontology.
+ * @param checksum_cache The cache used to hash the files.
+ * @param algorithm The checksum algorithm (see `checksum_file`).
+ * @param storage The project's storage.
+ * @param project_root The root directory of the project.
+ * @param num_threads The number of worker threads (0 means one per hardware core).
+ * @return The per-file results and totals.
+ */
+ValidationReport validate_files(
+    const std::vector<std::string>& files,
+    const nlohmann::json& index_json,
+    const Ontology& ontology,
+    ChecksumCache& checksum_cache,
+    const std::string& algorithm,
+    TraceStorage& storage,
+    const std::filesystem::path& project_root,
+    unsigned int num_threads = 0
+);
+
+#endif // VALIDATION_HPP
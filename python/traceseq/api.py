@@ -1,4 +1,7 @@
 from . import traceseq_py
+import asyncio
+import concurrent.futures
+import contextlib
 import os
 
 def get_project_root():
@@ -9,15 +12,21 @@ def get_project_root():
             return os.getcwd()
     return current_dir
 
-def annotate(filepath, operation, method, assumptions=[], parent_id="null"):
+_checksum_caches = {}
+
+def _checksum_cache(project_root):
+    # One cache per project so repeated calls only stat unchanged files
+    if project_root not in _checksum_caches:
+        _checksum_caches[project_root] = traceseq_py.ChecksumCache(project_root)
+    return _checksum_caches[project_root]
+
+def annotate(filepath, operation, method, assumptions=[], parent_id="null", algorithm="sha256"):
     project_root = get_project_root()
     
-    input_checksum = traceseq_py.sha256_file(filepath)
+    input_checksum = _checksum_cache(project_root).recorded_checksum(filepath, algorithm)
 
     ontology = traceseq_py.Ontology()
-    op_ontology_path = os.path.join(project_root, "core", "operation_ontology.yaml")
-    assump_ontology_path = os.path.join(project_root, "core", "assumption_ontology.yaml")
-    ontology.load(op_ontology_path, assump_ontology_path)
+    ontology.load_project(project_root)
 
     if not ontology.validate_operation(operation):
         raise ValueError(f"Invalid operation: {operation}")
@@ -42,13 +51,80 @@ def annotate(filepath, operation, method, assumptions=[], parent_id="null"):
     print(f"Successfully annotated {filepath} with trace ID: {node.trace_id}")
     return node.trace_id
 
-def explain(filepath):
+def explain(filepath, algorithm="sha256"):
     project_root = get_project_root()
-    input_checksum = traceseq_py.sha256_file(filepath)
-    
     index = traceseq_py.load_index(project_root)
-    if input_checksum not in index:
+    # Handles indexes that mix checksum algorithms
+    trace_id = traceseq_py.lookup_trace_id(index, filepath, algorithm, _checksum_cache(project_root))
+    if not trace_id:
         return []
-        
-    trace_id = index[input_checksum]
     return traceseq_py.resolve_lineage(trace_id, project_root)
+
+def annotate_stream(output_path, operation, method, assumptions=[], parent_id="null", input_path=None, algorithm="sha256"):
+    """Returns a StreamAnnotator that writes to output_path while hashing it.
+
+    Write the output through `.write(data)` and call `.close()` to record the
+    trace node; the output is never read back to checksum it.
+    """
+    project_root = get_project_root()
+
+    ontology = traceseq_py.Ontology()
+    ontology.load_project(project_root)
+
+    request = traceseq_py.AnnotationRequest()
+    request.filepath = output_path
+    request.operation_class = operation
+    request.operation_method = method
+    request.assumptions = assumptions
+    request.parent_id = parent_id
+
+    annotator = traceseq_py.StreamAnnotator(request, ontology, algorithm, project_root)
+    if input_path is not None:
+        annotator.set_input_checksum(_checksum_cache(project_root).recorded_checksum(input_path, algorithm))
+    return annotator
+
+@contextlib.contextmanager
+def profile(path):
+    # Records the library's timed spans and counters as Chrome trace JSON:
+    #   with traceseq.profile("trace.json"):
+    #       traceseq.explain("data/processed/normalized.csv")
+    traceseq_py.profile_start()
+    try:
+        yield
+    finally:
+        traceseq_py.profile_stop()
+        traceseq_py.profile_write(path)
+
+def lineage_columns(trace_ids):
+    # One columnar table for many lineages. Columns are shared with C++
+    # through the Arrow PyCapsule interface (pyarrow >= 14, polars) or as
+    # numpy views via .buffers(name), without a Python object per node.
+    return traceseq_py.resolve_lineage_columns(list(trace_ids), get_project_root())
+
+def lineage_table(trace_ids):
+    import pyarrow
+    return pyarrow.record_batch(lineage_columns(trace_ids))
+
+_executor = None
+
+def _background():
+    # The native calls release the GIL and fan out on their own thread pool;
+    # this executor only keeps them off the caller's thread
+    global _executor
+    if _executor is None:
+        _executor = concurrent.futures.ThreadPoolExecutor(max_workers=4, thread_name_prefix="traceseq")
+    return _executor
+
+def sha256_files(paths, num_threads=0):
+    # Returns a concurrent.futures.Future of the checksums, in path order
+    return _background().submit(traceseq_py.sha256_files, [os.fspath(p) for p in paths], num_threads)
+
+def resolve_lineages(trace_ids, num_threads=0):
+    # Returns a concurrent.futures.Future of one lineage per trace ID
+    return _background().submit(traceseq_py.resolve_lineages, list(trace_ids), get_project_root(), num_threads)
+
+async def sha256_files_async(paths, num_threads=0):
+    return await asyncio.wrap_future(sha256_files(paths, num_threads))
+
+async def resolve_lineages_async(trace_ids, num_threads=0):
+    return await asyncio.wrap_future(resolve_lineages(trace_ids, num_threads))